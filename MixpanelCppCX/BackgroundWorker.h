@@ -1,16 +1,72 @@
 #pragma once
 
-#include <agents.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+#include "LockFreeIngestionQueue.h"
+#include "RetryBackoff.h"
+#include "SequencedItemQueue.h"
 #include "Tracing.h"
+#include "WorkerExecutor.h"
 
 namespace Codevoid::Utilities {
     /// <summary>
-    /// Represents the importance of the work added to the BackgroundWorker
+    /// Represents the importance of the work added to the BackgroundWorker.
+    /// Each priority has its own lane in the queue, and higher priority lanes
+    /// get a bigger share of each batch.
     /// </summary>
     enum class WorkPriority
     {
+        /// <summary>
+        /// Doesn't wake the worker; processed when something else does.
+        /// </summary>
         Low,
+
+        /// <summary>
+        /// Processed once the idle timeout or item threshold is reached.
+        /// </summary>
         Normal,
+
+        /// <summary>
+        /// Wakes the worker immediately, without waiting for the idle
+        /// timeout or the item threshold.
+        /// </summary>
+        High,
+    };
+
+    /// <summary>
+    /// What a BackgroundWorker does when work is added that would take it
+    /// over its capacity.
+    /// </summary>
+    enum class OverflowPolicy
+    {
+        /// <summary>
+        /// Adds the new work, and drops the items that have been waiting the
+        /// longest, regardless of their priority, until there's room.
+        /// </summary>
+        DropOldest,
+
+        /// <summary>
+        /// Adds the new work, and drops the oldest items from the lowest
+        /// priority lane that has items in it, until there's room. This can
+        /// include the new work, if it's the lowest priority.
+        /// </summary>
+        DropLowestPriority,
+
+        /// <summary>
+        /// Doesn't add the new work.
+        /// </summary>
+        RejectNew,
+
+        /// <summary>
+        /// Blocks the thread adding work until there's room for it, or the
+        /// blocking timeout passes, in which case the work isn't added.
+        /// </summary>
+        Block,
     };
 
     template <typename ItemType>
@@ -18,9 +74,20 @@ namespace Codevoid::Utilities {
     {
         using ItemType_ptr = std::shared_ptr<ItemType>;
         using ItemTypeVector = std::vector<ItemType_ptr>;
+        using SequenceNumber = typename SequencedItemQueue<ItemType>::SequenceNumber;
+        using SequenceNumberVector = typename SequencedItemQueue<ItemType>::SequenceNumberVector;
         using lock_guard_mutex = std::lock_guard<std::mutex>;
 
     public:
+        // <summary>
+        // Capacity used for items & bytes when no limit has been set.
+        // </summary>
+        static constexpr size_t UNBOUNDED = (std::numeric_limits<size_t>::max)();
+
+        using ProcessItemsCallback = std::function<ItemTypeVector(ItemTypeVector&, const std::function<bool()>&)>;
+        using PostProcessItemsCallback = std::function<void(ItemTypeVector&)>;
+        using AsyncProcessItemsCallback = std::function<concurrency::task<ItemTypeVector>(ItemTypeVector&, const std::function<bool()>&)>;
+        using AsyncPostProcessItemsCallback = std::function<concurrency::task<void>(ItemTypeVector&)>;
 
         // <summary>
         // Creates, but does not start, a worker queue that is processed on
@@ -49,8 +116,33 @@ namespace Codevoid::Utilities {
         // </param>
         // </summary>
         BackgroundWorker(
-            std::function<ItemTypeVector(ItemTypeVector&, const std::function<bool()>&)> processItemsCallback,
-            std::function<void(ItemTypeVector&)> postProcessItemsCallback,
+            ProcessItemsCallback processItemsCallback,
+            PostProcessItemsCallback postProcessItemsCallback,
+            const std::wstring& tracePrefix,
+            const std::chrono::milliseconds idleTimeout = std::chrono::milliseconds(500),
+            size_t itemThreshold = 10
+        ) : BackgroundWorker(
+                BackgroundWorker::AsAsyncCallback(processItemsCallback),
+                BackgroundWorker::AsAsyncCallback(postProcessItemsCallback),
+                tracePrefix,
+                idleTimeout,
+                itemThreshold)
+        { }
+
+        // <summary>
+        // Creates, but does not start, a worker queue whose callbacks complete
+        // asynchronously. Parameters are the same as for synchronous callbacks.
+        //
+        // When running on an executor, the worker gives up its thread while
+        // waiting for a callback to complete, and is rescheduled when it has.
+        // On a dedicated thread, that thread waits for it instead. Either way,
+        // the next batch isn't started until the current one has completed,
+        // and the items & the shouldKeepProcessing function passed to a
+        // callback remain valid until the task it returned has completed.
+        // </summary>
+        BackgroundWorker(
+            AsyncProcessItemsCallback processItemsCallback,
+            AsyncPostProcessItemsCallback postProcessItemsCallback,
             const std::wstring& tracePrefix,
             const std::chrono::milliseconds idleTimeout = std::chrono::milliseconds(500),
             size_t itemThreshold = 10
@@ -59,12 +151,47 @@ namespace Codevoid::Utilities {
             m_postProcessItemsCallback(postProcessItemsCallback),
             m_tracePrefix(tracePrefix),
             m_state(WorkerState::None),
+            m_workerIsWaitingForItems(false),
+            m_idleDeadline(NO_IDLE_DEADLINE),
             m_idleTimeout(idleTimeout),
             m_itemThreshold(itemThreshold),
+            m_maximumBatchSize(std::numeric_limits<size_t>::max()),
+            m_adaptiveDebounceEnabled(false),
+            m_latencyTarget(idleTimeout),
+            m_minimumItemThreshold(itemThreshold),
+            m_maximumItemThreshold(itemThreshold),
+            m_minimumIdleTimeout(idleTimeout),
+            m_lastArrival(NO_ARRIVAL),
+            m_averageArrivalGap(NO_AVERAGE_ARRIVAL_GAP),
+            m_maximumItems(UNBOUNDED),
+            m_maximumBytes(UNBOUNDED),
+            m_overflowPolicy(OverflowPolicy::RejectNew),
+            m_blockingTimeout(std::chrono::milliseconds(1000)),
+            m_blockedProducerCount(0),
+            m_pendingItemCount(0),
+            m_pendingItemBytes(0),
+            m_nextArrival(0),
             m_backoffOnRetryEnabled(false),
             m_numberOfRetriesToAttempt(3),
-            m_backoffDelayBaseValue(10ms)
-        { }
+            m_backoffDelayBaseValue(10ms),
+            m_maximumBackoffDelay(std::chrono::minutes(5)),
+            m_circuitBreakerEnabled(false),
+            m_probeInterval(std::chrono::minutes(1)),
+            m_probeBatchSize(1),
+            m_workerLoopActive(false),
+            m_executorLoopState(ExecutorLoopState::Idle),
+            m_callbackCompleted(false)
+        {
+            m_shouldKeepProcessingItems = std::bind(&BackgroundWorker<ItemType>::ShouldKeepProcessingItems, this);
+            this->GetLane(WorkPriority::High).Weight = 6;
+            this->GetLane(WorkPriority::Normal).Weight = 3;
+            this->GetLane(WorkPriority::Low).Weight = 1;
+
+            for (auto&& overflowCount : m_overflowCounts)
+            {
+                overflowCount = 0;
+            }
+        }
 
         BackgroundWorker<ItemType>(const BackgroundWorker<ItemType>&) = delete;
         BackgroundWorker<ItemType>(BackgroundWorker<ItemType>&&) = delete;
@@ -73,13 +200,46 @@ namespace Codevoid::Utilities {
         {
             TRACE_OUT(m_tracePrefix + L": Queue being destroyed");
             this->Shutdown(WorkerState::Drain);
+
+            // Even if we never started, or had already stopped, the executor
+            // may still have a wake up scheduled for us.
+            if (m_executor != nullptr)
+            {
+                m_executor->CancelAndWait(this);
+            }
+
             TRACE_OUT(m_tracePrefix + L": Queue Destroyed");
         }
 
+        // <summary>
+        // Number of items waiting to be processed, including any that are in
+        // the batch currently being processed. This doesn't take any locks, so
+        // may briefly lag behind items that are being concurrently added.
+        // </summary>
         size_t GetQueueLength()
         {
-            lock_guard_mutex lock(m_itemsLock);
-            return m_items.size();
+            auto pendingItemCount = m_pendingItemCount.load();
+            return (pendingItemCount > 0) ? static_cast<size_t>(pendingItemCount) : 0;
+        }
+
+        // <summary>
+        // Total size of the items waiting to be processed, as reported by the
+        // item size callback. If there isn't one, this is always zero.
+        // </summary>
+        size_t GetQueueSizeInBytes()
+        {
+            auto pendingItemBytes = m_pendingItemBytes.load();
+            return (pendingItemBytes > 0) ? static_cast<size_t>(pendingItemBytes) : 0;
+        }
+
+        // <summary>
+        // Number of items waiting to be processed in the lane for the supplied
+        // priority. Like GetQueueLength, this doesn't take any locks.
+        // </summary>
+        size_t GetQueueLength(const WorkPriority priority)
+        {
+            auto pendingItemCount = this->GetLane(priority).PendingItemCount.load();
+            return (pendingItemCount > 0) ? static_cast<size_t>(pendingItemCount) : 0;
         }
 
         // <summary>
@@ -90,46 +250,114 @@ namespace Codevoid::Utilities {
         // If the worker isn't started, items are just placed in the queue,
         // and will be processed once the worker has been started.
         //
+        // Adding items doesn't block on the worker -- they're placed in a
+        // lock-free list that the worker moves in to the main queue in bulk
+        // the next time it looks for work.
+        //
+        // If a capacity has been set, and there isn't room for the work, the
+        // overflow policy is applied. Returns false if that meant the work
+        // wasn't added.
+        //
         // <param name='priority'>
-        // Priority of the work being queued. This is used to control
-        // whether the worker is signalled for this item -- e.g. no
-        // point in waking the worker up to process the item if this one
-        // isn't very important.
+        // Priority of the work being queued. This selects the lane the item
+        // is placed in, and controls whether the worker is signalled for this
+        // item -- e.g. no point in waking the worker up to process the item if
+        // this one isn't very important, but high priority items shouldn't
+        // wait for the idle timeout.
         //
-        // It's important to note that this doesn't stop the items being
-        // processed at all -- it just doesn't wake up the thread if it's
+        // It's important to note that low priority doesn't stop the items
+        // being processed at all -- it just doesn't wake up the thread if it's
         // not already going to be woken e.g. this doesn't reset the idle
         // timeout.
         // </param>
         // </summary>
-        void AddWork(const ItemType_ptr item, const WorkPriority priority = WorkPriority::Normal)
+        bool AddWork(const ItemType_ptr item, const WorkPriority priority = WorkPriority::Normal)
         {
             TRACE_OUT(m_tracePrefix + L": Adding Item. Priority: " + to_wstring((int)priority));
 
+            auto itemSize = this->GetItemSize(item);
+            if (!this->ReserveCapacity(1, itemSize))
             {
-                lock_guard_mutex lock(m_itemsLock);
-                m_items.emplace_back(item);
+                TRACE_OUT(m_tracePrefix + L": No room for item, not adding it");
+                return false;
             }
 
+            this->RememberItemSize(item, itemSize);
+
+            auto& lane = this->GetLane(priority);
+            lane.Incoming.Push({ m_nextArrival++, item });
+            lane.PendingItemCount += 1;
+            this->DropItemsOverCapacity();
+            this->RecordArrivals(1);
+
             if (priority != WorkPriority::Low)
             {
-                this->TriggerWorkOrWaitForIdle();
+                this->TriggerWorkOrWaitForIdle(priority);
             }
+
+            return true;
         }
 
-        void AddWork(const ItemTypeVector& itemsToAdd, const WorkPriority priority = WorkPriority::Normal)
+        // <summary>
+        // Adds all the supplied items, as with adding a single item. If there
+        // isn't room for them, and the overflow policy doesn't drop items,
+        // none of them are added.
+        // </summary>
+        bool AddWork(const ItemTypeVector& itemsToAdd, const WorkPriority priority = WorkPriority::Normal)
         {
             TRACE_OUT(m_tracePrefix + L": Adding Items: " + to_wstring(itemsToAdd.size()));
 
+            if (itemsToAdd.empty())
             {
-                lock_guard_mutex lock(m_itemsLock);
-                m_items.insert(end(m_items), begin(itemsToAdd), end(itemsToAdd));
+                return true;
+            }
+
+            std::vector<size_t> itemSizes;
+            size_t itemsSize = 0;
+            if (m_getItemSize != nullptr)
+            {
+                itemSizes.reserve(itemsToAdd.size());
+                for (auto&& item : itemsToAdd)
+                {
+                    itemSizes.push_back(this->GetItemSize(item));
+                    itemsSize += itemSizes.back();
+                }
+            }
+
+            if (!this->ReserveCapacity(itemsToAdd.size(), itemsSize))
+            {
+                TRACE_OUT(m_tracePrefix + L": No room for items, not adding them");
+                return false;
+            }
+
+            for (size_t i = 0; i < itemSizes.size(); i++)
+            {
+                this->RememberItemSize(itemsToAdd[i], itemSizes[i]);
+            }
+
+            // Arrival is stamped here, rather than when the items are moved
+            // in to the queue, so it reflects the order across all lanes.
+            std::vector<IncomingItem> incomingItems;
+            incomingItems.reserve(itemsToAdd.size());
+
+            auto arrival = m_nextArrival.fetch_add(itemsToAdd.size());
+            for (auto&& item : itemsToAdd)
+            {
+                incomingItems.push_back({ arrival++, item });
             }
 
+            auto& lane = this->GetLane(priority);
+            lane.Incoming.Push(std::move(incomingItems));
+            lane.PendingItemCount += static_cast<long long>(itemsToAdd.size());
+            this->DropItemsOverCapacity();
+            this->RecordArrivals(itemsToAdd.size());
+
             if (priority != WorkPriority::Low)
             {
-                this->TriggerWorkOrWaitForIdle();
+                this->TriggerWorkOrWaitForIdle(priority);
             }
+
+            return true;
         }
 
         // <summary>
@@ -155,6 +383,26 @@ namespace Codevoid::Utilities {
             }
 
             TRACE_OUT(m_tracePrefix + L": Starting worker");
+            if (m_executor != nullptr)
+            {
+                {
+                    std::unique_lock<mutex> lock(m_workerLock);
+
+                    // The loop may still be completing (e.g. it paused itself
+                    // after running out of retries), so let it finish first.
+                    m_hasWorkerStopped.wait(lock, [this]() {
+                        return !m_workerLoopActive;
+                    });
+
+                    m_state = WorkerState::Running;
+                    this->ResetWorkerLoop();
+                    m_workerLoopActive = true;
+                }
+
+                TRACE_OUT(m_tracePrefix + L": Scheduling worker on executor");
+                this->ScheduleWorkerLoop();
+            }
+            else
             {
                 std::unique_lock<mutex> lock(m_workerLock);
 
@@ -175,7 +423,7 @@ namespace Codevoid::Utilities {
                 assert(m_state == WorkerState::Running);
             }
 
-            this->TriggerWorkOrWaitForIdle();
+            this->TriggerWorkOrWaitForIdle(WorkPriority::Normal);
         }
 
         // <summary>
@@ -204,7 +452,29 @@ namespace Codevoid::Utilities {
         {
             TRACE_OUT(m_tracePrefix + L": Clearing");
             lock_guard_mutex lock(m_itemsLock);
-            m_items.clear();
+
+            // Items that are still being added may not have been counted yet, so
+            // rather than resetting the count, subtract only what we remove. The
+            // count will settle once those in-flight additions are complete.
+            for (auto&& lane : m_lanes)
+            {
+                size_t discardedByteCount = 0;
+                auto discardedItemCount = lane.Incoming.Drain([this, &discardedByteCount](IncomingItem&& incoming) {
+                    discardedByteCount += this->ForgetItemSize(incoming.Item);
+                });
+
+                if (m_getItemSize != nullptr)
+                {
+                    ItemTypeVector queuedItems;
+                    SequenceNumberVector queuedItemSequenceNumbers;
+                    lane.Items.PeekFront(queuedItems, queuedItemSequenceNumbers, lane.Items.Size());
+                    discardedByteCount += this->ForgetItemsSize(queuedItems);
+                }
+
+                discardedItemCount += lane.Items.Size();
+                lane.Items.Clear();
+                this->ReleaseCapacity(lane, discardedItemCount, discardedByteCount);
+            }
             TRACE_OUT(m_tracePrefix + L": Cleared");
         }
 
@@ -246,24 +516,240 @@ namespace Codevoid::Utilities {
             this->Shutdown(WorkerState::Drop);
         }
 
+        // <summary>
+        // Changes how long to wait for idle before processing items. This can
+        // be changed while the worker is running; if it's shorter than before,
+        // any items already waiting won't wait longer than the new timeout.
+        //
+        // If adaptive debounce is enabled, this will be replaced as the rate
+        // items are being added changes.
+        // </summary>
         void SetIdleTimeout(const std::chrono::milliseconds idleTimeout)
         {
-            if (this->IsProcessing())
+            m_idleTimeout = idleTimeout;
+
+            // Unlike adding work, this only ever pulls the deadline in.
+            auto newDeadline = std::chrono::steady_clock::now() + idleTimeout;
+            auto currentDeadline = m_idleDeadline.load();
+            bool deadlineMoved = false;
+            while ((currentDeadline != NO_IDLE_DEADLINE) && (currentDeadline > newDeadline))
             {
-                throw std::logic_error("Cannot change debounce timeout while worker is running");
+                deadlineMoved = m_idleDeadline.compare_exchange_weak(currentDeadline, newDeadline);
+                if (deadlineMoved)
+                {
+                    break;
+                }
             }
 
-            m_idleTimeout = idleTimeout;
+            // The worker would otherwise wait for the deadline it already had
+            if (deadlineMoved && (m_state == WorkerState::Running) && m_workerIsWaitingForItems)
+            {
+                this->WakeWorker();
+            }
         }
 
+        // <summary>
+        // Changes the number of items to wait for before processing the queue.
+        // This can be changed while the worker is running; if there are already
+        // enough items to reach the new threshold, the worker is woken to start
+        // processing them.
+        //
+        // If adaptive debounce is enabled, this will be replaced as the rate
+        // items are being added changes.
+        // </summary>
         void SetItemThreshold(const size_t itemThreshold)
+        {
+            m_itemThreshold = itemThreshold;
+
+            if ((m_state == WorkerState::Running) && m_workerIsWaitingForItems && (this->GetQueueLength() >= itemThreshold))
+            {
+                this->WakeWorker();
+            }
+        }
+
+        std::chrono::milliseconds GetIdleTimeout()
+        {
+            return m_idleTimeout;
+        }
+
+        size_t GetItemThreshold()
+        {
+            return m_itemThreshold;
+        }
+
+        // <summary>
+        // Adjusts the item threshold & idle timeout as items are added, based
+        // on a moving average of the time between items being added. The aim
+        // is to process items in batches that are as large as possible, while
+        // still processing items within (about) the latency target:
+        //
+        // - The threshold is the number of items we'd expect to be added within
+        //   the latency target, within the supplied bounds.
+        // - The idle timeout is a couple of average gaps between items, so a
+        //   burst of items is processed soon after it's finished, within the
+        //   minimum timeout & the latency target.
+        //
+        // Until enough items have been added, the current values are used.
+        // </summary>
+        void EnableAdaptiveDebounce(
+            const std::chrono::milliseconds latencyTarget,
+            const size_t minimumItemThreshold,
+            const size_t maximumItemThreshold,
+            const std::chrono::milliseconds minimumIdleTimeout)
+        {
+            if ((minimumItemThreshold < 1) || (minimumItemThreshold > maximumItemThreshold))
+            {
+                throw std::invalid_argument("Item threshold bounds must be at least one, with the minimum no larger than the maximum");
+            }
+
+            if ((minimumIdleTimeout.count() < 1) || (minimumIdleTimeout > latencyTarget))
+            {
+                throw std::invalid_argument("Minimum idle timeout must be at least 1ms, and no longer than the latency target");
+            }
+
+            m_latencyTarget = latencyTarget;
+            m_minimumItemThreshold = minimumItemThreshold;
+            m_maximumItemThreshold = maximumItemThreshold;
+            m_minimumIdleTimeout = minimumIdleTimeout;
+            m_adaptiveDebounceEnabled = true;
+        }
+
+        // <summary>
+        // Stops adjusting the item threshold & idle timeout, leaving them at
+        // whatever they were last set to.
+        // </summary>
+        void DisableAdaptiveDebounce()
+        {
+            m_adaptiveDebounceEnabled = false;
+            m_lastArrival = NO_ARRIVAL;
+            m_averageArrivalGap = NO_AVERAGE_ARRIVAL_GAP;
+        }
+
+        // <summary>
+        // Runs this worker on the supplied executor, sharing its threads with
+        // any other workers using it, rather than on a thread of its own. This
+        // means starting the worker doesn't create a thread, and while it's
+        // waiting for work, it isn't holding on to one.
+        //
+        // Ordering, and the drain/drop/pause behaviour, are the same as when
+        // running on a dedicated thread. Must be set before starting.
+        // </summary>
+        void SetExecutor(std::shared_ptr<WorkerExecutor> executor)
         {
             if (this->IsProcessing())
             {
-                throw std::logic_error("Cannot change debounce item threshold while worker is running");
+                throw std::logic_error("Cannot change executor while worker is running");
             }
 
-            m_itemThreshold = itemThreshold;
+            m_executor = executor;
+        }
+
+        // <summary>
+        // Limits the number of items handed to the process callback in a
+        // single batch. Items beyond the limit stay where they are in the
+        // queue, and are picked up by the next iteration of the worker
+        // without waiting for the idle timeout or item threshold.
+        //
+        // By default batches are unbounded, and include every item in the
+        // queue. This can be set any time, but won't be picked up until the
+        // next batch is started.
+        // </summary>
+        void SetMaximumBatchSize(const size_t maximumBatchSize)
+        {
+            if (maximumBatchSize < 1)
+            {
+                throw std::invalid_argument("Maximum batch size must be at least one item");
+            }
+
+            m_maximumBatchSize = maximumBatchSize;
+        }
+
+        // <summary>
+        // Sets the share of each batch given to items from the lane for the
+        // supplied priority, relative to the other lanes that have items in
+        // them. E.g. with weights of 6, 3 & 1, and items in every lane, a batch
+        // of 50 items will have 30 high, 15 normal, and 5 low priority items.
+        //
+        // A share a lane can't use is given to the other lanes, highest
+        // priority first, and every lane with items gets at least one item in
+        // each batch so long as there's room. Within a batch, higher priority
+        // items are always ahead of lower priority ones.
+        //
+        // This can be set any time, but won't be picked up until the next
+        // batch is started.
+        // </summary>
+        void SetPriorityWeight(const WorkPriority priority, const size_t weight)
+        {
+            if (weight < 1)
+            {
+                throw std::invalid_argument("Priority weight must be at least one");
+            }
+
+            this->GetLane(priority).Weight = weight;
+        }
+
+        // <summary>
+        // Limits the number of items, and the total size of those items, that
+        // can be waiting in the queue (including the batch being processed).
+        // When adding work would exceed either, the overflow policy is applied.
+        // Use UNBOUNDED for no limit.
+        //
+        // Sizes come from the item size callback; without one, every item is
+        // zero bytes. Items that are dropped from the queue while they're being
+        // processed will still complete processing.
+        //
+        // This can be set any time, but only applies to work added after.
+        // </summary>
+        void SetCapacity(const size_t maximumItems, const size_t maximumBytes, const OverflowPolicy policy)
+        {
+            if ((maximumItems < 1) || (maximumBytes < 1))
+            {
+                throw std::invalid_argument("Capacity must allow at least one item, and one byte");
+            }
+
+            m_maximumItems = maximumItems;
+            m_maximumBytes = maximumBytes;
+            m_overflowPolicy = policy;
+        }
+
+        // <summary>
+        // How long to block the thread adding work, when using the Block
+        // overflow policy, before giving up. Note that blocking from the
+        // callbacks of this worker will always wait for the full timeout,
+        // since the worker can't make room while it's blocked.
+        // </summary>
+        void SetBlockingTimeout(const std::chrono::milliseconds blockingTimeout)
+        {
+            m_blockingTimeout = blockingTimeout;
+        }
+
+        // <summary>
+        // Supplies the size of an item, for limiting the size of the queue in
+        // bytes. This is called as items are added, and again for any left in
+        // the queue once they've been processed, so it needs to be cheap. The
+        // size is counted until it's next asked for, so it can change while
+        // the item is queued (e.g. once the item is no longer holding on to
+        // something).
+        //
+        // Must be set before any work is added.
+        // </summary>
+        void SetItemSizeCallback(std::function<size_t(const ItemType&)> getItemSize)
+        {
+            if (this->GetQueueLength() > 0)
+            {
+                throw std::logic_error("Cannot change how items are sized once work has been added");
+            }
+
+            m_getItemSize = getItemSize;
+        }
+
+        // <summary>
+        // Number of items that were dropped, or not added, as a result of the
+        // supplied overflow policy.
+        // </summary>
+        size_t GetOverflowCount(const OverflowPolicy policy)
+        {
+            return m_overflowCounts[static_cast<size_t>(policy)];
         }
 
         // <summary>
@@ -293,12 +779,46 @@ namespace Codevoid::Utilities {
         // The default delay between retry attempts. This is not the same value
         // between each attempt, but a base value that is used to gradually
         // increase the back off until the retry limit has been reached.
+        //
+        // Each delay is randomly chosen between this, and three times the
+        // previous delay, so that many workers failing at the same time don't
+        // all retry at the same time.
         // </summary>
         void SetBackoffDelay(const std::chrono::milliseconds retryDelay)
         {
             m_backoffDelayBaseValue = retryDelay;
         }
 
+        // <summary>
+        // The longest the worker will wait between retry attempts, no matter
+        // how many have failed.
+        // </summary>
+        void SetMaximumBackoffDelay(const std::chrono::milliseconds maximumDelay)
+        {
+            m_maximumBackoffDelay = maximumDelay;
+        }
+
+        // <summary>
+        // Rather than pausing the queue once the retry limit has been reached,
+        // waits for the probe interval, and then attempts a batch of (at most)
+        // the probe batch size. If any of those items are processed, the worker
+        // carries on as normal; otherwise, it waits for another probe interval.
+        //
+        // As with backoff, the worker needs to be stopped & restarted for this
+        // to be picked up if it's already running.
+        // </summary>
+        void EnableCircuitBreaker(const std::chrono::milliseconds probeInterval, const size_t probeBatchSize = 1)
+        {
+            if (probeBatchSize < 1)
+            {
+                throw std::invalid_argument("Probe batch size must be at least one");
+            }
+
+            m_probeInterval = probeInterval;
+            m_probeBatchSize = probeBatchSize;
+            m_circuitBreakerEnabled = true;
+        }
+
     private:
         enum class WorkerState
         {
@@ -346,54 +866,206 @@ namespace Codevoid::Utilities {
         };
 
         // <summary>
-        // Should we keep processing _individual_ items in the batch
-        // The idea being that if we're running, and not shutdown or
-        // dropping (E.g draining, paused, running), we should keep
-        // doing potentially long running work on individual items.
+        // Whether the worker loop has been scheduled on the executor. Ensures
+        // there's only one instance of the loop for a worker at a time.
         // </summary>
-        bool ShouldKeepProcessingItems() const
+        enum class ExecutorLoopState
         {
-            WorkerState currentState = m_state;
-            return ((currentState > WorkerState::None) && (currentState < WorkerState::Drop));
-        }
+            Idle,
+            Scheduled,
+            Running,
 
-        void Shutdown(const WorkerState targetState)
+            // <summary>
+            // Running, and asked to run again after it's finished, since
+            // something it may have missed happened while it was running.
+            // </summary>
+            RunAgain
+        };
+
+        enum class IterationResult
         {
-            WorkerState previousState = m_state;
-            m_state = targetState;
+            Continue,
+            BatchProcessed,
+            Exit,
 
-            TRACE_OUT(m_tracePrefix + L": Shutting down");
-            if ((previousState != WorkerState::Running) && (previousState != WorkerState::Paused))
-            {
-                TRACE_OUT(m_tracePrefix + L": Not actually started");
-                return;
-            }
+            // <summary>
+            // Waiting for a callback to complete; the loop will be scheduled
+            // on the executor again when it has.
+            // </summary>
+            Suspended
+        };
 
-            // Ensure that anyone waiting for the backoff shutdown
-            // signal gets unblocked so they can give up waiting.
-            m_backoffShutdown.notify_one();
+        enum class WaitOutcome
+        {
+            // <summary>
+            // Finished waiting; carry on with the loop.
+            // </summary>
+            Proceed,
 
-            if ((previousState == WorkerState::Paused) && (targetState != WorkerState::Paused) && (this->GetQueueLength() > 0))
-            {
-                TRACE_OUT(m_tracePrefix + L": Worker was paused, starting again to allow draining");
-                this->Start();
-            }
+            // <summary>
+            // Can't block the thread; the loop has been scheduled to run
+            // again when there's something for it to do.
+            // </summary>
+            Suspend,
 
-            CancelConcurrencyTimer(m_idleTimer, m_idleTimerCallback);
+            // <summary>
+            // Stop the loop; we're shutting down.
+            // </summary>
+            Stop
+        };
 
-            if (m_workerThread.joinable())
-            {
-                TRACE_OUT(m_tracePrefix + L": Waiting on Worker Thread");
-                m_state = targetState;
-                m_hasItems.notify_one();
-                m_workerThread.join();
-                assert(m_state != WorkerState::Running);
-            }
+        // <summary>
+        // Tracks retries between iterations of the worker loop. Only accessed
+        // by the loop itself.
+        // </summary>
+        struct RetryState
+        {
+            bool BackoffEnabled;
+            bool LastBatchWasTotalFailure;
+            bool CircuitBreakerEnabled;
+            size_t ProbeBatchSize;
+            DecorrelatedJitterBackoff Backoff;
+            CircuitBreaker Breaker;
+            std::optional<std::chrono::steady_clock::time_point> ResumeAt;
+        };
 
-            TRACE_OUT(m_tracePrefix + L": Shutdown");
-        }
+        // <summary>
+        // An item that has been added, but not yet moved in to its lane's
+        // queue, along with the order it was added in across all the lanes.
+        // </summary>
+        struct IncomingItem
+        {
+            SequenceNumber Arrival;
+            ItemType_ptr Item;
+        };
 
-        void TriggerWorkOrWaitForIdle()
+        // <summary>
+        // Items of a single priority. Each lane has its own incoming list and
+        // queue, so a backlog in one doesn't hold up the others.
+        // </summary>
+        struct Lane
+        {
+            Lane() : PendingItemCount(0), Weight(1)
+            { }
+
+            LockFreeIngestionQueue<IncomingItem> Incoming;
+            std::atomic<long long> PendingItemCount;
+            SequencedItemQueue<ItemType> Items;
+            std::atomic<size_t> Weight;
+        };
+
+        static constexpr size_t LANE_COUNT = 3;
+        static constexpr WorkPriority LANE_PRECEDENCE[LANE_COUNT] = { WorkPriority::High, WorkPriority::Normal, WorkPriority::Low };
+        using LaneCounts = std::array<size_t, LANE_COUNT>;
+
+        // <summary>
+        // The batch the worker loop is in the middle of, held while the
+        // callbacks for it are completing.
+        // </summary>
+        struct CurrentBatch
+        {
+            ItemTypeVector Items;
+            SequenceNumberVector SequenceNumbers;
+
+            // <summary>
+            // Number of items from each lane, in LANE_PRECEDENCE order. The
+            // items are laid out a lane at a time in that same order.
+            // </summary>
+            LaneCounts ItemsPerLane;
+
+            ItemTypeVector SuccessfullyProcessed;
+            std::optional<concurrency::task<ItemTypeVector>> Processing;
+            std::optional<concurrency::task<void>> PostProcessing;
+
+            // <summary>
+            // We've given up our thread, and are waiting to be told the
+            // callback has completed.
+            // </summary>
+            bool WaitingForCallback;
+        };
+
+        static AsyncProcessItemsCallback AsAsyncCallback(ProcessItemsCallback callback)
+        {
+            if (callback == nullptr)
+            {
+                return nullptr;
+            }
+
+            return [callback](ItemTypeVector& items, const std::function<bool()>& shouldKeepProcessing) {
+                return concurrency::task_from_result(callback(items, shouldKeepProcessing));
+            };
+        }
+
+        static AsyncPostProcessItemsCallback AsAsyncCallback(PostProcessItemsCallback callback)
+        {
+            if (callback == nullptr)
+            {
+                return nullptr;
+            }
+
+            return [callback](ItemTypeVector& items) {
+                callback(items);
+                return concurrency::task_from_result();
+            };
+        }
+
+        // <summary>
+        // Should we keep processing _individual_ items in the batch
+        // The idea being that if we're running, and not shutdown or
+        // dropping (E.g draining, paused, running), we should keep
+        // doing potentially long running work on individual items.
+        // </summary>
+        bool ShouldKeepProcessingItems() const
+        {
+            WorkerState currentState = m_state;
+            return ((currentState > WorkerState::None) && (currentState < WorkerState::Drop));
+        }
+
+        void Shutdown(const WorkerState targetState)
+        {
+            WorkerState previousState = m_state;
+            m_state = targetState;
+
+            TRACE_OUT(m_tracePrefix + L": Shutting down");
+            if ((previousState != WorkerState::Running) && (previousState != WorkerState::Paused))
+            {
+                TRACE_OUT(m_tracePrefix + L": Not actually started");
+                return;
+            }
+
+            // Ensure that anyone waiting for the backoff shutdown
+            // signal gets unblocked so they can give up waiting.
+            m_backoffShutdown.notify_one();
+
+            if ((previousState == WorkerState::Paused) && (targetState != WorkerState::Paused) && (this->GetQueueLength() > 0))
+            {
+                TRACE_OUT(m_tracePrefix + L": Worker was paused, starting again to allow draining");
+                this->Start();
+            }
+
+            m_idleDeadline = NO_IDLE_DEADLINE;
+
+            if (m_executor != nullptr)
+            {
+                TRACE_OUT(m_tracePrefix + L": Waiting on Worker to complete on executor");
+                m_state = targetState;
+                this->WakeWorker();
+                this->WaitForWorkerLoopToComplete();
+                assert(m_state != WorkerState::Running);
+            }
+            else if (m_workerThread.joinable())
+            {
+                TRACE_OUT(m_tracePrefix + L": Waiting on Worker Thread");
+                m_state = targetState;
+                this->WakeWorker();
+                m_workerThread.join();
+                assert(m_state != WorkerState::Running);
+            }
+
+            TRACE_OUT(m_tracePrefix + L": Shutdown");
+        }
+
+        void TriggerWorkOrWaitForIdle(const WorkPriority priority)
         {
             if (m_state != WorkerState::Running)
             {
@@ -401,32 +1073,559 @@ namespace Codevoid::Utilities {
                 return;
             }
 
-            CancelConcurrencyTimer(m_idleTimer, m_idleTimerCallback);
+            if ((priority == WorkPriority::High) || (this->GetQueueLength() >= m_itemThreshold))
+            {
+                // Only pay for waking the worker if it's actually waiting; if it's
+                // busy, it'll see the new items when it next looks for work.
+                if (m_workerIsWaitingForItems)
+                {
+                    this->WakeWorker();
+                }
+
+                return;
+            }
+
+            // Push the idle deadline out. Multiple threads can be adding work at
+            // the same time, so only ever move it later -- a thread that read the
+            // clock earlier mustn't pull the deadline back in.
+            auto newDeadline = std::chrono::steady_clock::now() + m_idleTimeout.load();
+            auto currentDeadline = m_idleDeadline.load();
+            while ((currentDeadline < newDeadline)
+                && !m_idleDeadline.compare_exchange_weak(currentDeadline, newDeadline))
+            { }
+
+            // If the worker is already waiting on a deadline, it'll notice it's
+            // been moved when the earlier one passes, so there's no need to wake
+            // it. We only need to if it's waiting without a deadline at all.
+            if ((currentDeadline == NO_IDLE_DEADLINE) && m_workerIsWaitingForItems)
+            {
+                this->WakeWorker();
+            }
+        }
 
-            if (this->GetQueueLength() >= m_itemThreshold)
+        // <summary>
+        // When adaptive debounce is enabled, updates the average gap between
+        // items being added, and adjusts the item threshold & idle timeout to
+        // match. Gaps are measured between calls, so a number of items added
+        // together share the gap since the last call.
+        // </summary>
+        void RecordArrivals(const size_t itemCount)
+        {
+            if (!m_adaptiveDebounceEnabled)
             {
-                m_hasItems.notify_one();
+                return;
             }
-            else
+
+            auto now = std::chrono::steady_clock::now();
+            auto previousArrival = m_lastArrival.exchange(now);
+            if (previousArrival == NO_ARRIVAL)
+            {
+                return;
+            }
+
+            // Gaps longer than the latency target mean the same thing -- items
+            // are being added slowly -- so they're capped, rather than letting
+            // a quiet period between bursts dominate the average. Threads racing
+            // to add items can also see a gap slightly below zero.
+            auto latencyTarget = m_latencyTarget.load();
+            auto gap = (std::min)(now - previousArrival, std::chrono::steady_clock::duration(latencyTarget));
+            gap = (std::max)(gap, std::chrono::steady_clock::duration::zero());
+            double gapPerItem = std::chrono::duration<double, std::milli>(gap).count() / itemCount;
+
+            double averageGap = m_averageArrivalGap.load();
+            double updatedAverageGap;
+            do
+            {
+                updatedAverageGap = (averageGap < 0)
+                    ? gapPerItem
+                    : averageGap + (ADAPTIVE_DEBOUNCE_SMOOTHING * (gapPerItem - averageGap));
+            } while (!m_averageArrivalGap.compare_exchange_weak(averageGap, updatedAverageGap));
+
+            // Items we expect to be added within the latency target
+            double expectedItems = latencyTarget.count() / (std::max)(updatedAverageGap, 0.001);
+            m_itemThreshold = (std::max)(m_minimumItemThreshold.load(),
+                static_cast<size_t>((std::min)(expectedItems, static_cast<double>(m_maximumItemThreshold.load()))));
+
+            // Consider a burst finished after a couple of average gaps
+            auto idleTimeout = std::chrono::milliseconds(static_cast<long long>(std::ceil(updatedAverageGap * 2)));
+            m_idleTimeout = (std::min)((std::max)(idleTimeout, m_minimumIdleTimeout.load()), latencyTarget);
+        }
+
+        // <summary>
+        // Checks if the worker should stop waiting, and start processing items:
+        // either there are enough items to reach the threshold, the idle timeout
+        // has passed since items were last added, there are high priority items,
+        // or we're shutting down. Must be called while holding m_itemsLock.
+        // </summary>
+        bool IsReadyToProcessItems()
+        {
+            TRACE_OUT(m_tracePrefix + L": Checking if ready to process. State: " + to_wstring((int)m_state.load()));
+
+            // If we're going away, we can ignore all other state
+            // and allow the thread to continue and eventually
+            // shutdown.
+            if (m_state > WorkerState::Running)
+            {
+                return true;
+            }
+
+            this->MoveIncomingItemsToQueue();
+
+            // Once the deadline has passed, it's spent -- clear it so we go back
+            // to waiting without a timeout until someone adds more work. If it was
+            // pushed out since we read it, leave the new one in place.
+            auto idleDeadline = m_idleDeadline.load();
+            bool idleTimeoutElapsed = (idleDeadline != NO_IDLE_DEADLINE) && (std::chrono::steady_clock::now() >= idleDeadline);
+            if (idleTimeoutElapsed)
+            {
+                TRACE_OUT(m_tracePrefix + L": Idle timeout elapsed");
+                m_idleDeadline.compare_exchange_strong(idleDeadline, NO_IDLE_DEADLINE);
+            }
+
+            // Only wake up if we actually have some items to process
+            auto itemCount = this->GetQueuedItemCount();
+            if (itemCount < 1)
             {
-                auto timer = CreateConcurrencyTimer(m_idleTimeout, [this]() {
-                    TRACE_OUT(m_tracePrefix + L": Debounce Timer tiggered");
-                    m_hasItems.notify_one();
+                return false;
+            }
+
+            return (idleTimeoutElapsed
+                || (itemCount >= m_itemThreshold)
+                || (this->GetLane(WorkPriority::High).Items.Size() > 0));
+        }
+
+        // <summary>
+        // Signals the worker that there is something for it to look at. When
+        // running on an executor, this schedules the worker to run. Otherwise, the
+        // lock is briefly taken so that a worker in the middle of deciding to
+        // wait is guaranteed to either see the new state, or get the signal;
+        // otherwise the notification could be lost.
+        // </summary>
+        void WakeWorker()
+        {
+            if (m_executor != nullptr)
+            {
+                this->ScheduleWorkerLoop();
+                return;
+            }
+
+            {
+                lock_guard_mutex lock(m_itemsLock);
+            }
+
+            m_hasItems.notify_one();
+        }
+
+        // <summary>
+        // Moves items from the lock-free incoming lists to the end of the queue
+        // for their lane. Must be called while holding m_itemsLock.
+        // </summary>
+        void MoveIncomingItemsToQueue()
+        {
+            for (auto&& lane : m_lanes)
+            {
+                lane.Incoming.Drain([&lane](IncomingItem&& incoming) {
+                    lane.Items.Push(incoming.Item, incoming.Arrival);
                 });
+            }
+        }
+
+        size_t GetItemSize(const ItemType_ptr& item) const
+        {
+            return (m_getItemSize != nullptr) ? m_getItemSize(*item) : 0;
+        }
+
+        // <summary>
+        // Keeps the size an item is counted at, so exactly that is released
+        // when it leaves the queue, even if the size callback would now say
+        // something else.
+        // </summary>
+        void RememberItemSize(const ItemType_ptr& item, const size_t size)
+        {
+            if (m_getItemSize == nullptr)
+            {
+                return;
+            }
+
+            lock_guard_mutex lock(m_countedSizesLock);
+            m_countedSizes.emplace(item.get(), size);
+        }
+
+        size_t ForgetItemSize(const ItemType_ptr& item)
+        {
+            if (m_getItemSize == nullptr)
+            {
+                return 0;
+            }
+
+            lock_guard_mutex lock(m_countedSizesLock);
+            auto counted = m_countedSizes.find(item.get());
+            if (counted == end(m_countedSizes))
+            {
+                return 0;
+            }
+
+            auto size = counted->second;
+            m_countedSizes.erase(counted);
+            return size;
+        }
+
+        void RecountItemsSize(const ItemTypeVector& items)
+        {
+            if (m_getItemSize == nullptr)
+            {
+                return;
+            }
+
+            long long change = 0;
+            {
+                lock_guard_mutex lock(m_countedSizesLock);
+                for (auto&& item : items)
+                {
+                    auto counted = m_countedSizes.equal_range(item.get());
+                    for (auto entry = counted.first; entry != counted.second; entry++)
+                    {
+                        auto size = m_getItemSize(*item);
+                        change += static_cast<long long>(size) - static_cast<long long>(entry->second);
+                        entry->second = size;
+                    }
+                }
+            }
+
+            m_pendingItemBytes += change;
+            if ((change < 0) && (m_blockedProducerCount > 0))
+            {
+                {
+                    lock_guard_mutex lock(m_capacityLock);
+                }
+
+                m_capacityAvailable.notify_all();
+            }
+        }
+
+        size_t ForgetItemsSize(const ItemTypeVector& items)
+        {
+            size_t size = 0;
+            for (auto&& item : items)
+            {
+                size += this->ForgetItemSize(item);
+            }
+
+            return size;
+        }
 
-                m_idleTimer = std::get<0>(timer);
-                m_idleTimerCallback = std::get<1>(timer);
+        bool IsWithinCapacity() const
+        {
+            // Counts are signed, since they can briefly go negative while
+            // items are being added & removed concurrently.
+            return (m_pendingItemCount.load() <= static_cast<long long>((std::min)(m_maximumItems.load(), MAXIMUM_COUNT)))
+                && (m_pendingItemBytes.load() <= static_cast<long long>((std::min)(m_maximumBytes.load(), MAXIMUM_COUNT)));
+        }
 
-                m_idleTimer->start();
+        // <summary>
+        // Counts the items against the capacity of the queue, before they're
+        // added. If there isn't room, and the policy is to reject or block,
+        // that's applied here -- returning false if the items can't be added.
+        // </summary>
+        bool ReserveCapacity(const size_t itemCount, const size_t byteCount)
+        {
+            // Policies that drop items make room once the new items have been
+            // added, so the new items are always accepted here.
+            auto policy = m_overflowPolicy.load();
+            if ((policy == OverflowPolicy::DropOldest) || (policy == OverflowPolicy::DropLowestPriority))
+            {
+                m_pendingItemCount += static_cast<long long>(itemCount);
+                m_pendingItemBytes += static_cast<long long>(byteCount);
+                return true;
+            }
+
+            auto tryReserve = [this, itemCount, byteCount]() {
+                m_pendingItemCount += static_cast<long long>(itemCount);
+                m_pendingItemBytes += static_cast<long long>(byteCount);
+                if (this->IsWithinCapacity())
+                {
+                    return true;
+                }
+
+                m_pendingItemCount -= static_cast<long long>(itemCount);
+                m_pendingItemBytes -= static_cast<long long>(byteCount);
+                return false;
+            };
+
+            if (tryReserve())
+            {
+                return true;
+            }
+
+            if (policy == OverflowPolicy::Block)
+            {
+                std::unique_lock<std::mutex> lock(m_capacityLock);
+
+                // Anyone making room checks this after they've made it, so
+                // they'll know to wake us if we didn't see the room they made.
+                m_blockedProducerCount += 1;
+                bool reserved = m_capacityAvailable.wait_until(lock, std::chrono::steady_clock::now() + m_blockingTimeout.load(), tryReserve);
+                m_blockedProducerCount -= 1;
+
+                if (reserved)
+                {
+                    return true;
+                }
+            }
+
+            m_overflowCounts[static_cast<size_t>(policy)] += itemCount;
+            return false;
+        }
+
+        // <summary>
+        // Returns capacity to the queue when items are removed from a lane,
+        // and wakes anyone who was blocked waiting for it.
+        // </summary>
+        void ReleaseCapacity(Lane& lane, const size_t itemCount, const size_t byteCount)
+        {
+            lane.PendingItemCount -= static_cast<long long>(itemCount);
+            m_pendingItemCount -= static_cast<long long>(itemCount);
+            m_pendingItemBytes -= static_cast<long long>(byteCount);
+
+            if (m_blockedProducerCount > 0)
+            {
+                {
+                    lock_guard_mutex lock(m_capacityLock);
+                }
+
+                m_capacityAvailable.notify_all();
+            }
+        }
+
+        // <summary>
+        // If the queue is over capacity, and the policy is to drop items,
+        // drops items until it's back within capacity.
+        // </summary>
+        void DropItemsOverCapacity()
+        {
+            auto policy = m_overflowPolicy.load();
+            if (((policy != OverflowPolicy::DropOldest) && (policy != OverflowPolicy::DropLowestPriority))
+                || this->IsWithinCapacity())
+            {
+                return;
+            }
+
+            lock_guard_mutex lock(m_itemsLock);
+            this->MoveIncomingItemsToQueue();
+
+            while (!this->IsWithinCapacity())
+            {
+                Lane* laneToDropFrom = (policy == OverflowPolicy::DropOldest)
+                    ? this->GetLaneWithOldestItem()
+                    : this->GetLowestPriorityLaneWithItems();
+
+                // Anything still over capacity is on its way in to the queue,
+                // and will be dealt with by whoever is adding it.
+                if (laneToDropFrom == nullptr)
+                {
+                    break;
+                }
+
+                auto droppedItem = laneToDropFrom->Items.PopFront();
+                this->ReleaseCapacity(*laneToDropFrom, 1, this->ForgetItemSize(droppedItem));
+                m_overflowCounts[static_cast<size_t>(policy)] += 1;
+            }
+
+            TRACE_OUT(m_tracePrefix + L": Dropped items to stay within capacity");
+        }
+
+        // <summary>
+        // The lane whose front item arrived before the front items of the other
+        // lanes. Must be called while holding m_itemsLock.
+        // </summary>
+        Lane* GetLaneWithOldestItem()
+        {
+            Lane* oldestLane = nullptr;
+            std::optional<SequenceNumber> oldestArrival;
+
+            for (auto&& lane : m_lanes)
+            {
+                auto arrival = lane.Items.GetFrontArrival();
+                if (arrival.has_value() && (!oldestArrival.has_value() || (*arrival < *oldestArrival)))
+                {
+                    oldestLane = &lane;
+                    oldestArrival = arrival;
+                }
+            }
+
+            return oldestLane;
+        }
+
+        // <summary>
+        // Must be called while holding m_itemsLock.
+        // </summary>
+        Lane* GetLowestPriorityLaneWithItems()
+        {
+            for (auto&& lane : m_lanes)
+            {
+                if (lane.Items.Size() > 0)
+                {
+                    return &lane;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // <summary>
+        // Number of items in the queue across all lanes, excluding any that
+        // are still in the incoming lists. Must be called while holding
+        // m_itemsLock.
+        // </summary>
+        size_t GetQueuedItemCount() const
+        {
+            size_t itemCount = 0;
+            for (auto&& lane : m_lanes)
+            {
+                itemCount += lane.Items.Size();
+            }
+
+            return itemCount;
+        }
+
+        Lane& GetLane(const WorkPriority priority)
+        {
+            return m_lanes[static_cast<size_t>(priority)];
+        }
+
+        // <summary>
+        // Works out how many items to take from each lane (in LANE_PRECEDENCE
+        // order) for a batch of at most <paramref name="maximumBatchSize" />
+        // items, per the weights described in SetPriorityWeight. Must be
+        // called while holding m_itemsLock.
+        // </summary>
+        LaneCounts GetItemsToTakeFromEachLane(const size_t maximumBatchSize)
+        {
+            LaneCounts available{};
+            LaneCounts itemsToTake{};
+            size_t totalAvailable = 0;
+            size_t totalWeight = 0;
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                auto& lane = this->GetLane(LANE_PRECEDENCE[i]);
+                available[i] = lane.Items.Size();
+                totalAvailable += available[i];
+                if (available[i] > 0)
+                {
+                    totalWeight += lane.Weight;
+                }
+            }
+
+            // Everything fits, so there's nothing to weigh up
+            if (totalAvailable <= maximumBatchSize)
+            {
+                return available;
+            }
+
+            size_t remaining = maximumBatchSize;
+            for (size_t i = 0; (i < LANE_COUNT) && (remaining > 0); i++)
+            {
+                if (available[i] < 1)
+                {
+                    continue;
+                }
+
+                // Overflow isn't a concern: the batch size is bounded by what's
+                // available, and weights are expected to be small.
+                size_t share = (std::max)(size_t(1), (maximumBatchSize * this->GetLane(LANE_PRECEDENCE[i]).Weight) / totalWeight);
+                itemsToTake[i] = (std::min)({ share, available[i], remaining });
+                remaining -= itemsToTake[i];
+            }
+
+            // Hand out anything left over (e.g. rounding, or a lane that didn't
+            // have enough items for its share), highest priority first.
+            for (size_t i = 0; (i < LANE_COUNT) && (remaining > 0); i++)
+            {
+                size_t extra = (std::min)(available[i] - itemsToTake[i], remaining);
+                itemsToTake[i] += extra;
+                remaining -= extra;
+            }
+
+            return itemsToTake;
+        }
+
+        // <summary>
+        // Removes the successfully processed items in the current batch from
+        // their lanes. Must be called while holding m_itemsLock.
+        // </summary>
+        void RemoveProcessedItems(const CurrentBatch& batch)
+        {
+            // Processing may have changed how much the items hold on to, so
+            // those that are left are counted at their size now.
+            this->RecountItemsSize(batch.Items);
+
+            size_t lanesInBatch = std::count_if(begin(batch.ItemsPerLane), end(batch.ItemsPerLane), [](const size_t count) {
+                return count > 0;
+            });
+
+            // Most batches come from a single lane, so everything can be
+            // handed straight to it.
+            if (lanesInBatch == 1)
+            {
+                auto laneIndex = std::distance(begin(batch.ItemsPerLane), std::find_if(begin(batch.ItemsPerLane), end(batch.ItemsPerLane), [](const size_t count) {
+                    return count > 0;
+                }));
+
+                auto& lane = this->GetLane(LANE_PRECEDENCE[laneIndex]);
+                ItemTypeVector removedItems;
+                auto removedItemCount = lane.Items.Remove(batch.Items, batch.SequenceNumbers, batch.SuccessfullyProcessed, &removedItems);
+                this->ReleaseCapacity(lane, removedItemCount, this->ForgetItemsSize(removedItems));
+                return;
+            }
+
+            // Otherwise, split the processed items by the lane they came from.
+            // The batch is laid out a lane at a time, so the position of an item
+            // in the batch tells us which lane it's from.
+            std::unordered_map<const ItemType*, size_t> laneForItem;
+            laneForItem.reserve(batch.Items.size());
+            for (size_t laneIndex = 0, position = 0; laneIndex < LANE_COUNT; laneIndex++)
+            {
+                for (size_t i = 0; i < batch.ItemsPerLane[laneIndex]; i++, position++)
+                {
+                    laneForItem.emplace(batch.Items[position].get(), laneIndex);
+                }
+            }
+
+            std::array<ItemTypeVector, LANE_COUNT> processedPerLane;
+            for (auto&& processedItem : batch.SuccessfullyProcessed)
+            {
+                auto found = laneForItem.find(processedItem.get());
+                if (found != end(laneForItem))
+                {
+                    processedPerLane[found->second].emplace_back(processedItem);
+                }
+            }
+
+            auto laneStart = begin(batch.Items);
+            auto laneSequenceNumbersStart = begin(batch.SequenceNumbers);
+            for (size_t laneIndex = 0; laneIndex < LANE_COUNT; laneIndex++)
+            {
+                auto laneItemCount = static_cast<std::ptrdiff_t>(batch.ItemsPerLane[laneIndex]);
+                if (!processedPerLane[laneIndex].empty())
+                {
+                    auto& lane = this->GetLane(LANE_PRECEDENCE[laneIndex]);
+                    ItemTypeVector removedItems;
+                    auto removedItemCount = lane.Items.Remove(
+                        ItemTypeVector(laneStart, laneStart + laneItemCount),
+                        SequenceNumberVector(laneSequenceNumbersStart, laneSequenceNumbersStart + laneItemCount),
+                        processedPerLane[laneIndex],
+                        &removedItems);
+                    this->ReleaseCapacity(lane, removedItemCount, this->ForgetItemsSize(removedItems));
+                }
+
+                laneStart += laneItemCount;
+                laneSequenceNumbersStart += laneItemCount;
             }
         }
 
         void Worker()
         {
-            // When we make the first iteration through the loops
-            // we will want to wait if there aren't enough items in
-            // the queue yet.
-            bool waitForFirstWakeUp = this->GetQueueLength() <= m_itemThreshold;
             m_state = WorkerState::Running;
 
             {
@@ -439,137 +1638,434 @@ namespace Codevoid::Utilities {
                 m_hasWorkerStarted.notify_one();
             }
 
-            bool lastBatchWasTotalFailure = false;
-            bool retryAndBackoffEnabled = this->m_backoffOnRetryEnabled.load();
-            size_t retryLimit = this->m_numberOfRetriesToAttempt;
-            size_t retriesRemaining = retryLimit;
-            std::chrono::milliseconds nextRetryDelay = m_backoffDelayBaseValue;
+            this->ResetWorkerLoop();
+            this->RunWorkerLoop(true);
+            this->CompleteWorkerLoop();
+        }
 
+        // <summary>
+        // Runs the worker loop on a thread borrowed from the executor, until it
+        // either finishes or needs to wait for something. Rather than blocking the
+        // executor thread while waiting, it's rescheduled when it has work to do.
+        // </summary>
+        void RunWorkerLoopOnExecutor()
+        {
+            m_executorLoopState = ExecutorLoopState::Running;
+
+            if (m_workerLoopActive && this->RunWorkerLoop(false))
+            {
+                this->CompleteWorkerLoop();
+
+                {
+                    lock_guard_mutex lock(m_workerLock);
+                    m_workerLoopActive = false;
+                }
+
+                m_hasWorkerStopped.notify_all();
+            }
+
+            // If someone asked for the loop to be run while we were running it, we
+            // need to go around again, since we might have missed what they wanted.
+            auto expected = ExecutorLoopState::Running;
+            if (!m_executorLoopState.compare_exchange_strong(expected, ExecutorLoopState::Idle))
+            {
+                m_executorLoopState = ExecutorLoopState::Scheduled;
+                m_executor->Post(this, [this]() { this->RunWorkerLoopOnExecutor(); });
+            }
+        }
+
+        // <summary>
+        // Requests the worker loop be run on the executor. If it's already been
+        // requested, this does nothing, so there's only ever one instance of
+        // the loop for a worker running at a time.
+        // </summary>
+        void ScheduleWorkerLoop()
+        {
+            auto current = m_executorLoopState.load();
+            while (true)
+            {
+                switch (current)
+                {
+                    case ExecutorLoopState::Idle:
+                        if (m_executorLoopState.compare_exchange_weak(current, ExecutorLoopState::Scheduled))
+                        {
+                            m_executor->Post(this, [this]() { this->RunWorkerLoopOnExecutor(); });
+                            return;
+                        }
+                        break;
+
+                    case ExecutorLoopState::Running:
+                        if (m_executorLoopState.compare_exchange_weak(current, ExecutorLoopState::RunAgain))
+                        {
+                            return;
+                        }
+                        break;
+
+                    default:
+                        return;
+                }
+            }
+        }
+
+        // <summary>
+        // Requests the worker loop be run on the executor once
+        // <paramref name="when" /> has passed.
+        // </summary>
+        void ScheduleWorkerLoopAt(const std::chrono::steady_clock::time_point when)
+        {
+            // We can end up here several times for the same point in time (e.g.
+            // woken up before the idle deadline), so don't schedule it twice.
+            if (m_scheduledWakeUp == when)
+            {
+                return;
+            }
+
+            m_scheduledWakeUp = when;
+            m_executor->PostAt(this, when, [this]() { this->ScheduleWorkerLoop(); });
+        }
+
+        // <summary>
+        // Waits for the worker loop to have completed on the executor, and makes
+        // sure anything it had scheduled has been cancelled.
+        // </summary>
+        void WaitForWorkerLoopToComplete()
+        {
+            {
+                std::unique_lock<mutex> lock(m_workerLock);
+                m_hasWorkerStopped.wait(lock, [this]() {
+                    return !m_workerLoopActive;
+                });
+            }
+
+            m_executor->CancelAndWait(this);
+
+            // Anything we'd asked the executor to run has now been cancelled,
+            // so the next request needs to actually schedule the loop.
+            m_executorLoopState = ExecutorLoopState::Idle;
+        }
+
+        // <summary>
+        // Resets everything the worker loop tracks between iterations, ready
+        // to start the loop again.
+        // </summary>
+        void ResetWorkerLoop()
+        {
+            m_retry.BackoffEnabled = m_backoffOnRetryEnabled.load();
+            m_retry.CircuitBreakerEnabled = m_circuitBreakerEnabled.load();
+            m_retry.ProbeBatchSize = m_probeBatchSize;
+            m_retry.Backoff = DecorrelatedJitterBackoff(m_backoffDelayBaseValue, m_maximumBackoffDelay);
+
+            // The first attempt, plus each of the retries
+            m_retry.Breaker = CircuitBreaker(m_numberOfRetriesToAttempt + 1, m_probeInterval);
+            m_retry.LastBatchWasTotalFailure = false;
+            m_retry.ResumeAt.reset();
+            m_scheduledWakeUp.reset();
+            m_workerIsWaitingForItems = false;
+        }
+
+        void CompleteWorkerLoop()
+        {
+            m_state = (m_state == WorkerState::Paused) ? WorkerState::Paused : WorkerState::Shutdown;
+        }
+
+        // <summary>
+        // Processes items until the worker is shutdown, paused, or runs out of
+        // retries. Returns true when the loop is complete.
+        //
+        // When <paramref name="canBlock" /> is true, this blocks the calling
+        // thread whenever it needs to wait (for items, or to retry). Otherwise,
+        // it returns false, having arranged to be scheduled on the executor
+        // again when there's something to do.
+        // </summary>
+        bool RunWorkerLoop(const bool canBlock)
+        {
             while (m_state < WorkerState::Shutdown)
             {
                 TRACE_OUT(m_tracePrefix + L": Worker Starting Loop Iteration");
-                ItemTypeVector itemsToProcess;
 
-                // Only want to attempt the complex logic of retry backoff if it's enabled
-                // and our last attempt was a total failure
-                if (retryAndBackoffEnabled && lastBatchWasTotalFailure)
+                // If we're waiting on a callback for the current batch, pick up
+                // where we left off, rather than waiting for more items.
+                if (!m_currentBatch.has_value())
                 {
-
-                    TRACE_OUT(m_tracePrefix + L": Last Batch failed, and back off is enabled");
-                    if (retriesRemaining < 1)
+                    if (m_workerIsWaitingForItems)
                     {
-                        // Enter paused state
-                        m_state = WorkerState::Paused;
-                        TRACE_OUT(m_tracePrefix + L": Backoff retries exhausted, pausing thread");
-                        break;
+                        if (this->WaitForItems(canBlock) == WaitOutcome::Suspend)
+                        {
+                            return false;
+                        }
                     }
-
+                    // Only want to attempt the complex logic of retry backoff if it's enabled
+                    // and our last attempt was a total failure
+                    else if (m_retry.BackoffEnabled && m_retry.LastBatchWasTotalFailure)
                     {
-                        TRACE_OUT(m_tracePrefix + L": Backoff retry waiting...");
-                        std::unique_lock<std::mutex> retryLock(m_backoffRetryLock);
-                        auto waitResult = m_backoffShutdown.wait_for(retryLock, nextRetryDelay);
-                        if ((waitResult == std::cv_status::no_timeout) &&
-                            (!this->IsProcessing() || m_state > WorkerState::Paused))
+                        TRACE_OUT(m_tracePrefix + L": Last Batch failed, and back off is enabled");
+                        if ((m_retry.Breaker.GetState() == CircuitState::Open) && !m_retry.CircuitBreakerEnabled)
                         {
-                            // We didn't timeout, and we're not processing items -- this implies
-                            // that we're actually shutting down, so lets stop the queue now.
-                            TRACE_OUT(m_tracePrefix + L": Backoff retry signaled, and not processing so exiting");
+                            // Enter paused state
+                            m_state = WorkerState::Paused;
+                            TRACE_OUT(m_tracePrefix + L": Backoff retries exhausted, pausing thread");
                             break;
                         }
 
-                        // We timed out, implying we delayed the right amount. So lets decrement
-                        // our retry count, and update our delay value for the next attempt.
-                        // Note, it's possible the wakeup was spurious, but in that case we'll
-                        // just go and retry _anyway_, since, well, why not?
-                        TRACE_OUT(m_tracePrefix + L": Backoff Retry complete; updating for attempt");
-                        retriesRemaining -= 1;
-                        nextRetryDelay = (nextRetryDelay * 2);
+                        auto outcome = this->WaitToRetry(canBlock);
+                        if (outcome == WaitOutcome::Suspend)
+                        {
+                            return false;
+                        }
+
+                        if (outcome == WaitOutcome::Stop)
+                        {
+                            break;
+                        }
                     }
                 }
 
+                auto result = this->ProcessNextBatch(canBlock);
+                if (result == IterationResult::Exit)
                 {
-                    std::unique_lock<std::mutex> lock(m_itemsLock);
+                    break;
+                }
 
-                    // If we don't have anything in the queue, lets wait for something
-                    // to be in it, or to shutdown.
-                    if (m_items.size() < 1)
-                    {
-                        TRACE_OUT(m_tracePrefix + L": Waiting for Items to process");
-                        m_hasItems.wait(lock, [this, &waitForFirstWakeUp]() {
-                            TRACE_OUT(m_tracePrefix + L": Condition Triggered. State: " + to_wstring((int)m_state.load()));
-
-                            // If we're going away, we can ignore all other state
-                            // and allow the thread to continue and eventually
-                            // shutdown.
-                            if (m_state > WorkerState::Running)
-                            {
-                                return true;
-                            }
-
-                            // During the first iteration of the loop when started, we
-                            // might have items, but not enough to wake up the thread
-                            // normally. But since this is the first pass, we might have
-                            // fewer than that number. Ties to the conditional check on
-                            // the wait below, we'll start pushing items even though our
-                            // thresholds / idle timeout hasn't been hit.
-                            //
-                            // If we don't have enough items on the first pass, we'll
-                            // just wait until our second wake up -- assumed to be triggered
-                            // by some external force (timer, threshold), and process those
-                            // items normally.
-                            if (waitForFirstWakeUp)
-                            {
-                                waitForFirstWakeUp = false;
-                                return false;
-                            }
-
-                            // Only wake up if we actually have some times to process
-                            return (m_items.size() > 0);
-                        });
-                    }
+                if (result == IterationResult::Suspended)
+                {
+                    return false;
+                }
+
+                // Give other workers sharing the executor a chance to run
+                // between each of our batches.
+                if (!canBlock && (result == IterationResult::BatchProcessed))
+                {
+                    this->ScheduleWorkerLoop();
+                    return false;
+                }
+            }
 
-                    // If we've been asked to pause, just give up on everything, and
-                    // leave the queue, and state as is.
-                    if (m_state == WorkerState::Paused || m_state == WorkerState::Drop)
+            return true;
+        }
+
+        // <summary>
+        // Waits until there are items to process, per IsReadyToProcessItems.
+        // The worker must have already indicated that it's waiting for items,
+        // so that anyone adding items knows to wake it up.
+        // </summary>
+        WaitOutcome WaitForItems(const bool canBlock)
+        {
+            std::unique_lock<std::mutex> lock(m_itemsLock);
+
+            // Rather than a timer firing to wake us, we wait until the idle
+            // deadline that's pushed out each time work is added. When there
+            // isn't one, we wait until someone sets one, or the threshold is
+            // reached.
+            while (!this->IsReadyToProcessItems())
+            {
+                auto idleDeadline = m_idleDeadline.load();
+                if (!canBlock)
+                {
+                    if (idleDeadline != NO_IDLE_DEADLINE)
                     {
-                        break;
+                        this->ScheduleWorkerLoopAt(idleDeadline);
                     }
 
-                    itemsToProcess.assign(begin(m_items), end(m_items));
+                    return WaitOutcome::Suspend;
                 }
 
-                // When we've got no items, and we're shuting down, theres
-                // no work for us to do (no items), so we're just going to
-                // break out of the loop right now, and let the clean up happen
-                if ((itemsToProcess.size() == 0) && (m_state > WorkerState::Paused))
+                if (idleDeadline == NO_IDLE_DEADLINE)
                 {
-                    TRACE_OUT(m_tracePrefix + L": No items, exiting loop");
-                    break;
+                    m_hasItems.wait(lock);
+                }
+                else
+                {
+                    m_hasItems.wait_until(lock, idleDeadline);
+                }
+            }
+
+            m_workerIsWaitingForItems = false;
+            return WaitOutcome::Proceed;
+        }
+
+        // <summary>
+        // Waits for the next retry delay to pass -- or if we've run out of
+        // retries, until it's time to probe -- unless the worker is shutdown
+        // while waiting.
+        // </summary>
+        WaitOutcome WaitToRetry(const bool canBlock)
+        {
+            TRACE_OUT(m_tracePrefix + L": Backoff retry waiting...");
+            if (!m_retry.ResumeAt.has_value())
+            {
+                m_retry.ResumeAt = (m_retry.Breaker.GetState() == CircuitState::Open)
+                    ? m_retry.Breaker.GetProbeAt()
+                    : std::chrono::steady_clock::now() + m_retry.Backoff.NextDelay();
+            }
+
+            bool signalled = false;
+            if (canBlock)
+            {
+                std::unique_lock<std::mutex> retryLock(m_backoffRetryLock);
+                signalled = (m_backoffShutdown.wait_until(retryLock, *m_retry.ResumeAt) == std::cv_status::no_timeout);
+            }
+            else
+            {
+                // On the executor, being run before the delay has passed is the
+                // equivalent of being signalled. If we're still running, it's
+                // not for us, so keep waiting.
+                signalled = (std::chrono::steady_clock::now() < *m_retry.ResumeAt);
+                if (signalled && (m_state == WorkerState::Running))
+                {
+                    this->ScheduleWorkerLoopAt(*m_retry.ResumeAt);
+                    return WaitOutcome::Suspend;
                 }
+            }
+
+            if (signalled && (!this->IsProcessing() || m_state > WorkerState::Paused))
+            {
+                // We didn't timeout, and we're not processing items -- this implies
+                // that we're actually shutting down, so lets stop the queue now.
+                TRACE_OUT(m_tracePrefix + L": Backoff retry signaled, and not processing so exiting");
+                return WaitOutcome::Stop;
+            }
 
-                // Assume we should have some items if we've gotten this far
-                assert(itemsToProcess.size() > 0);
+            // We timed out, implying we delayed the right amount. If we were
+            // waiting to probe, the next batch is the probe. Note, it's possible
+            // the wakeup was spurious, but in that case we'll just go and retry
+            // (or probe) _anyway_, since, well, why not?
+            TRACE_OUT(m_tracePrefix + L": Backoff Retry complete; updating for attempt");
+            m_retry.ResumeAt.reset();
+            m_retry.Breaker.TryAttempt();
+            return WaitOutcome::Proceed;
+        }
+
+        // <summary>
+        // Takes the next batch from the queue, and processes it. If there aren't
+        // any items, the worker is marked as waiting for items, and the next
+        // iteration of the loop will wait for them.
+        //
+        // If we're already part way through a batch, that's continued instead.
+        // </summary>
+        IterationResult ProcessNextBatch(const bool canBlock)
+        {
+            if (m_currentBatch.has_value())
+            {
+                return this->ContinueCurrentBatch(canBlock);
+            }
 
-                TRACE_OUT(m_tracePrefix + L": Processing Items");
-                ItemTypeVector successfullyProcessed =
-                    this->m_processItemsCallback(itemsToProcess, bind(&BackgroundWorker<ItemType>::ShouldKeepProcessingItems, this));
+            ItemTypeVector itemsToProcess;
+            SequenceNumberVector itemsToProcessSequenceNumbers;
+            LaneCounts itemsPerLane{};
+
+            {
+                std::unique_lock<std::mutex> lock(m_itemsLock);
+                this->MoveIncomingItemsToQueue();
+
+                // If we don't have anything in the queue, lets wait for something
+                // to be in it, or to shutdown.
+                if ((this->GetQueuedItemCount() < 1) && (m_state == WorkerState::Running))
+                {
+                    TRACE_OUT(m_tracePrefix + L": Waiting for Items to process");
+
+                    // Let anyone adding items know they need to wake us up. This
+                    // must be set before we check for items for the last time.
+                    m_workerIsWaitingForItems = true;
+                    return IterationResult::Continue;
+                }
+
+                // If we've been asked to pause, just give up on everything, and
+                // leave the queue, and state as is.
+                if (m_state == WorkerState::Paused || m_state == WorkerState::Drop)
+                {
+                    return IterationResult::Exit;
+                }
+
+                // Pick up anything that arrived while we were waiting (e.g. if we
+                // were woken up to drain the queue on shutdown).
+                this->MoveIncomingItemsToQueue();
+
+                // Only take as many items as we're allowed in one batch; anything
+                // else is left in place for the next iteration. Higher priority
+                // lanes go first, so their items are at the front of the batch.
+                // If we're probing after running out of retries, keep it small.
+                size_t maximumBatchSize = m_maximumBatchSize;
+                if (m_retry.Breaker.GetState() != CircuitState::Closed)
+                {
+                    maximumBatchSize = (std::min)(maximumBatchSize, m_retry.ProbeBatchSize);
+                }
+
+                itemsPerLane = this->GetItemsToTakeFromEachLane(maximumBatchSize);
+                size_t batchSize = std::accumulate(begin(itemsPerLane), end(itemsPerLane), size_t(0));
+                itemsToProcess.reserve(batchSize);
+                itemsToProcessSequenceNumbers.reserve(batchSize);
+                for (size_t i = 0; i < LANE_COUNT; i++)
+                {
+                    this->GetLane(LANE_PRECEDENCE[i]).Items.PeekFront(itemsToProcess, itemsToProcessSequenceNumbers, itemsPerLane[i]);
+                }
+            }
+
+            // When we've got no items, and we're shuting down, theres
+            // no work for us to do (no items), so we're just going to
+            // break out of the loop right now, and let the clean up happen
+            if ((itemsToProcess.size() == 0) && (m_state > WorkerState::Paused))
+            {
+                TRACE_OUT(m_tracePrefix + L": No items, exiting loop");
+                return IterationResult::Exit;
+            }
+
+            // Woken up, but nothing to do (e.g. the queue was cleared after
+            // we were signalled), so go back to waiting.
+            if (itemsToProcess.size() == 0)
+            {
+                return IterationResult::Continue;
+            }
+
+            TRACE_OUT(m_tracePrefix + L": Processing Items");
+            m_currentBatch.emplace();
+            m_currentBatch->Items = std::move(itemsToProcess);
+            m_currentBatch->SequenceNumbers = std::move(itemsToProcessSequenceNumbers);
+            m_currentBatch->ItemsPerLane = itemsPerLane;
+            m_currentBatch->WaitingForCallback = false;
+            m_currentBatch->Processing = this->m_processItemsCallback(m_currentBatch->Items, m_shouldKeepProcessingItems);
+
+            return this->ContinueCurrentBatch(canBlock);
+        }
+
+        // <summary>
+        // Moves the current batch on as far as it can go: once processing has
+        // completed, the successful items are removed from the queue and post
+        // processed. If a callback hasn't completed, and we can't block, the
+        // batch is left where it is until it has.
+        // </summary>
+        IterationResult ContinueCurrentBatch(const bool canBlock)
+        {
+            auto& batch = *m_currentBatch;
+
+            if (!batch.PostProcessing.has_value())
+            {
+                if (!this->HasCallbackCompleted(*batch.Processing, canBlock))
+                {
+                    return IterationResult::Suspended;
+                }
+
+                batch.SuccessfullyProcessed = batch.Processing->get();
 
                 // If we fail to process any items in a batch, we should switch
                 // to a mode where we're going wait to attempt the next batch.
                 // This will happen up until the retry limit is reached, at which
-                // point we'll pause the queue to (maybe) be restarted later.
-                if (successfullyProcessed.size() < 1)
+                // point we'll pause the queue to (maybe) be restarted later, or
+                // if the circuit breaker is enabled, periodically probe.
+                if (batch.SuccessfullyProcessed.size() < 1)
                 {
                     TRACE_OUT(m_tracePrefix + L": No items were successfully processed. Skipping post processing, and starting loop again");
-                    lastBatchWasTotalFailure = true;
-                    continue;
+                    m_retry.LastBatchWasTotalFailure = true;
+                    m_retry.Breaker.RecordFailure();
+                    this->RecountItemsSize(batch.Items);
+                    m_currentBatch.reset();
+                    return IterationResult::BatchProcessed;
                 }
 
                 // It was not a total failure, so set our retry limits to defaults
                 // to prep for the next failure.
-                lastBatchWasTotalFailure = false;
-                retriesRemaining = retryLimit;
-                nextRetryDelay = m_backoffDelayBaseValue;
+                m_retry.LastBatchWasTotalFailure = false;
+                m_retry.Breaker.RecordSuccess();
+                m_retry.Backoff.Reset();
 
                 // Remove the items from the queue
                 {
@@ -577,88 +2073,148 @@ namespace Codevoid::Utilities {
 
                     TRACE_OUT(m_tracePrefix + L": Clearing Queue of processed items");
 
-                    // Remove the items from the list that had been successfully processed
-                    // This requires us to loop through the list multiple times (boo), since
-                    // we're changing the list, and they may be non-contiguous. Hopefully,
-                    // however, the items are near the front of the list since thats what we
-                    // were processing.
-                    for (auto&& processedItem : successfullyProcessed)
-                    {
-                        auto removeAt = find(begin(m_items),
-                            end(m_items),
-                            processedItem);
-
-                        if (removeAt == m_items.end())
-                        {
-                            // Didn't find the item, so it must not be in the list any more
-                            continue;
-                        }
-
-                        m_items.erase(removeAt);
-                    }
+                    // Remove the items from the list that had been successfully processed.
+                    // The sequence numbers captured with the batch let us go straight to
+                    // each item, rather than searching the queue for them. Any that aren't
+                    // found must not be in the list any more (e.g. it was cleared).
+                    this->RemoveProcessedItems(batch);
                 }
 
                 if (m_state > WorkerState::Drain)
                 {
                     TRACE_OUT(m_tracePrefix + L": Queue shutting down, skipping post processing");
-                    continue;
+                    m_currentBatch.reset();
+                    return IterationResult::BatchProcessed;
                 }
 
                 TRACE_OUT(m_tracePrefix + L": Post Processing");
-                m_postProcessItemsCallback(successfullyProcessed);
+                batch.PostProcessing = m_postProcessItemsCallback(batch.SuccessfullyProcessed);
             }
 
-            m_state = (m_state == WorkerState::Paused) ? WorkerState::Paused : WorkerState::Shutdown;
+            if (!this->HasCallbackCompleted(*batch.PostProcessing, canBlock))
+            {
+                return IterationResult::Suspended;
+            }
+
+            auto postProcessing = std::move(*batch.PostProcessing);
+            m_currentBatch.reset();
+
+            // Surfaces anything the post processing threw
+            postProcessing.get();
+            return IterationResult::BatchProcessed;
         }
 
-        // concurrency::timer is weird, and requires you to set things up in weird ways
-        // (hence the pointers). Also, it can't be "Restarted" if it's a single timer
-        // so we need to recreate it every time. This function just wraps things up neatly.
-        std::tuple<std::shared_ptr<Concurrency::timer<int>>, std::shared_ptr<Concurrency::call<int>>> CreateConcurrencyTimer(std::chrono::milliseconds timeout, std::function<void()> callback)
+        // <summary>
+        // Checks if the task returned by a callback for the current batch has
+        // completed. If we can block, we'll wait for it to complete -- otherwise
+        // we arrange for the loop to be scheduled on the executor when it does.
+        // </summary>
+        template <typename ResultType>
+        bool HasCallbackCompleted(concurrency::task<ResultType>& callbackTask, const bool canBlock)
         {
-            auto callWrapper = std::make_shared<Concurrency::call<int>>([callback](int) {
-                callback();
-            });
+            auto& batch = *m_currentBatch;
+            if (batch.WaitingForCallback)
+            {
+                // Scheduled for some other reason (e.g. shutting down), but the
+                // callback still hasn't completed, so keep waiting.
+                if (!m_callbackCompleted)
+                {
+                    return false;
+                }
 
-            auto timerInstance = std::make_shared<Concurrency::timer<int>>((int)timeout.count(), 0, callWrapper.get(), false);
+                batch.WaitingForCallback = false;
+                m_callbackCompleted = false;
+                return true;
+            }
 
-            return make_tuple(timerInstance, callWrapper);
-        }
+            if (canBlock)
+            {
+                callbackTask.wait();
+                return true;
+            }
 
-        // Per CreateConcurrencyTimer, this helps clean the timers up.
-        static void CancelConcurrencyTimer(std::shared_ptr<Concurrency::timer<int>>& timer, std::shared_ptr<Concurrency::call<int>>& target)
-        {
-            if (timer != nullptr && target != nullptr)
+            if (callbackTask.is_done())
             {
-                timer->stop();
-                timer->unlink_target(target.get());
+                return true;
             }
 
-            target = nullptr;
-            timer = nullptr;
+            // The continuation doesn't touch this instance directly; it only
+            // posts work to the executor, which we cancel and wait for before
+            // going away. Since that work is what tells the loop the callback
+            // has completed, the loop (and us) can't go away before it's run.
+            batch.WaitingForCallback = true;
+            callbackTask.then([executor = m_executor, this](concurrency::task<ResultType>) {
+                executor->Post(this, [this]() {
+                    m_callbackCompleted = true;
+                    this->ScheduleWorkerLoop();
+                });
+            }, concurrency::task_continuation_context::use_arbitrary());
+
+            return false;
         }
 
         // Callbacks
-        std::function<ItemTypeVector(ItemTypeVector&, const std::function<bool()>&)> m_processItemsCallback;
-        std::function<void(ItemTypeVector&)> m_postProcessItemsCallback;
+        AsyncProcessItemsCallback m_processItemsCallback;
+        AsyncPostProcessItemsCallback m_postProcessItemsCallback;
+        std::function<bool()> m_shouldKeepProcessingItems;
+        std::optional<CurrentBatch> m_currentBatch;
+        std::atomic<bool> m_callbackCompleted;
 
         // Idle timeout / item limits
-        std::shared_ptr<concurrency::timer<int>> m_idleTimer;
-        std::shared_ptr<concurrency::call<int>> m_idleTimerCallback;
-        std::chrono::milliseconds m_idleTimeout;
-        size_t m_itemThreshold;
+        // No deadline is the earliest possible time, so any real deadline replaces it
+        static constexpr std::chrono::steady_clock::time_point NO_IDLE_DEADLINE = (std::chrono::steady_clock::time_point::min)();
+        std::atomic<std::chrono::steady_clock::time_point> m_idleDeadline;
+        std::atomic<std::chrono::milliseconds> m_idleTimeout;
+        std::atomic<size_t> m_itemThreshold;
+        std::atomic<size_t> m_maximumBatchSize;
+
+        // Adaptive debounce
+        static constexpr double ADAPTIVE_DEBOUNCE_SMOOTHING = 0.2;
+        static constexpr double NO_AVERAGE_ARRIVAL_GAP = -1.0;
+        static constexpr std::chrono::steady_clock::time_point NO_ARRIVAL = (std::chrono::steady_clock::time_point::min)();
+        std::atomic<bool> m_adaptiveDebounceEnabled;
+        std::atomic<std::chrono::milliseconds> m_latencyTarget;
+        std::atomic<size_t> m_minimumItemThreshold;
+        std::atomic<size_t> m_maximumItemThreshold;
+        std::atomic<std::chrono::milliseconds> m_minimumIdleTimeout;
+        std::atomic<std::chrono::steady_clock::time_point> m_lastArrival;
+        std::atomic<double> m_averageArrivalGap;
+
+        // Capacity
+        static constexpr size_t OVERFLOW_POLICY_COUNT = 4;
+        static constexpr size_t MAXIMUM_COUNT = static_cast<size_t>((std::numeric_limits<long long>::max)());
+        std::atomic<size_t> m_maximumItems;
+        std::atomic<size_t> m_maximumBytes;
+        std::atomic<OverflowPolicy> m_overflowPolicy;
+        std::atomic<std::chrono::milliseconds> m_blockingTimeout;
+        std::function<size_t(const ItemType&)> m_getItemSize;
+        std::mutex m_countedSizesLock;
+        std::unordered_multimap<const ItemType*, size_t> m_countedSizes;
+        std::array<std::atomic<size_t>, OVERFLOW_POLICY_COUNT> m_overflowCounts;
+        std::mutex m_capacityLock;
+        std::condition_variable m_capacityAvailable;
+        std::atomic<size_t> m_blockedProducerCount;
 
         // Retry & Backoff
         std::atomic<bool> m_backoffOnRetryEnabled;
         std::atomic<size_t> m_numberOfRetriesToAttempt;
         std::atomic<std::chrono::milliseconds> m_backoffDelayBaseValue;
+        std::atomic<std::chrono::milliseconds> m_maximumBackoffDelay;
+        std::atomic<bool> m_circuitBreakerEnabled;
+        std::atomic<std::chrono::milliseconds> m_probeInterval;
+        std::atomic<size_t> m_probeBatchSize;
         std::mutex m_backoffRetryLock;
         std::condition_variable m_backoffShutdown;
+        RetryState m_retry;
 
         // Items & Concurrency
-        ItemTypeVector m_items;
+        std::array<Lane, LANE_COUNT> m_lanes;
+        std::atomic<long long> m_pendingItemCount;
+        std::atomic<long long> m_pendingItemBytes;
+        std::atomic<SequenceNumber> m_nextArrival;
         std::mutex m_itemsLock;
         std::condition_variable m_hasItems;
+        std::atomic<bool> m_workerIsWaitingForItems;
 
         // Worker state & concurrency
         std::mutex m_workerLock;
@@ -666,6 +2222,13 @@ namespace Codevoid::Utilities {
         std::thread m_workerThread;
         std::atomic<WorkerState> m_state;
 
+        // Shared executor, when not running on our own thread
+        std::shared_ptr<WorkerExecutor> m_executor;
+        std::atomic<bool> m_workerLoopActive;
+        std::condition_variable m_hasWorkerStopped;
+        std::atomic<ExecutorLoopState> m_executorLoopState;
+        std::optional<std::chrono::steady_clock::time_point> m_scheduledWakeUp;
+
         std::wstring m_tracePrefix;
     };
 }
\ No newline at end of file
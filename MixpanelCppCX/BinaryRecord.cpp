@@ -0,0 +1,174 @@
+#include "pch.h"
+#include <cstring>
+#include "BinaryRecord.h"
+
+using namespace Codevoid::Utilities;
+using namespace std;
+
+// A 64bit value takes at most ten 7 bit groups.
+constexpr size_t MAXIMUM_VARINT_SIZE = 10;
+
+void BinaryRecordWriter::WriteByte(const uint8_t value)
+{
+    m_record.push_back(static_cast<char>(value));
+}
+
+void BinaryRecordWriter::WriteVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        m_record.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+
+    m_record.push_back(static_cast<char>(value));
+}
+
+void BinaryRecordWriter::WriteSignedVarint(const int64_t value)
+{
+    auto zigZag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    this->WriteVarint(zigZag);
+}
+
+void BinaryRecordWriter::WriteDouble(const double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    for (size_t i = 0; i < sizeof(bits); i++)
+    {
+        m_record.push_back(static_cast<char>((bits >> (i * 8)) & 0xFF));
+    }
+}
+
+void BinaryRecordWriter::WriteString(const char* data, const size_t length)
+{
+    this->WriteVarint(length);
+    m_record.append(data, length);
+}
+
+void BinaryRecordWriter::WriteString(const string& value)
+{
+    this->WriteString(value.data(), value.size());
+}
+
+const string& BinaryRecordWriter::GetRecord() const
+{
+    return m_record;
+}
+
+string BinaryRecordWriter::ReleaseRecord()
+{
+    return move(m_record);
+}
+
+BinaryRecordReader::BinaryRecordReader(const string& record) :
+    BinaryRecordReader(record.data(), record.size())
+{ }
+
+BinaryRecordReader::BinaryRecordReader(const char* data, const size_t length) :
+    m_data(data),
+    m_length(length),
+    m_position(0)
+{ }
+
+bool BinaryRecordReader::ReadByte(uint8_t* value)
+{
+    if (m_position >= m_length)
+    {
+        return false;
+    }
+
+    *value = static_cast<uint8_t>(m_data[m_position++]);
+    return true;
+}
+
+bool BinaryRecordReader::ReadVarint(uint64_t* value)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < MAXIMUM_VARINT_SIZE; i++)
+    {
+        uint8_t group;
+        if (!this->ReadByte(&group))
+        {
+            return false;
+        }
+
+        result |= static_cast<uint64_t>(group & 0x7F) << (i * 7);
+        if ((group & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+
+    // Too long to be a 64bit value, so the record must be damaged
+    return false;
+}
+
+bool BinaryRecordReader::ReadSignedVarint(int64_t* value)
+{
+    uint64_t zigZag;
+    if (!this->ReadVarint(&zigZag))
+    {
+        return false;
+    }
+
+    *value = static_cast<int64_t>((zigZag >> 1) ^ (~(zigZag & 1) + 1));
+    return true;
+}
+
+bool BinaryRecordReader::ReadDouble(double* value)
+{
+    uint64_t bits = 0;
+    if (this->GetRemaining() < sizeof(bits))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(bits); i++)
+    {
+        bits |= static_cast<uint64_t>(static_cast<uint8_t>(m_data[m_position++])) << (i * 8);
+    }
+
+    memcpy(value, &bits, sizeof(bits));
+    return true;
+}
+
+bool BinaryRecordReader::ReadString(const char** data, size_t* length)
+{
+    uint64_t stringLength;
+    if (!this->ReadVarint(&stringLength) || (stringLength > this->GetRemaining()))
+    {
+        return false;
+    }
+
+    *data = m_data + m_position;
+    *length = static_cast<size_t>(stringLength);
+    m_position += *length;
+
+    return true;
+}
+
+bool BinaryRecordReader::ReadString(string* value)
+{
+    const char* data;
+    size_t length;
+    if (!this->ReadString(&data, &length))
+    {
+        return false;
+    }
+
+    value->assign(data, length);
+    return true;
+}
+
+size_t BinaryRecordReader::GetRemaining() const
+{
+    return m_length - m_position;
+}
+
+bool BinaryRecordReader::AtEnd() const
+{
+    return m_position == m_length;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // Builds a compact binary record out of primitive values. Lengths &
+    // integers are written as varints -- 7 bits per byte, low bits first --
+    // so the small numbers that make up most of a record take a byte or two.
+    // Fixed size values are little endian.
+    // </summary>
+    class BinaryRecordWriter
+    {
+    public:
+        void WriteByte(const uint8_t value);
+        void WriteVarint(uint64_t value);
+
+        // <summary>
+        // Zig-zag encodes the value first, so small negative numbers are as
+        // compact as small positive ones.
+        // </summary>
+        void WriteSignedVarint(const int64_t value);
+        void WriteDouble(const double value);
+
+        // <summary>
+        // Writes the length of the bytes, followed by the bytes themselves.
+        // </summary>
+        void WriteString(const char* data, const size_t length);
+        void WriteString(const std::string& value);
+
+        const std::string& GetRecord() const;
+        std::string ReleaseRecord();
+
+    private:
+        std::string m_record;
+    };
+
+    // <summary>
+    // Reads back the values written by a BinaryRecordWriter, in the order
+    // they were written. Records are read from storage, so every read checks
+    // it's within the record, and returns false -- rather than reading past
+    // the end -- if it isn't.
+    // </summary>
+    class BinaryRecordReader
+    {
+    public:
+        BinaryRecordReader(const std::string& record);
+        BinaryRecordReader(const char* data, const size_t length);
+
+        bool ReadByte(uint8_t* value);
+        bool ReadVarint(uint64_t* value);
+        bool ReadSignedVarint(int64_t* value);
+        bool ReadDouble(double* value);
+
+        // <summary>
+        // Reads a length prefixed string, without copying it: the result
+        // points into the record.
+        // </summary>
+        bool ReadString(const char** data, size_t* length);
+        bool ReadString(std::string* value);
+
+        // <summary>
+        // Number of bytes that haven't been read yet. Useful to sanity check
+        // element counts before allocating space for them.
+        // </summary>
+        size_t GetRemaining() const;
+        bool AtEnd() const;
+
+    private:
+        const char* m_data;
+        size_t m_length;
+        size_t m_position;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // CRC-32 (IEEE 802.3, as used by zip & gzip) of the supplied data. To
+    // checksum data that arrives in pieces, pass the result for the previous
+    // pieces as the previous checksum.
+    // </summary>
+    inline uint32_t Crc32(const char* data, const size_t length, const uint32_t previous = 0)
+    {
+        static const std::array<uint32_t, 256> table = []() {
+            std::array<uint32_t, 256> result;
+            for (uint32_t i = 0; i < result.size(); i++)
+            {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+                }
+
+                result[i] = value;
+            }
+
+            return result;
+        }();
+
+        uint32_t crc = previous ^ 0xFFFFFFFF;
+        for (size_t i = 0; i < length; i++)
+        {
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+
+        return crc ^ 0xFFFFFFFF;
+    }
+}
\ No newline at end of file
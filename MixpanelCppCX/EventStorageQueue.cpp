@@ -1,6 +1,11 @@
 #include "pch.h"
+#include <unordered_set>
 #include "BackgroundWorker.h"
 #include "EventStorageQueue.h"
+#include "MemoryRecordStore.h"
+#include "PayloadCodec.h"
+#include "PayloadEncoder.h"
+#include "SegmentedLog.h"
 #include "Tracing.h"
 
 using namespace Codevoid::Utilities::Mixpanel;
@@ -14,19 +19,81 @@ using namespace Windows::Data::Json;
 using PayloadContainer_ptr = shared_ptr<PayloadContainer>;
 using PayloadContainers = vector<PayloadContainer_ptr>;
 
+// Bounds the write to storage worker adapts its batching within. Events are
+// written to storage within about the latency target, in batches as large as
+// the rate they're being queued allows: a burst of events is written in a few
+// large batches, rather than many small ones, and a trickle of events isn't
+// held on to waiting for a batch to fill up.
+constexpr auto WRITE_TO_STORAGE_LATENCY_TARGET = 500ms;
+constexpr auto WRITE_TO_STORAGE_MINIMUM_IDLE_TIMEOUT = 50ms;
+constexpr size_t WRITE_TO_STORAGE_MINIMUM_ITEM_THRESHOLD = 10;
+constexpr size_t WRITE_TO_STORAGE_MAXIMUM_ITEM_THRESHOLD = 250;
+
+// Limits on how many events, and how much of their payloads, wait to be
+// written to storage. Writes normally keep well ahead of events being queued;
+// these only matter when storage stalls, so that memory doesn't grow without
+// bound while it does.
+constexpr size_t DEFAULT_MAXIMUM_QUEUED_WRITES = 10000;
+constexpr size_t DEFAULT_MAXIMUM_QUEUED_WRITE_BYTES = 16 * 1024 * 1024;
+
+// Number of file operations issued to storage at once. Flash storage
+// completes a handful of concurrent requests far faster than the same
+// requests one after another.
+constexpr size_t DEFAULT_STORAGE_IO_WINDOW = 8;
+
+// Folder, within the queue's folder, that quarantined events are kept in.
+constexpr auto DEAD_LETTERS_FOLDER = L"DeadLetters";
+
 String^ Codevoid::Utilities::Mixpanel::GetFileNameForId(const long long& id)
 {
     return ref new String(to_wstring(id).append(L".json").c_str());
 }
 
+Codevoid::Utilities::WorkPriority Codevoid::Utilities::Mixpanel::ToWorkPriority(const EventPriority priority)
+{
+    switch (priority)
+    {
+        case EventPriority::Low:
+            return WorkPriority::Low;
+
+        case EventPriority::High:
+            return WorkPriority::High;
+
+        default:
+            return WorkPriority::Normal;
+    }
+}
+
+size_t Codevoid::Utilities::Mixpanel::GetQueuedSizeInBytes(const PayloadContainer& item)
+{
+    if (item.Payload == nullptr)
+    {
+        return 0;
+    }
+
+    return (item.SizeInBytes > 0) ? item.SizeInBytes : item.UploadSizeInBytes;
+}
+
+EventStorageQueue::EventStorageQueue(
+    StorageFolder^ localStorage,
+    function<void(const vector<shared_ptr<PayloadContainer>>&)> writtenToStorageCallback
+) : EventStorageQueue(localStorage, nullptr, writtenToStorageCallback)
+{
+}
+
 EventStorageQueue::EventStorageQueue(
     StorageFolder^ localStorage,
+    unique_ptr<RecordStore> store,
     function<void(const vector<shared_ptr<PayloadContainer>>&)> writtenToStorageCallback
 ) :
     m_localStorage(localStorage),
+    m_log(move(store)),
     m_state(QueueState::None),
     m_writtenToStorageCallback(writtenToStorageCallback),
     m_dontWriteToStorageForTestPurposes(false),
+    m_releasePayloadsOnceWritten(false),
+    m_storageIoWindow(DEFAULT_STORAGE_IO_WINDOW),
+    m_maximumQuarantinedEvents(DEFAULT_MAXIMUM_QUARANTINED_EVENTS),
     m_writeToStorageWorker(
         bind(&EventStorageQueue::WriteItemsToStorage, this, placeholders::_1, placeholders::_2),
         bind(&EventStorageQueue::HandleProcessedItems, this, placeholders::_1),
@@ -38,8 +105,25 @@ EventStorageQueue::EventStorageQueue(
         throw invalid_argument("Must provide local storage folder");
     }
 
+    // Unless told otherwise, items are kept in a log in the folder
+    if (m_log == nullptr)
+    {
+        m_log = make_unique<SegmentedLog>(localStorage->Path->Data());
+    }
+
+    this->SetDurability(EventDurability::Buffered);
+
     TRACE_OUT(L"Event Queue Constructed");
 
+    m_writeToStorageWorker.EnableAdaptiveDebounce(
+        WRITE_TO_STORAGE_LATENCY_TARGET,
+        WRITE_TO_STORAGE_MINIMUM_ITEM_THRESHOLD,
+        WRITE_TO_STORAGE_MAXIMUM_ITEM_THRESHOLD,
+        WRITE_TO_STORAGE_MINIMUM_IDLE_TIMEOUT);
+
+    m_writeToStorageWorker.SetItemSizeCallback(GetQueuedSizeInBytes);
+    this->SetOverflowPolicy(OverflowPolicy::DropOldest);
+
     // Initialize our base ID for saving events to disk to ensure we avoid clashes with
     // multiple concurrent callers generating items at the same moment.
     m_baseId = time_point_cast<milliseconds>(system_clock::now()).time_since_epoch().count();
@@ -65,6 +149,22 @@ size_t EventStorageQueue::GetWaitingToWriteToStorageLength()
     return m_writeToStorageWorker.GetQueueLength();
 }
 
+void EventStorageQueue::SetOverflowPolicy(const OverflowPolicy policy)
+{
+    m_writeToStorageWorker.SetCapacity(DEFAULT_MAXIMUM_QUEUED_WRITES, DEFAULT_MAXIMUM_QUEUED_WRITE_BYTES, policy);
+}
+
+size_t EventStorageQueue::GetDroppedEventCount()
+{
+    size_t dropped = 0;
+    for (auto policy : { OverflowPolicy::DropOldest, OverflowPolicy::DropLowestPriority, OverflowPolicy::RejectNew, OverflowPolicy::Block })
+    {
+        dropped += m_writeToStorageWorker.GetOverflowCount(policy);
+    }
+
+    return dropped;
+}
+
 long long EventStorageQueue::QueueEventToStorage(IJsonValue^ payload, const EventPriority& priority)
 {
     if (m_state > QueueState::Running)
@@ -76,52 +176,62 @@ long long EventStorageQueue::QueueEventToStorage(IJsonValue^ payload, const Even
     auto id = this->GetNextId();
     auto item = make_shared<PayloadContainer>(id, payload, priority);
 
+    // Estimated now, so the item is counted at a size until it's written --
+    // which it never is, if its durability is EventDurability::None. It's
+    // needed to batch the item for upload anyway.
+    item->UploadSizeInBytes = EstimateUploadSize(payload);
+
     TRACE_OUT(L"Event Queued: " + id);
-    m_writeToStorageWorker.AddWork(item, (item->Priority == EventPriority::Low ? WorkPriority::Low : WorkPriority::Normal));
+    m_writeToStorageWorker.AddWork(item, ToWorkPriority(item->Priority));
 
     return id;
 }
 
-task<vector<shared_ptr<PayloadContainer>>> EventStorageQueue::LoadItemsFromStorage(StorageFolder^ sourceFolder)
+task<vector<shared_ptr<PayloadContainer>>> EventStorageQueue::LoadItemsFromStorage()
 {
     TRACE_OUT(L"Restoring items from storage");
-    auto files = co_await sourceFolder->GetFilesAsync();
+    co_await this->MoveLegacyItemsToLog();
+
     PayloadContainers loadedPayload;
+    vector<long long> emptyItems;
+    long long largestId = 0;
+
+    // Storage calls block while they wait on the disk, so they're run on the
+    // thread pool, rather than holding up the thread (e.g. a shared worker's)
+    // this was called on.
+    auto pendingRecords = co_await create_task([this]() {
+        return m_log->GetPendingRecords();
+    });
 
-    for (auto&& file : files)
+    // Payloads aren't read, or parsed, until the items are about to be
+    // uploaded, so restoring a large backlog doesn't hold all of it in memory.
+    for (auto&& record : pendingRecords)
     {
-        TRACE_OUT(L"Reading from storage:" + file->Path);
-        auto contents = co_await FileIO::ReadTextAsync(file);
-
-        JsonObject^ payload = nullptr;
-        bool successfullyParsed = false;
-
-        // There are situations where the file gets corrupted
-        // on disk. This will cause bad things to happen.
-        if (!contents->IsEmpty())
-        {
-            // If the file is there, has contents but *isn't*
-            // correct JSON, it'll fail to parse. If it does
-            // we'll just move on past this file
-            successfullyParsed = JsonObject::TryParse(contents, &payload);
-        }
-
-        if (!successfullyParsed || (payload == nullptr))
+        largestId = (max)(largestId, record.Id);
+        if (record.PayloadSize == 0)
         {
-            create_task(file->DeleteAsync()).wait();
+            emptyItems.push_back(record.Id);
             continue;
         }
 
-        // Convert the file name to the ID
-        // This assumes the data is constant, and that wcstoll will stop
-        // when it finds a non-numeric char and give me a number that we need
-        auto rawString = file->Name->Data();
-        auto id = std::wcstoll(rawString, nullptr, 0);
-
         // Note, it's assumed that items being restored from disk have lasted longer
         // than a few seconds (E.g. across an app restart), we probably want to get
         // it to the network now.
-        loadedPayload.emplace_back(make_shared<PayloadContainer>(id, payload, EventPriority::Normal));
+        auto item = make_shared<PayloadContainer>(record.Id, nullptr, EventPriority::Normal, record.PayloadSize);
+        item->InStorage = true;
+        loadedPayload.emplace_back(move(item));
+    }
+
+    co_await create_task([this, &emptyItems]() {
+        m_log->Acknowledge(emptyItems);
+    });
+
+    // New IDs start from the time the queue was created, which a backlog
+    // queued faster than one a millisecond can be ahead of. Appending a
+    // record with a pending ID replaces it, so new IDs must follow them.
+    auto baseId = m_baseId.load();
+    while ((baseId < largestId) && !m_baseId.compare_exchange_weak(baseId, largestId))
+    {
     }
 
     // Load the items loaded from storage into the upload queue.
@@ -132,15 +242,202 @@ task<vector<shared_ptr<PayloadContainer>>> EventStorageQueue::LoadItemsFromStora
     return loadedPayload;
 }
 
+task<PayloadContainers> EventStorageQueue::LoadPayloadsFromStorage(const PayloadContainers& items)
+{
+    unordered_map<long long, PayloadContainer_ptr> itemsToLoad;
+    vector<long long> ids;
+    for (auto&& item : items)
+    {
+        if (item->Payload == nullptr)
+        {
+            itemsToLoad[item->Id] = item;
+            ids.push_back(item->Id);
+        }
+    }
+
+    if (ids.empty())
+    {
+        return PayloadContainers();
+    }
+
+    // Items that couldn't be read because of an I/O error are still in
+    // storage, so they're left there to be loaded on a later attempt.
+    vector<long long> unreadableIds;
+    auto records = co_await create_task([this, &ids, &unreadableIds]() {
+        return m_log->ReadRecords(ids, &unreadableIds);
+    });
+    unordered_set<long long> unreadable(begin(unreadableIds), end(unreadableIds));
+
+    for (auto&& record : records)
+    {
+        // If the item is there, has contents but they can't be decoded, it's
+        // left without a payload, and removed from storage so we don't see
+        // it again.
+        auto payload = DecodePayload(record.Payload);
+        if (payload == nullptr)
+        {
+            continue;
+        }
+
+        auto& item = itemsToLoad[record.Id];
+        item->Payload = payload;
+        item->SizeInBytes = record.Payload.size();
+    }
+
+    PayloadContainers unloadableItems;
+    vector<long long> unloadableIds;
+    for (auto&& item : items)
+    {
+        if ((item->Payload == nullptr) && (unreadable.find(item->Id) == unreadable.end()))
+        {
+            unloadableItems.push_back(item);
+            unloadableIds.push_back(item->Id);
+        }
+    }
+
+    TRACE_OUT(L"Loaded " + to_wstring(ids.size() - unloadableIds.size() - unreadable.size()) + L" payloads from storage");
+    co_await create_task([this, &unloadableIds]() {
+        m_log->Acknowledge(unloadableIds);
+    });
+
+    return unloadableItems;
+}
+
+void EventStorageQueue::SetReleasePayloadsOnceWritten(const bool release)
+{
+    m_releasePayloadsOnceWritten = release;
+}
+
+void EventStorageQueue::ReleasePayloads(const PayloadContainers& items)
+{
+    if (!m_releasePayloadsOnceWritten)
+    {
+        return;
+    }
+
+    for (auto&& item : items)
+    {
+        if (item->InStorage)
+        {
+            item->Payload = nullptr;
+        }
+    }
+}
+
+task<void> EventStorageQueue::MoveLegacyItemsToLog()
+{
+    // Earlier versions stored each item in a file of it's own, named after
+    // the ID of the item.
+    auto files = co_await m_localStorage->GetFilesAsync();
+    vector<LogRecord> records;
+    vector<StorageFile^> legacyFiles;
+
+    for (auto&& file : files)
+    {
+        if (file->FileType == StringReference(L".json"))
+        {
+            legacyFiles.push_back(file);
+        }
+    }
+
+    // Reads are issued a window at a time; when_all returns the contents in
+    // the same order as the files, however the reads complete.
+    size_t window = m_storageIoWindow;
+    for (size_t start = 0; start < legacyFiles.size(); start += window)
+    {
+        auto windowEnd = (min)(start + window, legacyFiles.size());
+        vector<task<String^>> reads;
+        reads.reserve(windowEnd - start);
+
+        for (auto i = start; i < windowEnd; i++)
+        {
+            TRACE_OUT(L"Reading from storage:" + legacyFiles[i]->Path);
+            reads.push_back(create_task(FileIO::ReadTextAsync(legacyFiles[i])));
+        }
+
+        auto contents = co_await when_all(begin(reads), end(reads));
+        for (auto i = start; i < windowEnd; i++)
+        {
+            // There are situations where the file gets corrupted
+            // on disk. Those that are empty, or aren't JSON, don't need to be
+            // moved at all. The rest are converted to the binary format, so
+            // they're restored the same way as everything else.
+            auto payload = ConvertJsonToPayload(contents[i - start]);
+            if (payload.empty())
+            {
+                continue;
+            }
+
+            // Convert the file name to the ID
+            // This assumes the data is constant, and that wcstoll will stop
+            // when it finds a non-numeric char and give me a number that we need
+            auto rawString = legacyFiles[i]->Name->Data();
+            auto id = std::wcstoll(rawString, nullptr, 0);
+
+            records.push_back({ id, move(payload) });
+        }
+    }
+
+    // If the items couldn't be moved, leave the files in place to try again
+    // next time, rather than losing them.
+    auto moved = co_await create_task([this, &records]() {
+        return m_log->Append(records);
+    });
+
+    if (!moved)
+    {
+        return;
+    }
+
+    co_await this->DeleteFiles(legacyFiles);
+}
+
+task<void> EventStorageQueue::DeleteFiles(const vector<StorageFile^>& files)
+{
+    size_t window = m_storageIoWindow;
+    for (size_t start = 0; start < files.size(); start += window)
+    {
+        auto windowEnd = (min)(start + window, files.size());
+        vector<task<void>> deletes;
+        deletes.reserve(windowEnd - start);
+
+        for (auto i = start; i < windowEnd; i++)
+        {
+            deletes.push_back(create_task(files[i]->DeleteAsync()).then([](task<void> deleted) {
+                try
+                {
+                    deleted.get();
+                }
+                catch (COMException^ e)
+                {
+                    // Already gone is just as good as deleted
+                    if (e->HResult != HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+                    {
+                        throw e;
+                    }
+                }
+            }));
+        }
+
+        co_await when_all(begin(deletes), end(deletes));
+    }
+}
+
 void EventStorageQueue::EnableQueuingToStorage()
 {
     m_state = QueueState::Running;
     m_writeToStorageWorker.Start();
 }
 
-PayloadContainers EventStorageQueue::WriteItemsToStorage(const PayloadContainers& items, const function<bool()>& shouldKeepProcessing)
+task<PayloadContainers> EventStorageQueue::WriteItemsToStorage(const PayloadContainers& items, const function<bool()>& shouldKeepProcessing)
 {
     PayloadContainers processedItems;
+    PayloadContainers writtenItems;
+    vector<LogRecord> records;
+    bool flushToDisk = false;
+    processedItems.reserve(items.size());
+    writtenItems.reserve(items.size());
+    records.reserve(items.size());
 
     for (auto&& item : items)
     {
@@ -149,29 +446,62 @@ PayloadContainers EventStorageQueue::WriteItemsToStorage(const PayloadContainers
             break;
         }
 
-        bool didWrite = true;
-        if (!m_dontWriteToStorageForTestPurposes)
+        processedItems.emplace_back(item);
+
+        auto durability = this->GetDurability(item->Priority);
+        if (m_dontWriteToStorageForTestPurposes || (durability == EventDurability::None))
         {
-            didWrite = this->WriteItemToStorage(item).get();
+            continue;
         }
 
-        processedItems.emplace_back(item);
+        flushToDisk = flushToDisk || (durability == EventDurability::FlushedPerBatch);
 
-        if (!didWrite) {
-            TRACE_OUT(L"Item couldn't be persisted to disk");
-        }
+        auto contents = EncodePayload(item->Payload);
+        item->SizeInBytes = contents.size();
+
+        records.push_back({ item->Id, move(contents) });
+        writtenItems.emplace_back(item);
+    }
+
+    // The whole batch is written to storage together, so the cost of
+    // persisting the items grows with the number of batches, rather than the
+    // number of items. Items are passed on to the next stage even if they
+    // couldn't be written, so they can still be uploaded.
+    TRACE_OUT(L"Writing " + to_wstring(records.size()) + L" Items");
+    if (records.empty())
+    {
+        return processedItems;
+    }
+
+    auto written = co_await create_task([this, &records, flushToDisk]() {
+        return m_log->Append(records, flushToDisk);
+    });
+
+    if (!written)
+    {
+        TRACE_OUT(L"Items couldn't be persisted to disk");
+        return processedItems;
+    }
+
+    for (auto&& item : writtenItems)
+    {
+        item->InStorage = true;
     }
 
+    this->ReleasePayloads(writtenItems);
+
     return processedItems;
 }
 
-void EventStorageQueue::HandleProcessedItems(const PayloadContainers& itemsWrittenToStorage)
+task<void> EventStorageQueue::HandleProcessedItems(const PayloadContainers& itemsWrittenToStorage)
 {
     TRACE_OUT(L"Calling Written To Storage Callback");
     if (m_writtenToStorageCallback != nullptr)
     {
         this->m_writtenToStorageCallback(itemsWrittenToStorage);
     }
+
+    return task_from_result();
 }
 
 task<void> EventStorageQueue::PersistAllQueuedItemsToStorageAndShutdown()
@@ -191,71 +521,245 @@ task<void> EventStorageQueue::Clear()
     co_await this->ClearStorage();
 }
 
-task<bool> EventStorageQueue::WriteItemToStorage(const PayloadContainer_ptr item)
+task<void> EventStorageQueue::ClearStorage()
 {
-    TRACE_OUT(L"Writing File: " + GetFileNameForId(item->Id));
-    IJsonValue^ payload = item->Payload;
+    // This only starts a new, empty, generation of the log, so takes the
+    // same time however many items were stored; their files are removed in
+    // the background.
+    co_await create_task([this]() {
+        m_log->Clear();
+        this->ClearQuarantinedEvents();
+    });
+
+    // Anything left over (e.g. items from earlier versions, that were never
+    // moved into the log) is removed too.
+    auto files = co_await m_localStorage->GetFilesAsync();
+    co_await this->DeleteFiles(vector<StorageFile^>(begin(files), end(files)));
+}
 
-    try {
-        auto file = co_await m_localStorage->CreateFileAsync(GetFileNameForId(item->Id));
-        co_await FileIO::WriteTextAsync(file, payload->Stringify());
+task<void> EventStorageQueue::RemoveEventFromStorage(PayloadContainer& itemToRemove)
+{
+    TRACE_OUT(L"Removing Item: " + to_wstring(itemToRemove.Id));
+    auto id = itemToRemove.Id;
+
+    return create_task([this, id]() {
+        m_log->Acknowledge({ id });
+    });
+}
+
+task<void> EventStorageQueue::RemoveEventsFromStorage(const PayloadContainers& itemsToRemove)
+{
+    TRACE_OUT(L"Removing " + to_wstring(itemsToRemove.size()) + L" Items");
+
+    vector<long long> ids;
+    ids.reserve(itemsToRemove.size());
+    for (auto&& item : itemsToRemove)
+    {
+        ids.push_back(item->Id);
     }
-    catch (Exception^ e) {
-        TRACE_OUT(L"Failed to write file: " + e->Message);
-        return false;
+
+    return create_task([this, ids]() {
+        m_log->Acknowledge(ids);
+    });
+}
+
+RecordStore& EventStorageQueue::GetDeadLetterStore()
+{
+    if (m_deadLetters != nullptr)
+    {
+        return *m_deadLetters;
     }
 
-    return true;
+    // When nothing's being written to the folder, they're only kept for the
+    // lifetime of the queue.
+    if (m_dontWriteToStorageForTestPurposes)
+    {
+        m_deadLetters = make_unique<MemoryRecordStore>();
+    }
+    else
+    {
+        m_deadLetters = make_unique<SegmentedLog>(filesystem::path(m_localStorage->Path->Data()) / DEAD_LETTERS_FOLDER);
+    }
+
+    return *m_deadLetters;
 }
 
-task<void> EventStorageQueue::ClearStorage()
+task<PayloadContainers> EventStorageQueue::QuarantineEvents(const PayloadContainers& items)
 {
-    auto files = co_await m_localStorage->GetFilesAsync();
-    for (auto&& file : files)
+    if (items.empty())
+    {
+        return task_from_result(PayloadContainers());
+    }
+
+    return create_task([this, items]() {
+        return this->MoveEventsToDeadLetterStore(items);
+    });
+}
+
+PayloadContainers EventStorageQueue::MoveEventsToDeadLetterStore(const PayloadContainers& items)
+{
+    TRACE_OUT(L"Quarantining " + to_wstring(items.size()) + L" Items");
+
+    // Items that have released their payloads are copied from storage as
+    // they are, rather than being read & encoded again.
+    vector<LogRecord> records;
+    vector<long long> idsToCopy;
+    for (auto&& item : items)
+    {
+        if (item->Payload != nullptr)
+        {
+            records.push_back({ item->Id, EncodePayload(item->Payload) });
+        }
+        else if (item->InStorage)
+        {
+            idsToCopy.push_back(item->Id);
+        }
+    }
+
+    // Any that can't be read are missing from what's copied, and stay in
+    // storage.
+    if (!idsToCopy.empty())
+    {
+        auto copied = m_log->ReadRecords(idsToCopy);
+        records.insert(end(records), make_move_iterator(begin(copied)), make_move_iterator(end(copied)));
+    }
+
+    // More than the store keeps would be dropped as soon as they were
+    // written, so they're left in storage instead.
+    size_t maximum = m_maximumQuarantinedEvents;
+    if (records.size() > maximum)
+    {
+        records.erase(begin(records), begin(records) + (records.size() - maximum));
+    }
+
+    if (records.empty())
+    {
+        return {};
+    }
+
     {
-        try
+        lock_guard<mutex> lock(m_deadLettersLock);
+        auto& deadLetters = this->GetDeadLetterStore();
+        if (!deadLetters.Append(records))
         {
-            co_await file->DeleteAsync();
+            TRACE_OUT(L"Couldn't write quarantined items");
+            return {};
         }
-        catch (COMException^ e)
+
+        // The oldest are dropped to make room, so a stream of bad events
+        // can't fill up the disk. This never writes more than the maximum,
+        // so only events quarantined earlier are dropped.
+        auto quarantined = deadLetters.GetPendingRecords();
+        if (quarantined.size() > maximum)
         {
-            if (e->HResult != HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+            vector<long long> idsToDrop;
+            for (size_t i = 0; i < quarantined.size() - maximum; i++)
             {
-                throw e;
+                idsToDrop.push_back(quarantined[i].Id);
             }
+
+            deadLetters.Acknowledge(idsToDrop);
         }
     }
-}
 
-task<void> EventStorageQueue::RemoveEventFromStorage(PayloadContainer& itemToRemove)
-{
-    TRACE_OUT(L"Removing File: " + GetFileNameForId(itemToRemove.Id));
-
-    auto fileToDelete = co_await m_localStorage->TryGetItemAsync(GetFileNameForId(itemToRemove.Id));
-    if (fileToDelete == nullptr)
+    unordered_set<long long> quarantinedIds;
+    vector<long long> ids;
+    for (auto&& record : records)
     {
-        return;
+        quarantinedIds.insert(record.Id);
+        ids.push_back(record.Id);
     }
 
-    try
+    m_log->Acknowledge(ids);
+
+    PayloadContainers quarantinedItems;
+    copy_if(begin(items), end(items), back_inserter(quarantinedItems), [&quarantinedIds](const auto& item) {
+        return quarantinedIds.find(item->Id) != quarantinedIds.end();
+    });
+
+    return quarantinedItems;
+}
+
+PayloadContainers EventStorageQueue::GetQuarantinedEvents()
+{
+    vector<LogRecord> records;
     {
-        co_await fileToDelete->DeleteAsync();
+        lock_guard<mutex> lock(m_deadLettersLock);
+        records = this->GetDeadLetterStore().ReadPendingRecords();
     }
-    catch (COMException^ e)
+
+    PayloadContainers quarantined;
+    for (auto&& record : records)
     {
-        if (e->HResult != HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+        auto payload = DecodePayload(record.Payload);
+        if (payload == nullptr)
         {
-            throw e;
+            continue;
         }
+
+        quarantined.push_back(make_shared<PayloadContainer>(record.Id, payload, EventPriority::Normal, record.Payload.size()));
     }
+
+    return quarantined;
+}
+
+size_t EventStorageQueue::GetQuarantinedEventCount()
+{
+    lock_guard<mutex> lock(m_deadLettersLock);
+    return this->GetDeadLetterStore().GetPendingRecordCount();
+}
+
+void EventStorageQueue::ClearQuarantinedEvents()
+{
+    lock_guard<mutex> lock(m_deadLettersLock);
+    this->GetDeadLetterStore().Clear();
+}
+
+void EventStorageQueue::SetMaximumQuarantinedEvents(const size_t maximum)
+{
+    m_maximumQuarantinedEvents = maximum;
 }
 
 void EventStorageQueue::SetWriteToStorageIdleLimits(const std::chrono::milliseconds& idleTimeout, const size_t& idleItemThreshold)
 {
+    m_writeToStorageWorker.DisableAdaptiveDebounce();
     m_writeToStorageWorker.SetIdleTimeout(idleTimeout);
     m_writeToStorageWorker.SetItemThreshold(idleItemThreshold);
 }
 
+void EventStorageQueue::SetStorageIoWindow(const size_t window)
+{
+    if (window < 1)
+    {
+        throw invalid_argument("Storage I/O window must allow at least one operation");
+    }
+
+    m_storageIoWindow = window;
+}
+
+void EventStorageQueue::SetDurability(const EventDurability durability)
+{
+    for (auto&& priorityDurability : m_durability)
+    {
+        priorityDurability = durability;
+    }
+}
+
+void EventStorageQueue::SetDurability(const EventPriority priority, const EventDurability durability)
+{
+    m_durability[static_cast<size_t>(priority)] = durability;
+}
+
+EventDurability EventStorageQueue::GetDurability(const EventPriority priority)
+{
+    return m_durability[static_cast<size_t>(priority)];
+}
+
+void EventStorageQueue::SetWorkerExecutor(shared_ptr<WorkerExecutor> executor)
+{
+    m_writeToStorageWorker.SetExecutor(executor);
+}
+
 void EventStorageQueue::DontWriteToStorageFolder()
 {
     m_dontWriteToStorageForTestPurposes = true;
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include "BackgroundWorker.h"
+#include "RecordStore.h"
 
 namespace Codevoid::Tests::Mixpanel {
     class EventStorageQueueTests;
@@ -9,18 +11,56 @@ namespace Codevoid::Tests::Mixpanel {
 namespace Codevoid::Utilities::Mixpanel {
     Platform::String^ GetFileNameForId(const long long& id);
 
+    /// <summary>
+    /// Number of quarantined events a queue keeps, unless told otherwise
+    /// </summary>
+    constexpr size_t DEFAULT_MAXIMUM_QUARANTINED_EVENTS = 100;
+
     enum class EventPriority
     {
         Normal,
         Low,
+        High,
+    };
+
+    /// <summary>
+    /// The priority of the lane in a BackgroundWorker that items with the
+    /// supplied priority are processed in.
+    /// </summary>
+    Codevoid::Utilities::WorkPriority ToWorkPriority(const EventPriority priority);
+
+    /// <summary>
+    /// How much effort is put into making sure an event survives until it's
+    /// been uploaded. More durable levels cost more to write to storage.
+    /// </summary>
+    enum class EventDurability
+    {
+        /// <summary>
+        /// Only held in memory, and lost if the app exits before they're
+        /// uploaded. Nothing is written to storage.
+        /// </summary>
+        None,
+
+        /// <summary>
+        /// Written to storage, but the OS may hold on to the write for a
+        /// while. Survives the app exiting, but not the device losing power.
+        /// </summary>
+        Buffered,
+
+        /// <summary>
+        /// Written to storage, and each batch is flushed through to the disk
+        /// before it's passed on to be uploaded.
+        /// </summary>
+        FlushedPerBatch,
     };
 
     struct PayloadContainer
     {
         PayloadContainer(const long long id,
             Windows::Data::Json::IJsonValue^ payload,
-            const EventPriority priority) :
-            Id(id), Payload(payload), Priority(priority)
+            const EventPriority priority,
+            const size_t sizeInBytes = 0) :
+            Id(id), Payload(payload), Priority(priority), SizeInBytes(sizeInBytes), UploadSizeInBytes(0), InStorage(false), FailureCount(0)
         {
         }
 
@@ -29,8 +69,43 @@ namespace Codevoid::Utilities::Mixpanel {
         long long Id;
         Windows::Data::Json::IJsonValue^ Payload;
         EventPriority Priority;
+
+        /// <summary>
+        /// Size of the payload as it was written to, or read from, storage.
+        /// Zero until then.
+        /// </summary>
+        size_t SizeInBytes;
+
+        /// <summary>
+        /// Estimated size of the payload once it's encoded to be sent, which
+        /// is larger than it's stored. Estimated as it's queued, or, if it was
+        /// restored from storage, as it's first batched for upload.
+        /// </summary>
+        size_t UploadSizeInBytes;
+
+        /// <summary>
+        /// Whether the payload can be read back from storage, so it doesn't
+        /// need to be held in memory while the item waits to be uploaded.
+        /// </summary>
+        bool InStorage;
+
+        /// <summary>
+        /// Number of times the service has rejected this item when it was
+        /// sent on it's own, so the failure can only have been caused by it.
+        /// Failures that say nothing about the payload (e.g. server errors,
+        /// or throttling) aren't counted.
+        /// </summary>
+        unsigned int FailureCount;
     };
 
+    /// <summary>
+    /// Size an item is counted at against the capacity of a queue it's
+    /// waiting in: the size it was written to storage at or, if it hasn't
+    /// been, the size it's estimated to be sent at. Once its payload has
+    /// been released, it's counted as nothing.
+    /// </summary>
+    size_t GetQueuedSizeInBytes(const PayloadContainer& item);
+
     class EventStorageQueue
     {
         friend class Codevoid::Tests::Mixpanel::EventStorageQueueTests;
@@ -41,6 +116,17 @@ namespace Codevoid::Utilities::Mixpanel {
             std::function<void(const std::vector<std::shared_ptr<PayloadContainer>>&)> writtenToStorageCallback
         );
 
+        /// <summary>
+        /// Creates a queue that keeps items in the supplied store, rather than
+        /// in a log in <paramref name="localStorage" />. The folder is still
+        /// where items stored by earlier versions are looked for.
+        /// </summary>
+        EventStorageQueue(
+            Windows::Storage::StorageFolder^ localStorage,
+            std::unique_ptr<Codevoid::Utilities::RecordStore> store,
+            std::function<void(const std::vector<std::shared_ptr<PayloadContainer>>&)> writtenToStorageCallback
+        );
+
         EventStorageQueue(const EventStorageQueue&) = delete;
         EventStorageQueue(EventStorageQueue&&) = delete;
 
@@ -62,9 +148,41 @@ namespace Codevoid::Utilities::Mixpanel {
         /// <summary>
         /// Loads any persisted items from storage.
         /// Completes when it's finished loading from disk, and returns
-        /// those items to the caller
+        /// those items to the caller.
+        ///
+        /// Only the index of the items in storage is read, so the returned
+        /// items don't have a payload: use LoadPayloadsFromStorage when they
+        /// are needed.
+        ///
+        /// Items stored by earlier versions, in a file per item, are moved
+        /// into the log as they're loaded.
+        /// </summary>
+        concurrency::task<std::vector<std::shared_ptr<PayloadContainer>>> LoadItemsFromStorage();
+
+        /// <summary>
+        /// Reads, and parses, the payloads of any of the supplied items that
+        /// don't have one yet, from storage.
+        ///
+        /// Items whose payloads can't be loaded (e.g. they're corrupt) are
+        /// removed from storage, and returned, so the caller can drop them.
+        /// Items that couldn't be read because of an I/O error are left in
+        /// storage, without a payload, to be loaded on a later attempt.
         /// </summary>
-        static concurrency::task<std::vector<std::shared_ptr<PayloadContainer>>> LoadItemsFromStorage(Windows::Storage::StorageFolder^ folder);
+        concurrency::task<std::vector<std::shared_ptr<PayloadContainer>>> LoadPayloadsFromStorage(const std::vector<std::shared_ptr<PayloadContainer>>& items);
+
+        /// <summary>
+        /// When enabled, items drop their payloads once they've been written
+        /// to storage, and again by ReleasePayloads, so only the items being
+        /// uploaded have their payloads in memory. The rest are read back from
+        /// storage, a batch at a time, by LoadPayloadsFromStorage.
+        /// </summary>
+        void SetReleasePayloadsOnceWritten(const bool release);
+
+        /// <summary>
+        /// If payloads are being released once written, releases the payloads
+        /// of any of the supplied items that are in storage.
+        /// </summary>
+        void ReleasePayloads(const std::vector<std::shared_ptr<PayloadContainer>>& items);
 
         /// <summary>
         /// Clears any items in the queue, and from storage.
@@ -76,6 +194,19 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         std::size_t GetWaitingToWriteToStorageLength();
 
+        /// <summary>
+        /// Sets what happens to events queued while there are already too
+        /// many, or too many bytes of, events waiting to be written to
+        /// storage. Defaults to dropping the oldest.
+        /// </summary>
+        void SetOverflowPolicy(const Codevoid::Utilities::OverflowPolicy policy);
+
+        /// <summary>
+        /// Number of events that were dropped, or not queued, because too
+        /// many were waiting to be written to storage.
+        /// </summary>
+        std::size_t GetDroppedEventCount();
+
         /// <summary>
         /// Start logging any items queue to disk.
         /// </summary>
@@ -87,12 +218,84 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         concurrency::task<void> RemoveEventFromStorage(PayloadContainer& container);
 
+        /// <summary>
+        /// Removes all the supplied events from storage in one go, which is
+        /// much cheaper than removing them one at a time.
+        /// </summary>
+        concurrency::task<void> RemoveEventsFromStorage(const std::vector<std::shared_ptr<PayloadContainer>>& containers);
+
+        /// <summary>
+        /// Moves the supplied items out of storage, and into the queue's
+        /// dead-letter store: events the service has rejected too many times
+        /// to be worth sending again, kept so they can be inspected, rather
+        /// than being lost. Once the store holds more than the maximum number
+        /// of quarantined events, the oldest are dropped.
+        ///
+        /// Only items that are written to the dead-letter store are removed
+        /// from storage, and returned. Any that can't be read, or written,
+        /// or that are beyond the maximum in this one call, are left where
+        /// they are, to be retried.
+        /// </summary>
+        concurrency::task<std::vector<std::shared_ptr<PayloadContainer>>> QuarantineEvents(const std::vector<std::shared_ptr<PayloadContainer>>& items);
+
+        /// <summary>
+        /// Reads the events in the dead-letter store, with their payloads,
+        /// oldest first. Any that can't be read are left out.
+        /// </summary>
+        std::vector<std::shared_ptr<PayloadContainer>> GetQuarantinedEvents();
+
+        std::size_t GetQuarantinedEventCount();
+
+        /// <summary>
+        /// Removes every event from the dead-letter store.
+        /// </summary>
+        void ClearQuarantinedEvents();
+
+        /// <summary>
+        /// Sets how many events the dead-letter store keeps. If it's zero,
+        /// nothing is quarantined, and rejected events stay in the queue.
+        /// Defaults to DEFAULT_MAXIMUM_QUARANTINED_EVENTS.
+        /// </summary>
+        void SetMaximumQuarantinedEvents(const size_t maximum);
+
         /// <summary>
         /// Configures the idle limits for the write to storage behaviour.
-        /// This overrides the defaults, soley for testing purposes.
+        /// This overrides the defaults, soley for testing purposes, and
+        /// stops them being adapted to the rate events are queued.
         /// </summary>
         void SetWriteToStorageIdleLimits(const std::chrono::milliseconds& idleTimeout, const size_t& idleItemThreshold);
 
+        /// <summary>
+        /// Sets how durably events of every priority are written to storage.
+        /// Defaults to EventDurability::Buffered.
+        /// </summary>
+        void SetDurability(const EventDurability durability);
+
+        /// <summary>
+        /// Sets how durably events of the supplied priority are written to
+        /// storage, e.g. so bulk diagnostic events aren't written at all, but
+        /// important ones are flushed to the disk. When a batch contains
+        /// events that need to be flushed, the whole batch is flushed.
+        /// </summary>
+        void SetDurability(const EventPriority priority, const EventDurability durability);
+
+        EventDurability GetDurability(const EventPriority priority);
+
+        /// <summary>
+        /// Sets how many file operations (e.g. reading or deleting the files
+        /// items were stored in by earlier versions) are issued to storage at
+        /// once, rather than waiting for each to complete before starting the
+        /// next. Must be at least one.
+        /// </summary>
+        void SetStorageIoWindow(const size_t window);
+
+        /// <summary>
+        /// Runs the write to storage worker on the supplied executor, rather
+        /// than on a thread of it's own. Must be called before queuing to
+        /// storage is enabled.
+        /// </summary>
+        void SetWorkerExecutor(std::shared_ptr<Codevoid::Utilities::WorkerExecutor> executor);
+
         /// <summary>
         /// Disables the act of writing the payloads to disk to, despite that being the primary
         /// purpose of this class. This is because there are corner cases in obtaining storage folders
@@ -125,8 +328,16 @@ namespace Codevoid::Utilities::Mixpanel {
         std::atomic<QueueState> m_state;
 
         Windows::Storage::StorageFolder^ m_localStorage;
+        std::unique_ptr<Codevoid::Utilities::RecordStore> m_log;
         Codevoid::Utilities::BackgroundWorker<PayloadContainer> m_writeToStorageWorker;
         bool m_dontWriteToStorageForTestPurposes;
+        std::array<std::atomic<EventDurability>, 3> m_durability;
+        std::atomic<bool> m_releasePayloadsOnceWritten;
+        std::atomic<size_t> m_storageIoWindow;
+
+        std::mutex m_deadLettersLock;
+        std::unique_ptr<Codevoid::Utilities::RecordStore> m_deadLetters;
+        std::atomic<size_t> m_maximumQuarantinedEvents;
 
         std::function<void(const std::vector<std::shared_ptr<PayloadContainer>>&)> m_writtenToStorageCallback;
 
@@ -138,9 +349,18 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         long long GetNextId();
 
-        concurrency::task<bool> WriteItemToStorage(const std::shared_ptr<PayloadContainer> item);
-        std::vector<std::shared_ptr<PayloadContainer>> WriteItemsToStorage(const std::vector<std::shared_ptr<PayloadContainer>>& items, const std::function<bool()>& shouldKeepProcessing);
-        void HandleProcessedItems(const std::vector<std::shared_ptr<PayloadContainer>>& itemsToUpload);
+        concurrency::task<std::vector<std::shared_ptr<PayloadContainer>>> WriteItemsToStorage(const std::vector<std::shared_ptr<PayloadContainer>>& items, const std::function<bool()>& shouldKeepProcessing);
+        concurrency::task<void> HandleProcessedItems(const std::vector<std::shared_ptr<PayloadContainer>>& itemsToUpload);
         concurrency::task<void> ClearStorage();
+        concurrency::task<void> MoveLegacyItemsToLog();
+        std::vector<std::shared_ptr<PayloadContainer>> MoveEventsToDeadLetterStore(const std::vector<std::shared_ptr<PayloadContainer>>& items);
+        concurrency::task<void> DeleteFiles(const std::vector<Windows::Storage::StorageFile^>& files);
+
+        /// <summary>
+        /// Opens the dead-letter store the first time it's needed, so queues
+        /// that never quarantine anything don't pay for it. Must be called
+        /// with the dead-letters lock held.
+        /// </summary>
+        Codevoid::Utilities::RecordStore& GetDeadLetterStore();
     };
 }
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include "pch.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include "Crc32.h"
+#include "GzipCompressor.h"
+
+using namespace Codevoid::Utilities;
+using namespace std;
+
+// Deflate refers back at most 32KB, with matches between 3 and 258 bytes
+constexpr size_t WINDOW_SIZE = 32 * 1024;
+constexpr size_t WINDOW_MASK = WINDOW_SIZE - 1;
+constexpr size_t MINIMUM_MATCH = 3;
+constexpr size_t MAXIMUM_MATCH = 258;
+
+constexpr unsigned int HASH_BITS = 15;
+constexpr size_t HASH_SIZE = 1 << HASH_BITS;
+
+// How many earlier positions are compared when looking for a match, and the
+// length of match that's considered good enough to stop looking -- and to
+// not check whether the next position has a longer one.
+constexpr size_t MAXIMUM_CHAIN_LENGTH = 128;
+constexpr size_t GOOD_ENOUGH_MATCH = 64;
+
+constexpr uint32_t END_OF_BLOCK = 256;
+constexpr uint32_t FIXED_HUFFMAN_BLOCK = 1;
+
+// Header for a gzip stream of deflated data, with no name or time, from an
+// unknown OS.
+constexpr array<uint8_t, 10> GZIP_HEADER = { 0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF };
+
+// Lengths & distances are written as a code for a range, followed by extra
+// bits for the position within that range (RFC 1951, 3.2.5)
+constexpr array<uint16_t, 29> LENGTH_BASE = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr array<uint8_t, 29> LENGTH_EXTRA_BITS = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr array<uint16_t, 30> DISTANCE_BASE = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr array<uint8_t, 30> DISTANCE_EXTRA_BITS = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+template<typename T, size_t N>
+static size_t FindRange(const array<T, N>& bases, const size_t value)
+{
+    // Index of the last range starting at, or before, the value
+    return static_cast<size_t>(upper_bound(begin(bases), end(bases), value) - begin(bases)) - 1;
+}
+
+GzipCompressor::GzipCompressor() :
+    m_inputStart(0),
+    m_position(0),
+    m_hashedPosition(0),
+    m_head(HASH_SIZE, 0),
+    m_previous(WINDOW_SIZE, 0),
+    m_bitBuffer(0),
+    m_bitCount(0),
+    m_crc(0),
+    m_inputSize(0),
+    m_finished(false)
+{
+    m_output.append(begin(GZIP_HEADER), end(GZIP_HEADER));
+
+    // Everything is written in a single block, which isn't known to be
+    // the last until the stream is finished; an empty final block is
+    // written after it then.
+    this->WriteBits(0, 1);
+    this->WriteBits(FIXED_HUFFMAN_BLOCK, 2);
+}
+
+void GzipCompressor::Write(const char* data, const size_t length)
+{
+    if (m_finished)
+    {
+        throw logic_error("Cannot write to a finished stream");
+    }
+
+    m_crc = Crc32(data, length, m_crc);
+    m_inputSize += static_cast<uint32_t>(length);
+    m_input.append(data, length);
+
+    this->CompressInput(false);
+}
+
+void GzipCompressor::Write(const string& data)
+{
+    this->Write(data.data(), data.size());
+}
+
+string GzipCompressor::Finish()
+{
+    if (m_finished)
+    {
+        throw logic_error("Stream has already been finished");
+    }
+
+    this->CompressInput(true);
+    this->WriteSymbol(END_OF_BLOCK);
+
+    this->WriteBits(1, 1);
+    this->WriteBits(FIXED_HUFFMAN_BLOCK, 2);
+    this->WriteSymbol(END_OF_BLOCK);
+
+    // Pad out to a whole byte
+    this->WriteBits(0, (8 - (m_bitCount % 8)) % 8);
+
+    for (auto value : { m_crc, m_inputSize })
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            m_output.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+        }
+    }
+
+    m_finished = true;
+    m_input.clear();
+    m_input.shrink_to_fit();
+
+    return move(m_output);
+}
+
+void GzipCompressor::CompressInput(const bool finishing)
+{
+    auto inputEnd = m_inputStart + m_input.size();
+    while (m_position < inputEnd)
+    {
+        // Until the stream is finished, a match found now might have been
+        // longer with input that hasn't been written yet, so wait for it.
+        if (!finishing && ((inputEnd - m_position) < (MAXIMUM_MATCH + 1)))
+        {
+            break;
+        }
+
+        size_t distance = 0;
+        auto length = this->FindMatch(m_position, &distance);
+
+        // If the next position has a longer match, this one is better off as
+        // a literal, so that longer match can be used instead.
+        if ((length >= MINIMUM_MATCH) && (length < GOOD_ENOUGH_MATCH))
+        {
+            size_t nextDistance = 0;
+            this->HashUpTo(m_position + 1);
+            if (this->FindMatch(m_position + 1, &nextDistance) > length)
+            {
+                length = 0;
+            }
+        }
+
+        if (length >= MINIMUM_MATCH)
+        {
+            this->WriteMatch(length, distance);
+            m_position += length;
+        }
+        else
+        {
+            this->WriteLiteral(this->GetInput(m_position));
+            m_position += 1;
+        }
+
+        this->HashUpTo(m_position);
+    }
+
+    // Only the window before the next position can be referred to, so
+    // anything before it is no longer needed.
+    if (m_position - m_inputStart > WINDOW_SIZE * 2)
+    {
+        auto unneeded = m_position - WINDOW_SIZE - m_inputStart;
+        m_input.erase(0, unneeded);
+        m_inputStart += unneeded;
+    }
+}
+
+size_t GzipCompressor::FindMatch(const size_t position, size_t* distance)
+{
+    auto inputEnd = m_inputStart + m_input.size();
+    if (inputEnd - position < MINIMUM_MATCH)
+    {
+        return 0;
+    }
+
+    auto maximumLength = (min)(MAXIMUM_MATCH, inputEnd - position);
+    auto hash = ((GetInput(position) << 10) ^ (GetInput(position + 1) << 5) ^ GetInput(position + 2)) & (HASH_SIZE - 1);
+    auto current = m_input.data() + (position - m_inputStart);
+    size_t bestLength = 0;
+
+    auto candidate = m_head[hash];
+    for (size_t chain = 0; (chain < MAXIMUM_CHAIN_LENGTH) && (candidate != 0); chain++)
+    {
+        auto candidatePosition = candidate - 1;
+        if ((candidatePosition >= position) || (position - candidatePosition > WINDOW_SIZE))
+        {
+            break;
+        }
+
+        auto earlier = m_input.data() + (candidatePosition - m_inputStart);
+        size_t length = 0;
+        while ((length < maximumLength) && (earlier[length] == current[length]))
+        {
+            length++;
+        }
+
+        if (length > bestLength)
+        {
+            bestLength = length;
+            *distance = position - candidatePosition;
+
+            if (length >= maximumLength)
+            {
+                break;
+            }
+        }
+
+        // Positions in each chain only ever get earlier; anything else is
+        // left over from an earlier pass through the window.
+        auto next = m_previous[candidatePosition & WINDOW_MASK];
+        if (next >= candidate)
+        {
+            break;
+        }
+
+        candidate = next;
+    }
+
+    return bestLength;
+}
+
+void GzipCompressor::HashUpTo(const size_t position)
+{
+    auto inputEnd = m_inputStart + m_input.size();
+    for (; (m_hashedPosition < position) && (inputEnd - m_hashedPosition >= MINIMUM_MATCH); m_hashedPosition++)
+    {
+        auto hash = ((GetInput(m_hashedPosition) << 10) ^ (GetInput(m_hashedPosition + 1) << 5) ^ GetInput(m_hashedPosition + 2)) & (HASH_SIZE - 1);
+        m_previous[m_hashedPosition & WINDOW_MASK] = m_head[hash];
+        m_head[hash] = m_hashedPosition + 1;
+    }
+}
+
+uint8_t GzipCompressor::GetInput(const size_t position) const
+{
+    return static_cast<uint8_t>(m_input[position - m_inputStart]);
+}
+
+void GzipCompressor::WriteBits(const uint32_t value, const unsigned int count)
+{
+    m_bitBuffer |= static_cast<uint64_t>(value) << m_bitCount;
+    m_bitCount += count;
+
+    while (m_bitCount >= 8)
+    {
+        m_output.push_back(static_cast<char>(m_bitBuffer & 0xFF));
+        m_bitBuffer >>= 8;
+        m_bitCount -= 8;
+    }
+}
+
+void GzipCompressor::WriteCode(const uint32_t code, const unsigned int length)
+{
+    // Huffman codes are packed starting from their most significant bit,
+    // unlike everything else.
+    uint32_t reversed = 0;
+    for (unsigned int i = 0; i < length; i++)
+    {
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+    }
+
+    this->WriteBits(reversed, length);
+}
+
+void GzipCompressor::WriteSymbol(const uint32_t symbol)
+{
+    // The fixed literal/length codes (RFC 1951, 3.2.6)
+    if (symbol < 144)
+    {
+        this->WriteCode(0x30 + symbol, 8);
+    }
+    else if (symbol < 256)
+    {
+        this->WriteCode(0x190 + (symbol - 144), 9);
+    }
+    else if (symbol < 280)
+    {
+        this->WriteCode(symbol - 256, 7);
+    }
+    else
+    {
+        this->WriteCode(0xC0 + (symbol - 280), 8);
+    }
+}
+
+void GzipCompressor::WriteLiteral(const uint8_t literal)
+{
+    this->WriteSymbol(literal);
+}
+
+void GzipCompressor::WriteMatch(const size_t length, const size_t distance)
+{
+    auto lengthCode = FindRange(LENGTH_BASE, length);
+    this->WriteSymbol(257 + static_cast<uint32_t>(lengthCode));
+    this->WriteBits(static_cast<uint32_t>(length - LENGTH_BASE[lengthCode]), LENGTH_EXTRA_BITS[lengthCode]);
+
+    // Distance codes are all five bits long
+    auto distanceCode = FindRange(DISTANCE_BASE, distance);
+    this->WriteCode(static_cast<uint32_t>(distanceCode), 5);
+    this->WriteBits(static_cast<uint32_t>(distance - DISTANCE_BASE[distanceCode]), DISTANCE_EXTRA_BITS[distanceCode]);
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // Compresses data to the gzip format (RFC 1952) as it's written, so the
+    // input is never held in memory all at once: only the last 32KB -- the
+    // furthest back deflate can refer to -- and enough to find the next
+    // match are kept.
+    //
+    // Repeated data is found with hash chains, and encoded with deflate's
+    // fixed Huffman codes. For the text this is intended for, which repeats
+    // the same names & values many times over, that's most of the benefit of
+    // compressing it, for much less work than building codes for each block.
+    // </summary>
+    class GzipCompressor
+    {
+    public:
+        GzipCompressor();
+
+        void Write(const char* data, const size_t length);
+        void Write(const std::string& data);
+
+        // <summary>
+        // Compresses anything that's still waiting, and completes the
+        // stream. Returns the whole compressed stream; nothing can be written
+        // once it's finished.
+        // </summary>
+        std::string Finish();
+
+    private:
+        void CompressInput(const bool finishing);
+        size_t FindMatch(const size_t position, size_t* distance);
+        void HashUpTo(const size_t position);
+        uint8_t GetInput(const size_t position) const;
+
+        void WriteBits(const uint32_t value, const unsigned int count);
+        void WriteCode(const uint32_t code, const unsigned int length);
+        void WriteSymbol(const uint32_t symbol);
+        void WriteLiteral(const uint8_t literal);
+        void WriteMatch(const size_t length, const size_t distance);
+
+        // Input that's still needed, along with the position in the whole
+        // input of the first byte in it.
+        std::string m_input;
+        size_t m_inputStart;
+
+        // Position of the next byte to be compressed, and of the first byte
+        // that hasn't been added to the hash chains yet.
+        size_t m_position;
+        size_t m_hashedPosition;
+
+        // Most recent position (+1, so 0 is none) with each hash, and for
+        // each position in the window, the one before it with the same hash.
+        std::vector<size_t> m_head;
+        std::vector<size_t> m_previous;
+
+        std::string m_output;
+        uint64_t m_bitBuffer;
+        unsigned int m_bitCount;
+        uint32_t m_crc;
+        uint32_t m_inputSize;
+        bool m_finished;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // Multiple-producer, single-consumer queue that producers can add to
+    // without taking a lock, and that the consumer empties in bulk.
+    //
+    // Producers push nodes onto an intrusive singly-linked list with a single
+    // compare-and-swap on the head. The consumer detaches the whole list with
+    // one exchange, and reverses it to recover the order the items were added.
+    // Because the consumer never removes individual nodes, there's no ABA
+    // hazard on the head pointer.
+    //
+    // All operations are sequentially consistent, so a consumer that
+    // publishes it is about to wait (e.g. via an atomic flag) and then drains
+    // is guaranteed to either see a concurrent push, or have that producer
+    // see the flag.
+    //
+    // Only one thread may call Drain at a time; callers are expected to
+    // serialise that themselves (e.g. by holding the lock that protects the
+    // structure being drained into).
+    // </summary>
+    template <typename ValueType>
+    class LockFreeIngestionQueue
+    {
+    public:
+        LockFreeIngestionQueue() : m_head(nullptr)
+        { }
+
+        LockFreeIngestionQueue(const LockFreeIngestionQueue&) = delete;
+        LockFreeIngestionQueue(LockFreeIngestionQueue&&) = delete;
+
+        ~LockFreeIngestionQueue()
+        {
+            this->Drain([](ValueType&&) {});
+        }
+
+        void Push(ValueType value)
+        {
+            Node* node = new Node{ std::move(value), nullptr };
+            this->PushChain(node, node);
+        }
+
+        // <summary>
+        // Adds all the values atomically, in order, with a single update
+        // of the list head regardless of how many values are supplied.
+        // </summary>
+        void Push(std::vector<ValueType> values)
+        {
+            if (values.empty())
+            {
+                return;
+            }
+
+            // The list is newest-first, so the chain is built from the
+            // last value backwards, leaving the first value at the tail.
+            Node* first = nullptr;
+            Node* last = nullptr;
+            for (auto value = values.rbegin(); value != values.rend(); value++)
+            {
+                Node* node = new Node{ std::move(*value), nullptr };
+                if (first == nullptr)
+                {
+                    first = last = node;
+                    continue;
+                }
+
+                last->Next = node;
+                last = node;
+            }
+
+            this->PushChain(first, last);
+        }
+
+        // <summary>
+        // Removes everything that has been pushed so far, and hands each value
+        // to <paramref name="consume" /> in the order they were pushed.
+        // Returns the number of values consumed.
+        // </summary>
+        template <typename Consumer>
+        size_t Drain(Consumer consume)
+        {
+            Node* detached = m_head.exchange(nullptr);
+            if (detached == nullptr)
+            {
+                return 0;
+            }
+
+            // Reverse to get back to oldest-first
+            Node* oldestFirst = nullptr;
+            while (detached != nullptr)
+            {
+                Node* next = detached->Next;
+                detached->Next = oldestFirst;
+                oldestFirst = detached;
+                detached = next;
+            }
+
+            size_t consumed = 0;
+            while (oldestFirst != nullptr)
+            {
+                Node* next = oldestFirst->Next;
+                consume(std::move(oldestFirst->Value));
+                delete oldestFirst;
+                oldestFirst = next;
+                consumed += 1;
+            }
+
+            return consumed;
+        }
+
+        bool IsEmpty() const
+        {
+            return (m_head.load() == nullptr);
+        }
+
+    private:
+        struct Node
+        {
+            ValueType Value;
+            Node* Next;
+        };
+
+        void PushChain(Node* first, Node* last)
+        {
+            Node* currentHead = m_head.load();
+            do
+            {
+                last->Next = currentHead;
+            } while (!m_head.compare_exchange_weak(currentHead, first));
+        }
+
+        std::atomic<Node*> m_head;
+    };
+}
\ No newline at end of file
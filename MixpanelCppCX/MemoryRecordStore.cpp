@@ -0,0 +1,117 @@
+#include "pch.h"
+#include <algorithm>
+#include "MemoryRecordStore.h"
+
+using namespace Codevoid::Utilities;
+using namespace std;
+
+MemoryRecordStore::MemoryRecordStore() : m_nextSequence(0)
+{
+}
+
+bool MemoryRecordStore::Append(const vector<LogRecord>& records, const bool /*flushToDisk*/)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    for (auto&& record : records)
+    {
+        auto existing = m_sequenceForId.find(record.Id);
+        if (existing != m_sequenceForId.end())
+        {
+            m_records.erase(existing->second);
+        }
+
+        auto sequence = m_nextSequence++;
+        m_records[sequence] = record;
+        m_sequenceForId[record.Id] = sequence;
+    }
+
+    return true;
+}
+
+void MemoryRecordStore::Acknowledge(const vector<long long>& ids)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    for (auto&& id : ids)
+    {
+        auto existing = m_sequenceForId.find(id);
+        if (existing == m_sequenceForId.end())
+        {
+            continue;
+        }
+
+        m_records.erase(existing->second);
+        m_sequenceForId.erase(existing);
+    }
+}
+
+vector<LogRecord> MemoryRecordStore::ReadPendingRecords()
+{
+    lock_guard<mutex> lock(m_lock);
+
+    vector<LogRecord> records;
+    records.reserve(m_records.size());
+    for (auto&& [sequence, record] : m_records)
+    {
+        records.push_back(record);
+    }
+
+    return records;
+}
+
+vector<PendingLogRecord> MemoryRecordStore::GetPendingRecords()
+{
+    lock_guard<mutex> lock(m_lock);
+
+    vector<PendingLogRecord> records;
+    records.reserve(m_records.size());
+    for (auto&& [sequence, record] : m_records)
+    {
+        records.push_back({ record.Id, record.Payload.size() });
+    }
+
+    return records;
+}
+
+vector<LogRecord> MemoryRecordStore::ReadRecords(const vector<long long>& ids, vector<long long>* /*unreadableIds*/)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    vector<unsigned long long> sequences;
+    sequences.reserve(ids.size());
+    for (auto&& id : ids)
+    {
+        auto existing = m_sequenceForId.find(id);
+        if (existing != m_sequenceForId.end())
+        {
+            sequences.push_back(existing->second);
+        }
+    }
+
+    sort(begin(sequences), end(sequences));
+
+    vector<LogRecord> records;
+    records.reserve(sequences.size());
+    for (auto&& sequence : sequences)
+    {
+        records.push_back(m_records[sequence]);
+    }
+
+    return records;
+}
+
+void MemoryRecordStore::Clear()
+{
+    lock_guard<mutex> lock(m_lock);
+
+    m_records.clear();
+    m_sequenceForId.clear();
+}
+
+size_t MemoryRecordStore::GetPendingRecordCount()
+{
+    lock_guard<mutex> lock(m_lock);
+
+    return m_records.size();
+}
\ No newline at end of file
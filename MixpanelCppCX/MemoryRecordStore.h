@@ -0,0 +1,39 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include "RecordStore.h"
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // RecordStore that only holds records in memory, so nothing survives the
+    // store being destroyed. Useful for measuring the cost of everything
+    // other than storage, and for testing without touching the filesystem.
+    // </summary>
+    class MemoryRecordStore : public RecordStore
+    {
+    public:
+        MemoryRecordStore();
+
+        MemoryRecordStore(const MemoryRecordStore&) = delete;
+        MemoryRecordStore(MemoryRecordStore&&) = delete;
+
+        bool Append(const std::vector<LogRecord>& records, const bool flushToDisk = false) override;
+        void Acknowledge(const std::vector<long long>& ids) override;
+        std::vector<LogRecord> ReadPendingRecords() override;
+        std::vector<PendingLogRecord> GetPendingRecords() override;
+        std::vector<LogRecord> ReadRecords(const std::vector<long long>& ids, std::vector<long long>* unreadableIds = nullptr) override;
+        void Clear() override;
+        size_t GetPendingRecordCount() override;
+
+    private:
+        std::mutex m_lock;
+
+        // Records are keyed by the order they were written in, so they can be
+        // listed in that order, with a map from ID to find them by.
+        std::map<unsigned long long, LogRecord> m_records;
+        std::unordered_map<long long, unsigned long long> m_sequenceForId;
+        unsigned long long m_nextSequence;
+    };
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "pch.h"
+#include <deque>
 #include "BackgroundWorker.h"
 #include "EventStorageQueue.h"
+#include "GzipCompressor.h"
 #include "MixpanelClient.h"
 #include "PayloadEncoder.h"
 
@@ -22,6 +24,7 @@ using namespace Windows::Security::Cryptography::Core;
 using namespace Windows::Storage;
 using namespace Windows::Storage::Streams;
 using namespace Windows::Web::Http;
+using namespace Windows::Web::Http::Filters;
 using namespace Windows::Web::Http::Headers;
 
 constexpr auto MIXPANEL_BASE_URL = L"https://api.mixpanel.com/";
@@ -38,8 +41,75 @@ constexpr auto SESSION_TRACKING_EVENT = L"Session";
 constexpr auto DISTINCT_ID_PROPERTY_NAME = L"distinct_id";
 constexpr auto DISTINCT_ID_PROPERTY_NAME_ENGAGE = L"$distinct_id";
 constexpr auto TOKEN_PROPERTY_NAME_ENGAGE = L"$token";
-
-constexpr vector<shared_ptr<PayloadContainer>>::difference_type DEFAULT_UPLOAD_SIZE_STRIDE = 50;
+constexpr auto QUARANTINED_EVENT_TYPE_PROPERTY_NAME = L"type";
+constexpr auto QUARANTINED_EVENT_PAYLOAD_PROPERTY_NAME = L"payload";
+constexpr auto QUARANTINED_TRACK_EVENT_TYPE = L"track";
+constexpr auto QUARANTINED_ENGAGE_EVENT_TYPE = L"engage";
+
+// Most events sent to the service in one request; the service's own limit.
+constexpr size_t DEFAULT_UPLOAD_SIZE_STRIDE = 50;
+
+// Most bytes of events, as they're sent (before any compression), packed into
+// one request. This is well under the service's limit on the size of a
+// request, and keeps batches of large events from exceeding it.
+constexpr size_t DEFAULT_MAXIMUM_UPLOAD_BATCH_BYTES = 256 * 1024;
+
+// Number of items the upload workers hand to HandleBatchUploadWithUri at
+// once. When there is a large backlog (e.g. restored from storage), this
+// keeps each pass over the queue bounded, rather than copying the whole
+// backlog every time the worker wakes up.
+constexpr size_t DEFAULT_UPLOAD_ITEMS_PER_BATCH = DEFAULT_UPLOAD_SIZE_STRIDE * 10;
+
+// Limits on how many events, and how much of their payloads, the upload
+// workers hold in memory. When they're exceeded (e.g. offline for a long
+// time), events are dropped from the queue, by default the oldest. Only
+// payloads held in memory are counted; those paged out to storage aren't.
+// Dropped events that were written to storage are restored from there the
+// next time the app starts; those that weren't (e.g. their durability is
+// EventDurability::None, or storage couldn't be used) are lost.
+constexpr size_t DEFAULT_MAXIMUM_QUEUED_UPLOADS = 10000;
+constexpr size_t DEFAULT_MAXIMUM_QUEUED_UPLOAD_BYTES = 16 * 1024 * 1024;
+
+// Once an upload worker has run out of retries, how often it tries uploading
+// a single event to see if the service is reachable again. Without this, it
+// would stay paused until the network status changes, which never happens
+// when the network is connected, but the service isn't responding.
+constexpr auto DEFAULT_UPLOAD_PROBE_INTERVAL = 1min;
+
+// Threads in the pool shared by clients that have UseSharedWorkerThreads
+// enabled. Workers don't hold a thread while they wait: requests are in
+// flight on the network, and storage calls run on the system thread pool,
+// so even batches flushed to disk don't hold up other clients' workers. The
+// threads are only busy encoding & batching events, so a few is enough.
+constexpr size_t SHARED_WORKER_THREAD_COUNT = 4;
+
+// Batches each upload worker has in flight at once. On a high latency link,
+// waiting for each response before sending the next batch caps throughput
+// at a batch per round trip.
+constexpr size_t DEFAULT_MAXIMUM_UPLOADS_IN_FLIGHT = 2;
+
+// Connections to the service kept open, and reused, by the HTTP client the
+// track & engage workers share; enough for every batch either has in flight.
+constexpr unsigned int DEFAULT_MAXIMUM_UPLOAD_CONNECTIONS = static_cast<unsigned int>(DEFAULT_MAXIMUM_UPLOADS_IN_FLIGHT * 2);
+
+// When uploads are compressed, those smaller than this are sent as they are:
+// there's too little repetition in them to be worth the work, or for the
+// saving to outweigh the gzip header & trailer.
+constexpr size_t DEFAULT_UPLOAD_COMPRESSION_THRESHOLD = 1024;
+
+// Times the service can reject an event, sent on it's own, before it's
+// quarantined. Rejections are only counted in passes where some other batch
+// was accepted, so a service that's rejecting everything (e.g. a revoked
+// token) doesn't quarantine the whole backlog. More than once, so one odd
+// response doesn't cost an event.
+constexpr unsigned int DEFAULT_MAXIMUM_UPLOAD_FAILURES = 3;
+
+// Batches the service can reject in one pass, before it's accepted any,
+// until the rest of the pass is abandoned. Splitting batches the service
+// rejects wholesale costs nearly two requests per event; a few bad events
+// in a batch are isolated, and the first half without one accepted, well
+// within this.
+constexpr size_t MAXIMUM_REJECTIONS_BEFORE_ANY_ACCEPTED = 8;
 
 #pragma region Helper Functions
 // Sourced from:
@@ -128,16 +198,41 @@ JsonArray^ AppendNumberToJsonArray(IVector<T>^ values)
     return target;
 }
 
+shared_ptr<WorkerExecutor> GetSharedWorkerExecutor()
+{
+    // Only kept alive by the clients using it, so once they've all
+    // gone away, so do the threads.
+    static mutex s_sharedExecutorLock;
+    static weak_ptr<WorkerExecutor> s_sharedExecutor;
+
+    lock_guard<mutex> lock(s_sharedExecutorLock);
+    auto executor = s_sharedExecutor.lock();
+    if (executor == nullptr)
+    {
+        executor = make_shared<WorkerExecutor>(SHARED_WORKER_THREAD_COUNT);
+        s_sharedExecutor = executor;
+    }
+
+    return executor;
+}
+
 void AddItemsToQueue(BackgroundWorker<PayloadContainer>& worker, const vector<shared_ptr<PayloadContainer>>& itemsToUpload)
 {
-    // If there are any normal priority items, we'll make the work we queue
-    // as normal too -- but otherwise, no point in waking up the network stack
-    // to process the low priority items.
-    bool anyNormalPriorityItems = any_of(begin(itemsToUpload), end(itemsToUpload), [](auto item) -> bool {
-        return item->Priority == EventPriority::Normal;
-    });
+    // Each priority has its own lane in the worker, so split the items up,
+    // keeping them in order within each priority. Adding the most important
+    // first means they'll wake the worker (if needed), and any low priority
+    // items will just ride along -- no point in waking up the network stack
+    // just to process the low priority items.
+    vector<shared_ptr<PayloadContainer>> itemsForPriority;
+    for (auto priority : { EventPriority::High, EventPriority::Normal, EventPriority::Low })
+    {
+        itemsForPriority.clear();
+        copy_if(begin(itemsToUpload), end(itemsToUpload), back_inserter(itemsForPriority), [priority](auto item) -> bool {
+            return item->Priority == priority;
+        });
 
-    worker.AddWork(itemsToUpload, anyNormalPriorityItems ? WorkPriority::Normal : WorkPriority::Low);
+        worker.AddWork(itemsForPriority, ToWorkPriority(priority));
+    }
 }
 
 EngageOperationType ToEngageOperationType(UserProfileOperation operation)
@@ -169,6 +264,60 @@ EngageOperationType ToEngageOperationType(UserProfileOperation operation)
             throw ref new InvalidArgumentException("Unexpected UserProfileOperation");
     }
 }
+
+EventPriority ToEventPriority(TrackPriority priority)
+{
+    switch (priority)
+    {
+        case TrackPriority::Low:
+            return EventPriority::Low;
+
+        case TrackPriority::High:
+            return EventPriority::High;
+
+        case TrackPriority::Normal:
+            return EventPriority::Normal;
+
+        default:
+            throw ref new InvalidArgumentException("Unexpected TrackPriority");
+    }
+}
+
+EventDurability ToEventDurability(StorageDurability durability)
+{
+    switch (durability)
+    {
+        case StorageDurability::None:
+            return EventDurability::None;
+
+        case StorageDurability::Buffered:
+            return EventDurability::Buffered;
+
+        case StorageDurability::FlushedPerBatch:
+            return EventDurability::FlushedPerBatch;
+
+        default:
+            throw ref new InvalidArgumentException("Unexpected StorageDurability");
+    }
+}
+
+OverflowPolicy ToOverflowPolicy(QueueOverflowPolicy policy)
+{
+    switch (policy)
+    {
+        case QueueOverflowPolicy::DropOldest:
+            return OverflowPolicy::DropOldest;
+
+        case QueueOverflowPolicy::DropLowestPriority:
+            return OverflowPolicy::DropLowestPriority;
+
+        case QueueOverflowPolicy::RejectNew:
+            return OverflowPolicy::RejectNew;
+
+        default:
+            throw ref new InvalidArgumentException("Unexpected QueueOverflowPolicy");
+    }
+}
 #pragma endregion
 
 #pragma region Initialization
@@ -177,20 +326,20 @@ MixpanelClient::MixpanelClient(String^ token) :
     m_trackUploadWorker(
         [this](const auto& items, const auto& shouldContinueProcessing) -> auto {
             // Not using std::bind, because ref classes & it don't play nice
-            return this->HandleBatchUploadWithUri(m_trackEventUri, items, shouldContinueProcessing);
+            return this->HandleBatchUploadWithUri(m_trackEventUri, *m_trackStorageQueue, items, shouldContinueProcessing);
         },
-        [this](const auto& items) -> void {
-            MixpanelClient::HandleCompletedUploadsForQueue(*m_trackStorageQueue, items);
+        [this](const auto& items) -> task<void> {
+            return MixpanelClient::HandleCompletedUploadsForQueue(*m_trackStorageQueue, items);
         },
         wstring(L"UploadTrackToMixpanel")
     ),
     m_profileUploadWorker(
         [this](const auto& items, const auto& shouldContinueProcessing) -> auto {
             // Not using std::bind, because ref classes & it don't play nice
-            return this->HandleBatchUploadWithUri(m_engageUri, items, shouldContinueProcessing);
+            return this->HandleBatchUploadWithUri(m_engageUri, *m_profileStorageQueue, items, shouldContinueProcessing);
         },
-        [this](const auto& items) -> void {
-            MixpanelClient::HandleCompletedUploadsForQueue(*m_profileStorageQueue, items);
+        [this](const auto& items) -> task<void> {
+            return MixpanelClient::HandleCompletedUploadsForQueue(*m_profileStorageQueue, items);
         },
         wstring(L"UploadProfileToMixpanel")
     )
@@ -204,8 +353,36 @@ MixpanelClient::MixpanelClient(String^ token) :
     this->PersistSuperPropertiesToApplicationData = true;
     this->AutomaticallyAttachTimeToEvents = true;
     this->AutomaticallyTrackSessions = true;
+    m_storageDurability.fill(EventDurability::Buffered);
+    m_pageUploadsFromStorage = false;
+    m_compressUploads = false;
+    m_uploadCompressionThreshold = DEFAULT_UPLOAD_COMPRESSION_THRESHOLD;
+    m_maximumUploadsInFlight = DEFAULT_MAXIMUM_UPLOADS_IN_FLIGHT;
+    m_maximumUploadBatchBytes = DEFAULT_MAXIMUM_UPLOAD_BATCH_BYTES;
+    m_maximumUploadFailures = DEFAULT_MAXIMUM_UPLOAD_FAILURES;
+    m_maximumQuarantinedEvents = DEFAULT_MAXIMUM_QUARANTINED_EVENTS;
+    m_overflowPolicy = OverflowPolicy::DropOldest;
+
+    // The client is kept for the lifetime of this instance, so each upload
+    // reuses an open connection -- and it's TLS session -- rather than
+    // paying to set one up for every batch.
+    m_httpFilter = ref new HttpBaseProtocolFilter();
+    m_httpFilter->MaxConnectionsPerServer = DEFAULT_MAXIMUM_UPLOAD_CONNECTIONS;
+    m_httpClient = MixpanelClient::CreateHttpClient(m_httpFilter, m_userAgent);
+
     this->m_trackUploadWorker.EnableBackoffOnRetry();
+    this->m_trackUploadWorker.SetMaximumBatchSize(DEFAULT_UPLOAD_ITEMS_PER_BATCH);
     this->m_profileUploadWorker.EnableBackoffOnRetry();
+    this->m_profileUploadWorker.SetMaximumBatchSize(DEFAULT_UPLOAD_ITEMS_PER_BATCH);
+
+    for (auto worker : { &m_trackUploadWorker, &m_profileUploadWorker })
+    {
+        worker->EnableCircuitBreaker(DEFAULT_UPLOAD_PROBE_INTERVAL);
+
+        worker->SetItemSizeCallback(GetQueuedSizeInBytes);
+    }
+
+    this->ApplyOverflowPolicy();
 }
 
 IAsyncAction^ MixpanelClient::InitializeAsync()
@@ -248,8 +425,8 @@ task<void> MixpanelClient::Initialize()
     }
 
     if (!this->DropEventsForPrivacy && !couldNotCreateUniquePersistenceFolders) {
-        auto previousTrackItemsTask = EventStorageQueue::LoadItemsFromStorage(trackFolder);
-        auto previousProfileItemsTask = EventStorageQueue::LoadItemsFromStorage(profileFolder);
+        auto previousTrackItemsTask = m_trackStorageQueue->LoadItemsFromStorage();
+        auto previousProfileItemsTask = m_profileStorageQueue->LoadItemsFromStorage();
         auto previousTrackItems = co_await previousTrackItemsTask;
         if (previousTrackItems.size() > 0)
         {
@@ -288,9 +465,182 @@ void MixpanelClient::Initialize(StorageFolder^ trackQueueFolder,
         m_profileWrittenToStorageMockCallback(writtenItems);
     });
 
+    this->ApplyStorageSettings();
+
+    if (this->UseSharedWorkerThreads)
+    {
+        auto executor = GetSharedWorkerExecutor();
+        m_trackStorageQueue->SetWorkerExecutor(executor);
+        m_profileStorageQueue->SetWorkerExecutor(executor);
+        m_trackUploadWorker.SetExecutor(executor);
+        m_profileUploadWorker.SetExecutor(executor);
+    }
+
     m_trackEventUri = serviceUri->CombineUri(StringReference(MIXPANEL_TRACK_URI_SUFFIX));
     m_engageUri = serviceUri->CombineUri(StringReference(MIXPANEL_PROFILE_URL_SUFFIX));
-    m_requestHelper = &MixpanelClient::SendRequestToService;
+    m_requestHelper = [this](Uri^ uri, IMap<String^, IJsonValue^>^ payload, HttpClient^ client) {
+        auto compressionThreshold = m_compressUploads ? m_uploadCompressionThreshold : NO_UPLOAD_COMPRESSION;
+        return MixpanelClient::SendRequestToService(uri, payload, client, compressionThreshold);
+    };
+}
+
+void MixpanelClient::SetStorageDurability(StorageDurability durability)
+{
+    m_storageDurability.fill(ToEventDurability(durability));
+    this->ApplyStorageSettings();
+}
+
+void MixpanelClient::SetStorageDurabilityForPriority(TrackPriority priority, StorageDurability durability)
+{
+    m_storageDurability[static_cast<size_t>(ToEventPriority(priority))] = ToEventDurability(durability);
+    this->ApplyStorageSettings();
+}
+
+void MixpanelClient::SetMaximumUploadConnections(unsigned int maximumConnections)
+{
+    if (maximumConnections < 1)
+    {
+        throw ref new InvalidArgumentException(L"Must allow at least one connection");
+    }
+
+    m_httpFilter->MaxConnectionsPerServer = maximumConnections;
+}
+
+void MixpanelClient::SetMaximumUploadsInFlight(unsigned int maximumUploads)
+{
+    if (maximumUploads < 1)
+    {
+        throw ref new InvalidArgumentException(L"Must allow at least one upload in flight");
+    }
+
+    m_maximumUploadsInFlight = maximumUploads;
+}
+
+void MixpanelClient::SetMaximumUploadBatchSize(unsigned int maximumSizeInBytes)
+{
+    if (maximumSizeInBytes < 1)
+    {
+        throw ref new InvalidArgumentException(L"Must allow at least one byte in a batch");
+    }
+
+    m_maximumUploadBatchBytes = maximumSizeInBytes;
+}
+
+void MixpanelClient::SetCompressUploads(bool enabled)
+{
+    m_compressUploads = enabled;
+}
+
+void MixpanelClient::SetUploadCompressionThreshold(unsigned int minimumSizeInBytes)
+{
+    m_uploadCompressionThreshold = minimumSizeInBytes;
+}
+
+void MixpanelClient::SetMaximumUploadFailures(unsigned int maximumFailures)
+{
+    if (maximumFailures < 1)
+    {
+        throw ref new InvalidArgumentException(L"Must allow at least one failure");
+    }
+
+    m_maximumUploadFailures = maximumFailures;
+}
+
+void MixpanelClient::SetMaximumQuarantinedEvents(unsigned int maximumEvents)
+{
+    m_maximumQuarantinedEvents = maximumEvents;
+    this->ApplyStorageSettings();
+}
+
+unsigned int MixpanelClient::GetQuarantinedEventCount()
+{
+    this->ThrowIfNotInitialized();
+    return static_cast<unsigned int>(m_trackStorageQueue->GetQuarantinedEventCount() + m_profileStorageQueue->GetQuarantinedEventCount());
+}
+
+JsonArray^ MixpanelClient::ExportQuarantinedEvents()
+{
+    this->ThrowIfNotInitialized();
+
+    auto exported = ref new JsonArray();
+    auto exportFrom = [&exported](EventStorageQueue& queue, const wchar_t* type) {
+        for (auto&& item : queue.GetQuarantinedEvents())
+        {
+            auto quarantined = ref new JsonObject();
+            quarantined->Insert(StringReference(QUARANTINED_EVENT_TYPE_PROPERTY_NAME), JsonValue::CreateStringValue(StringReference(type)));
+            quarantined->Insert(StringReference(QUARANTINED_EVENT_PAYLOAD_PROPERTY_NAME), item->Payload);
+            exported->Append(quarantined);
+        }
+    };
+
+    exportFrom(*m_trackStorageQueue, QUARANTINED_TRACK_EVENT_TYPE);
+    exportFrom(*m_profileStorageQueue, QUARANTINED_ENGAGE_EVENT_TYPE);
+
+    return exported;
+}
+
+void MixpanelClient::ClearQuarantinedEvents()
+{
+    this->ThrowIfNotInitialized();
+    m_trackStorageQueue->ClearQuarantinedEvents();
+    m_profileStorageQueue->ClearQuarantinedEvents();
+}
+
+void MixpanelClient::SetPageUploadsFromStorage(bool enabled)
+{
+    m_pageUploadsFromStorage = enabled;
+    this->ApplyStorageSettings();
+}
+
+void MixpanelClient::ApplyStorageSettings()
+{
+    for (auto&& queue : { m_trackStorageQueue.get(), m_profileStorageQueue.get() })
+    {
+        if (queue == nullptr)
+        {
+            continue;
+        }
+
+        for (auto priority : { EventPriority::High, EventPriority::Normal, EventPriority::Low })
+        {
+            queue->SetDurability(priority, m_storageDurability[static_cast<size_t>(priority)]);
+        }
+
+        queue->SetReleasePayloadsOnceWritten(m_pageUploadsFromStorage);
+        queue->SetMaximumQuarantinedEvents(m_maximumQuarantinedEvents);
+        queue->SetOverflowPolicy(m_overflowPolicy);
+    }
+}
+
+void MixpanelClient::SetQueueOverflowPolicy(QueueOverflowPolicy policy)
+{
+    m_overflowPolicy = ToOverflowPolicy(policy);
+    this->ApplyOverflowPolicy();
+    this->ApplyStorageSettings();
+}
+
+void MixpanelClient::ApplyOverflowPolicy()
+{
+    for (auto worker : { &m_trackUploadWorker, &m_profileUploadWorker })
+    {
+        worker->SetCapacity(DEFAULT_MAXIMUM_QUEUED_UPLOADS, DEFAULT_MAXIMUM_QUEUED_UPLOAD_BYTES, m_overflowPolicy);
+    }
+}
+
+unsigned int MixpanelClient::GetDroppedEventCount()
+{
+    this->ThrowIfNotInitialized();
+
+    size_t dropped = m_trackStorageQueue->GetDroppedEventCount() + m_profileStorageQueue->GetDroppedEventCount();
+    for (auto worker : { &m_trackUploadWorker, &m_profileUploadWorker })
+    {
+        for (auto policy : { OverflowPolicy::DropOldest, OverflowPolicy::DropLowestPriority, OverflowPolicy::RejectNew })
+        {
+            dropped += worker->GetOverflowCount(policy);
+        }
+    }
+
+    return static_cast<unsigned int>(dropped);
 }
 
 void MixpanelClient::StartWorkers()
@@ -447,6 +797,11 @@ IAsyncAction^ MixpanelClient::ClearStorageAsync()
 
 #pragma region Public Operations
 void MixpanelClient::Track(String^ name, IPropertySet^ properties)
+{
+    this->TrackWithPriority(name, properties, TrackPriority::Normal);
+}
+
+void MixpanelClient::TrackWithPriority(String^ name, IPropertySet^ properties, TrackPriority priority)
 {
     this->ThrowIfNotInitialized();
 
@@ -464,7 +819,7 @@ void MixpanelClient::Track(String^ name, IPropertySet^ properties)
     this->AddDurationForTrack(name, properties);
 
     IJsonValue^ payload = MixpanelClient::GenerateTrackJsonPayload(name, properties);
-    m_trackStorageQueue->QueueEventToStorage(payload);
+    m_trackStorageQueue->QueueEventToStorage(payload, ToEventPriority(priority));
 }
 
 void MixpanelClient::UpdateProfile(UserProfileOperation operation, IPropertySet^ properties)
@@ -523,74 +878,216 @@ void MixpanelClient::StartTimedEvent(String^ name)
 #pragma endregion
 
 #pragma region Queue management
-void MixpanelClient::HandleCompletedUploadsForQueue(EventStorageQueue& queue, const vector<shared_ptr<PayloadContainer>>& items)
+task<void> MixpanelClient::HandleCompletedUploadsForQueue(EventStorageQueue& queue, const vector<shared_ptr<PayloadContainer>>& items)
 {
-    for (auto&& item : items)
-    {
-        queue.RemoveEventFromStorage(*item).get();
-    }
+    co_await queue.RemoveEventsFromStorage(items);
 }
 
-vector<shared_ptr<PayloadContainer>> MixpanelClient::HandleBatchUploadWithUri(Uri^ destination, const vector<shared_ptr<PayloadContainer>>& items, const function<bool()>& /*shouldKeepProcessing*/)
+task<vector<shared_ptr<PayloadContainer>>> MixpanelClient::HandleBatchUploadWithUri(Uri^ destination, EventStorageQueue& queue, const vector<shared_ptr<PayloadContainer>>& items, const function<bool()>& /*shouldKeepProcessing*/)
 {
-    vector<shared_ptr<PayloadContainer>>::difference_type strideSize = DEFAULT_UPLOAD_SIZE_STRIDE;
-    vector<shared_ptr<PayloadContainer>> successfulItems;
-    auto front = begin(items);
-    auto back = end(items);
+    // Items restored from storage don't have their payloads loaded until
+    // they're about to be uploaded. Any that can't be loaded will never
+    // upload, so they're treated as done with, and leave the queue.
+    vector<shared_ptr<PayloadContainer>> successfulItems = co_await queue.LoadPayloadsFromStorage(items);
+    vector<shared_ptr<PayloadContainer>> itemsToUpload;
+    itemsToUpload.reserve(items.size());
+    copy_if(begin(items), end(items), back_inserter(itemsToUpload), [](const auto& item) { return item->Payload != nullptr; });
 
-    TRACE_OUT(L"MixpanelClient: Beginning upload of " + to_wstring(items.size()) + L" items");
-    while (front != back)
+    // Up to the window's worth of batches are in flight at once, and their
+    // responses are handled in the order they were sent. If a batch fails at
+    // the service, it's split in half, and each half retried, until the
+    // items causing the failure are on their own. A single bad item in a
+    // batch is found in a handful of requests, and everything else is still
+    // sent in full batches. Only the service rejecting the payload causes a
+    // split; any other failure stops anything more being sent.
+    struct InFlightBatch
     {
-        auto first = front;
+        size_t First;
+        size_t Count;
+        task<SendToServiceResult> Result;
+    };
+
+    size_t window = m_maximumUploadsInFlight;
+    size_t maximumBatchBytes = m_maximumUploadBatchBytes;
+    unsigned int maximumFailures = m_maximumUploadFailures;
+    size_t nextItem = 0;
+    bool keepSending = true;
+    bool anyBatchAccepted = false;
+    size_t rejectedBatchCount = 0;
+    deque<InFlightBatch> inFlight;
+    deque<pair<size_t, size_t>> batchesToRetry;
+    vector<shared_ptr<PayloadContainer>> rejectedItems;
+    vector<shared_ptr<PayloadContainer>> quarantinedItems;
+
+    TRACE_OUT(L"MixpanelClient: Beginning upload of " + to_wstring(itemsToUpload.size()) + L" items");
+    while (true)
+    {
+        while (keepSending && (inFlight.size() < window))
+        {
+            // Halves of failed batches go first, before any items that
+            // haven't been sent at all.
+            size_t first = 0;
+            size_t count = 0;
+            if (!batchesToRetry.empty())
+            {
+                first = batchesToRetry.front().first;
+                count = batchesToRetry.front().second;
+                batchesToRetry.pop_front();
+            }
+            else if (nextItem < itemsToUpload.size())
+            {
+                // Items are packed in until the batch reaches either the
+                // count, or the size, limit. Each item's size is estimated
+                // as it'll be sent -- JSON, base64 & form encoded -- which is
+                // much larger than it's stored, and kept for later passes. A
+                // batch always has at least one item, however large.
+                first = nextItem;
+                size_t batchBytes = 0;
+                while ((nextItem < itemsToUpload.size()) && (count < DEFAULT_UPLOAD_SIZE_STRIDE))
+                {
+                    auto& item = itemsToUpload[nextItem];
+                    if (item->UploadSizeInBytes == 0)
+                    {
+                        item->UploadSizeInBytes = EstimateUploadSize(item->Payload);
+                    }
+
+                    auto itemBytes = item->UploadSizeInBytes;
+                    if ((count > 0) && ((batchBytes + itemBytes) > maximumBatchBytes))
+                    {
+                        break;
+                    }
+
+                    batchBytes += itemBytes;
+                    count++;
+                    nextItem++;
+                }
+            }
+            else
+            {
+                break;
+            }
+
+            TRACE_OUT(L"MixpanelClient: Copying JsonValues to payload");
+            vector<IJsonValue^> eventPayload;
+            eventPayload.reserve(count);
+            for (auto i = first; i < first + count; i++)
+            {
+                eventPayload.push_back(itemsToUpload[i]->Payload);
+            }
+
+            TRACE_OUT(L"MixpanelClient: Sending " + to_wstring(eventPayload.size()) + L" events to service");
+            inFlight.push_back({ first, count, this->PostPayloadToUri(destination, eventPayload) });
+        }
+
+        if (inFlight.empty())
+        {
+            break;
+        }
 
-        // Find the last item -- capping at the end of the collection if the stride
-        // size would put it past the end of the collection.
-        auto totalSize = distance(front, back);
-        auto last = (totalSize >= strideSize) ? (front + (strideSize - 1)) : prev(back);
-        vector<IJsonValue^> eventPayload;
-        eventPayload.reserve(distance(front, last)); // Pre-allocate the size.
+        auto batch = move(inFlight.front());
+        inFlight.pop_front();
 
-        TRACE_OUT(L"MixpanelClient: Copying JsonValues to payload");
-        while(first <= last)
+        auto result = co_await batch.Result;
+        if (result == SendToServiceResult::SuccessfullySent)
         {
-            eventPayload.push_back((*first)->Payload);
-            first++;
+            // These items were successfully processed, so we can now
+            // put these in the list to be removed from our queue
+            auto batchStart = begin(itemsToUpload) + batch.First;
+            successfulItems.insert(end(successfulItems), batchStart, batchStart + batch.Count);
+            anyBatchAccepted = true;
+            continue;
         }
 
-        TRACE_OUT(L"MixpanelClient: Sending " + to_wstring(eventPayload.size()) + L" events to service");
-        auto result = this->PostPayloadToUri(destination, eventPayload).get();
-        if (result != SendToServiceResult::SuccessfullySent)
+        TRACE_OUT(L"MixpanelClient: Upload failed");
+        if (result == SendToServiceResult::FailedConnectivity)
         {
-            TRACE_OUT(L"MixpanelClient: Upload failed");
-            if (result == SendToServiceResult::FailedConnectivity) {
+            // Nothing more is sent, but the batches that are already in
+            // flight are still waited for; any of them might have made it.
+            if (keepSending)
+            {
                 this->BeginListeningForNetworkReconnectionToResumeQueueProcessingAfterErrors();
                 TRACE_OUT(L"MixpanelClient: Upload failed due to connectivity reasons. Ending batch.");
-                break;
+                keepSending = false;
+            }
+
+            continue;
+        }
+
+        if (result == SendToServiceResult::FailedServiceUnavailable)
+        {
+            // Splitting the batch won't help when it's the service that's
+            // failing, and sending more will only add to it's load. As with
+            // connectivity, the in flight batches are waited for, and
+            // everything else is left for the worker to retry later.
+            if (keepSending)
+            {
+                TRACE_OUT(L"MixpanelClient: Service unavailable. Ending batch.");
+                keepSending = false;
             }
 
-            if (strideSize != 1)
+            continue;
+        }
+
+        // If nothing's been accepted, the service may be rejecting every
+        // request, whatever's in it. Rather than splitting everything down
+        // to single events to find out, the rest of the pass is left for the
+        // worker to retry later.
+        rejectedBatchCount++;
+        if (!anyBatchAccepted && (rejectedBatchCount >= MAXIMUM_REJECTIONS_BEFORE_ANY_ACCEPTED))
+        {
+            if (keepSending)
             {
-                TRACE_OUT(L"MixpanelClient: Switching to single-event upload");
-                strideSize = 1;
-
-                // Just go around the loop again to reprocess the items
-                // in the smaller stride size -- because we're using our
-                // local iterator, and not updating the while iterator
-                // we can just jump back to the top of the loop again
-                continue;
+                TRACE_OUT(L"MixpanelClient: Service rejected every batch. Ending batch.");
+                keepSending = false;
+                batchesToRetry.clear();
             }
+
+            continue;
         }
-        else
+
+        // A single item that fails is left to be retried on a later pass,
+        // until the service has rejected it too many times to be worth
+        // sending again.
+        if (batch.Count == 1)
         {
-            // These items were successfully processed, so we can now
-            // put these in the list to be removed from our queue
-            successfulItems.insert(end(successfulItems), front, next(last));
+            rejectedItems.push_back(itemsToUpload[batch.First]);
+            continue;
+        }
+
+        TRACE_OUT(L"MixpanelClient: Splitting failed batch of " + to_wstring(batch.Count) + L" events");
+        auto half = batch.Count / 2;
+        batchesToRetry.emplace_back(batch.First, half);
+        batchesToRetry.emplace_back(batch.First + half, batch.Count - half);
+    }
+
+    // The rejections are only held against the items if the service accepted
+    // something else, so it's the items, not the service, at fault.
+    if (anyBatchAccepted)
+    {
+        for (auto&& item : rejectedItems)
+        {
+            item->FailureCount++;
+            if (item->FailureCount >= maximumFailures)
+            {
+                quarantinedItems.push_back(item);
+            }
         }
+    }
 
-        // Move to the beginning of the next item.
-        front = first;
+    // Quarantined items are done with as far as the upload queue is
+    // concerned, so they leave it along with the successful ones. Any that
+    // couldn't be quarantined stay, and are retried.
+    if (!quarantinedItems.empty())
+    {
+        TRACE_OUT(L"MixpanelClient: Quarantining " + to_wstring(quarantinedItems.size()) + L" items");
+        auto quarantined = co_await queue.QuarantineEvents(quarantinedItems);
+        successfulItems.insert(end(successfulItems), begin(quarantined), end(quarantined));
     }
 
+    // Anything that's going to be retried can be read back from storage
+    // then, rather than holding on to it's payload until it is.
+    queue.ReleasePayloads(itemsToUpload);
+
     TRACE_OUT(L"MixpanelClient: Batch complete. " + to_wstring(successfulItems.size()) + L" items were successfully uploaded");
     return successfulItems;
 }
@@ -643,14 +1140,51 @@ task<SendToServiceResult> MixpanelClient::PostPayloadToUri(Uri^ destination, con
     auto formPayload = ref new Map<String^, IJsonValue^>();
     formPayload->Insert(L"data", jsonEvents);
 
-    return co_await m_requestHelper(destination, formPayload, m_userAgent);
+    return co_await m_requestHelper(destination, formPayload, m_httpClient);
 }
 
-task<SendToServiceResult> MixpanelClient::SendRequestToService(Uri^ uri, IMap<String^, IJsonValue^>^ payload, HttpProductInfoHeaderValue^ userAgent)
+HttpClient^ MixpanelClient::CreateHttpClient(HttpBaseProtocolFilter^ filter, HttpProductInfoHeaderValue^ userAgent)
 {
-    HttpClient^ client = ref new HttpClient();
+    // Uploads happen in the background; there's no one to show UI to, and
+    // the responses are never the same twice.
+    filter->AllowUI = false;
+    filter->CacheControl->ReadBehavior = HttpCacheReadBehavior::NoCache;
+    filter->CacheControl->WriteBehavior = HttpCacheWriteBehavior::NoCache;
+
+    auto client = ref new HttpClient(filter);
     client->DefaultRequestHeaders->UserAgent->Append(userAgent);
+    client->DefaultRequestHeaders->Connection->Append(ref new HttpConnectionOptionHeaderValue(L"Keep-Alive"));
+
+    return client;
+}
+
+static task<IHttpContent^> CompressContentIfLargerThan(IHttpContent^ content, const size_t compressionThreshold)
+{
+    auto uncompressed = co_await content->ReadAsBufferAsync();
+    if ((uncompressed->Length == 0) || (uncompressed->Length < compressionThreshold))
+    {
+        return content;
+    }
+
+    Array<unsigned char>^ uncompressedBytes;
+    CryptographicBuffer::CopyToByteArray(uncompressed, &uncompressedBytes);
+
+    GzipCompressor compressor;
+    compressor.Write(reinterpret_cast<const char*>(uncompressedBytes->Data), uncompressedBytes->Length);
+    auto compressedBytes = compressor.Finish();
 
+    // The body is the same form encoded data, just compressed, so it keeps
+    // it's content type.
+    auto compressed = ref new HttpBufferContent(CryptographicBuffer::CreateFromByteArray(
+        ArrayReference<unsigned char>(reinterpret_cast<unsigned char*>(&compressedBytes[0]), static_cast<unsigned int>(compressedBytes.size()))));
+    compressed->Headers->ContentType = content->Headers->ContentType;
+    compressed->Headers->ContentEncoding->Append(ref new HttpContentCodingHeaderValue(L"gzip"));
+
+    return compressed;
+}
+
+task<SendToServiceResult> MixpanelClient::SendRequestToService(Uri^ uri, IMap<String^, IJsonValue^>^ payload, HttpClient^ client, const size_t compressionThreshold)
+{
     Map<String^, String^>^ encodedPayload = ref new Map<String^, String^>();
 
     for (auto&& pair : payload)
@@ -660,14 +1194,25 @@ task<SendToServiceResult> MixpanelClient::SendRequestToService(Uri^ uri, IMap<St
 
     try
     {
-        auto content = ref new HttpFormUrlEncodedContent(encodedPayload);
+        IHttpContent^ content = ref new HttpFormUrlEncodedContent(encodedPayload);
+        if (compressionThreshold != NO_UPLOAD_COMPRESSION)
+        {
+            content = co_await CompressContentIfLargerThan(content, compressionThreshold);
+        }
+
         auto requestResult = co_await client->PostAsync(uri, content);
-        auto requestBody = co_await requestResult->Content->ReadAsStringAsync();
-        if (requestBody == L"0")
+
+        // Server errors, timeouts, throttling & being refused access say
+        // nothing about the payload; the same request may well succeed
+        // later (e.g. once the token's been sorted out).
+        auto statusCode = requestResult->StatusCode;
+        if ((statusCode >= HttpStatusCode::InternalServerError)
+            || (statusCode == HttpStatusCode::RequestTimeout)
+            || (statusCode == HttpStatusCode::TooManyRequests)
+            || (statusCode == HttpStatusCode::Unauthorized)
+            || (statusCode == HttpStatusCode::Forbidden))
         {
-            // Mixpanel returns 0 in the body if it failed due to an error
-            // in the payload itself.
-            return SendToServiceResult::FailedAtService;
+            return SendToServiceResult::FailedServiceUnavailable;
         }
 
         // IsSuccessStatusCode defines success as 200-299 inclusive
@@ -676,6 +1221,14 @@ task<SendToServiceResult> MixpanelClient::SendRequestToService(Uri^ uri, IMap<St
             return SendToServiceResult::FailedAtService;
         }
 
+        auto requestBody = co_await requestResult->Content->ReadAsStringAsync();
+        if (requestBody == L"0")
+        {
+            // Mixpanel returns 0 in the body if it failed due to an error
+            // in the payload itself.
+            return SendToServiceResult::FailedAtService;
+        }
+
         return SendToServiceResult::SuccessfullySent;
     }
     catch (...)
@@ -1187,7 +1740,7 @@ void MixpanelClient::AppendNumericPropertySetToJsonPayload(IPropertySet^ propert
 #pragma endregion
 
 #pragma region Test Helpers
-void MixpanelClient::SetUploadToServiceMock(const function<task<SendToServiceResult>(Uri^, IMap<String^, IJsonValue^>^, HttpProductInfoHeaderValue^)> mock)
+void MixpanelClient::SetUploadToServiceMock(const function<task<SendToServiceResult>(Uri^, IMap<String^, IJsonValue^>^, HttpClient^)> mock)
 {
     m_requestHelper = mock;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <limits>
 #include "DurationTracker.h"
 #include "EventStorageQueue.h"
 
@@ -23,10 +24,27 @@ namespace Codevoid::Utilities::Mixpanel {
     enum SendToServiceResult
     {
         SuccessfullySent,
+
+        /// <summary>
+        /// The service rejected the payload itself, so sending the same
+        /// events again won't succeed either.
+        /// </summary>
         FailedAtService,
+
+        /// <summary>
+        /// The service couldn't handle the request right now (e.g. it's
+        /// overloaded, asked us to slow down, or refused us access); the
+        /// payload may be fine.
+        /// </summary>
+        FailedServiceUnavailable,
         FailedConnectivity,
     };
 
+    /// <summary>
+    /// Compression threshold for requests that are never compressed
+    /// </summary>
+    constexpr size_t NO_UPLOAD_COMPRESSION = (std::numeric_limits<size_t>::max)();
+
     /// <summary>
     /// Represents the different type of updates that can be performed on
     /// profile that has been created on the service. See
@@ -79,6 +97,81 @@ namespace Codevoid::Utilities::Mixpanel {
         Unset
     };
 
+    /// <summary>
+    /// How urgently a tracked event needs to be sent to the service. Higher
+    /// priority events are sent ahead of lower priority ones, even if the
+    /// lower priority events were tracked first.
+    /// </summary>
+    public enum class TrackPriority {
+        /// <summary>
+        /// Sent along with other events, but won't cause events to be sent
+        /// on its own.
+        /// </summary>
+        Low,
+
+        /// <summary>
+        /// Sent once the app has been idle for a short period, or enough
+        /// events have been tracked.
+        /// </summary>
+        Normal,
+
+        /// <summary>
+        /// Sent as soon as possible, ahead of any other waiting events.
+        /// Intended for important events, such as purchases or crashes.
+        /// </summary>
+        High
+    };
+
+    /// <summary>
+    /// How much effort is put into making sure events waiting to be sent to
+    /// the service survive until they're sent. More durable levels cost more
+    /// to write to storage.
+    /// </summary>
+    public enum class StorageDurability {
+        /// <summary>
+        /// Only held in memory; events are lost if the app exits before
+        /// they've been sent. Intended for bulk, diagnostic, events.
+        /// </summary>
+        None,
+
+        /// <summary>
+        /// Written to storage, but the OS may hold on to the writes for a
+        /// while. Survives the app exiting, but not the device losing power.
+        /// </summary>
+        Buffered,
+
+        /// <summary>
+        /// Written to storage, and flushed through to the disk before
+        /// being sent. Intended for events that can't be lost, such as
+        /// purchases.
+        /// </summary>
+        FlushedPerBatch
+    };
+
+    /// <summary>
+    /// What happens to events that are tracked while there are already too
+    /// many, or too large a size of, events waiting to be written to storage
+    /// or sent to the service (e.g. when offline for a long time).
+    /// </summary>
+    public enum class QueueOverflowPolicy {
+        /// <summary>
+        /// Queues the new event, and drops the events that have been waiting
+        /// the longest, whatever their priority.
+        /// </summary>
+        DropOldest,
+
+        /// <summary>
+        /// Queues the new event, and drops the oldest of the lowest priority
+        /// events waiting. This may be the new event, if it's low priority.
+        /// </summary>
+        DropLowestPriority,
+
+        /// <summary>
+        /// Doesn't queue the new event.
+        /// </summary>
+        RejectNew
+    };
+
     /// <summary>
     /// MixpanelClient offers a API for interacting with Mixpanel for UWP apps running on Windows 10+
     /// </summary>
@@ -113,6 +206,21 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         void Track(Platform::String^ name, Windows::Foundation::Collections::IPropertySet^ properties);
 
+        /// <summary>
+        /// Logs a datapoint to the Mixpanel Service, as with Track, but with the
+        /// supplied priority. Higher priority events are uploaded ahead of any
+        /// lower priority events that are waiting to be uploaded.
+        ///
+        /// Note, the priority isn't persisted; events restored from storage
+        /// after the app restarts are sent with normal priority.
+        /// <param name="name">The event name for the tracking call</param>
+        /// <param name="properties">
+        /// A value type only list of parameters to attach to this event.
+        /// </param>
+        /// <param name="priority">How urgently this event should be sent</param>
+        /// </summary>
+        void TrackWithPriority(Platform::String^ name, Windows::Foundation::Collections::IPropertySet^ properties, TrackPriority priority);
+
         /// <summary>
         /// Begins tracking the duration of the named event. When an event is tracked
         /// with the same name by calling Track, a "duration" property will be added
@@ -332,6 +440,133 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         property bool DropEventsForPrivacy;
 
+        /// <summary>
+        /// When enabled before the client is initialized, background work (writing
+        /// to storage, uploading) is performed on a small pool of threads shared with
+        /// every other client in the process that has also enabled this, rather than
+        /// on threads of it's own. Useful when there are many clients (e.g. one per
+        /// token) in a single process.
+        /// </summary>
+        property bool UseSharedWorkerThreads;
+
+        /// <summary>
+        /// Sets how durably events of every priority are written to storage
+        /// while they wait to be sent. Defaults to StorageDurability::Buffered.
+        /// </summary>
+        void SetStorageDurability(StorageDurability durability);
+
+        /// <summary>
+        /// Sets how durably tracked events of the supplied priority are written
+        /// to storage while they wait to be sent. Profile updates use the
+        /// durability for TrackPriority::Normal.
+        /// </summary>
+        void SetStorageDurabilityForPriority(TrackPriority priority, StorageDurability durability);
+
+        /// <summary>
+        /// When enabled, events that have been written to storage don't keep
+        /// their payloads in memory while they wait to be sent. Instead, they
+        /// are read back from storage a batch at a time as they're uploaded,
+        /// so memory use is bounded by the batch size, not by how many events
+        /// are waiting. Off by default, since it costs a read from storage for
+        /// each batch.
+        /// </summary>
+        void SetPageUploadsFromStorage(bool enabled);
+
+        /// <summary>
+        /// Sets how many connections to the service are kept open for uploads.
+        /// Track &amp; profile uploads share them. Defaults to 4.
+        /// </summary>
+        void SetMaximumUploadConnections(unsigned int maximumConnections);
+
+        /// <summary>
+        /// Sets how many batches of track, and of profile, updates are sent
+        /// to the service at once, without waiting for the earlier ones to
+        /// complete. Responses are still handled in the order the batches
+        /// were sent. Defaults to 2.
+        /// </summary>
+        void SetMaximumUploadsInFlight(unsigned int maximumUploads);
+
+        /// <summary>
+        /// Sets the most bytes of events, as they're sent (JSON, base64 & form
+        /// encoded, before any compression), in one request to the service.
+        /// Batches are filled until they reach this, or 50 events, whichever
+        /// comes first, so large events don't make requests the service
+        /// refuses, and small ones are sent in as few requests as possible.
+        /// An event larger than this is sent on it's own. Defaults to 256KB.
+        /// </summary>
+        void SetMaximumUploadBatchSize(unsigned int maximumSizeInBytes);
+
+        /// <summary>
+        /// When enabled, uploads are sent gzip compressed, which the repeated
+        /// names &amp; values in events shrink well under, reducing the data
+        /// sent &amp; the time the radio is on. Uploads smaller than the
+        /// compression threshold are still sent uncompressed. Off by default.
+        /// </summary>
+        void SetCompressUploads(bool enabled);
+
+        /// <summary>
+        /// Sets the size, in bytes, below which uploads aren't compressed,
+        /// even if compression is enabled. Defaults to 1KB.
+        /// </summary>
+        void SetUploadCompressionThreshold(unsigned int minimumSizeInBytes);
+
+        /// <summary>
+        /// Sets how many times the service can reject an event before it's
+        /// quarantined: taken out of the upload queue, and kept to one side,
+        /// rather than being sent again on every upload. Rejections are only
+        /// counted when the event was sent on it's own, so it can only have
+        /// been that event that was rejected, and the service accepted other
+        /// events in the same upload, so it's not rejecting everything. Only
+        /// the service rejecting the payload counts; server errors,
+        /// throttling &amp; being refused access don't.
+        /// Defaults to 3.
+        /// </summary>
+        void SetMaximumUploadFailures(unsigned int maximumFailures);
+
+        /// <summary>
+        /// Sets how many quarantined track events, and profile updates, are
+        /// kept. Once there are more, the oldest are dropped. Zero turns
+        /// quarantining off, and rejected events stay in the queue. Defaults
+        /// to 100.
+        /// </summary>
+        void SetMaximumQuarantinedEvents(unsigned int maximumEvents);
+
+        /// <summary>
+        /// The number of track events &amp; profile updates that have been
+        /// quarantined, and are still kept.
+        /// </summary>
+        unsigned int GetQuarantinedEventCount();
+
+        /// <summary>
+        /// Returns the quarantined track events &amp; profile updates, oldest
+        /// first, so they can be inspected, or saved somewhere for diagnosis.
+        /// Each is an object with the "type" of event ("track" or "engage"),
+        /// and the "payload" that the service rejected.
+        /// </summary>
+        Windows::Data::Json::JsonArray^ ExportQuarantinedEvents();
+
+        /// <summary>
+        /// Removes any quarantined events. These are also removed by
+        /// ClearStorageAsync.
+        /// </summary>
+        void ClearQuarantinedEvents();
+
+        /// <summary>
+        /// Sets what happens to events tracked while too many are waiting to
+        /// be written to storage, or sent. Events that were written to storage
+        /// before being dropped from the upload queue aren't lost: they're
+        /// restored from storage the next time the app starts. Defaults to
+        /// DropOldest.
+        /// </summary>
+        void SetQueueOverflowPolicy(QueueOverflowPolicy policy);
+
+        /// <summary>
+        /// The number of track events &amp; profile updates that have been
+        /// dropped, or not queued, because too many were waiting to be
+        /// written to storage, or sent.
+        /// </summary>
+        unsigned int GetDroppedEventCount();
+
         /// <summary>
         /// Begins processing any events that get queued -- either currently, or in the future.s
         /// </summary>
@@ -446,6 +681,18 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         concurrency::task<void> PauseWorkers();
 
+        /// <summary>
+        /// Applies the configured storage durability, paging, quarantine
+        /// limit, and overflow policy, to the storage queues, if they've been
+        /// created.
+        /// </summary>
+        void ApplyStorageSettings();
+
+        /// <summary>
+        /// Applies the configured overflow policy to the upload workers.
+        /// </summary>
+        void ApplyOverflowPolicy();
+
         /// <summary>
         /// By default all the super properties are persisted to storage.
         /// For testing, we don't want to do that. Settings this flag
@@ -492,15 +739,28 @@ namespace Codevoid::Utilities::Mixpanel {
         /// </summary>
         void HandleApplicationLeavingBackground(Platform::Object^ sender, Windows::ApplicationModel::LeavingBackgroundEventArgs^ args);
 
+        /// <summary>
+        /// Creates the client uploads are sent with. It's intended to be kept,
+        /// and used for every request, so connections to the service are
+        /// reused; the supplied filter controls how many are kept open.
+        /// </summary>
+        static Windows::Web::Http::HttpClient^ CreateHttpClient(Windows::Web::Http::Filters::HttpBaseProtocolFilter^ filter,
+                                                                Windows::Web::Http::Headers::HttpProductInfoHeaderValue^ userAgent);
+
+        /// <summary>
+        /// Sends the payload to the service. Request bodies at least as large
+        /// as the compression threshold are sent gzip compressed.
+        /// </summary>
         static concurrency::task<SendToServiceResult> SendRequestToService(Windows::Foundation::Uri^ uri,
                                                       Windows::Foundation::Collections::IMap<Platform::String^, Windows::Data::Json::IJsonValue^>^ payload,
-                                                      Windows::Web::Http::Headers::HttpProductInfoHeaderValue^ userAgent);
+                                                      Windows::Web::Http::HttpClient^ client,
+                                                      const size_t compressionThreshold = NO_UPLOAD_COMPRESSION);
         
         // Helpers to testing upload logic
         void SetUploadToServiceMock(const std::function<concurrency::task<SendToServiceResult>(
             Windows::Foundation::Uri^,
             Windows::Foundation::Collections::IMap<Platform::String^, Windows::Data::Json::IJsonValue^>^,
-            Windows::Web::Http::Headers::HttpProductInfoHeaderValue^
+            Windows::Web::Http::HttpClient^
         )> mock);
 
         // Helpers for testing the persist to storage behaviour
@@ -510,16 +770,17 @@ namespace Codevoid::Utilities::Mixpanel {
         void SetProfileWrittenToStorageMock(const std::function<void(std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>)> mock);
         std::function<void(const std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>)> m_profileWrittenToStorageMockCallback;
 
-        std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>
+        concurrency::task<std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>>
             HandleBatchUploadWithUri(
                 Windows::Foundation::Uri^ destination,
+                Codevoid::Utilities::Mixpanel::EventStorageQueue& queue,
                 const std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>& items,
                 const std::function<bool()>& shouldKeepProcessing
             );
         void BeginListeningForNetworkReconnectionToResumeQueueProcessingAfterErrors();
         void ClearListeningForNetworkReconnectionToResumeQueueProcessingAfterErrors();
 
-        static void HandleCompletedUploadsForQueue(Codevoid::Utilities::Mixpanel::EventStorageQueue& queue, const std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>& items);
+        static concurrency::task<void> HandleCompletedUploadsForQueue(Codevoid::Utilities::Mixpanel::EventStorageQueue& queue, const std::vector<std::shared_ptr<Codevoid::Utilities::Mixpanel::PayloadContainer>>& items);
         static Windows::Data::Json::JsonObject^ GenerateTrackJsonPayload(Platform::String^ eventName, Windows::Foundation::Collections::IPropertySet^ properties);
         static Windows::Data::Json::JsonObject^ GenerateEngageJsonPayload(EngageOperationType operation, Windows::Foundation::Collections::IPropertySet^ values, Windows::Foundation::Collections::IPropertySet^ options);
         Windows::Foundation::Collections::IPropertySet^ EmbelishPropertySetForTrack(Windows::Foundation::Collections::IPropertySet^ properties);
@@ -543,14 +804,25 @@ namespace Codevoid::Utilities::Mixpanel {
         Windows::Foundation::Uri^ m_trackEventUri;
         Windows::Foundation::Uri^ m_engageUri;
         Windows::Web::Http::Headers::HttpProductInfoHeaderValue^ m_userAgent;
+        Windows::Web::Http::Filters::HttpBaseProtocolFilter^ m_httpFilter;
+        Windows::Web::Http::HttpClient^ m_httpClient;
         std::unique_ptr<Codevoid::Utilities::Mixpanel::EventStorageQueue> m_trackStorageQueue;
         std::unique_ptr<Codevoid::Utilities::Mixpanel::EventStorageQueue> m_profileStorageQueue;
+        std::array<Codevoid::Utilities::Mixpanel::EventDurability, 3> m_storageDurability;
+        bool m_pageUploadsFromStorage;
+        bool m_compressUploads;
+        size_t m_uploadCompressionThreshold;
+        std::atomic<size_t> m_maximumUploadsInFlight;
+        std::atomic<size_t> m_maximumUploadBatchBytes;
+        std::atomic<unsigned int> m_maximumUploadFailures;
+        size_t m_maximumQuarantinedEvents;
+        Codevoid::Utilities::OverflowPolicy m_overflowPolicy;
         Codevoid::Utilities::BackgroundWorker<Codevoid::Utilities::Mixpanel::PayloadContainer> m_trackUploadWorker;
         Codevoid::Utilities::BackgroundWorker<Codevoid::Utilities::Mixpanel::PayloadContainer> m_profileUploadWorker;
         std::function<concurrency::task<SendToServiceResult>(
             Windows::Foundation::Uri^,
             Windows::Foundation::Collections::IMap<Platform::String^, Windows::Data::Json::IJsonValue^>^,
-            Windows::Web::Http::Headers::HttpProductInfoHeaderValue^)> m_requestHelper;
+            Windows::Web::Http::HttpClient^)> m_requestHelper;
         Windows::Foundation::EventRegistrationToken m_suspendingEventToken;
         Windows::Foundation::EventRegistrationToken m_resumingEventToken;
         Windows::Foundation::EventRegistrationToken m_enteredBackgroundEventToken;
@@ -0,0 +1,315 @@
+#include "pch.h"
+#include <cmath>
+#include "BinaryRecord.h"
+#include "PayloadCodec.h"
+
+using namespace Codevoid::Utilities;
+using namespace Codevoid::Utilities::Mixpanel;
+using namespace Platform;
+using namespace std;
+using namespace Windows::Data::Json;
+
+// Records start with the version of the format they're written in. Versions
+// are kept below the first character any JSON text can start with (tab), so
+// records written as JSON text before there was a binary format are told
+// apart by their first byte.
+constexpr uint8_t PAYLOAD_FORMAT_VERSION = 1;
+constexpr uint8_t FIRST_JSON_TEXT_CHARACTER = '\t';
+
+// Each value is written as a tag, followed by the value:
+// - Integers: a zig-zag varint. Most numbers in events are integral -- times,
+//   counts, IDs -- so they're kept out of 8 byte doubles.
+// - Numbers: a little endian double
+// - Strings: a varint length, followed by UTF-8
+// - Arrays: a varint count, followed by each value
+// - Objects: a varint count, followed by each name (as a string) & value
+enum class ValueTag : uint8_t
+{
+    Null = 0,
+    False = 1,
+    True = 2,
+    Integer = 3,
+    Number = 4,
+    String = 5,
+    Array = 6,
+    Object = 7
+};
+
+// Doubles can represent every integer up to 2^53 exactly; beyond that, the
+// number is kept as a double so it's restored exactly as it was.
+constexpr double MAXIMUM_EXACT_INTEGER = 9007199254740992.0;
+
+// Payloads nest only a few levels deep; anything deeper is a damaged record,
+// and is rejected rather than recursing through it.
+constexpr size_t MAXIMUM_DEPTH = 64;
+
+static string ToUtf8(String^ value)
+{
+    if (value->IsEmpty())
+    {
+        return string();
+    }
+
+    auto length = WideCharToMultiByte(CP_UTF8, 0, value->Data(), value->Length(), nullptr, 0, nullptr, nullptr);
+    string result(length, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, value->Data(), value->Length(), &result[0], length, nullptr, nullptr);
+
+    return result;
+}
+
+static String^ FromUtf8(const char* value, const size_t length)
+{
+    if (length == 0)
+    {
+        return ref new String();
+    }
+
+    auto wideLength = MultiByteToWideChar(CP_UTF8, 0, value, (int)length, nullptr, 0);
+    wstring result(wideLength, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, value, (int)length, &result[0], wideLength);
+
+    return ref new String(result.c_str(), (unsigned int)result.size());
+}
+
+static void WriteValue(BinaryRecordWriter& writer, IJsonValue^ value)
+{
+    switch (value->ValueType)
+    {
+        case JsonValueType::Boolean:
+            writer.WriteByte(static_cast<uint8_t>(value->GetBoolean() ? ValueTag::True : ValueTag::False));
+            break;
+
+        case JsonValueType::Number:
+        {
+            auto number = value->GetNumber();
+            if ((number == trunc(number)) && (fabs(number) <= MAXIMUM_EXACT_INTEGER) && !((number == 0.0) && signbit(number)))
+            {
+                writer.WriteByte(static_cast<uint8_t>(ValueTag::Integer));
+                writer.WriteSignedVarint(static_cast<int64_t>(number));
+            }
+            else
+            {
+                writer.WriteByte(static_cast<uint8_t>(ValueTag::Number));
+                writer.WriteDouble(number);
+            }
+            break;
+        }
+
+        case JsonValueType::String:
+            writer.WriteByte(static_cast<uint8_t>(ValueTag::String));
+            writer.WriteString(ToUtf8(value->GetString()));
+            break;
+
+        case JsonValueType::Array:
+        {
+            auto values = value->GetArray();
+            writer.WriteByte(static_cast<uint8_t>(ValueTag::Array));
+            writer.WriteVarint(values->Size);
+
+            for (auto&& item : values)
+            {
+                WriteValue(writer, item);
+            }
+            break;
+        }
+
+        case JsonValueType::Object:
+        {
+            auto properties = value->GetObject();
+            writer.WriteByte(static_cast<uint8_t>(ValueTag::Object));
+            writer.WriteVarint(properties->Size);
+
+            for (auto&& property : properties)
+            {
+                writer.WriteString(ToUtf8(property->Key));
+                WriteValue(writer, property->Value);
+            }
+            break;
+        }
+
+        default:
+            writer.WriteByte(static_cast<uint8_t>(ValueTag::Null));
+            break;
+    }
+}
+
+static IJsonValue^ ReadValue(BinaryRecordReader& reader, const size_t depth);
+
+static JsonObject^ ReadObject(BinaryRecordReader& reader, const size_t depth)
+{
+    uint64_t count;
+
+    // Every property takes at least two bytes, which bounds a count that's
+    // been damaged before trying to read that many properties.
+    if ((depth > MAXIMUM_DEPTH) || !reader.ReadVarint(&count) || (count > reader.GetRemaining() / 2))
+    {
+        return nullptr;
+    }
+
+    auto object = ref new JsonObject();
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const char* name;
+        size_t nameLength;
+        if (!reader.ReadString(&name, &nameLength))
+        {
+            return nullptr;
+        }
+
+        auto value = ReadValue(reader, depth + 1);
+        if (value == nullptr)
+        {
+            return nullptr;
+        }
+
+        object->Insert(FromUtf8(name, nameLength), value);
+    }
+
+    return object;
+}
+
+static IJsonValue^ ReadValue(BinaryRecordReader& reader, const size_t depth)
+{
+    uint8_t tag;
+    if ((depth > MAXIMUM_DEPTH) || !reader.ReadByte(&tag))
+    {
+        return nullptr;
+    }
+
+    switch (static_cast<ValueTag>(tag))
+    {
+        case ValueTag::Null:
+            return JsonValue::CreateNullValue();
+
+        case ValueTag::False:
+            return JsonValue::CreateBooleanValue(false);
+
+        case ValueTag::True:
+            return JsonValue::CreateBooleanValue(true);
+
+        case ValueTag::Integer:
+        {
+            int64_t integer;
+            if (!reader.ReadSignedVarint(&integer))
+            {
+                return nullptr;
+            }
+
+            return JsonValue::CreateNumberValue(static_cast<double>(integer));
+        }
+
+        case ValueTag::Number:
+        {
+            double number;
+            if (!reader.ReadDouble(&number))
+            {
+                return nullptr;
+            }
+
+            return JsonValue::CreateNumberValue(number);
+        }
+
+        case ValueTag::String:
+        {
+            const char* data;
+            size_t length;
+            if (!reader.ReadString(&data, &length))
+            {
+                return nullptr;
+            }
+
+            return JsonValue::CreateStringValue(FromUtf8(data, length));
+        }
+
+        case ValueTag::Array:
+        {
+            // Every value takes at least a byte
+            uint64_t count;
+            if (!reader.ReadVarint(&count) || (count > reader.GetRemaining()))
+            {
+                return nullptr;
+            }
+
+            auto values = ref new JsonArray();
+            for (uint64_t i = 0; i < count; i++)
+            {
+                auto value = ReadValue(reader, depth + 1);
+                if (value == nullptr)
+                {
+                    return nullptr;
+                }
+
+                values->Append(value);
+            }
+
+            return values;
+        }
+
+        case ValueTag::Object:
+            return ReadObject(reader, depth);
+
+        default:
+            return nullptr;
+    }
+}
+
+string Codevoid::Utilities::Mixpanel::EncodePayload(IJsonValue^ payload)
+{
+    BinaryRecordWriter writer;
+    writer.WriteByte(PAYLOAD_FORMAT_VERSION);
+    WriteValue(writer, payload);
+
+    return writer.ReleaseRecord();
+}
+
+JsonObject^ Codevoid::Utilities::Mixpanel::DecodePayload(const string& record)
+{
+    if (record.empty())
+    {
+        return nullptr;
+    }
+
+    auto version = static_cast<uint8_t>(record[0]);
+    if (version >= FIRST_JSON_TEXT_CHARACTER)
+    {
+        JsonObject^ payload = nullptr;
+        if (!JsonObject::TryParse(FromUtf8(record.data(), record.size()), &payload))
+        {
+            return nullptr;
+        }
+
+        return payload;
+    }
+
+    // Written by a newer version of the format than this one understands
+    if (version != PAYLOAD_FORMAT_VERSION)
+    {
+        return nullptr;
+    }
+
+    BinaryRecordReader reader(record.data() + 1, record.size() - 1);
+    uint8_t tag;
+    if (!reader.ReadByte(&tag) || (static_cast<ValueTag>(tag) != ValueTag::Object))
+    {
+        return nullptr;
+    }
+
+    auto payload = ReadObject(reader, 0);
+    if (!reader.AtEnd())
+    {
+        return nullptr;
+    }
+
+    return payload;
+}
+
+string Codevoid::Utilities::Mixpanel::ConvertJsonToPayload(String^ json)
+{
+    JsonObject^ payload = nullptr;
+    if (!JsonObject::TryParse(json, &payload) || (payload == nullptr))
+    {
+        return string();
+    }
+
+    return EncodePayload(payload);
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+namespace Codevoid::Utilities::Mixpanel {
+    /// <summary>
+    /// Encodes a payload as a compact binary record for storage. The record
+    /// starts with the version of the format it's written in, so the format
+    /// can change without losing records written by earlier versions.
+    /// </summary>
+    std::string EncodePayload(Windows::Data::Json::IJsonValue^ payload);
+
+    /// <summary>
+    /// Decodes a stored payload. Binary records are read directly into
+    /// JSON objects; records stored as JSON text -- by versions before the
+    /// binary format -- are parsed. Returns nullptr if the record is damaged,
+    /// from a newer version of the format, or isn't a JSON object.
+    /// </summary>
+    Windows::Data::Json::JsonObject^ DecodePayload(const std::string& record);
+
+    /// <summary>
+    /// Converts a payload stored as JSON text to a binary record. Returns an
+    /// empty string if the text isn't a JSON object.
+    /// </summary>
+    std::string ConvertJsonToPayload(Platform::String^ json);
+}
\ No newline at end of file
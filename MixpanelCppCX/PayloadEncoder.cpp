@@ -18,6 +18,38 @@ String^ Codevoid::Utilities::Mixpanel::EncodeJson(IJsonValue^ payload)
     return encodedPayload;
 }
 
+size_t Codevoid::Utilities::Mixpanel::EstimateUploadSize(IJsonValue^ payload)
+{
+    auto payloadAsString = payload->Stringify();
+
+    // Starts at one for the comma separating it from the next event
+    size_t utf8Length = 1;
+    auto characters = payloadAsString->Data();
+    for (unsigned int i = 0; i < payloadAsString->Length(); i++)
+    {
+        auto character = characters[i];
+        if (character < 0x80)
+        {
+            utf8Length += 1;
+        }
+        else if ((character < 0x800) || ((character >= 0xD800) && (character <= 0xDFFF)))
+        {
+            // Each half of a surrogate pair is half of a 4 byte character
+            utf8Length += 2;
+        }
+        else
+        {
+            utf8Length += 3;
+        }
+    }
+
+    // Base64 turns every 3 bytes into 4 characters. Two of those 64
+    // characters ('+' & '/') are escaped as 3 characters when form encoded,
+    // so on average, form encoding adds another 1/16th.
+    size_t base64Length = ((utf8Length + 2) / 3) * 4;
+    return base64Length + (base64Length / 16);
+}
+
 String^ Codevoid::Utilities::Mixpanel::DateTimeToMixpanelDateFormat(const DateTime time)
 {
     // Format from mixpanel:
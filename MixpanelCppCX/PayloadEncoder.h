@@ -2,5 +2,12 @@
 
 namespace Codevoid::Utilities::Mixpanel {
     Platform::String^ EncodeJson(Windows::Data::Json::IJsonValue^ payload);
+
+    /// <summary>
+    /// Estimates how many bytes a payload adds to a request: it's JSON text,
+    /// within an array of events, as UTF-8, encoded by EncodeJson, and then
+    /// form encoded.
+    /// </summary>
+    size_t EstimateUploadSize(Windows::Data::Json::IJsonValue^ payload);
     Platform::String^ DateTimeToMixpanelDateFormat(const Windows::Foundation::DateTime time);
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // A single record stored in a RecordStore. The payload is opaque to the
+    // store; the ID is how the record is acknowledged once it's been handled.
+    // </summary>
+    struct LogRecord
+    {
+        long long Id;
+        std::string Payload;
+    };
+
+    // <summary>
+    // A record that hasn't been acknowledged yet, without its payload. This
+    // is what's known about a record without reading it from storage.
+    // </summary>
+    struct PendingLogRecord
+    {
+        long long Id;
+        size_t PayloadSize;
+    };
+
+    // <summary>
+    // Somewhere records are kept until they've been handled. Records are
+    // written in batches, listed & read back in the order they were written,
+    // and removed by acknowledging them.
+    //
+    // Storage is separated from the queueing, batching & restore logic built
+    // on top of it so that logic can be exercised against any store -- e.g.
+    // an in-memory one -- and so stores can be measured on their own.
+    //
+    // Implementations must be thread safe.
+    // </summary>
+    class RecordStore
+    {
+    public:
+        virtual ~RecordStore() = default;
+
+        // <summary>
+        // Writes the supplied records as a single batch. Returns false if they
+        // couldn't be written, in which case none of them are in the store.
+        // Writing a record with the ID of a pending record replaces it.
+        //
+        // If flushToDisk is set, the records must survive the device losing
+        // power once this returns, where the store can make that promise.
+        // </summary>
+        virtual bool Append(const std::vector<LogRecord>& records, const bool flushToDisk = false) = 0;
+
+        // <summary>
+        // Removes the records with the supplied IDs. IDs that aren't pending
+        // are ignored.
+        // </summary>
+        virtual void Acknowledge(const std::vector<long long>& ids) = 0;
+
+        // <summary>
+        // Reads every pending record, in the order they were written.
+        // </summary>
+        virtual std::vector<LogRecord> ReadPendingRecords() = 0;
+
+        // <summary>
+        // Lists every pending record, in the order they were written, without
+        // reading their payloads.
+        // </summary>
+        virtual std::vector<PendingLogRecord> GetPendingRecords() = 0;
+
+        // <summary>
+        // Reads the pending records with the supplied IDs, in the order they
+        // were written. Any that aren't pending, or are damaged, are left
+        // out.
+        //
+        // Records that couldn't be read because of an I/O error (e.g. the
+        // file they're in couldn't be opened) are left out too, but their IDs
+        // are added to unreadableIds, if it's supplied. They're still pending,
+        // and may well be readable later.
+        // </summary>
+        virtual std::vector<LogRecord> ReadRecords(const std::vector<long long>& ids, std::vector<long long>* unreadableIds = nullptr) = 0;
+
+        // <summary>
+        // Removes every record from the store.
+        // </summary>
+        virtual void Clear() = 0;
+
+        virtual size_t GetPendingRecordCount() = 0;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // Source of the current time for retry & backoff decisions. Defaults to
+    // the steady clock, but can be replaced to test the behaviour without
+    // having to wait for real time to pass.
+    // </summary>
+    using RetryClock = std::function<std::chrono::steady_clock::time_point()>;
+
+    inline std::chrono::steady_clock::time_point SteadyClockNow()
+    {
+        return std::chrono::steady_clock::now();
+    }
+
+    // <summary>
+    // Calculates the delay before each retry using capped exponential backoff
+    // with decorrelated jitter: each delay is a random value between the base
+    // delay and three times the previous delay, capped at the maximum.
+    //
+    // The jitter means many clients that failed at the same moment (e.g. a
+    // service outage) spread their retries out, rather than all retrying in
+    // lockstep. Each instance is seeded independently for the same reason.
+    // </summary>
+    class DecorrelatedJitterBackoff
+    {
+    public:
+        DecorrelatedJitterBackoff(
+            const std::chrono::milliseconds baseDelay = std::chrono::milliseconds(10),
+            const std::chrono::milliseconds maximumDelay = std::chrono::minutes(5)
+        ) : m_baseDelay((std::max)(baseDelay, std::chrono::milliseconds(1))),
+            m_maximumDelay((std::max)(maximumDelay, m_baseDelay)),
+            m_previousDelay(m_baseDelay),
+            m_random(std::random_device()())
+        { }
+
+        // <summary>
+        // The delay to wait before the next attempt. Grows with each call,
+        // until Reset is called.
+        // </summary>
+        std::chrono::milliseconds NextDelay()
+        {
+            // Growing from three times the previous delay will overflow long
+            // before it's useful, so it's clamped to the maximum first.
+            auto upperBound = (std::min)(m_previousDelay.count() * 3, m_maximumDelay.count());
+            std::uniform_int_distribution<long long> distribution(m_baseDelay.count(), (std::max)(upperBound, m_baseDelay.count()));
+
+            m_previousDelay = std::chrono::milliseconds(distribution(m_random));
+            return m_previousDelay;
+        }
+
+        // <summary>
+        // Starts the delays again from the base delay, e.g. after a success.
+        // </summary>
+        void Reset()
+        {
+            m_previousDelay = m_baseDelay;
+        }
+
+        std::chrono::milliseconds GetBaseDelay() const
+        {
+            return m_baseDelay;
+        }
+
+        std::chrono::milliseconds GetMaximumDelay() const
+        {
+            return m_maximumDelay;
+        }
+
+    private:
+        std::chrono::milliseconds m_baseDelay;
+        std::chrono::milliseconds m_maximumDelay;
+        std::chrono::milliseconds m_previousDelay;
+        std::minstd_rand m_random;
+    };
+
+    // <summary>
+    // Whether a CircuitBreaker is currently allowing attempts.
+    // </summary>
+    enum class CircuitState
+    {
+        // <summary>
+        // Attempts are being made as normal.
+        // </summary>
+        Closed,
+
+        // <summary>
+        // Too many attempts failed in a row; no attempts should be made until
+        // the probe interval has passed.
+        // </summary>
+        Open,
+
+        // <summary>
+        // The probe interval has passed, and a single (small) attempt can be
+        // made to see if things have recovered.
+        // </summary>
+        HalfOpen,
+    };
+
+    // <summary>
+    // Tracks consecutive failures, and stops attempts once there have been
+    // too many. Rather than stopping forever, it periodically allows a probe
+    // attempt: if that succeeds, attempts carry on as normal; if it fails, it
+    // waits for another probe interval.
+    //
+    // Not thread safe; expected to be used by a single worker.
+    // </summary>
+    class CircuitBreaker
+    {
+    public:
+        CircuitBreaker(
+            const size_t failureThreshold = 1,
+            const std::chrono::milliseconds probeInterval = std::chrono::minutes(1),
+            RetryClock clock = SteadyClockNow
+        ) : m_failureThreshold((std::max)(failureThreshold, size_t(1))),
+            m_probeInterval(probeInterval),
+            m_clock(clock),
+            m_state(CircuitState::Closed),
+            m_consecutiveFailures(0)
+        { }
+
+        CircuitState GetState() const
+        {
+            return m_state;
+        }
+
+        size_t GetConsecutiveFailures() const
+        {
+            return m_consecutiveFailures;
+        }
+
+        // <summary>
+        // When the circuit is open, the time at which a probe can be made.
+        // </summary>
+        std::chrono::steady_clock::time_point GetProbeAt() const
+        {
+            return m_probeAt;
+        }
+
+        // <summary>
+        // Returns true if an attempt can be made now. If the circuit is open,
+        // and the probe interval has passed, the circuit becomes half open,
+        // and the attempt is the probe.
+        // </summary>
+        bool TryAttempt()
+        {
+            if ((m_state == CircuitState::Open) && (m_clock() >= m_probeAt))
+            {
+                m_state = CircuitState::HalfOpen;
+            }
+
+            return (m_state != CircuitState::Open);
+        }
+
+        void RecordSuccess()
+        {
+            m_state = CircuitState::Closed;
+            m_consecutiveFailures = 0;
+        }
+
+        // <summary>
+        // Counts a failed attempt, opening the circuit once the threshold is
+        // reached. A failed probe opens it again straight away.
+        // </summary>
+        void RecordFailure()
+        {
+            m_consecutiveFailures += 1;
+            if ((m_state == CircuitState::HalfOpen) || (m_consecutiveFailures >= m_failureThreshold))
+            {
+                m_state = CircuitState::Open;
+                m_probeAt = m_clock() + m_probeInterval;
+            }
+        }
+
+    private:
+        size_t m_failureThreshold;
+        std::chrono::milliseconds m_probeInterval;
+        RetryClock m_clock;
+        CircuitState m_state;
+        size_t m_consecutiveFailures;
+        std::chrono::steady_clock::time_point m_probeAt;
+    };
+}
\ No newline at end of file
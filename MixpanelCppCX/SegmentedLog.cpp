@@ -0,0 +1,1049 @@
+#include "pch.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "Crc32.h"
+#include "SegmentedLog.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace Codevoid::Utilities;
+using namespace std;
+
+namespace fs = std::filesystem;
+
+using CommitState = map<unsigned long long, pair<unsigned long long, set<unsigned long long>>>;
+
+// Each record is written as [uint32 body length][uint32 body checksum][body],
+// where the body is [int64 id][payload]. All numbers are little endian.
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) * 2;
+constexpr size_t RECORD_ID_SIZE = sizeof(uint64_t);
+constexpr auto SEGMENT_FILE_EXTENSION = ".log";
+constexpr auto INDEX_FILE_EXTENSION = ".idx";
+constexpr auto COMMIT_FILE_PREFIX = "commit.";
+
+static void AppendUInt32(string& buffer, const uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        buffer.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+static void AppendUInt64(string& buffer, const uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        buffer.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+static uint32_t ReadUInt32(const char* data)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+    }
+
+    return value;
+}
+
+static uint64_t ReadUInt64(const char* data)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+    }
+
+    return value;
+}
+
+static FILE* OpenFile(const fs::path& path, const char* mode)
+{
+#ifdef _WIN32
+    // The segment being appended to is read back while it's still open, so
+    // the file needs to be opened for sharing.
+    wstring wideMode(mode, mode + strlen(mode));
+    return _wfsopen(path.c_str(), wideMode.c_str(), _SH_DENYNO);
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+static bool FlushFileToDisk(FILE* file)
+{
+#ifdef _WIN32
+    return (_commit(_fileno(file)) == 0);
+#else
+    return (fsync(fileno(file)) == 0);
+#endif
+}
+
+static bool IsNumber(const string& value)
+{
+    return !value.empty() && all_of(begin(value), end(value), [](const char c) { return (c >= '0') && (c <= '9'); });
+}
+
+// <summary>
+// Removes every generation folder numbered lower than the supplied
+// generation. Nothing reads from these once a newer generation exists, so
+// this is safe to run alongside the log using the newer generation.
+// </summary>
+static void RemoveGenerationsBefore(const fs::path& folder, const unsigned long long generation)
+{
+    error_code error;
+    vector<fs::path> oldGenerations;
+    for (auto&& entry : fs::directory_iterator(folder, error))
+    {
+        auto name = entry.path().filename().string();
+        if (entry.is_directory(error) && IsNumber(name) && (stoull(name) < generation))
+        {
+            oldGenerations.push_back(entry.path());
+        }
+    }
+
+    for (auto&& oldGeneration : oldGenerations)
+    {
+        fs::remove_all(oldGeneration, error);
+    }
+}
+
+static bool SeekTo(FILE* file, const unsigned long long offset)
+{
+#ifdef _WIN32
+    return (_fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0);
+#else
+    return (fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0);
+#endif
+}
+
+static bool WriteFileContents(const fs::path& path, const string& contents)
+{
+    FILE* file = OpenFile(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool written = (fwrite(contents.data(), 1, contents.size(), file) == contents.size());
+    written = (fflush(file) == 0) && written;
+    fclose(file);
+
+    return written;
+}
+
+static bool ReadFileContents(const fs::path& path, string& contents)
+{
+    FILE* file = OpenFile(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    contents.clear();
+    array<char, 64 * 1024> chunk;
+    size_t read = 0;
+    while ((read = fread(chunk.data(), 1, chunk.size(), file)) > 0)
+    {
+        contents.append(chunk.data(), read);
+    }
+
+    bool succeeded = (ferror(file) == 0);
+    fclose(file);
+
+    return succeeded;
+}
+
+// <summary>
+// Reads the record at the supplied offset, returning the size of the whole
+// record, or zero if there isn't a complete, valid, record there.
+// </summary>
+static size_t ReadRecordAt(const string& contents, const unsigned long long offset, LogRecord* record)
+{
+    if ((offset + RECORD_HEADER_SIZE) > contents.size())
+    {
+        return 0;
+    }
+
+    auto header = contents.data() + offset;
+    auto bodyLength = ReadUInt32(header);
+    auto checksum = ReadUInt32(header + sizeof(uint32_t));
+    if ((bodyLength < RECORD_ID_SIZE) || ((offset + RECORD_HEADER_SIZE + bodyLength) > contents.size()))
+    {
+        return 0;
+    }
+
+    auto body = header + RECORD_HEADER_SIZE;
+    if (Crc32(body, bodyLength) != checksum)
+    {
+        return 0;
+    }
+
+    if (record != nullptr)
+    {
+        record->Id = static_cast<long long>(ReadUInt64(body));
+        record->Payload.assign(body + RECORD_ID_SIZE, bodyLength - RECORD_ID_SIZE);
+    }
+
+    return RECORD_HEADER_SIZE + bodyLength;
+}
+
+enum class RecordReadResult
+{
+    Read,
+    Damaged,
+    IoError,
+};
+
+// <summary>
+// Reads the record at the supplied offset straight from the segment file,
+// without reading the rest of the segment. A record that isn't complete &
+// valid is damaged; failing to read from the file at all is an I/O error.
+// </summary>
+static RecordReadResult ReadRecordFromFile(FILE* file, const unsigned long long offset, const unsigned long long segmentSize, LogRecord* record)
+{
+    auto readFailed = [file]() {
+        return ferror(file) ? RecordReadResult::IoError : RecordReadResult::Damaged;
+    };
+
+    char header[RECORD_HEADER_SIZE];
+    if (!SeekTo(file, offset))
+    {
+        return RecordReadResult::IoError;
+    }
+
+    if (fread(header, 1, RECORD_HEADER_SIZE, file) != RECORD_HEADER_SIZE)
+    {
+        return readFailed();
+    }
+
+    auto bodyLength = ReadUInt32(header);
+    auto checksum = ReadUInt32(header + sizeof(uint32_t));
+    if ((bodyLength < RECORD_ID_SIZE) || ((offset + RECORD_HEADER_SIZE + bodyLength) > segmentSize))
+    {
+        return RecordReadResult::Damaged;
+    }
+
+    string body(bodyLength, '\0');
+    if (fread(&body[0], 1, bodyLength, file) != bodyLength)
+    {
+        return readFailed();
+    }
+
+    if (Crc32(body.data(), bodyLength) != checksum)
+    {
+        return RecordReadResult::Damaged;
+    }
+
+    record->Id = static_cast<long long>(ReadUInt64(body.data()));
+    record->Payload = body.substr(RECORD_ID_SIZE);
+
+    return RecordReadResult::Read;
+}
+
+SegmentedLog::SegmentedLog(const fs::path& folder, const size_t maximumSegmentSize) :
+    m_folder(folder),
+    m_maximumSegmentSize(maximumSegmentSize),
+    m_opened(false),
+    m_nextSegmentNumber(0),
+    m_commitSequence(0),
+    m_activeSegmentFile(nullptr),
+    m_activeSegmentNumber(0),
+    m_generation(0)
+{
+    if (maximumSegmentSize < 1)
+    {
+        throw invalid_argument("Segments must be allowed to hold at least one byte");
+    }
+}
+
+SegmentedLog::~SegmentedLog()
+{
+    lock_guard<mutex> lock(m_lock);
+    this->CloseActiveSegment();
+}
+
+bool SegmentedLog::Append(const vector<LogRecord>& records, const bool flushToDisk)
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    if (records.empty())
+    {
+        return true;
+    }
+
+    // All the records are serialized into a single buffer, so they can be
+    // written -- and flushed -- in one go, however many there are.
+    size_t bufferSize = 0;
+    for (auto&& record : records)
+    {
+        bufferSize += RECORD_HEADER_SIZE + RECORD_ID_SIZE + record.Payload.size();
+    }
+
+    string buffer;
+    buffer.reserve(bufferSize);
+    vector<size_t> recordOffsets;
+    recordOffsets.reserve(records.size());
+
+    for (auto&& record : records)
+    {
+        auto bodyLength = RECORD_ID_SIZE + record.Payload.size();
+        auto recordOffset = buffer.size();
+        recordOffsets.push_back(recordOffset);
+
+        // The checksum covers the body, so is filled in once that's written
+        AppendUInt32(buffer, static_cast<uint32_t>(bodyLength));
+        AppendUInt32(buffer, 0);
+        AppendUInt64(buffer, static_cast<uint64_t>(record.Id));
+        buffer.append(record.Payload);
+
+        string checksum;
+        AppendUInt32(checksum, Crc32(buffer.data() + recordOffset + RECORD_HEADER_SIZE, bodyLength));
+        buffer.replace(recordOffset + sizeof(uint32_t), checksum.size(), checksum);
+    }
+
+    // Segments are only rotated between appends, so all the records are
+    // written together. This can take a segment over the maximum size.
+    if ((m_activeSegmentFile != nullptr) && (m_segments[m_activeSegmentNumber].Size >= m_maximumSegmentSize))
+    {
+        this->CloseActiveSegment();
+        this->DeleteCompletedSegments();
+    }
+
+    if ((m_activeSegmentFile == nullptr) && !this->OpenNewActiveSegment())
+    {
+        return false;
+    }
+
+    auto& segment = m_segments[m_activeSegmentNumber];
+    bool written = (fwrite(buffer.data(), 1, buffer.size(), m_activeSegmentFile) == buffer.size());
+    written = (fflush(m_activeSegmentFile) == 0) && written;
+    if (written && flushToDisk)
+    {
+        written = FlushFileToDisk(m_activeSegmentFile);
+    }
+
+    if (!written)
+    {
+        // Don't leave part of a record behind for the next append to follow,
+        // since reading it back would stop at the partial record.
+        auto segmentNumber = m_activeSegmentNumber;
+        this->CloseActiveSegment();
+
+        error_code error;
+        fs::resize_file(this->GetSegmentPath(segmentNumber), segment.Size, error);
+        this->DeleteCompletedSegments();
+
+        return false;
+    }
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        auto id = records[i].Id;
+        auto offset = segment.Size + recordOffsets[i];
+
+        // Appending a record with an ID that is already pending replaces it.
+        this->MarkAcknowledged(id);
+
+        auto payloadSize = records[i].Payload.size();
+        segment.PendingOffsets[offset] = { id, payloadSize };
+        m_pendingRecords[id] = { m_activeSegmentNumber, offset };
+        m_activeSegmentIndex.push_back({ id, offset, payloadSize });
+    }
+
+    segment.Size += buffer.size();
+
+    return true;
+}
+
+void SegmentedLog::Acknowledge(const vector<long long>& ids)
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    bool acknowledgedAnything = false;
+    for (auto&& id : ids)
+    {
+        if (m_pendingRecords.find(id) == m_pendingRecords.end())
+        {
+            continue;
+        }
+
+        this->MarkAcknowledged(id);
+        acknowledgedAnything = true;
+    }
+
+    if (!acknowledgedAnything)
+    {
+        return;
+    }
+
+    // If the segment being appended to is already full, and has been
+    // completely acknowledged, there is no point waiting for the next append
+    // to start a new one before deleting it.
+    if (m_activeSegmentFile != nullptr)
+    {
+        auto& active = m_segments[m_activeSegmentNumber];
+        if ((active.Size >= m_maximumSegmentSize) && active.PendingOffsets.empty())
+        {
+            this->CloseActiveSegment();
+        }
+    }
+
+    // Commit before deleting, so if we never get to delete a segment, it's
+    // still known to be complete the next time the log is opened.
+    this->WriteCommit();
+    this->DeleteCompletedSegments();
+}
+
+vector<LogRecord> SegmentedLog::ReadPendingRecords()
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    vector<LogRecord> records;
+    records.reserve(m_pendingRecords.size());
+
+    for (auto&& [number, segment] : m_segments)
+    {
+        if (segment.PendingOffsets.empty())
+        {
+            continue;
+        }
+
+        string contents;
+        if (!ReadFileContents(this->GetSegmentPath(number), contents))
+        {
+            continue;
+        }
+
+        for (auto&& [offset, pending] : segment.PendingOffsets)
+        {
+            LogRecord record;
+            if (ReadRecordAt(contents, offset, &record) > 0)
+            {
+                records.emplace_back(move(record));
+            }
+        }
+    }
+
+    return records;
+}
+
+vector<PendingLogRecord> SegmentedLog::GetPendingRecords()
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    vector<PendingLogRecord> records;
+    records.reserve(m_pendingRecords.size());
+
+    for (auto&& [number, segment] : m_segments)
+    {
+        for (auto&& [offset, pending] : segment.PendingOffsets)
+        {
+            records.push_back(pending);
+        }
+    }
+
+    return records;
+}
+
+vector<LogRecord> SegmentedLog::ReadRecords(const vector<long long>& ids, vector<long long>* unreadableIds)
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    // Sorting by location means each segment is opened once, and read from
+    // start to end, however the IDs were ordered.
+    vector<pair<RecordLocation, long long>> locations;
+    locations.reserve(ids.size());
+    for (auto&& id : ids)
+    {
+        auto pending = m_pendingRecords.find(id);
+        if (pending != m_pendingRecords.end())
+        {
+            locations.emplace_back(pending->second, id);
+        }
+    }
+
+    sort(begin(locations), end(locations), [](const auto& a, const auto& b) {
+        return (a.first.Segment < b.first.Segment) || ((a.first.Segment == b.first.Segment) && (a.first.Offset < b.first.Offset));
+    });
+
+    vector<LogRecord> records;
+    records.reserve(locations.size());
+
+    FILE* file = nullptr;
+    bool fileOpened = false;
+    unsigned long long fileSegment = 0;
+    for (auto&& [location, id] : locations)
+    {
+        if (!fileOpened || (fileSegment != location.Segment))
+        {
+            if (file != nullptr)
+            {
+                fclose(file);
+            }
+
+            fileOpened = true;
+            fileSegment = location.Segment;
+            file = OpenFile(this->GetSegmentPath(fileSegment), "rb");
+        }
+
+        LogRecord record;
+        auto result = (file == nullptr) ? RecordReadResult::IoError : ReadRecordFromFile(file, location.Offset, m_segments[location.Segment].Size, &record);
+        if (result == RecordReadResult::Read)
+        {
+            records.emplace_back(move(record));
+        }
+        else if ((result == RecordReadResult::IoError) && (unreadableIds != nullptr))
+        {
+            unreadableIds->push_back(id);
+        }
+    }
+
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+
+    return records;
+}
+
+void SegmentedLog::Clear()
+{
+    lock_guard<mutex> lock(m_lock);
+    this->CloseActiveSegment();
+
+    // The segments themselves don't need to have been read to be cleared,
+    // just which generation they're in.
+    if (!m_opened)
+    {
+        m_generation = this->FindCurrentGeneration();
+    }
+
+    auto previousGeneration = this->GetGenerationFolder();
+    m_generation += 1;
+
+    // Creating the folder for the next generation is what clears the log:
+    // once it exists, it's the one that's opened, however much of the
+    // previous generation is left behind.
+    error_code error;
+    fs::create_directories(this->GetGenerationFolder(), error);
+    if (error)
+    {
+        // Without a newer generation, the previous one would be opened
+        // again, so it has to be removed before returning instead.
+        fs::remove_all(previousGeneration, error);
+    }
+
+    m_segments.clear();
+    m_pendingRecords.clear();
+    m_nextSegmentNumber = 0;
+    m_commitSequence = 0;
+    m_opened = true;
+
+    this->RemoveOldGenerationsInBackground();
+}
+
+void SegmentedLog::WaitForOldGenerationsToBeRemoved()
+{
+    vector<future<void>> removals;
+    {
+        lock_guard<mutex> lock(m_lock);
+        removals.swap(m_oldGenerationRemovals);
+    }
+
+    for (auto&& removal : removals)
+    {
+        removal.wait();
+    }
+}
+
+size_t SegmentedLog::GetPendingRecordCount()
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    return m_pendingRecords.size();
+}
+
+size_t SegmentedLog::GetSegmentCount()
+{
+    lock_guard<mutex> lock(m_lock);
+    this->EnsureOpen();
+
+    return m_segments.size();
+}
+
+void SegmentedLog::EnsureOpen()
+{
+    if (m_opened)
+    {
+        return;
+    }
+
+    m_opened = true;
+    m_generation = this->FindCurrentGeneration();
+
+    // Any older generations were cleared, but their removal didn't finish
+    // (e.g. the process exited part way through).
+    this->RemoveOldGenerationsInBackground();
+
+    error_code error;
+    if (!fs::is_directory(this->GetGenerationFolder(), error))
+    {
+        return;
+    }
+
+    vector<unsigned long long> segmentNumbers;
+    for (auto&& entry : fs::directory_iterator(this->GetGenerationFolder(), error))
+    {
+        auto path = entry.path();
+        auto name = path.stem().string();
+        if ((path.extension() != SEGMENT_FILE_EXTENSION) || !IsNumber(name))
+        {
+            continue;
+        }
+
+        segmentNumbers.push_back(stoull(name));
+    }
+
+    sort(begin(segmentNumbers), end(segmentNumbers));
+    if (!segmentNumbers.empty())
+    {
+        m_nextSegmentNumber = segmentNumbers.back() + 1;
+    }
+
+    CommitState commit;
+    this->ReadCommit(commit);
+
+    // Segment numbers are never reused: the commit can still list segments
+    // that were deleted after it was written, and applying their offsets to
+    // a new segment with the same number would lose it's records.
+    for (auto&& [number, committed] : commit)
+    {
+        m_nextSegmentNumber = (max)(m_nextSegmentNumber, number + 1);
+    }
+
+    bool commitListsMissingSegments = any_of(begin(commit), end(commit), [&segmentNumbers](const auto& committed) {
+        return !binary_search(begin(segmentNumbers), end(segmentNumbers), committed.first);
+    });
+
+    for (auto&& number : segmentNumbers)
+    {
+        // Segments are never appended to once they've been closed, so if the
+        // index was written for a segment of this size, it's a complete list
+        // of the records in it.
+        vector<IndexEntry> entries;
+        unsigned long long segmentSize = fs::file_size(this->GetSegmentPath(number), error);
+        bool scanned = false;
+        if (error || !this->ReadIndex(number, segmentSize, entries))
+        {
+            entries.clear();
+            if (!this->ScanSegment(number, entries, segmentSize))
+            {
+                continue;
+            }
+
+            scanned = true;
+        }
+
+        auto& segment = m_segments[number];
+        segment.Size = segmentSize;
+
+        // Anything before the commit offset has been acknowledged
+        unsigned long long commitOffset = 0;
+        set<unsigned long long> acknowledgedOffsets;
+        auto committed = commit.find(number);
+        if (committed != commit.end())
+        {
+            commitOffset = committed->second.first;
+            acknowledgedOffsets = move(committed->second.second);
+        }
+
+        for (auto&& entry : entries)
+        {
+            if (entry.Offset < commitOffset)
+            {
+                continue;
+            }
+
+            if (acknowledgedOffsets.find(entry.Offset) != acknowledgedOffsets.end())
+            {
+                segment.AcknowledgedOffsets.insert(entry.Offset);
+                continue;
+            }
+
+            this->MarkAcknowledged(entry.Id);
+            segment.PendingOffsets[entry.Offset] = { entry.Id, entry.PayloadSize };
+            m_pendingRecords[entry.Id] = { number, entry.Offset };
+        }
+
+        // Only worth indexing if it's not about to be deleted
+        if (scanned && !segment.PendingOffsets.empty())
+        {
+            this->WriteIndex(number, segmentSize, entries);
+        }
+    }
+
+    auto openedSegmentCount = m_segments.size();
+    this->DeleteCompletedSegments();
+
+    // Anything in the commit about segments that are gone is dropped, along
+    // with the segments that were just deleted, so it's not carried forward.
+    if (commitListsMissingSegments || (m_segments.size() < openedSegmentCount))
+    {
+        this->WriteCommit();
+    }
+}
+
+void SegmentedLog::ReadCommit(CommitState& commit)
+{
+    string newest;
+    for (unsigned long long candidate = 0; candidate < 2; candidate++)
+    {
+        string contents;
+        if (!ReadFileContents(this->GetCommitPath(candidate), contents) || (contents.size() < RECORD_HEADER_SIZE))
+        {
+            continue;
+        }
+
+        auto bodyLength = ReadUInt32(contents.data());
+        if ((bodyLength < sizeof(uint64_t)) || ((RECORD_HEADER_SIZE + bodyLength) > contents.size())
+            || (Crc32(contents.data() + RECORD_HEADER_SIZE, bodyLength) != ReadUInt32(contents.data() + sizeof(uint32_t))))
+        {
+            // Torn, or otherwise damaged, so the other commit file is the
+            // one to use.
+            continue;
+        }
+
+        auto sequence = ReadUInt64(contents.data() + RECORD_HEADER_SIZE);
+        if (newest.empty() || (sequence > m_commitSequence))
+        {
+            m_commitSequence = sequence;
+            newest = contents.substr(RECORD_HEADER_SIZE, bodyLength);
+        }
+    }
+
+    // [uint64 sequence][uint32 segment count], and then for each segment:
+    // [uint64 segment][uint64 commit offset][uint32 count][uint64 offset]...
+    // followed by [uint64 next segment number]. Commits written before the
+    // next segment number was added end after the segments.
+    size_t position = sizeof(uint64_t);
+    auto canRead = [&](size_t length) { return (position + length) <= newest.size(); };
+
+    if (!canRead(sizeof(uint32_t)))
+    {
+        return;
+    }
+
+    auto segmentCount = ReadUInt32(newest.data() + position);
+    position += sizeof(uint32_t);
+
+    for (uint32_t i = 0; (i < segmentCount) && canRead((sizeof(uint64_t) * 2) + sizeof(uint32_t)); i++)
+    {
+        auto number = ReadUInt64(newest.data() + position);
+        auto& entry = commit[number];
+        entry.first = ReadUInt64(newest.data() + position + sizeof(uint64_t));
+        auto acknowledgedCount = ReadUInt32(newest.data() + position + (sizeof(uint64_t) * 2));
+        position += (sizeof(uint64_t) * 2) + sizeof(uint32_t);
+
+        for (uint32_t j = 0; (j < acknowledgedCount) && canRead(sizeof(uint64_t)); j++)
+        {
+            entry.second.insert(ReadUInt64(newest.data() + position));
+            position += sizeof(uint64_t);
+        }
+    }
+
+    if (canRead(sizeof(uint64_t)))
+    {
+        m_nextSegmentNumber = (max)(m_nextSegmentNumber, static_cast<unsigned long long>(ReadUInt64(newest.data() + position)));
+    }
+}
+
+unsigned long long SegmentedLog::FindCurrentGeneration()
+{
+    error_code error;
+    bool foundGeneration = false;
+    unsigned long long generation = 0;
+    vector<fs::path> ungeneratedFiles;
+
+    for (auto&& entry : fs::directory_iterator(m_folder, error))
+    {
+        auto path = entry.path();
+        auto name = path.filename().string();
+        if (entry.is_directory(error))
+        {
+            if (IsNumber(name))
+            {
+                generation = foundGeneration ? (max)(generation, stoull(name)) : stoull(name);
+                foundGeneration = true;
+            }
+
+            continue;
+        }
+
+        auto extension = path.extension();
+        if ((extension == SEGMENT_FILE_EXTENSION) || (extension == INDEX_FILE_EXTENSION) || (name.rfind(COMMIT_FILE_PREFIX, 0) == 0))
+        {
+            ungeneratedFiles.push_back(path);
+        }
+    }
+
+    // Logs written before generations were introduced kept their files in
+    // the folder itself, so those become the first generation.
+    if (!foundGeneration && !ungeneratedFiles.empty())
+    {
+        auto firstGeneration = m_folder / to_string(generation);
+        fs::create_directories(firstGeneration, error);
+        for (auto&& file : ungeneratedFiles)
+        {
+            fs::rename(file, firstGeneration / file.filename(), error);
+        }
+    }
+
+    return generation;
+}
+
+void SegmentedLog::RemoveOldGenerationsInBackground()
+{
+    // Finished removals don't need to be waited for
+    m_oldGenerationRemovals.erase(remove_if(begin(m_oldGenerationRemovals), end(m_oldGenerationRemovals), [](const future<void>& removal) {
+        return removal.wait_for(chrono::seconds(0)) == future_status::ready;
+    }), end(m_oldGenerationRemovals));
+
+    m_oldGenerationRemovals.push_back(async(launch::async, RemoveGenerationsBefore, m_folder, m_generation));
+}
+
+bool SegmentedLog::ReadIndex(const unsigned long long segment, const unsigned long long segmentSize, vector<IndexEntry>& entries)
+{
+    // [uint32 body length][uint32 body checksum][body], where the body is
+    // [uint64 segment size][uint32 count], and then for each record:
+    // [int64 id][uint64 offset][uint32 payload size]
+    constexpr size_t ENTRY_SIZE = (sizeof(uint64_t) * 2) + sizeof(uint32_t);
+
+    string contents;
+    if (!ReadFileContents(this->GetIndexPath(segment), contents) || (contents.size() < RECORD_HEADER_SIZE))
+    {
+        return false;
+    }
+
+    auto bodyLength = ReadUInt32(contents.data());
+    if ((bodyLength < (sizeof(uint64_t) + sizeof(uint32_t))) || ((RECORD_HEADER_SIZE + bodyLength) > contents.size())
+        || (Crc32(contents.data() + RECORD_HEADER_SIZE, bodyLength) != ReadUInt32(contents.data() + sizeof(uint32_t))))
+    {
+        return false;
+    }
+
+    auto body = contents.data() + RECORD_HEADER_SIZE;
+    auto count = ReadUInt32(body + sizeof(uint64_t));
+    if ((ReadUInt64(body) != segmentSize) || (bodyLength != (sizeof(uint64_t) + sizeof(uint32_t) + (count * ENTRY_SIZE))))
+    {
+        return false;
+    }
+
+    entries.reserve(count);
+    auto entry = body + sizeof(uint64_t) + sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++, entry += ENTRY_SIZE)
+    {
+        entries.push_back({
+            static_cast<long long>(ReadUInt64(entry)),
+            ReadUInt64(entry + sizeof(uint64_t)),
+            ReadUInt32(entry + (sizeof(uint64_t) * 2))
+        });
+    }
+
+    return true;
+}
+
+void SegmentedLog::WriteIndex(const unsigned long long segment, const unsigned long long segmentSize, const vector<IndexEntry>& entries)
+{
+    string body;
+    AppendUInt64(body, segmentSize);
+    AppendUInt32(body, static_cast<uint32_t>(entries.size()));
+    for (auto&& entry : entries)
+    {
+        AppendUInt64(body, static_cast<uint64_t>(entry.Id));
+        AppendUInt64(body, entry.Offset);
+        AppendUInt32(body, static_cast<uint32_t>(entry.PayloadSize));
+    }
+
+    string buffer;
+    AppendUInt32(buffer, static_cast<uint32_t>(body.size()));
+    AppendUInt32(buffer, Crc32(body.data(), body.size()));
+    buffer.append(body);
+
+    // If this doesn't get written intact, the checksum won't match, and the
+    // segment will be read in full next time instead.
+    WriteFileContents(this->GetIndexPath(segment), buffer);
+}
+
+bool SegmentedLog::ScanSegment(const unsigned long long segment, vector<IndexEntry>& entries, unsigned long long& segmentSize)
+{
+    string contents;
+    if (!ReadFileContents(this->GetSegmentPath(segment), contents))
+    {
+        return false;
+    }
+
+    segmentSize = contents.size();
+
+    unsigned long long offset = 0;
+    LogRecord record;
+    size_t recordSize = 0;
+    while ((recordSize = ReadRecordAt(contents, offset, &record)) > 0)
+    {
+        entries.push_back({ record.Id, offset, record.Payload.size() });
+        offset += recordSize;
+    }
+
+    return true;
+}
+
+void SegmentedLog::WriteCommit()
+{
+    auto sequence = m_commitSequence + 1;
+
+    string body;
+    AppendUInt64(body, sequence);
+    AppendUInt32(body, static_cast<uint32_t>(m_segments.size()));
+
+    for (auto&& [number, segment] : m_segments)
+    {
+        auto commitOffset = segment.PendingOffsets.empty() ? segment.Size : segment.PendingOffsets.begin()->first;
+
+        AppendUInt64(body, number);
+        AppendUInt64(body, commitOffset);
+        AppendUInt32(body, static_cast<uint32_t>(segment.AcknowledgedOffsets.size()));
+        for (auto&& offset : segment.AcknowledgedOffsets)
+        {
+            AppendUInt64(body, offset);
+        }
+    }
+
+    AppendUInt64(body, m_nextSegmentNumber);
+
+    string buffer;
+    AppendUInt32(buffer, static_cast<uint32_t>(body.size()));
+    AppendUInt32(buffer, Crc32(body.data(), body.size()));
+    buffer.append(body);
+
+    // Alternate between the two commit files, so the previous commit is
+    // still intact if this write doesn't complete.
+    if (WriteFileContents(this->GetCommitPath(sequence), buffer))
+    {
+        m_commitSequence = sequence;
+    }
+}
+
+bool SegmentedLog::OpenNewActiveSegment()
+{
+    error_code error;
+    fs::create_directories(this->GetGenerationFolder(), error);
+
+    auto number = m_nextSegmentNumber;
+    auto path = this->GetSegmentPath(number);
+    FILE* file = OpenFile(path, "ab");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    m_nextSegmentNumber += 1;
+    m_activeSegmentFile = file;
+    m_activeSegmentNumber = number;
+    m_activeSegmentIndex.clear();
+
+    auto existingSize = fs::file_size(path, error);
+    m_segments[number].Size = error ? 0 : existingSize;
+
+    return true;
+}
+
+void SegmentedLog::CloseActiveSegment()
+{
+    if (m_activeSegmentFile == nullptr)
+    {
+        return;
+    }
+
+    fclose(m_activeSegmentFile);
+    m_activeSegmentFile = nullptr;
+
+    // Nothing more will be written to this segment, so it can be indexed.
+    // If every record's been acknowledged, it's going to be deleted anyway.
+    auto& segment = m_segments[m_activeSegmentNumber];
+    if (!segment.PendingOffsets.empty())
+    {
+        this->WriteIndex(m_activeSegmentNumber, segment.Size, m_activeSegmentIndex);
+    }
+
+    m_activeSegmentIndex.clear();
+}
+
+void SegmentedLog::MarkAcknowledged(const long long id)
+{
+    auto pending = m_pendingRecords.find(id);
+    if (pending == m_pendingRecords.end())
+    {
+        return;
+    }
+
+    auto& segment = m_segments[pending->second.Segment];
+    segment.PendingOffsets.erase(pending->second.Offset);
+    segment.AcknowledgedOffsets.insert(pending->second.Offset);
+    m_pendingRecords.erase(pending);
+
+    // Acknowledged records before the commit offset are implied by it, so
+    // they don't need to be tracked individually.
+    auto commitOffset = segment.PendingOffsets.empty() ? segment.Size : segment.PendingOffsets.begin()->first;
+    segment.AcknowledgedOffsets.erase(begin(segment.AcknowledgedOffsets), segment.AcknowledgedOffsets.lower_bound(commitOffset));
+}
+
+void SegmentedLog::DeleteCompletedSegments()
+{
+    for (auto segment = begin(m_segments); segment != end(m_segments);)
+    {
+        bool isActive = (m_activeSegmentFile != nullptr) && (segment->first == m_activeSegmentNumber);
+        if (isActive || !segment->second.PendingOffsets.empty())
+        {
+            ++segment;
+            continue;
+        }
+
+        error_code error;
+        fs::remove(this->GetSegmentPath(segment->first), error);
+        fs::remove(this->GetIndexPath(segment->first), error);
+        segment = m_segments.erase(segment);
+    }
+}
+
+fs::path SegmentedLog::GetGenerationFolder() const
+{
+    return m_folder / to_string(m_generation);
+}
+
+fs::path SegmentedLog::GetSegmentPath(const unsigned long long segment) const
+{
+    return this->GetGenerationFolder() / (to_string(segment) + SEGMENT_FILE_EXTENSION);
+}
+
+fs::path SegmentedLog::GetIndexPath(const unsigned long long segment) const
+{
+    return this->GetGenerationFolder() / (to_string(segment) + INDEX_FILE_EXTENSION);
+}
+
+fs::path SegmentedLog::GetCommitPath(const unsigned long long sequence) const
+{
+    return this->GetGenerationFolder() / (COMMIT_FILE_PREFIX + to_string(sequence % 2));
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "RecordStore.h"
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // Append-only store of records, split across a series of segment files
+    // in a folder. Records are appended to the newest segment, each prefixed
+    // with its length & a checksum, and a new segment is started once the
+    // current one reaches the maximum segment size.
+    //
+    // When a record has been handled it is acknowledged, rather than deleted.
+    // For each segment, the log keeps a commit offset -- everything before it
+    // has been acknowledged -- along with any records acknowledged beyond it.
+    // These are written, per call to Acknowledge, to one of a pair of commit
+    // files, alternating between them so that a torn write leaves the other
+    // intact. Once every record in a segment has been acknowledged, and it's
+    // no longer being appended to, the whole segment file is deleted. The
+    // commit also records the next segment number, so a deleted segment's
+    // number is never used again, and left over commit offsets for it can't
+    // be applied to a different segment.
+    //
+    // This means files are only created & deleted once per segment, rather
+    // than once per record. Records are delivered at least once: if the
+    // process exits after a record has been handled, but before it has been
+    // acknowledged, it'll be returned again next time.
+    //
+    // Any partially written record at the end of a segment (e.g. from a crash
+    // part way through an append) ends that segment when it's read back.
+    //
+    // When a segment is closed, an index of the records in it -- their IDs,
+    // offsets & sizes -- is written alongside it. Opening the log reads these
+    // indexes, rather than the segments themselves, so finding out what's
+    // pending doesn't require reading every payload. Segments without a
+    // usable index (e.g. the one being appended to when the process exited)
+    // are read in full instead, and given an index for next time.
+    //
+    // The files are kept in a numbered generation folder within the folder,
+    // and the highest numbered generation is the one that's used. Clearing
+    // the log starts a new, empty, generation, rather than deleting all the
+    // files before returning; the previous generations are removed in the
+    // background. If that doesn't finish, they're removed the next time the
+    // log is opened.
+    //
+    // Only one instance should be used with a given folder at a time. All
+    // methods are thread safe.
+    //
+    // This only relies on the standard library (& fsync/_commit to flush to
+    // the disk), so is the RecordStore for any filesystem, not just the one
+    // in an app's container.
+    // </summary>
+    class SegmentedLog : public RecordStore
+    {
+    public:
+        static constexpr size_t DEFAULT_MAXIMUM_SEGMENT_SIZE = 1024 * 1024;
+
+        SegmentedLog(
+            const std::filesystem::path& folder,
+            const size_t maximumSegmentSize = DEFAULT_MAXIMUM_SEGMENT_SIZE
+        );
+
+        SegmentedLog(const SegmentedLog&) = delete;
+        SegmentedLog(SegmentedLog&&) = delete;
+
+        ~SegmentedLog() override;
+
+        // <summary>
+        // Appends the supplied records to the log. Returns false if they
+        // couldn't be written, in which case none of them are in the log.
+        //
+        // Records are always handed to the OS before returning. If
+        // flushToDisk is set, they are also flushed through to the disk, so
+        // they survive the device losing power, not just the app exiting.
+        // </summary>
+        bool Append(const std::vector<LogRecord>& records, const bool flushToDisk = false) override;
+
+        // <summary>
+        // Marks the records with the supplied IDs as handled, so they won't be
+        // returned by ReadPendingRecords again. IDs that aren't pending in the
+        // log are ignored.
+        // </summary>
+        void Acknowledge(const std::vector<long long>& ids) override;
+
+        // <summary>
+        // Reads every record that hasn't been acknowledged yet, in the order
+        // they were appended.
+        // </summary>
+        std::vector<LogRecord> ReadPendingRecords() override;
+
+        // <summary>
+        // Lists every record that hasn't been acknowledged yet, in the order
+        // they were appended, without reading any of their payloads.
+        // </summary>
+        std::vector<PendingLogRecord> GetPendingRecords() override;
+
+        // <summary>
+        // Reads the pending records with the supplied IDs, in the order they
+        // were appended. Records that aren't pending, or that aren't intact
+        // in their segment, are left out. If their segment couldn't be
+        // opened, or read from, they're left out, and listed in
+        // unreadableIds, since they're still there to be read later.
+        // </summary>
+        std::vector<LogRecord> ReadRecords(const std::vector<long long>& ids, std::vector<long long>* unreadableIds = nullptr) override;
+
+        // <summary>
+        // Removes every record from the log. The files they were stored in
+        // are removed in the background.
+        // </summary>
+        void Clear() override;
+
+        // <summary>
+        // Waits for the files of any cleared generations to be removed.
+        // </summary>
+        void WaitForOldGenerationsToBeRemoved();
+
+        size_t GetPendingRecordCount() override;
+        size_t GetSegmentCount();
+
+    private:
+        struct Segment
+        {
+            unsigned long long Size = 0;
+            std::map<unsigned long long, PendingLogRecord> PendingOffsets;
+            std::set<unsigned long long> AcknowledgedOffsets;
+        };
+
+        struct IndexEntry
+        {
+            long long Id;
+            unsigned long long Offset;
+            size_t PayloadSize;
+        };
+
+        struct RecordLocation
+        {
+            unsigned long long Segment;
+            unsigned long long Offset;
+        };
+
+        std::mutex m_lock;
+        std::filesystem::path m_folder;
+        size_t m_maximumSegmentSize;
+        bool m_opened;
+
+        std::map<unsigned long long, Segment> m_segments;
+        std::unordered_map<long long, RecordLocation> m_pendingRecords;
+        unsigned long long m_nextSegmentNumber;
+        unsigned long long m_commitSequence;
+
+        std::FILE* m_activeSegmentFile;
+        unsigned long long m_activeSegmentNumber;
+        std::vector<IndexEntry> m_activeSegmentIndex;
+
+        unsigned long long m_generation;
+        std::vector<std::future<void>> m_oldGenerationRemovals;
+
+        void EnsureOpen();
+        unsigned long long FindCurrentGeneration();
+        void RemoveOldGenerationsInBackground();
+        void ReadCommit(std::map<unsigned long long, std::pair<unsigned long long, std::set<unsigned long long>>>& commit);
+        void WriteCommit();
+        bool ReadIndex(const unsigned long long segment, const unsigned long long segmentSize, std::vector<IndexEntry>& entries);
+        void WriteIndex(const unsigned long long segment, const unsigned long long segmentSize, const std::vector<IndexEntry>& entries);
+        bool ScanSegment(const unsigned long long segment, std::vector<IndexEntry>& entries, unsigned long long& segmentSize);
+        bool OpenNewActiveSegment();
+        void CloseActiveSegment();
+        void MarkAcknowledged(const long long id);
+        void DeleteCompletedSegments();
+
+        std::filesystem::path GetGenerationFolder() const;
+        std::filesystem::path GetSegmentPath(const unsigned long long segment) const;
+        std::filesystem::path GetIndexPath(const unsigned long long segment) const;
+        std::filesystem::path GetCommitPath(const unsigned long long sequence) const;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // FIFO store of pending work items, where every item is stamped with a
+    // monotonically increasing sequence number as it is added.
+    //
+    // Items are handed out along with their sequence numbers, so when a
+    // batch has been processed the items can be located directly rather
+    // than searching the whole queue. This keeps the cost of removing a
+    // processed batch proportional to the size of that batch, not to the
+    // number of items waiting in the queue.
+    //
+    // Removed items are cleared in place, and trimmed once they reach either
+    // end of the queue. If cleared slots build up in the middle (e.g. an item
+    // at the front keeps failing while those behind it succeed), the storage
+    // is compacted once they outnumber the live items.
+    //
+    // Items can also carry an arrival number supplied by the caller, which
+    // isn't used by the queue itself, but lets the caller compare the age of
+    // items across several queues (e.g. to find the oldest one).
+    //
+    // This class is not thread safe -- callers are expected to provide their
+    // own locking.
+    // </summary>
+    template <typename ItemType>
+    class SequencedItemQueue
+    {
+        using ItemType_ptr = std::shared_ptr<ItemType>;
+        using ItemTypeVector = std::vector<ItemType_ptr>;
+
+    public:
+        using SequenceNumber = unsigned long long;
+        using SequenceNumberVector = std::vector<SequenceNumber>;
+
+        SequencedItemQueue() :
+            m_nextSequenceNumber(0),
+            m_liveItemCount(0)
+        { }
+
+        SequencedItemQueue(const SequencedItemQueue&) = delete;
+
+        // <summary>
+        // Number of items in the queue, excluding any that have been removed.
+        // </summary>
+        size_t Size() const
+        {
+            return m_liveItemCount;
+        }
+
+        void Push(const ItemType_ptr& item)
+        {
+            this->Push(item, m_nextSequenceNumber);
+        }
+
+        // <summary>
+        // Adds the item, with the supplied arrival number. These are expected
+        // to increase as items are added, but needn't be contiguous.
+        // </summary>
+        void Push(const ItemType_ptr& item, const SequenceNumber arrival)
+        {
+            m_entries.push_back({ m_nextSequenceNumber++, arrival, item });
+            m_liveItemCount += 1;
+        }
+
+        void Push(const ItemTypeVector& items)
+        {
+            for (auto&& item : items)
+            {
+                this->Push(item);
+            }
+        }
+
+        // <summary>
+        // Removes all items. Sequence numbers are never reused, so removing
+        // items from a batch that was handed out before clearing is a no-op.
+        // </summary>
+        void Clear()
+        {
+            m_entries.clear();
+            m_liveItemCount = 0;
+        }
+
+        // <summary>
+        // Appends up to <paramref name="maxItems" /> items from the front of the
+        // queue to <paramref name="items" />, and their sequence numbers to
+        // <paramref name="sequenceNumbers" />. The items are left in the queue.
+        // </summary>
+        size_t PeekFront(ItemTypeVector& items, SequenceNumberVector& sequenceNumbers, const size_t maxItems) const
+        {
+            size_t added = 0;
+            for (auto&& entry : m_entries)
+            {
+                if (added >= maxItems)
+                {
+                    break;
+                }
+
+                if (entry.Item == nullptr)
+                {
+                    continue;
+                }
+
+                items.emplace_back(entry.Item);
+                sequenceNumbers.emplace_back(entry.Sequence);
+                added += 1;
+            }
+
+            return added;
+        }
+
+        // <summary>
+        // Arrival number of the item at the front of the queue, if there is one.
+        // </summary>
+        std::optional<SequenceNumber> GetFrontArrival() const
+        {
+            if (m_entries.empty())
+            {
+                return std::nullopt;
+            }
+
+            // Cleared slots are always trimmed from the front, so the first
+            // entry is a live item.
+            return m_entries.front().Arrival;
+        }
+
+        // <summary>
+        // Removes the item at the front of the queue, and returns it. If the
+        // queue is empty, returns nullptr. Removing a batch that included this
+        // item will ignore it, as if it had been cleared.
+        // </summary>
+        ItemType_ptr PopFront()
+        {
+            if (m_entries.empty())
+            {
+                return nullptr;
+            }
+
+            auto item = std::move(m_entries.front().Item);
+            m_entries.pop_front();
+            m_liveItemCount -= 1;
+
+            this->TrimAndCompact();
+            return item;
+        }
+
+        // <summary>
+        // Removes <paramref name="processedItems" /> from the queue, where
+        // those items are a subset of a batch previously obtained from PeekFront
+        // (<paramref name="batchItems" /> &amp; <paramref name="batchSequenceNumbers" />).
+        // Items that are no longer in the queue (e.g. it was cleared) are ignored.
+        //
+        // Returns the number of items that were actually removed. If supplied,
+        // those items are also appended to <paramref name="removedItems" />.
+        // </summary>
+        size_t Remove(const ItemTypeVector& batchItems, const SequenceNumberVector& batchSequenceNumbers, const ItemTypeVector& processedItems, ItemTypeVector* removedItems = nullptr)
+        {
+            assert(batchItems.size() == batchSequenceNumbers.size());
+
+            size_t removed = 0;
+            size_t batchCursor = 0;
+            std::unordered_map<const ItemType*, size_t> batchIndex;
+
+            for (auto&& processedItem : processedItems)
+            {
+                // Processed items are nearly always returned in the same order
+                // as they were handed out, so walk forward through the batch
+                // first. Only if we run off the end do we pay to build a lookup
+                // of the batch to handle out of order items.
+                while ((batchCursor < batchItems.size()) && (batchItems[batchCursor] != processedItem))
+                {
+                    batchCursor += 1;
+                }
+
+                size_t positionInBatch = batchCursor;
+                if (batchCursor < batchItems.size())
+                {
+                    batchCursor += 1;
+                }
+                else
+                {
+                    if (batchIndex.empty())
+                    {
+                        batchIndex.reserve(batchItems.size());
+                        for (size_t i = 0; i < batchItems.size(); i++)
+                        {
+                            batchIndex.emplace(batchItems[i].get(), i);
+                        }
+                    }
+
+                    auto found = batchIndex.find(processedItem.get());
+                    if (found == batchIndex.end())
+                    {
+                        // Wasn't part of this batch, so we've nothing to remove.
+                        continue;
+                    }
+
+                    positionInBatch = found->second;
+                }
+
+                if (this->RemoveBySequenceNumber(batchSequenceNumbers[positionInBatch], processedItem))
+                {
+                    removed += 1;
+                    if (removedItems != nullptr)
+                    {
+                        removedItems->emplace_back(processedItem);
+                    }
+                }
+            }
+
+            this->TrimAndCompact();
+            return removed;
+        }
+
+    private:
+        // Minimum number of cleared slots before we'll consider compacting
+        // the storage; avoids churning small queues.
+        static constexpr size_t COMPACTION_THRESHOLD = 64;
+
+        struct Entry
+        {
+            SequenceNumber Sequence;
+            SequenceNumber Arrival;
+            ItemType_ptr Item;
+        };
+
+        bool RemoveBySequenceNumber(const SequenceNumber sequenceNumber, const ItemType_ptr& item)
+        {
+            if (m_entries.empty()
+                || (sequenceNumber < m_entries.front().Sequence)
+                || (sequenceNumber > m_entries.back().Sequence))
+            {
+                return false;
+            }
+
+            // Until the queue is compacted, an items position is its
+            // offset from the first sequence number in the queue.
+            size_t position = static_cast<size_t>(sequenceNumber - m_entries.front().Sequence);
+            if ((position >= m_entries.size()) || (m_entries[position].Sequence != sequenceNumber))
+            {
+                auto found = std::lower_bound(begin(m_entries), end(m_entries), sequenceNumber, [](const Entry& entry, const SequenceNumber value) {
+                    return entry.Sequence < value;
+                });
+
+                if ((found == end(m_entries)) || (found->Sequence != sequenceNumber))
+                {
+                    return false;
+                }
+
+                position = static_cast<size_t>(std::distance(begin(m_entries), found));
+            }
+
+            auto& entry = m_entries[position];
+            if ((entry.Item == nullptr) || (entry.Item != item))
+            {
+                return false;
+            }
+
+            entry.Item = nullptr;
+            m_liveItemCount -= 1;
+            return true;
+        }
+
+        void TrimAndCompact()
+        {
+            while (!m_entries.empty() && (m_entries.front().Item == nullptr))
+            {
+                m_entries.pop_front();
+            }
+
+            while (!m_entries.empty() && (m_entries.back().Item == nullptr))
+            {
+                m_entries.pop_back();
+            }
+
+            size_t clearedSlots = m_entries.size() - m_liveItemCount;
+            if ((clearedSlots > COMPACTION_THRESHOLD) && (clearedSlots > m_liveItemCount))
+            {
+                m_entries.erase(std::remove_if(begin(m_entries), end(m_entries), [](const Entry& entry) {
+                    return entry.Item == nullptr;
+                }), end(m_entries));
+            }
+        }
+
+        std::deque<Entry> m_entries;
+        SequenceNumber m_nextSequenceNumber;
+        size_t m_liveItemCount;
+    };
+}
\ No newline at end of file
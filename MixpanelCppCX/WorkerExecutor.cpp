@@ -0,0 +1,155 @@
+#include "pch.h"
+#include <algorithm>
+#include "WorkerExecutor.h"
+
+using namespace Codevoid::Utilities;
+using namespace std;
+using namespace std::chrono;
+
+WorkerExecutor::WorkerExecutor(const size_t threadCount) :
+    m_shuttingDown(false)
+{
+    if (threadCount < 1)
+    {
+        throw invalid_argument("Must have at least one thread to run work on");
+    }
+
+    m_threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        m_threads.emplace_back(&WorkerExecutor::RunWork, this);
+    }
+}
+
+WorkerExecutor::~WorkerExecutor()
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_shuttingDown = true;
+        m_scheduledWork.clear();
+    }
+
+    m_workAvailable.notify_all();
+
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+size_t WorkerExecutor::GetThreadCount() const
+{
+    return m_threads.size();
+}
+
+void WorkerExecutor::Post(const void* owner, function<void()> work)
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_readyWork.push_back({ owner, move(work) });
+    }
+
+    m_workAvailable.notify_one();
+}
+
+void WorkerExecutor::PostAt(const void* owner, const steady_clock::time_point when, function<void()> work)
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_scheduledWork.emplace(when, PendingWork{ owner, move(work) });
+    }
+
+    // Threads that are idle might be waiting for something later than
+    // this, so they all need to recalculate how long to wait for.
+    m_workAvailable.notify_all();
+}
+
+void WorkerExecutor::CancelAndWait(const void* owner)
+{
+    unique_lock<mutex> lock(m_lock);
+
+    // Work that's running can post more work before it completes, so keep
+    // removing it until there's nothing left running to post any more.
+    while (true)
+    {
+        m_readyWork.erase(remove_if(begin(m_readyWork), end(m_readyWork), [owner](const PendingWork& pending) {
+            return pending.Owner == owner;
+        }), end(m_readyWork));
+
+        for (auto scheduled = begin(m_scheduledWork); scheduled != end(m_scheduledWork);)
+        {
+            if (scheduled->second.Owner == owner)
+            {
+                scheduled = m_scheduledWork.erase(scheduled);
+                continue;
+            }
+
+            scheduled++;
+        }
+
+        if (m_runningWorkPerOwner.find(owner) == end(m_runningWorkPerOwner))
+        {
+            break;
+        }
+
+        m_workCompleted.wait(lock);
+    }
+}
+
+void WorkerExecutor::RunWork()
+{
+    unique_lock<mutex> lock(m_lock);
+
+    while (true)
+    {
+        // Anything scheduled that's now due joins the back of the ready
+        // work, so it's run in the order it became due.
+        auto now = steady_clock::now();
+        while (!m_scheduledWork.empty() && (m_scheduledWork.begin()->first <= now))
+        {
+            m_readyWork.push_back(move(m_scheduledWork.begin()->second));
+            m_scheduledWork.erase(m_scheduledWork.begin());
+        }
+
+        if (!m_readyWork.empty())
+        {
+            auto pending = move(m_readyWork.front());
+            m_readyWork.pop_front();
+            m_runningWorkPerOwner[pending.Owner] += 1;
+
+            lock.unlock();
+            pending.Work();
+
+            // Release anything the work captured before we say it's complete;
+            // the owner might be waiting to go away.
+            pending.Work = nullptr;
+            lock.lock();
+
+            auto running = m_runningWorkPerOwner.find(pending.Owner);
+            running->second -= 1;
+            if (running->second == 0)
+            {
+                m_runningWorkPerOwner.erase(running);
+                m_workCompleted.notify_all();
+            }
+
+            continue;
+        }
+
+        if (m_shuttingDown)
+        {
+            break;
+        }
+
+        if (m_scheduledWork.empty())
+        {
+            m_workAvailable.wait(lock);
+        }
+        else
+        {
+            // Copied, since the entry could be removed while we're waiting
+            auto nextScheduledWork = m_scheduledWork.begin()->first;
+            m_workAvailable.wait_until(lock, nextScheduledWork);
+        }
+    }
+}
\ No newline at end of file
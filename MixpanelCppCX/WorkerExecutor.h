@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Codevoid::Utilities {
+    // <summary>
+    // Small, fixed size pool of threads that can be shared between many
+    // BackgroundWorker instances, rather than each worker owning a thread
+    // that spends most of its life waiting for something to do.
+    //
+    // Work is posted as a callback tagged with an owner. It's run either as
+    // soon as a thread is free, or once a point in time has passed. Before an
+    // owner goes away, it must cancel anything it has posted that hasn't run
+    // yet, and wait for anything that is running to complete.
+    //
+    // Callbacks are run with no ordering guarantees between them; owners that
+    // need their work to be serialised are expected to only have one callback
+    // pending at a time. Callbacks that block (e.g. waiting on a network
+    // request) hold on to their thread while they do so, so the pool needs to
+    // be large enough for the number of callbacks expected to block at once.
+    // </summary>
+    class WorkerExecutor
+    {
+    public:
+        WorkerExecutor(const size_t threadCount);
+
+        WorkerExecutor(const WorkerExecutor&) = delete;
+        WorkerExecutor(WorkerExecutor&&) = delete;
+
+        // <summary>
+        // Runs any work that is ready, drops any that is scheduled for the
+        // future, and then waits for the threads to exit.
+        // </summary>
+        ~WorkerExecutor();
+
+        size_t GetThreadCount() const;
+
+        // <summary>
+        // Runs <paramref name="work" /> as soon as a thread is available.
+        // </summary>
+        void Post(const void* owner, std::function<void()> work);
+
+        // <summary>
+        // Runs <paramref name="work" /> once <paramref name="when" /> has
+        // passed, and a thread is available.
+        // </summary>
+        void PostAt(const void* owner, const std::chrono::steady_clock::time_point when, std::function<void()> work);
+
+        // <summary>
+        // Removes any work posted by <paramref name="owner" /> that hasn't
+        // started yet, and blocks until anything of theirs that is currently
+        // running has completed.
+        //
+        // This must not be called from work being run by this executor for
+        // the same owner, since it would be waiting for itself.
+        // </summary>
+        void CancelAndWait(const void* owner);
+
+    private:
+        struct PendingWork
+        {
+            const void* Owner;
+            std::function<void()> Work;
+        };
+
+        void RunWork();
+
+        std::mutex m_lock;
+        std::condition_variable m_workAvailable;
+        std::condition_variable m_workCompleted;
+        std::deque<PendingWork> m_readyWork;
+        std::multimap<std::chrono::steady_clock::time_point, PendingWork> m_scheduledWork;
+        std::unordered_map<const void*, size_t> m_runningWorkPerOwner;
+        bool m_shuttingDown;
+        std::vector<std::thread> m_threads;
+    };
+}
\ No newline at end of file
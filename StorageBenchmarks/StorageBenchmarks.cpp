@@ -0,0 +1,396 @@
+#include "pch.h"
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
+
+#include "MemoryRecordStore.h"
+#include "SegmentedLog.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+using namespace Codevoid::Utilities;
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // Small enough that the recovery rounds roll over, & delete, lots of
+    // segments -- which is where reopening the log has gone wrong before.
+    constexpr size_t RECOVERY_MAXIMUM_SEGMENT_SIZE = 4 * 1024;
+
+    // Each round's records start at a multiple of this, so IDs are never
+    // reused between rounds.
+    constexpr long long RECOVERY_IDS_PER_ROUND = 100000000;
+
+    // How many records an online round appends before acknowledging them.
+    constexpr size_t RECOVERY_RECORDS_PER_UPLOAD = 10;
+
+    struct BenchmarkSettings
+    {
+        int BatchSize;
+        int Batches;
+        int RestoreBatches;
+        int RecoveryRounds;
+    };
+
+    vector<LogRecord> GenerateStoreRecords(const int count, const long long startingAt = 1)
+    {
+        vector<LogRecord> records;
+        for (int i = 0; i < count; i++)
+        {
+            auto id = startingAt + i;
+            records.push_back({ id, "{\"title\":\"Record " + to_string(id) + "\"}" });
+        }
+
+        return records;
+    }
+
+    long long ItemsPerSecond(const size_t items, const steady_clock::duration duration)
+    {
+        return (static_cast<long long>(items) * 1000000LL) / (max)(static_cast<long long>(duration_cast<microseconds>(duration).count()), 1LL);
+    }
+
+    // <summary>
+    // How quickly records can be written, listed, read & acknowledged in a
+    // store, so the cost of the storage can be separated from the cost of
+    // everything else.
+    // </summary>
+    bool MeasureThroughput(RecordStore& store, const string& name, const BenchmarkSettings& settings, const bool flushToDisk)
+    {
+        auto start = steady_clock::now();
+        for (int i = 0; i < settings.Batches; i++)
+        {
+            if (!store.Append(GenerateStoreRecords(settings.BatchSize, (static_cast<long long>(i) * settings.BatchSize) + 1), flushToDisk))
+            {
+                cout << name << ": FAILED, records couldn't be written" << endl;
+                return false;
+            }
+        }
+
+        auto written = steady_clock::now();
+        auto pending = store.GetPendingRecords();
+        for (size_t i = 0; i < pending.size(); i += settings.BatchSize)
+        {
+            vector<long long> ids;
+            for (size_t j = i; j < (min)(i + settings.BatchSize, pending.size()); j++)
+            {
+                ids.push_back(pending[j].Id);
+            }
+
+            store.ReadRecords(ids);
+            store.Acknowledge(ids);
+        }
+
+        auto finished = steady_clock::now();
+        size_t total = static_cast<size_t>(settings.BatchSize) * settings.Batches;
+        cout << name << ": written " << ItemsPerSecond(total, written - start) << " items/sec, read & acknowledged "
+             << ItemsPerSecond(total, finished - written) << " items/sec" << endl;
+
+        if (pending.size() != total || store.GetPendingRecordCount() != 0)
+        {
+            cout << name << ": FAILED, " << pending.size() << " of " << total << " records were pending, and "
+                 << store.GetPendingRecordCount() << " were left after acknowledging them" << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    // <summary>
+    // How long it takes to find out what's pending when a log is reopened
+    // with a large backlog (e.g. after the app exited, or crashed).
+    // </summary>
+    bool MeasureRestore(const fs::path& folder, const BenchmarkSettings& settings)
+    {
+        {
+            SegmentedLog log(folder, 64 * 1024);
+            for (int i = 0; i < settings.RestoreBatches; i++)
+            {
+                log.Append(GenerateStoreRecords(settings.BatchSize, (static_cast<long long>(i) * settings.BatchSize) + 1));
+            }
+        }
+
+        auto start = steady_clock::now();
+        SegmentedLog log(folder, 64 * 1024);
+        auto pendingCount = log.GetPendingRecords().size();
+        auto duration = steady_clock::now() - start;
+
+        cout << "SegmentedLog: restored " << pendingCount << " records at " << ItemsPerSecond(pendingCount, duration) << " items/sec" << endl;
+
+        size_t expected = static_cast<size_t>(settings.BatchSize) * settings.RestoreBatches;
+        if (pendingCount != expected)
+        {
+            cout << "SegmentedLog: FAILED, restored " << pendingCount << " of " << expected << " records" << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+#ifndef _WIN32
+    // What the process being killed has told the benchmark, one message per
+    // record: the type, followed by the record's ID.
+    constexpr char REPORT_APPENDED = 'A';
+    constexpr char REPORT_ACKNOWLEDGING = 'K';
+    constexpr char REPORT_ACKNOWLEDGED = 'D';
+    constexpr size_t REPORT_SIZE = 1 + sizeof(long long);
+
+    void Report(const int reportFd, const char type, const long long id)
+    {
+        char message[REPORT_SIZE];
+        message[0] = type;
+        memcpy(message + 1, &id, sizeof(id));
+
+        // Messages are smaller than PIPE_BUF, so they're written whole.
+        if (write(reportFd, message, REPORT_SIZE) != static_cast<ssize_t>(REPORT_SIZE))
+        {
+            _exit(1);
+        }
+    }
+
+    void AcknowledgeAndReport(SegmentedLog& log, const int reportFd, const vector<long long>& ids)
+    {
+        for (auto id : ids)
+        {
+            Report(reportFd, REPORT_ACKNOWLEDGING, id);
+        }
+
+        log.Acknowledge(ids);
+        for (auto id : ids)
+        {
+            Report(reportFd, REPORT_ACKNOWLEDGED, id);
+        }
+    }
+
+    // <summary>
+    // Runs in the process that's killed, & behaves like an app that's either
+    // online -- handling whatever the previous round left behind, and then
+    // acknowledging records shortly after appending them -- or offline, only
+    // appending. Everything is reported as it happens, so the benchmark knows
+    // what should, & shouldn't, be in the log afterwards.
+    // </summary>
+    [[noreturn]] void AppendUntilKilled(const fs::path& folder, const int reportFd, const long long firstId, const bool online)
+    {
+        SegmentedLog log(folder, RECOVERY_MAXIMUM_SEGMENT_SIZE);
+
+        vector<long long> unacknowledged;
+        if (online)
+        {
+            for (auto& record : log.GetPendingRecords())
+            {
+                unacknowledged.push_back(record.Id);
+            }
+
+            AcknowledgeAndReport(log, reportFd, unacknowledged);
+            unacknowledged.clear();
+        }
+
+        for (long long id = firstId;; id++)
+        {
+            if (!log.Append(GenerateStoreRecords(1, id)))
+            {
+                continue;
+            }
+
+            Report(reportFd, REPORT_APPENDED, id);
+            unacknowledged.push_back(id);
+
+            if (online && (unacknowledged.size() == RECOVERY_RECORDS_PER_UPLOAD))
+            {
+                AcknowledgeAndReport(log, reportFd, unacknowledged);
+                unacknowledged.clear();
+            }
+        }
+    }
+
+    // <summary>
+    // Repeatedly kills a process part way through writing to a log, and then
+    // checks that reopening the log finds every record that was written, and
+    // none that were acknowledged. Rounds that acknowledge what they append
+    // continually delete & create segments; rounds that don't, leave them for
+    // later rounds to find.
+    // </summary>
+    bool MeasureRecovery(const fs::path& folder, const BenchmarkSettings& settings)
+    {
+        random_device seedSource;
+        auto seed = seedSource();
+        mt19937 random(seed);
+        uniform_int_distribution<int> killAfterMilliseconds(5, 50);
+        bernoulli_distribution online(0.5);
+
+        set<long long> mustBePending;
+        set<long long> mustNotBePending;
+        size_t totalAppended = 0;
+        steady_clock::duration totalReopenDuration{};
+
+        for (int round = 0; round < settings.RecoveryRounds; round++)
+        {
+            auto isOnline = online(random);
+
+            int reportPipe[2];
+            if (pipe(reportPipe) != 0)
+            {
+                cout << "Recovery: FAILED, couldn't create a pipe" << endl;
+                return false;
+            }
+
+            auto child = fork();
+            if (child < 0)
+            {
+                cout << "Recovery: FAILED, couldn't start a process" << endl;
+                return false;
+            }
+
+            if (child == 0)
+            {
+                close(reportPipe[0]);
+                AppendUntilKilled(folder, reportPipe[1], (round + 1) * RECOVERY_IDS_PER_ROUND, isOnline);
+            }
+
+            close(reportPipe[1]);
+
+            // Read as the reports arrive, so the process isn't held up by a
+            // full pipe, and collect any partial message for the next read.
+            vector<char> reports;
+            thread reader([&reports, fd = reportPipe[0]]() {
+                char buffer[4096];
+                ssize_t bytesRead;
+                while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
+                {
+                    reports.insert(reports.end(), buffer, buffer + bytesRead);
+                }
+            });
+
+            this_thread::sleep_for(milliseconds(killAfterMilliseconds(random)));
+            kill(child, SIGKILL);
+            waitpid(child, nullptr, 0);
+            reader.join();
+            close(reportPipe[0]);
+
+            for (size_t offset = 0; offset + REPORT_SIZE <= reports.size(); offset += REPORT_SIZE)
+            {
+                long long id;
+                memcpy(&id, reports.data() + offset + 1, sizeof(id));
+
+                switch (reports[offset])
+                {
+                case REPORT_APPENDED:
+                    mustBePending.insert(id);
+                    totalAppended++;
+                    break;
+
+                case REPORT_ACKNOWLEDGING:
+                    // Until Acknowledge returns, the record may or may not be
+                    // in the log.
+                    mustBePending.erase(id);
+                    break;
+
+                case REPORT_ACKNOWLEDGED:
+                    mustNotBePending.insert(id);
+                    break;
+                }
+            }
+
+            auto start = steady_clock::now();
+            SegmentedLog log(folder, RECOVERY_MAXIMUM_SEGMENT_SIZE);
+            auto pending = log.GetPendingRecords();
+            totalReopenDuration += steady_clock::now() - start;
+
+            set<long long> pendingIds;
+            for (auto& record : pending)
+            {
+                pendingIds.insert(record.Id);
+            }
+
+            size_t lost = 0;
+            for (auto id : mustBePending)
+            {
+                if (pendingIds.find(id) == pendingIds.end())
+                {
+                    lost++;
+                }
+            }
+
+            size_t resurrected = 0;
+            for (auto id : pendingIds)
+            {
+                if (mustNotBePending.find(id) != mustNotBePending.end())
+                {
+                    resurrected++;
+                }
+            }
+
+            if (lost > 0 || resurrected > 0)
+            {
+                cout << "Recovery: FAILED in round " << round + 1 << " (seed " << seed << "), " << lost << " of "
+                     << mustBePending.size() << " written records were lost, and " << resurrected
+                     << " acknowledged records came back" << endl;
+                return false;
+            }
+        }
+
+        cout << "Recovery: " << settings.RecoveryRounds << " rounds killed after writing " << totalAppended
+             << " records, nothing lost; reopened in " << duration_cast<microseconds>(totalReopenDuration).count() / (max)(settings.RecoveryRounds, 1)
+             << " us on average" << endl;
+
+        return true;
+    }
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    bool quick = (argc > 1) && (string(argv[1]) == "--quick");
+    BenchmarkSettings settings = quick ? BenchmarkSettings{ 50, 20, 40, 25 } : BenchmarkSettings{ 50, 200, 400, 100 };
+
+    auto folder = fs::temp_directory_path() / ("StorageBenchmarks-" + to_string(steady_clock::now().time_since_epoch().count()));
+    auto runInEmptyFolder = [&folder](const function<bool()>& benchmark) {
+        fs::remove_all(folder);
+        fs::create_directories(folder);
+        auto result = benchmark();
+        fs::remove_all(folder);
+        return result;
+    };
+
+    bool succeeded = true;
+
+    succeeded &= runInEmptyFolder([&settings]() {
+        MemoryRecordStore store;
+        return MeasureThroughput(store, "MemoryRecordStore", settings, false);
+    });
+
+    succeeded &= runInEmptyFolder([&folder, &settings]() {
+        SegmentedLog log(folder);
+        return MeasureThroughput(log, "SegmentedLog", settings, false);
+    });
+
+    succeeded &= runInEmptyFolder([&folder, &settings]() {
+        SegmentedLog log(folder);
+        return MeasureThroughput(log, "SegmentedLog (flushed to disk)", settings, true);
+    });
+
+    succeeded &= runInEmptyFolder([&folder, &settings]() {
+        return MeasureRestore(folder, settings);
+    });
+
+#ifndef _WIN32
+    succeeded &= runInEmptyFolder([&folder, &settings]() {
+        return MeasureRecovery(folder, settings);
+    });
+#else
+    cout << "Recovery: skipped, killing a process part way through writing needs fork()" << endl;
+#endif
+
+    return succeeded ? 0 : 1;
+}
\ No newline at end of file
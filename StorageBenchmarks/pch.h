@@ -0,0 +1,13 @@
+#pragma once
+
+// The storage layer only relies on the standard library, so when it is built
+// on its own (see CMakeLists.txt) this stands in for the shared precompiled
+// header used by the UWP projects.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
\ No newline at end of file
@@ -244,6 +244,46 @@ namespace Codevoid::Tests
             Assert::IsTrue(status, L"Queue didn't reach 0 before timeout");
         }
 
+        TEST_METHOD(IdleTimeoutIsResetEachTimeWorkIsAdded)
+        {
+            condition_variable workDequeued;
+            mutex workMutex;
+            unique_lock<mutex> workLock(workMutex);
+            atomic<int> batchesProcessed = 0;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&workDequeued, &batchesProcessed](auto)
+                {
+                    batchesProcessed += 1;
+                    workDequeued.notify_all();
+                }, L"IdleTimeoutIsResetEachTimeWorkIsAdded", 200ms, 100);
+
+            worker.Start();
+            this_thread::sleep_for(100ms); // Wait for worker to be ready
+
+            // Keep adding items more frequently than the idle timeout, for
+            // longer than the idle timeout. Nothing should be processed until
+            // we've stopped adding items.
+            for (int i = 0; i < 10; i++)
+            {
+                worker.AddWork(make_shared<int>(i));
+                this_thread::sleep_for(50ms);
+            }
+
+            size_t queueLengthWhileAdding = worker.GetQueueLength();
+
+            auto status = workDequeued.wait_for(workLock, 1000ms, [&worker]() {
+                return worker.GetQueueLength() == 0;
+            });
+
+            worker.Shutdown();
+
+            Assert::AreEqual(10, (int)queueLengthWhileAdding, L"Items were processed before the idle timeout");
+            Assert::IsTrue(status, L"Queue didn't reach 0 before timeout");
+            Assert::AreEqual(1, batchesProcessed.load(), L"Items should have been processed in a single batch");
+        }
+
         TEST_METHOD(WorkIsDeqeuedOnShutdownDrainBeforeTimeoutOrThreshold)
         {
             bool postProcessCalled = false;
@@ -905,5 +945,744 @@ namespace Codevoid::Tests
             Assert::AreEqual(2, (int)postProcessItemsBeforeShutdown, L"No items should have been post processed before shutdown");
             Assert::AreEqual(1, (int)processItemsCallCountBeforeShutdown, L"Wrong number of retry attempts made");
         }
+
+        TEST_METHOD(WorkIsProbedAfterRetryLimitWhenCircuitBreakerIsEnabled)
+        {
+            atomic<bool> rejectAllItems = true;
+            atomic<int> postProcessItemsCount = 0;
+            mutex batchSizesLock;
+            vector<size_t> batchSizes;
+
+            BackgroundWorker<int> worker([&rejectAllItems, &batchSizesLock, &batchSizes](auto current, auto shouldKeepProcessing)
+            {
+                {
+                    lock_guard<mutex> lock(batchSizesLock);
+                    batchSizes.push_back(current.size());
+                }
+
+                if (rejectAllItems.load())
+                {
+                    return vector<shared_ptr<int>>();
+                }
+
+                return processAll(current, shouldKeepProcessing);
+            },
+                [&postProcessItemsCount](auto postProcessItems)
+            {
+                postProcessItemsCount += (int)postProcessItems.size();
+            }, L"WorkIsProbedAfterRetryLimitWhenCircuitBreakerIsEnabled", 10ms, 1);
+
+            worker.EnableBackoffOnRetry();
+            worker.SetRetryLimits(1);
+            worker.SetBackoffDelay(1ms);
+            worker.EnableCircuitBreaker(20ms, 1);
+
+            worker.AddWork({ make_shared<int>(1), make_shared<int>(2), make_shared<int>(3) });
+            worker.Start();
+
+            // Long enough to run out of retries, and probe a few times
+            this_thread::sleep_for(200ms);
+            Assert::IsTrue(worker.IsProcessing(), L"Queue shouldn't have paused");
+
+            {
+                lock_guard<mutex> lock(batchSizesLock);
+                Assert::IsTrue(batchSizes.size() > 3, L"Queue should have continued to probe");
+                Assert::AreEqual(3, (int)batchSizes[0], L"First attempt should have been a full batch");
+                Assert::AreEqual(3, (int)batchSizes[1], L"Retry should have been a full batch");
+                for (size_t i = 2; i < batchSizes.size(); i++)
+                {
+                    Assert::AreEqual(1, (int)batchSizes[i], L"Probes should be limited to the probe batch size");
+                }
+            }
+
+            // Once the probe succeeds, the rest should be processed as normal
+            rejectAllItems = false;
+            auto start = chrono::steady_clock::now();
+            while ((postProcessItemsCount.load() < 3) && ((chrono::steady_clock::now() - start) < 1s))
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            worker.Shutdown();
+
+            Assert::AreEqual(3, postProcessItemsCount.load(), L"All items should have been processed after a successful probe");
+        }
+
+        TEST_METHOD(ProbeBatchSizeMustBeAtLeastOne)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"ProbeBatchSizeMustBeAtLeastOne");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.EnableCircuitBreaker(1000ms, 0);
+            }, L"Expected exception when setting a zero probe batch size");
+        }
+
+        TEST_METHOD(BatchesAreLimitedToTheMaximumBatchSize)
+        {
+            condition_variable workDequeued;
+            mutex workMutex;
+            unique_lock<mutex> workLock(workMutex);
+            vector<size_t> batchSizes;
+            vector<size_t> queueLengthsDuringBatch;
+            atomic<size_t> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                [&batchSizes, &queueLengthsDuringBatch, &worker](auto current, auto shouldKeepProcessing)
+                {
+                    batchSizes.push_back(current.size());
+                    queueLengthsDuringBatch.push_back(worker.GetQueueLength());
+                    return processAll(current, shouldKeepProcessing);
+                },
+                [&workDequeued, &postProcessItemsCount](auto items)
+                {
+                    postProcessItemsCount += items.size();
+                    workDequeued.notify_all();
+                }, L"BatchesAreLimitedToTheMaximumBatchSize", 1000ms, 1);
+
+            worker.SetMaximumBatchSize(10);
+
+            for (int i = 0; i < 25; i++)
+            {
+                worker.AddWork(make_shared<int>(i));
+            }
+
+            worker.Start();
+
+            auto status = workDequeued.wait_for(workLock, 500ms, [&postProcessItemsCount]() {
+                return postProcessItemsCount.load() == 25;
+            });
+
+            worker.Shutdown();
+
+            Assert::IsTrue(status, L"Items weren't all processed before timeout");
+            Assert::AreEqual(3, (int)batchSizes.size(), L"Wrong number of batches");
+            Assert::AreEqual(10, (int)batchSizes[0], L"First batch should be limited");
+            Assert::AreEqual(10, (int)batchSizes[1], L"Second batch should be limited");
+            Assert::AreEqual(5, (int)batchSizes[2], L"Last batch should contain the remainder");
+            Assert::AreEqual(25, (int)queueLengthsDuringBatch[0], L"Items not in the batch should remain in the queue");
+        }
+
+        TEST_METHOD(MaximumBatchSizeMustBeAtLeastOne)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"MaximumBatchSizeMustBeAtLeastOne");
+
+            bool exceptionSeen = false;
+            try
+            {
+                worker.SetMaximumBatchSize(0);
+            }
+            catch (const invalid_argument&)
+            {
+                exceptionSeen = true;
+            }
+
+            Assert::IsTrue(exceptionSeen, L"Expected exception when setting a zero batch size");
+        }
+
+        TEST_METHOD(QueueLengthIsAvailableForEachPriority)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"QueueLengthIsAvailableForEachPriority");
+
+            worker.AddWork(make_shared<int>(1), WorkPriority::Low);
+            worker.AddWork(make_shared<int>(2), WorkPriority::Low);
+            worker.AddWork({ make_shared<int>(3), make_shared<int>(4), make_shared<int>(5) }, WorkPriority::Normal);
+            worker.AddWork(make_shared<int>(6), WorkPriority::High);
+
+            Assert::AreEqual(2, (int)worker.GetQueueLength(WorkPriority::Low), L"Wrong number of low priority items");
+            Assert::AreEqual(3, (int)worker.GetQueueLength(WorkPriority::Normal), L"Wrong number of normal priority items");
+            Assert::AreEqual(1, (int)worker.GetQueueLength(WorkPriority::High), L"Wrong number of high priority items");
+            Assert::AreEqual(6, (int)worker.GetQueueLength(), L"Wrong number of items in total");
+        }
+
+        TEST_METHOD(HighPriorityItemsAreProcessedAheadOfEarlierItems)
+        {
+            vector<vector<int>> batches;
+            atomic<int> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                [&batches](auto current, auto shouldKeepProcessing)
+                {
+                    vector<int> batch;
+                    for (auto&& item : current)
+                    {
+                        batch.push_back(*item);
+                    }
+
+                    batches.push_back(batch);
+                    return processAll(current, shouldKeepProcessing);
+                },
+                [&postProcessItemsCount](auto items)
+                {
+                    postProcessItemsCount += (int)items.size();
+                }, L"HighPriorityItemsAreProcessedAheadOfEarlierItems", 1000ms, 1000);
+
+            worker.SetMaximumBatchSize(10);
+
+            for (int i = 0; i < 30; i++)
+            {
+                worker.AddWork(make_shared<int>(i), WorkPriority::Low);
+            }
+
+            for (int i = 100; i < 130; i++)
+            {
+                worker.AddWork(make_shared<int>(i), WorkPriority::Normal);
+            }
+
+            for (int i = 200; i < 205; i++)
+            {
+                worker.AddWork(make_shared<int>(i), WorkPriority::High);
+            }
+
+            worker.Start();
+            worker.Shutdown();
+
+            Assert::AreEqual(65, postProcessItemsCount.load(), L"Not all items were processed");
+
+            // With weights of 6, 3 & 1, the high priority items only need 5 of
+            // their 6 places, so the spare one goes to the normal priority lane.
+            auto& firstBatch = batches[0];
+            Assert::AreEqual(10, (int)firstBatch.size(), L"First batch was the wrong size");
+            for (int i = 0; i < 5; i++)
+            {
+                Assert::AreEqual(200 + i, firstBatch[i], L"High priority items should be first, in order");
+            }
+
+            for (int i = 0; i < 4; i++)
+            {
+                Assert::AreEqual(100 + i, firstBatch[5 + i], L"Normal priority items should follow, in order");
+            }
+
+            Assert::AreEqual(0, firstBatch[9], L"Low priority items should get a share of the batch");
+        }
+
+        TEST_METHOD(HighPriorityWorkDoesNotWaitForIdleTimeout)
+        {
+            condition_variable workDequeued;
+            mutex workMutex;
+            unique_lock<mutex> workLock(workMutex);
+            atomic<int> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&workDequeued, &postProcessItemsCount](auto items)
+                {
+                    postProcessItemsCount += (int)items.size();
+                    workDequeued.notify_all();
+                }, L"HighPriorityWorkDoesNotWaitForIdleTimeout", 5000ms, 100);
+
+            worker.Start();
+
+            // Give the worker a chance to start waiting
+            this_thread::sleep_for(20ms);
+            worker.AddWork(make_shared<int>(7), WorkPriority::Normal);
+            worker.AddWork(make_shared<int>(8), WorkPriority::High);
+
+            auto status = workDequeued.wait_for(workLock, 500ms, [&postProcessItemsCount]() {
+                return postProcessItemsCount.load() == 2;
+            });
+
+            worker.ShutdownAndDrop();
+
+            Assert::IsTrue(status, L"High priority item wasn't processed before the idle timeout");
+        }
+
+        TEST_METHOD(PriorityWeightMustBeAtLeastOne)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"PriorityWeightMustBeAtLeastOne");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.SetPriorityWeight(WorkPriority::High, 0);
+            }, L"Expected exception when setting a zero weight");
+        }
+
+        TEST_METHOD(AsyncCallbacksAreCompletedBeforeTheNextBatchIsStarted)
+        {
+            atomic<int> callbacksInProgress = 0;
+            atomic<bool> overlappingCallbacksSeen = false;
+            atomic<int> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                [&callbacksInProgress, &overlappingCallbacksSeen](auto& current, auto& shouldKeepProcessing)
+                {
+                    if ((callbacksInProgress += 1) > 1)
+                    {
+                        overlappingCallbacksSeen = true;
+                    }
+
+                    return create_task([&callbacksInProgress, &current, &shouldKeepProcessing]() {
+                        this_thread::sleep_for(10ms);
+                        callbacksInProgress -= 1;
+                        return processAll(current, shouldKeepProcessing);
+                    });
+                },
+                [&callbacksInProgress, &overlappingCallbacksSeen, &postProcessItemsCount](auto& items)
+                {
+                    if ((callbacksInProgress += 1) > 1)
+                    {
+                        overlappingCallbacksSeen = true;
+                    }
+
+                    return create_task([&callbacksInProgress, &postProcessItemsCount, &items]() {
+                        this_thread::sleep_for(10ms);
+                        postProcessItemsCount += (int)items.size();
+                        callbacksInProgress -= 1;
+                    });
+                }, L"AsyncCallbacksAreCompletedBeforeTheNextBatchIsStarted", 1000ms, 1);
+
+            worker.SetMaximumBatchSize(2);
+
+            for (int i = 0; i < 7; i++)
+            {
+                worker.AddWork(make_shared<int>(i));
+            }
+
+            worker.Start();
+            worker.Shutdown();
+
+            Assert::AreEqual(7, postProcessItemsCount.load(), L"Not all items were post processed");
+            Assert::AreEqual(0, (int)worker.GetQueueLength(), L"Items still in queue");
+            Assert::IsFalse(overlappingCallbacksSeen.load(), L"Callbacks were invoked before the previous ones had completed");
+        }
+
+        TEST_METHOD(CapacityMustAllowAtLeastOneItem)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"CapacityMustAllowAtLeastOneItem");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.SetCapacity(0, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::RejectNew);
+            }, L"Expected exception when setting a zero item capacity");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.SetCapacity(BackgroundWorker<int>::UNBOUNDED, 0, OverflowPolicy::RejectNew);
+            }, L"Expected exception when setting a zero byte capacity");
+        }
+
+        TEST_METHOD(NewWorkIsRejectedWhenOverCapacity)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"NewWorkIsRejectedWhenOverCapacity");
+
+            worker.SetCapacity(3, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::RejectNew);
+
+            Assert::IsTrue(worker.AddWork(make_shared<int>(1)), L"First item should have been added");
+            Assert::IsTrue(worker.AddWork({ make_shared<int>(2), make_shared<int>(3) }), L"Items within capacity should have been added");
+            Assert::IsFalse(worker.AddWork(make_shared<int>(4)), L"Item over capacity should have been rejected");
+            Assert::IsFalse(worker.AddWork({ make_shared<int>(5), make_shared<int>(6) }, WorkPriority::High), L"Items over capacity should have been rejected");
+
+            Assert::AreEqual(3, (int)worker.GetQueueLength(), L"Rejected items shouldn't be in the queue");
+            Assert::AreEqual(3, (int)worker.GetOverflowCount(OverflowPolicy::RejectNew), L"Wrong number of rejected items");
+        }
+
+        TEST_METHOD(OldestItemsAreDroppedWhenOverCapacity)
+        {
+            vector<int> processed;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&processed](auto items)
+                {
+                    for (auto&& item : items)
+                    {
+                        processed.push_back(*item);
+                    }
+                }, L"OldestItemsAreDroppedWhenOverCapacity");
+
+            worker.SetCapacity(3, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::DropOldest);
+
+            worker.AddWork(make_shared<int>(1), WorkPriority::High);
+            worker.AddWork(make_shared<int>(2), WorkPriority::Low);
+            worker.AddWork(make_shared<int>(3), WorkPriority::Normal);
+            Assert::IsTrue(worker.AddWork(make_shared<int>(4), WorkPriority::Normal), L"New item should always be added");
+
+            Assert::AreEqual(3, (int)worker.GetQueueLength(), L"Queue should be at capacity");
+            Assert::AreEqual(1, (int)worker.GetOverflowCount(OverflowPolicy::DropOldest), L"Wrong number of dropped items");
+
+            worker.Start();
+            worker.Shutdown();
+
+            sort(begin(processed), end(processed));
+            Assert::AreEqual(3, (int)processed.size(), L"Wrong number of items processed");
+            Assert::AreEqual(2, processed[0], L"Oldest item should have been dropped");
+        }
+
+        TEST_METHOD(LowestPriorityItemsAreDroppedWhenOverCapacity)
+        {
+            vector<int> processed;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&processed](auto items)
+                {
+                    for (auto&& item : items)
+                    {
+                        processed.push_back(*item);
+                    }
+                }, L"LowestPriorityItemsAreDroppedWhenOverCapacity");
+
+            worker.SetCapacity(3, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::DropLowestPriority);
+
+            worker.AddWork(make_shared<int>(1), WorkPriority::High);
+            worker.AddWork(make_shared<int>(2), WorkPriority::Normal);
+            worker.AddWork(make_shared<int>(3), WorkPriority::Low);
+            worker.AddWork(make_shared<int>(4), WorkPriority::Normal);
+
+            Assert::AreEqual(0, (int)worker.GetQueueLength(WorkPriority::Low), L"Low priority item should have been dropped");
+            Assert::AreEqual(1, (int)worker.GetOverflowCount(OverflowPolicy::DropLowestPriority), L"Wrong number of dropped items");
+
+            // With no low priority items left, the oldest normal priority item
+            // is the next to go.
+            worker.AddWork(make_shared<int>(5), WorkPriority::High);
+
+            worker.Start();
+            worker.Shutdown();
+
+            sort(begin(processed), end(processed));
+            Assert::AreEqual(3, (int)processed.size(), L"Wrong number of items processed");
+            Assert::AreEqual(1, processed[0], L"High priority item should have been kept");
+            Assert::AreEqual(4, processed[1], L"Newest normal priority item should have been kept");
+            Assert::AreEqual(5, processed[2], L"High priority item should have been kept");
+        }
+
+        TEST_METHOD(BlockedWorkIsAddedOnceThereIsRoom)
+        {
+            atomic<int> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&postProcessItemsCount](auto items)
+                {
+                    postProcessItemsCount += (int)items.size();
+                }, L"BlockedWorkIsAddedOnceThereIsRoom", 10ms, 1);
+
+            worker.SetCapacity(1, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::Block);
+            worker.SetBlockingTimeout(5000ms);
+            worker.Start();
+
+            for (int i = 0; i < 5; i++)
+            {
+                Assert::IsTrue(worker.AddWork(make_shared<int>(i)), L"Item should have been added once there was room");
+            }
+
+            worker.Shutdown();
+
+            Assert::AreEqual(5, postProcessItemsCount.load(), L"Not all items were processed");
+            Assert::AreEqual(0, (int)worker.GetOverflowCount(OverflowPolicy::Block), L"Nothing should have timed out");
+        }
+
+        TEST_METHOD(BlockedWorkIsNotAddedAfterTimeout)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"BlockedWorkIsNotAddedAfterTimeout");
+
+            worker.SetCapacity(1, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::Block);
+            worker.SetBlockingTimeout(50ms);
+            worker.AddWork(make_shared<int>(1));
+
+            auto start = chrono::steady_clock::now();
+            auto added = worker.AddWork(make_shared<int>(2));
+            auto blockedFor = chrono::steady_clock::now() - start;
+
+            Assert::IsFalse(added, L"Item shouldn't have been added");
+            Assert::IsTrue(blockedFor >= 50ms, L"Didn't block for the timeout");
+            Assert::AreEqual(1, (int)worker.GetQueueLength(), L"Wrong number of items in the queue");
+            Assert::AreEqual(1, (int)worker.GetOverflowCount(OverflowPolicy::Block), L"Wrong number of timed out items");
+        }
+
+        TEST_METHOD(ByteCapacityUsesTheItemSize)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"ByteCapacityUsesTheItemSize", 10ms, 1);
+
+            worker.SetItemSizeCallback([](const int& item) { return (size_t)item; });
+            worker.SetCapacity(BackgroundWorker<int>::UNBOUNDED, 10, OverflowPolicy::RejectNew);
+
+            Assert::IsTrue(worker.AddWork({ make_shared<int>(4), make_shared<int>(5) }), L"Items within capacity should have been added");
+            Assert::IsFalse(worker.AddWork(make_shared<int>(2)), L"Item over capacity should have been rejected");
+            Assert::IsTrue(worker.AddWork(make_shared<int>(1)), L"Item within capacity should have been added");
+            Assert::AreEqual(10, (int)worker.GetQueueSizeInBytes(), L"Wrong queue size");
+
+            worker.Start();
+            worker.Shutdown();
+
+            Assert::AreEqual(0, (int)worker.GetQueueSizeInBytes(), L"Processed items should have been removed from the queue size");
+        }
+
+        TEST_METHOD(ClearingReleasesCapacity)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"ClearingReleasesCapacity");
+
+            worker.SetItemSizeCallback([](const int& item) { return (size_t)item; });
+            worker.SetCapacity(2, BackgroundWorker<int>::UNBOUNDED, OverflowPolicy::RejectNew);
+            worker.AddWork({ make_shared<int>(3), make_shared<int>(4) });
+
+            worker.Clear();
+
+            Assert::AreEqual(0, (int)worker.GetQueueSizeInBytes(), L"Cleared items should have been removed from the queue size");
+            Assert::IsTrue(worker.AddWork(make_shared<int>(5)), L"Should be room once the queue was cleared");
+        }
+
+        TEST_METHOD(ItemsLeftInTheQueueAreRecountedOnceProcessed)
+        {
+            atomic<int> batchCount = 0;
+            atomic<bool> firstBatchCompleted = false;
+
+            BackgroundWorker<int> worker(
+                [&batchCount](const vector<shared_ptr<int>>& items, const function<bool()>&) {
+                    // The first batch makes every item smaller, but only
+                    // finishes with the first; later batches finish nothing.
+                    vector<shared_ptr<int>> processed;
+                    if (batchCount++ == 0)
+                    {
+                        for (auto&& item : items)
+                        {
+                            *item = 1;
+                        }
+
+                        processed.push_back(items.front());
+                    }
+
+                    return processed;
+                },
+                [&firstBatchCompleted](auto) { firstBatchCompleted = true; },
+                L"ItemsLeftInTheQueueAreRecountedOnceProcessed", 10ms, 1);
+
+            worker.SetItemSizeCallback([](const int& item) { return (size_t)item; });
+            worker.AddWork({ make_shared<int>(4), make_shared<int>(5), make_shared<int>(6) });
+            Assert::AreEqual(15, (int)worker.GetQueueSizeInBytes(), L"Wrong queue size before processing");
+
+            worker.Start();
+            for (int i = 0; (i < 1000) && !firstBatchCompleted; i++)
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            Assert::IsTrue(firstBatchCompleted.load(), L"First batch wasn't processed");
+            Assert::AreEqual(2, (int)worker.GetQueueSizeInBytes(), L"Items left in the queue should be counted at their new size");
+
+            worker.ShutdownAndDrop();
+        }
+
+        TEST_METHOD(SettingItemSizeCallbackAfterAddingWorkThrows)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"SettingItemSizeCallbackAfterAddingWorkThrows");
+
+            worker.AddWork(make_shared<int>(1));
+
+            Assert::ExpectException<logic_error>([&worker]() {
+                worker.SetItemSizeCallback([](const int&) { return (size_t)1; });
+            }, L"Expected exception when setting item size callback with work queued");
+        }
+
+        TEST_METHOD(ItemThresholdCanBeChangedWhileRunning)
+        {
+            atomic<int> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&postProcessItemsCount](auto items)
+                {
+                    postProcessItemsCount += (int)items.size();
+                }, L"ItemThresholdCanBeChangedWhileRunning", 10000ms, 100);
+
+            worker.Start();
+            this_thread::sleep_for(100ms); // Wait for worker to be ready
+            for (int i = 0; i < 5; i++)
+            {
+                worker.AddWork(make_shared<int>(i));
+            }
+
+            this_thread::sleep_for(50ms);
+            Assert::AreEqual(0, postProcessItemsCount.load(), L"Items shouldn't have been processed before the threshold was reached");
+
+            worker.SetItemThreshold(5);
+            auto start = chrono::steady_clock::now();
+            while ((postProcessItemsCount.load() < 5) && ((chrono::steady_clock::now() - start) < 1s))
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            Assert::AreEqual(5, postProcessItemsCount.load(), L"Items should have been processed once the threshold was lowered");
+            worker.Shutdown();
+        }
+
+        TEST_METHOD(IdleTimeoutCanBeChangedWhileRunning)
+        {
+            atomic<int> postProcessItemsCount = 0;
+
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [&postProcessItemsCount](auto items)
+                {
+                    postProcessItemsCount += (int)items.size();
+                }, L"IdleTimeoutCanBeChangedWhileRunning", 10000ms, 100);
+
+            worker.Start();
+            this_thread::sleep_for(100ms); // Wait for worker to be ready
+            worker.SetIdleTimeout(10ms);
+            worker.AddWork(make_shared<int>(1));
+
+            auto start = chrono::steady_clock::now();
+            while ((postProcessItemsCount.load() < 1) && ((chrono::steady_clock::now() - start) < 1s))
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            Assert::AreEqual(1, postProcessItemsCount.load(), L"Item should have been processed after the new idle timeout");
+            worker.Shutdown();
+        }
+
+        TEST_METHOD(AdaptiveDebounceBoundsMustBeValid)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"AdaptiveDebounceBoundsMustBeValid");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.EnableAdaptiveDebounce(100ms, 0, 10, 1ms);
+            }, L"Expected exception with a zero minimum threshold");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.EnableAdaptiveDebounce(100ms, 20, 10, 1ms);
+            }, L"Expected exception with the minimum threshold above the maximum");
+
+            Assert::ExpectException<invalid_argument>([&worker]() {
+                worker.EnableAdaptiveDebounce(100ms, 1, 10, 200ms);
+            }, L"Expected exception with the minimum timeout above the latency target");
+        }
+
+        TEST_METHOD(AdaptiveDebounceRaisesThresholdWhenItemsArriveRapidly)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"AdaptiveDebounceRaisesThresholdWhenItemsArriveRapidly");
+
+            worker.EnableAdaptiveDebounce(200ms, 2, 100, 5ms);
+            for (int i = 0; i < 100; i++)
+            {
+                worker.AddWork(make_shared<int>(i));
+            }
+
+            Assert::AreEqual(100, (int)worker.GetItemThreshold(), L"Threshold should be at the maximum");
+            Assert::AreEqual(5, (int)worker.GetIdleTimeout().count(), L"Idle timeout should be at the minimum");
+        }
+
+        TEST_METHOD(AdaptiveDebounceLowersThresholdWhenItemsArriveSlowly)
+        {
+            BackgroundWorker<int> worker(
+                bind(processAll, placeholders::_1, placeholders::_2),
+                [](auto) {},
+                L"AdaptiveDebounceLowersThresholdWhenItemsArriveSlowly");
+
+            worker.EnableAdaptiveDebounce(200ms, 1, 100, 5ms);
+            for (int i = 0; i < 30; i++)
+            {
+                worker.AddWork(make_shared<int>(i));
+                this_thread::sleep_for(20ms);
+            }
+
+            // ~20ms between items means ~10 within the latency target, and
+            // considering a burst complete after ~40ms. Sleeping can overshoot,
+            // so these are approximate.
+            auto threshold = (int)worker.GetItemThreshold();
+            auto idleTimeout = worker.GetIdleTimeout();
+            Assert::IsTrue((threshold >= 3) && (threshold <= 10), L"Threshold should reflect the rate items were added");
+            Assert::IsTrue((idleTimeout >= 40ms) && (idleTimeout <= 140ms), L"Idle timeout should reflect the rate items were added");
+        }
+
+        TEST_METHOD(AddingWorkScalesAcrossProducerThreads)
+        {
+            // Not a pass/fail test for performance -- this logs the time each
+            // AddWork call takes as the number of threads concurrently adding
+            // items increases, while the worker is draining the queue.
+            constexpr int TOTAL_ITEMS = 64000;
+
+            for (int producerCount : { 1, 2, 4, 8, 16, 32 })
+            {
+                atomic<int> postProcessItemsCount = 0;
+                BackgroundWorker<int> worker(
+                    bind(processAll, placeholders::_1, placeholders::_2),
+                    [&postProcessItemsCount](auto items)
+                    {
+                        postProcessItemsCount += (int)items.size();
+                    }, L"AddingWorkScalesAcrossProducerThreads", 10ms, 100);
+
+                worker.SetMaximumBatchSize(500);
+                worker.Start();
+
+                const int itemsPerProducer = TOTAL_ITEMS / producerCount;
+                atomic<int> readyProducers = 0;
+                atomic<bool> go = false;
+                vector<thread> producers;
+
+                for (int i = 0; i < producerCount; i++)
+                {
+                    producers.emplace_back([&worker, &readyProducers, &go, itemsPerProducer]() {
+                        readyProducers += 1;
+                        while (!go.load())
+                        {
+                            this_thread::yield();
+                        }
+
+                        for (int item = 0; item < itemsPerProducer; item++)
+                        {
+                            worker.AddWork(make_shared<int>(item));
+                        }
+                    });
+                }
+
+                while (readyProducers.load() < producerCount)
+                {
+                    this_thread::yield();
+                }
+
+                auto start = chrono::steady_clock::now();
+                go = true;
+
+                for (auto&& producer : producers)
+                {
+                    producer.join();
+                }
+
+                auto duration = chrono::steady_clock::now() - start;
+                worker.Shutdown();
+
+                const int itemsAdded = itemsPerProducer * producerCount;
+                Assert::AreEqual(itemsAdded, postProcessItemsCount.load(), L"Not all items were processed");
+                Assert::AreEqual(0, (int)worker.GetQueueLength(), L"Items still in queue");
+
+                wstring message = to_wstring(producerCount) + L" producer(s): "
+                    + to_wstring(chrono::duration_cast<chrono::nanoseconds>(duration).count() / itemsAdded) + L"ns per item added";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
     };
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include <cmath>
+#include <limits>
+
+#include "CppUnitTest.h"
+#include "BinaryRecord.h"
+
+using namespace std;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Codevoid::Tests
+{
+    TEST_CLASS(BinaryRecordTests)
+    {
+    public:
+        TEST_METHOD(SmallNumbersAreWrittenInASingleByte)
+        {
+            BinaryRecordWriter writer;
+            writer.WriteVarint(0);
+            writer.WriteVarint(127);
+            writer.WriteSignedVarint(-64);
+            writer.WriteSignedVarint(63);
+            Assert::AreEqual(4, (int)writer.GetRecord().size(), L"Each number should take a byte");
+
+            writer.WriteVarint(128);
+            Assert::AreEqual(6, (int)writer.GetRecord().size(), L"128 should take two bytes");
+        }
+
+        TEST_METHOD(NumbersAreReadBackAsTheyWereWritten)
+        {
+            vector<uint64_t> unsignedValues{ 0, 1, 127, 128, 300, 16384, 0xFFFFFFFFull, (numeric_limits<uint64_t>::max)() };
+            vector<int64_t> signedValues{ 0, -1, 1, -64, 64, -1234567, 1535731746000, (numeric_limits<int64_t>::min)(), (numeric_limits<int64_t>::max)() };
+            vector<double> doubles{ 0.0, -0.0, 0.25, -3.5, 1e300, numeric_limits<double>::infinity() };
+
+            BinaryRecordWriter writer;
+            for (auto&& value : unsignedValues) { writer.WriteVarint(value); }
+            for (auto&& value : signedValues) { writer.WriteSignedVarint(value); }
+            for (auto&& value : doubles) { writer.WriteDouble(value); }
+
+            BinaryRecordReader reader(writer.GetRecord());
+            for (auto&& expected : unsignedValues)
+            {
+                uint64_t value;
+                Assert::IsTrue(reader.ReadVarint(&value), L"Couldn't read unsigned value");
+                Assert::IsTrue(expected == value, L"Wrong unsigned value read");
+            }
+
+            for (auto&& expected : signedValues)
+            {
+                int64_t value;
+                Assert::IsTrue(reader.ReadSignedVarint(&value), L"Couldn't read signed value");
+                Assert::IsTrue(expected == value, L"Wrong signed value read");
+            }
+
+            for (auto&& expected : doubles)
+            {
+                double value;
+                Assert::IsTrue(reader.ReadDouble(&value), L"Couldn't read double");
+                Assert::IsTrue((expected == value) && (signbit(expected) == signbit(value)), L"Wrong double read");
+            }
+
+            Assert::IsTrue(reader.AtEnd(), L"Should have read the whole record");
+        }
+
+        TEST_METHOD(StringsAreReadBackAsTheyWereWritten)
+        {
+            // UTF-8 for "Zoë ☃", and a string with an embedded null
+            string utf8("Zo\xC3\xAB \xE2\x98\x83");
+            string withNull("a\0b", 3);
+
+            BinaryRecordWriter writer;
+            writer.WriteString(utf8);
+            writer.WriteString(string());
+            writer.WriteString(withNull);
+
+            BinaryRecordReader reader(writer.GetRecord());
+            string value;
+            Assert::IsTrue(reader.ReadString(&value) && (value == utf8), L"Wrong UTF-8 string read");
+            Assert::IsTrue(reader.ReadString(&value) && value.empty(), L"Wrong empty string read");
+            Assert::IsTrue(reader.ReadString(&value) && (value == withNull), L"Wrong string with null read");
+            Assert::IsTrue(reader.AtEnd(), L"Should have read the whole record");
+        }
+
+        TEST_METHOD(ValuesPastTheEndOfTheRecordAreNotRead)
+        {
+            BinaryRecordWriter writer;
+            writer.WriteVarint(300);
+            writer.WriteDouble(0.5);
+            writer.WriteString("Title");
+            auto record = writer.GetRecord();
+
+            // Cut the record short at every point; something must fail to
+            // read rather than reading beyond what's there.
+            for (size_t length = 0; length < record.size(); length++)
+            {
+                BinaryRecordReader reader(record.data(), length);
+                uint64_t number;
+                double fraction;
+                string title;
+
+                auto readEverything = reader.ReadVarint(&number) && reader.ReadDouble(&fraction) && reader.ReadString(&title);
+                Assert::IsFalse(readEverything, L"Shouldn't be able to read a truncated record");
+            }
+        }
+
+        TEST_METHOD(OverlongNumbersAreNotRead)
+        {
+            string record(11, '\xFF');
+            BinaryRecordReader reader(record);
+
+            uint64_t value;
+            Assert::IsFalse(reader.ReadVarint(&value), L"Number longer than 64 bits shouldn't be read");
+        }
+
+        TEST_METHOD(StringsLongerThanTheRecordAreNotRead)
+        {
+            BinaryRecordWriter writer;
+            writer.WriteVarint(100);
+            writer.WriteByte('a');
+
+            BinaryRecordReader reader(writer.GetRecord());
+            string value;
+            Assert::IsFalse(reader.ReadString(&value), L"String longer than the record shouldn't be read");
+        }
+    };
+}
\ No newline at end of file
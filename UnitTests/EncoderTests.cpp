@@ -1,8 +1,10 @@
 #include "pch.h"
 #include "CppUnitTest.h"
+#include "PayloadCodec.h"
 #include "PayloadEncoder.h"
 
 using namespace Platform;
+using namespace std;
 using namespace Codevoid::Utilities::Mixpanel;
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace Windows::Data::Json;
@@ -10,6 +12,11 @@ using namespace Windows::Foundation;
 using namespace Windows::Foundation::Collections;
 
 namespace Codevoid::Tests::Mixpanel {
+    static JsonObject^ GeneratePayloadOfEveryType()
+    {
+        return JsonObject::Parse(L"{ \"event\": \"Signed Up\", \"properties\": { \"distinct_id\": \"13793\", \"count\": 42, \"negative\": -1234567, \"fraction\": 0.25, \"large\": 1e300, \"time\": 1535731746000, \"returning\": true, \"trial\": false, \"referrer\": null, \"name\": \"Zo\u00eb \u2603\", \"tags\": [ \"a\", 1, [ ], { } ] } }");
+    }
+
     TEST_CLASS(EncoderTests)
     {
     public:
@@ -20,6 +27,98 @@ namespace Codevoid::Tests::Mixpanel {
             Assert::AreEqual(L"eyJldmVudCI6IlNpZ25lZCBVcCIsInByb3BlcnRpZXMiOnsiZGlzdGluY3RfaWQiOiIxMzc5MyIsInRva2VuIjoiZTNiYzQxMDAzMzBjMzU3MjI3NDBmYjhjNmY1YWJkZGMiLCJSZWZlcnJlZCBCeSI6IkZyaWVuZCJ9fQ==", encodedPayload, "Not equal");
         }
 
+        TEST_METHOD(UploadSizeIsEstimatedFromTheEncodedPayload)
+        {
+            // The payload includes characters that are more than one byte as
+            // UTF-8, so the estimate can't just count characters.
+            auto payload = GeneratePayloadOfEveryType();
+            auto events = ref new JsonArray();
+            for (int i = 0; i < 20; i++)
+            {
+                events->Append(payload);
+            }
+
+            size_t formEncodedSize = 0;
+            for (auto character : EncodeJson(events))
+            {
+                formEncodedSize += ((character == L'+') || (character == L'/') || (character == L'=')) ? 3 : 1;
+            }
+
+            auto estimatedSize = EstimateUploadSize(payload) * 20;
+            Assert::IsTrue(estimatedSize > (formEncodedSize * 9 / 10), L"Estimate is too small");
+            Assert::IsTrue(estimatedSize < (formEncodedSize * 11 / 10), L"Estimate is too large");
+        }
+
+        TEST_METHOD(PayloadIsRestoredFromTheBinaryFormat)
+        {
+            auto payload = GeneratePayloadOfEveryType();
+            auto encoded = EncodePayload(payload);
+            Assert::IsTrue(encoded.size() < payload->Stringify()->Length(), L"Binary format should be smaller than the JSON text");
+
+            auto decoded = DecodePayload(encoded);
+            Assert::IsNotNull(decoded, L"Payload didn't decode");
+            Assert::AreEqual(payload->Stringify()->Data(), decoded->Stringify()->Data(), L"Decoded payload didn't match");
+        }
+
+        TEST_METHOD(PayloadStoredAsJsonTextCanBeDecoded)
+        {
+            auto decoded = DecodePayload("{\"event\":\"Signed Up\"}");
+            Assert::IsNotNull(decoded, L"Payload didn't decode");
+            Assert::AreEqual(L"Signed Up", decoded->GetNamedString(L"event")->Data(), L"Wrong value decoded");
+        }
+
+        TEST_METHOD(PayloadStoredAsJsonTextCanBeConvertedToTheBinaryFormat)
+        {
+            auto payload = GeneratePayloadOfEveryType();
+            auto converted = ConvertJsonToPayload(payload->Stringify());
+            Assert::IsTrue(EncodePayload(payload) == converted, L"Converted payload doesn't match the encoded payload");
+
+            Assert::IsTrue(ConvertJsonToPayload(L"Not JSON").empty(), L"Text that isn't JSON shouldn't convert");
+            Assert::IsTrue(ConvertJsonToPayload(L"[ 1, 2 ]").empty(), L"Only objects are payloads");
+        }
+
+        TEST_METHOD(DamagedPayloadsAreNotDecoded)
+        {
+            auto encoded = EncodePayload(GeneratePayloadOfEveryType());
+            for (size_t length = 0; length < encoded.size(); length++)
+            {
+                Assert::IsNull(DecodePayload(encoded.substr(0, length)), L"Truncated payload shouldn't decode");
+            }
+
+            Assert::IsNull(DecodePayload(encoded + '\0'), L"Payload with trailing data shouldn't decode");
+            Assert::IsNull(DecodePayload(string(1, '\0') + encoded.substr(1)), L"Payload with an unknown version shouldn't decode");
+        }
+
+        TEST_METHOD(BinaryDecodingThroughputComparedToParsing)
+        {
+            // Not a pass/fail test; records the cost of restoring payloads
+            // from the binary format, compared to parsing JSON text.
+            constexpr int ITERATIONS = 10000;
+            auto payload = GeneratePayloadOfEveryType();
+            auto encoded = EncodePayload(payload);
+            auto text = payload->Stringify();
+
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < ITERATIONS; i++)
+            {
+                DecodePayload(encoded);
+            }
+            auto decodeDuration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < ITERATIONS; i++)
+            {
+                JsonObject::Parse(text);
+            }
+            auto parseDuration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+
+            wstring message = L"Binary: " + to_wstring(encoded.size()) + L" bytes, "
+                + to_wstring((ITERATIONS * 1000000LL) / (max)(decodeDuration.count(), 1LL)) + L" payloads/sec; JSON: "
+                + to_wstring(text->Length()) + L" chars, "
+                + to_wstring((ITERATIONS * 1000000LL) / (max)(parseDuration.count(), 1LL)) + L" payloads/sec";
+            Logger::WriteMessage(message.c_str());
+        }
+
         TEST_METHOD(EncodeDateTimeWithMixpanelFormat)
         {
             _SYSTEMTIME time = {
@@ -1,13 +1,18 @@
 #include "pch.h"
+#include <filesystem>
 #include <memory>
 
 #include "CppUnitTest.h"
 #include "AsyncHelper.h"
 #include "EventStorageQueue.h"
+#include "MemoryRecordStore.h"
+#include "PayloadCodec.h"
+#include "SegmentedLog.h"
 
 using namespace Platform;
 using namespace std;
 using namespace Codevoid::Tests::Utilities;
+using namespace Codevoid::Utilities;
 using namespace Codevoid::Utilities::Mixpanel;
 using namespace concurrency;
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
@@ -32,6 +37,13 @@ namespace Codevoid::Tests::Mixpanel
             }
         }
 
+        // Items are stored in folders within the queue's folder
+        auto folders = co_await storageFolder->GetFoldersAsync();
+        for (auto&& folderToDelete : folders)
+        {
+            co_await folderToDelete->DeleteAsync(StorageDeleteOption::PermanentDelete);
+        }
+
         return storageFolder;
     }
 
@@ -45,6 +57,59 @@ namespace Codevoid::Tests::Mixpanel
         return payload;
     }
 
+    static vector<shared_ptr<PayloadContainer>> GenerateItems(const int count, const long long startingAt = 0)
+    {
+        vector<shared_ptr<PayloadContainer>> items;
+        for (int i = 0; i < count; i++)
+        {
+            items.push_back(make_shared<PayloadContainer>(startingAt + i + 1, GenerateSamplePayload(), EventPriority::Normal));
+        }
+
+        return items;
+    }
+
+    // <summary>
+    // Store whose records can be made unreadable, as if reading them failed
+    // with an I/O error.
+    // </summary>
+    class UnreadableRecordStore : public MemoryRecordStore
+    {
+    public:
+        atomic<bool> Unreadable = false;
+
+        vector<LogRecord> ReadRecords(const vector<long long>& ids, vector<long long>* unreadableIds = nullptr) override
+        {
+            if (!Unreadable)
+            {
+                return MemoryRecordStore::ReadRecords(ids, unreadableIds);
+            }
+
+            if (unreadableIds != nullptr)
+            {
+                unreadableIds->insert(end(*unreadableIds), begin(ids), end(ids));
+            }
+
+            return {};
+        }
+    };
+
+    class ThreadRecordingRecordStore : public MemoryRecordStore
+    {
+    public:
+        mutex AppendThreadLock;
+        thread::id AppendThread;
+
+        bool Append(const vector<LogRecord>& records, const bool flushToDisk = false) override
+        {
+            {
+                lock_guard<mutex> lock(AppendThreadLock);
+                AppendThread = this_thread::get_id();
+            }
+
+            return MemoryRecordStore::Append(records, flushToDisk);
+        }
+    };
+
     TEST_CLASS(EventStorageQueueTests)
     {
     private:
@@ -121,7 +186,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
         }
 
         TEST_METHOD(ItemsQueuedBeforeStartingAreSuccessfullyQueued)
@@ -135,7 +200,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
         }
 
         TEST_METHOD(ItemsThatFailToWriteToDiskAreStillPassedToNextStageHandler)
@@ -145,8 +210,10 @@ namespace Codevoid::Tests::Mixpanel
             // We're going to cheat here, since we'd like at least one of the operations
             // to persist the file to disk to fail, causing the queue to get all kinds
             // of confused. What we're going to do is write a file into the location
-            // based on ID so that the write fails.
+            // based on ID, and point the storage at a folder inside that file, so
+            // that the write fails.
             AsyncHelper::RunSynced(this->WriteEmptyPayload(payloadId));
+            m_queue->m_log = make_unique<SegmentedLog>(filesystem::path(m_queueFolder->Path->Data()) / GetFileNameForId(payloadId)->Data());
 
             Assert::AreNotEqual(0, (int)payloadId, L"Didn't get a id back from queueing the event");
             Assert::AreEqual(1, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Incorrect number of items");
@@ -160,7 +227,7 @@ namespace Codevoid::Tests::Mixpanel
             Assert::IsTrue(fileWasDeleted);
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(0, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(0, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
             Assert::AreEqual(1, (int)m_writtenItems.size(), L"Items weren't passed to the next stage");
         }
 
@@ -187,7 +254,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
 
             result = m_queue->QueueEventToStorage(GenerateSamplePayload());
             Assert::AreEqual(0, (int)result, L"Got a result from queuing, when it was shutdown and shouldn't have");
@@ -206,7 +273,7 @@ namespace Codevoid::Tests::Mixpanel
 
             // Check the queue drained properly
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
 
             // Restart the queue, and queue an event
             m_queue->EnableQueuingToStorage();
@@ -221,7 +288,7 @@ namespace Codevoid::Tests::Mixpanel
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
             // 2 'cause second write in this test
-            Assert::AreEqual(2, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
         }
 
         TEST_METHOD(ItemsAreNotWrittenToDiskWhenAskedToSkipForTesting)
@@ -235,7 +302,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(0, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(0, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
         }
 
         TEST_METHOD(ItemsAreQueuedToDiskAfterDelay)
@@ -251,7 +318,7 @@ namespace Codevoid::Tests::Mixpanel
             }));
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
         }
 
         TEST_METHOD(ItemsAreQueuedToDiskAfterThreshold)
@@ -271,7 +338,155 @@ namespace Codevoid::Tests::Mixpanel
             }));
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(11, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(11, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
+        }
+
+        TEST_METHOD(BatchOfItemsIsWrittenToStorageTogether)
+        {
+            auto items = GenerateItems(10);
+
+            auto processedItems = AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+
+            Assert::AreEqual(10, (int)processedItems.size(), L"All items should have been processed");
+            Assert::AreEqual(10, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
+            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Batch should have been written to one file");
+            Assert::AreNotEqual(0, (int)processedItems.front()->SizeInBytes, L"Size of the written item wasn't recorded");
+        }
+
+        TEST_METHOD(OnlyItemsProcessedBeforeBeingAskedToStopAreWrittenToStorage)
+        {
+            auto items = GenerateItems(10);
+
+            int itemsBeforeStopping = 4;
+            auto processedItems = AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, [&itemsBeforeStopping]() {
+                return (itemsBeforeStopping-- > 0);
+            }));
+
+            Assert::AreEqual(4, (int)processedItems.size(), L"Wrong number of items processed");
+            Assert::AreEqual(4, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
+        }
+
+        TEST_METHOD(ItemsAreNotWrittenToStorageWhenDurabilityIsNone)
+        {
+            m_queue->SetDurability(EventDurability::None);
+
+            auto processedItems = AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(GenerateItems(5), []() { return true; }));
+
+            Assert::AreEqual(5, (int)processedItems.size(), L"Items should still be processed");
+            Assert::AreEqual(0, (int)this->GetCurrentItemCountInStorage(), L"Items shouldn't have been written");
+            Assert::AreEqual(0, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Didn't expect any files");
+        }
+
+        TEST_METHOD(QueuedItemsAreSizedByThePayloadsTheyHold)
+        {
+            m_queue->SetDurability(EventDurability::None);
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+
+            Assert::IsTrue(m_queue->m_writeToStorageWorker.GetQueueSizeInBytes() > 0, L"Item waiting to be written should have a size");
+
+            auto items = GenerateItems(3);
+            items[0]->UploadSizeInBytes = 100;
+            items[1]->UploadSizeInBytes = 100;
+            items[1]->SizeInBytes = 40;
+            items[2]->SizeInBytes = 40;
+            items[2]->Payload = nullptr;
+
+            Assert::AreEqual(100, (int)GetQueuedSizeInBytes(*items[0]), L"Unwritten item should be sized as it'll be sent");
+            Assert::AreEqual(40, (int)GetQueuedSizeInBytes(*items[1]), L"Written item should be sized as it was written");
+            Assert::AreEqual(0, (int)GetQueuedSizeInBytes(*items[2]), L"Item without its payload shouldn't have a size");
+        }
+
+        TEST_METHOD(DurabilityIsAppliedPerPriority)
+        {
+            m_queue->SetDurability(EventPriority::Low, EventDurability::None);
+            m_queue->SetDurability(EventPriority::High, EventDurability::FlushedPerBatch);
+
+            auto items = GenerateItems(3);
+            items[0]->Priority = EventPriority::Low;
+            items[2]->Priority = EventPriority::High;
+
+            auto processedItems = AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+
+            Assert::AreEqual(3, (int)processedItems.size(), L"All items should have been processed");
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Low priority item shouldn't have been written");
+            Assert::IsNull(this->RetrievePayloadForId(items[0]->Id), L"Low priority item shouldn't be in storage");
+            Assert::IsTrue(EventDurability::Buffered == m_queue->GetDurability(EventPriority::Normal), L"Normal priority should be unchanged");
+        }
+
+        TEST_METHOD(StorageThroughputForEachDurability)
+        {
+            // Not a pass/fail test; records how the cost of writing to
+            // storage changes with how durable the writes are.
+            constexpr int BATCH_SIZE = 50;
+            constexpr int BATCHES = 100;
+
+            vector<pair<EventDurability, wstring>> durabilities{
+                { EventDurability::None, L"None" },
+                { EventDurability::Buffered, L"Buffered" },
+                { EventDurability::FlushedPerBatch, L"FlushedPerBatch" },
+            };
+
+            for (auto&& [durability, name] : durabilities)
+            {
+                m_queue->SetDurability(durability);
+
+                auto start = chrono::steady_clock::now();
+                for (int i = 0; i < BATCHES; i++)
+                {
+                    AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(GenerateItems(BATCH_SIZE, i * BATCH_SIZE), []() { return true; }));
+                }
+
+                auto duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+                AsyncHelper::RunSynced(m_queue->Clear());
+
+                wstring message = name + L": "
+                    + to_wstring((BATCH_SIZE * BATCHES * 1000000LL) / (max)(duration.count(), 1LL)) + L" items/sec";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+
+        TEST_METHOD(LegacyItemRestoreThroughputForEachIoWindow)
+        {
+            // Not a pass/fail test; records how the number of file operations
+            // outstanding at once changes the cost of moving items stored by
+            // earlier versions into the log.
+            constexpr int ITEM_COUNT = 200;
+
+            for (size_t window : { 1, 4, 8, 16 })
+            {
+                for (int i = 0; i < ITEM_COUNT; i++)
+                {
+                    AsyncHelper::RunSynced(this->WritePayload(i + 1, GenerateSamplePayload()));
+                }
+
+                m_queue->SetStorageIoWindow(window);
+
+                auto start = chrono::steady_clock::now();
+                auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+                auto duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+
+                Assert::AreEqual(ITEM_COUNT, (int)queue.size(), L"Wrong number of items restored");
+                AsyncHelper::RunSynced(m_queue->Clear());
+
+                wstring message = L"Window " + to_wstring(window) + L": "
+                    + to_wstring((ITEM_COUNT * 1000000LL) / (max)(duration.count(), 1LL)) + L" items/sec";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+
+        TEST_METHOD(StorageIoWindowMustAllowAnOperation)
+        {
+            bool exceptionSeen = false;
+            try
+            {
+                m_queue->SetStorageIoWindow(0);
+            }
+            catch (const invalid_argument&)
+            {
+                exceptionSeen = true;
+            }
+
+            Assert::IsTrue(exceptionSeen, L"Expected to get exception when setting the window");
         }
 
         TEST_METHOD(QueuingAfterShutdownDoesntAddToQueue)
@@ -302,7 +517,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(2, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
         }
 
         TEST_METHOD(ItemContentStoredInCorrectFile)
@@ -317,9 +532,9 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
 
-            JsonObject^ fromFile = AsyncHelper::RunSynced(this->RetrievePayloadForId(result));
+            JsonObject^ fromFile = this->RetrievePayloadForId(result);
             Assert::IsNotNull(fromFile, L"Expected payload to be found, and loaded");
             if (fromFile == nullptr)
             {
@@ -343,7 +558,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
 
             Assert::AreEqual(2, (int)this->GetWrittenItemsSize(), L"Should've have anything in the successfully written queue.");
-            Assert::AreEqual(2, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
 
             AsyncHelper::RunSynced(m_queue->Clear());
 
@@ -378,7 +593,7 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(this->WritePayload(2, item2));
             AsyncHelper::RunSynced(this->WritePayload(3, item3));
 
-            auto queue = AsyncHelper::RunSynced(EventStorageQueue::LoadItemsFromStorage(m_queueFolder));
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
             Assert::AreEqual(3, (int)queue.size(), L"Expected items in the successfully written queue");
         }
 
@@ -393,10 +608,270 @@ namespace Codevoid::Tests::Mixpanel
             AsyncHelper::RunSynced(this->WritePayload(3, item3));
             AsyncHelper::RunSynced(this->WriteEmptyPayload(4));
 
-            auto queue = AsyncHelper::RunSynced(EventStorageQueue::LoadItemsFromStorage(m_queueFolder));
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
             Assert::AreEqual(3, (int)queue.size(), L"Expected items in the successfully written queue");
         }
 
+        TEST_METHOD(ItemsWrittenToStorageAreRestored)
+        {
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+
+            // Only one queue can use the folder at a time
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, m_processWrittenItemsCallback);
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(2, (int)queue.size(), L"Expected items in the successfully written queue");
+            Assert::AreEqual(m_writtenItems.front()->Id, queue.front()->Id, L"Items were restored out of order");
+        }
+
+        TEST_METHOD(RemovedItemsAreNotRestored)
+        {
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+
+            auto removedId = m_writtenItems[1]->Id;
+            AsyncHelper::RunSynced(m_queue->RemoveEventsFromStorage({ m_writtenItems[1] }));
+
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, m_processWrittenItemsCallback);
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(2, (int)queue.size(), L"Wrong number of items restored");
+            for (auto&& item : queue)
+            {
+                Assert::AreNotEqual(removedId, item->Id, L"Removed item was restored");
+            }
+        }
+
+        TEST_METHOD(ItemsCanBeKeptInASuppliedStore)
+        {
+            auto store = make_unique<MemoryRecordStore>();
+            auto storePointer = store.get();
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, move(store), m_processWrittenItemsCallback);
+
+            auto processedItems = AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(GenerateItems(5), []() { return true; }));
+
+            Assert::AreEqual(5, (int)processedItems.size(), L"All items should have been processed");
+            Assert::AreEqual(5, (int)storePointer->GetPendingRecordCount(), L"Items weren't written to the store");
+            Assert::AreEqual(0, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Nothing should have been written to the folder");
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(5, (int)queue.size(), L"Items should be restored from the store");
+        }
+
+        TEST_METHOD(ClearedItemsAreNotRestored)
+        {
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+            AsyncHelper::RunSynced(m_queue->Clear());
+
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, m_processWrittenItemsCallback);
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(0, (int)queue.size(), L"Cleared items shouldn't be restored");
+        }
+
+        TEST_METHOD(ItemsStoredInTheirOwnFilesAreMovedIntoStorage)
+        {
+            AsyncHelper::RunSynced(this->WritePayload(1, GenerateSamplePayload()));
+            AsyncHelper::RunSynced(this->WritePayload(2, GenerateSamplePayload()));
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(2, (int)queue.size(), L"Expected items to be restored");
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Items weren't moved into storage");
+            Assert::IsNull(AsyncHelper::RunSynced(m_queueFolder->TryGetItemAsync(GetFileNameForId(1))), L"Item file should have been removed");
+        }
+
+        TEST_METHOD(ItemsStoredInMoreFilesThanTheIoWindowAreAllMovedIntoStorage)
+        {
+            for (int i = 0; i < 5; i++)
+            {
+                AsyncHelper::RunSynced(this->WritePayload(i + 1, GenerateSamplePayload()));
+            }
+
+            m_queue->SetStorageIoWindow(2);
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(5, (int)queue.size(), L"Expected all the items to be restored");
+            Assert::AreEqual(5, (int)this->GetCurrentItemCountInStorage(), L"Items weren't moved into storage");
+
+            for (int i = 0; i < 5; i++)
+            {
+                Assert::IsNull(AsyncHelper::RunSynced(m_queueFolder->TryGetItemAsync(GetFileNameForId(i + 1))), L"Item file should have been removed");
+            }
+        }
+
+        TEST_METHOD(RestoredItemsHaveNoPayloadUntilLoaded)
+        {
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, m_processWrittenItemsCallback);
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(2, (int)queue.size(), L"Expected items to be restored");
+            Assert::IsNull(queue.front()->Payload, L"Payload shouldn't have been loaded");
+            Assert::AreNotEqual(0, (int)queue.front()->SizeInBytes, L"Size should be known without the payload");
+
+            auto unloadableItems = AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(queue));
+            Assert::AreEqual(0, (int)unloadableItems.size(), L"All the payloads should have loaded");
+            for (auto&& item : queue)
+            {
+                Assert::IsNotNull(item->Payload, L"Payload wasn't loaded");
+            }
+        }
+
+        TEST_METHOD(ItemsWithPayloadsThatCantBeParsedAreRemovedWhenLoaded)
+        {
+            m_queue->m_log->Append({ { 1, "{\"title\":\"Valid\"}" }, { 2, "Not JSON" } });
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(2, (int)queue.size(), L"Both items should be restored before being parsed");
+
+            auto unloadableItems = AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(queue));
+            Assert::AreEqual(1, (int)unloadableItems.size(), L"Expected one item to fail to load");
+            Assert::AreEqual(2, (int)unloadableItems.front()->Id, L"Wrong item failed to load");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Item that failed to load should have been removed");
+        }
+
+        TEST_METHOD(ItemsAreWrittenToStorageOffTheCallingThread)
+        {
+            auto store = make_unique<ThreadRecordingRecordStore>();
+            auto storePointer = store.get();
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, move(store), m_processWrittenItemsCallback);
+
+            auto items = GenerateItems(2);
+            AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Items should have been written");
+
+            lock_guard<mutex> lock(storePointer->AppendThreadLock);
+            Assert::IsTrue(storePointer->AppendThread != this_thread::get_id(), L"Storage shouldn't block the thread the write was started on");
+        }
+
+        TEST_METHOD(ItemsThatCantBeReadAreLeftInStorageToLoadLater)
+        {
+            auto store = make_unique<UnreadableRecordStore>();
+            auto storePointer = store.get();
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, move(store), m_processWrittenItemsCallback);
+            m_queue->m_log->Append({ { 1, EncodePayload(GenerateSamplePayload()) } });
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            storePointer->Unreadable = true;
+
+            auto unloadableItems = AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(queue));
+            Assert::AreEqual(0, (int)unloadableItems.size(), L"Item that couldn't be read isn't unloadable");
+            Assert::IsNull(queue.front()->Payload, L"Payload shouldn't have been loaded");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Item should have been left in storage");
+
+            storePointer->Unreadable = false;
+            unloadableItems = AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(queue));
+            Assert::AreEqual(0, (int)unloadableItems.size(), L"Item should have loaded");
+            Assert::IsNotNull(queue.front()->Payload, L"Payload should have been loaded");
+        }
+
+        TEST_METHOD(ItemsStoredInTheirOwnFilesAreConvertedToTheBinaryFormat)
+        {
+            auto payload = GenerateSamplePayload();
+            AsyncHelper::RunSynced(this->WritePayload(1, payload));
+            AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+
+            auto records = m_queue->m_log->ReadPendingRecords();
+            Assert::AreEqual(1, (int)records.size(), L"Expected the item to be moved into storage");
+            Assert::IsTrue(records.front().Payload.front() != '{', L"Item shouldn't still be stored as JSON text");
+            Assert::IsTrue(records.front().Payload.size() < payload->Stringify()->Length(), L"Binary format should be smaller than the JSON text");
+
+            auto restored = DecodePayload(records.front().Payload);
+            Assert::IsNotNull(restored, L"Converted item should decode");
+            Assert::AreEqual(payload->Stringify()->Data(), restored->Stringify()->Data(), L"Converted item didn't match the original");
+        }
+
+        TEST_METHOD(ItemsStoredInTheirOwnFilesThatArentJsonAreNotMoved)
+        {
+            auto file = AsyncHelper::RunSynced(m_queueFolder->CreateFileAsync(GetFileNameForId(1), CreationCollisionOption::ReplaceExisting));
+            AsyncHelper::RunSynced(create_task(FileIO::WriteTextAsync(file, L"Not JSON")));
+            AsyncHelper::RunSynced(this->WritePayload(2, GenerateSamplePayload()));
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(1, (int)queue.size(), L"Only the valid item should be restored");
+            Assert::AreEqual(2, (int)queue.front()->Id, L"Wrong item restored");
+        }
+
+        TEST_METHOD(ItemsFromANewerStorageFormatAreRemovedWhenLoaded)
+        {
+            auto payload = EncodePayload(GenerateSamplePayload());
+            auto newerPayload = payload;
+            newerPayload[0] += 1;
+            m_queue->m_log->Append({ { 1, payload }, { 2, newerPayload } });
+
+            auto queue = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            auto unloadableItems = AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(queue));
+            Assert::AreEqual(1, (int)unloadableItems.size(), L"Expected one item to fail to load");
+            Assert::AreEqual(2, (int)unloadableItems.front()->Id, L"Wrong item failed to load");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Item that failed to load should have been removed");
+        }
+
+        TEST_METHOD(PayloadsAreKeptOnceWrittenByDefault)
+        {
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+
+            Assert::AreEqual(1, (int)m_writtenItems.size(), L"Expected an item to be written");
+            Assert::IsTrue(m_writtenItems.front()->InStorage, L"Item should be in storage");
+            Assert::IsNotNull(m_writtenItems.front()->Payload, L"Payload shouldn't have been released");
+        }
+
+        TEST_METHOD(PayloadsAreReleasedOnceWrittenWhenEnabled)
+        {
+            m_queue->SetReleasePayloadsOnceWritten(true);
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+
+            Assert::AreEqual(2, (int)m_writtenItems.size(), L"Expected items to be written");
+            for (auto&& item : m_writtenItems)
+            {
+                Assert::IsNull(item->Payload, L"Payload should have been released");
+            }
+
+            auto unloadableItems = AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(m_writtenItems));
+            Assert::AreEqual(0, (int)unloadableItems.size(), L"All the payloads should have loaded");
+            Assert::IsNotNull(m_writtenItems.front()->Payload, L"Payload wasn't loaded");
+
+            m_queue->ReleasePayloads(m_writtenItems);
+            Assert::IsNull(m_writtenItems.front()->Payload, L"Payload should have been released again");
+        }
+
+        TEST_METHOD(PayloadsNotWrittenToStorageAreNotReleased)
+        {
+            m_queue->SetReleasePayloadsOnceWritten(true);
+            m_queue->SetDurability(EventDurability::None);
+            m_queue->EnableQueuingToStorage();
+            m_queue->QueueEventToStorage(GenerateSamplePayload());
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+
+            Assert::AreEqual(1, (int)m_writtenItems.size(), L"Expected the item to be processed");
+            Assert::IsFalse(m_writtenItems.front()->InStorage, L"Item shouldn't be in storage");
+            Assert::IsNotNull(m_writtenItems.front()->Payload, L"Payload shouldn't have been released");
+        }
+
         TEST_METHOD(ItemsCanBeRemovedFromStorage)
         {
             m_queue->SetWriteToStorageIdleLimits(10ms, 1);
@@ -408,17 +883,160 @@ namespace Codevoid::Tests::Mixpanel
             this_thread::sleep_for(50ms);
 
             Assert::AreEqual(0, (int)m_queue->GetWaitingToWriteToStorageLength(), L"Shouldn't find items waiting to be written to disk");
-            Assert::AreEqual(1, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Incorrect file count found");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Incorrect item count found");
 
             AsyncHelper::RunSynced(m_queue->RemoveEventFromStorage(*(m_writtenItems.front())));
 
-            Assert::AreEqual(0, (int)AsyncHelper::RunSynced(this->GetCurrentFileCountInQueueFolder()), L"Item wasn't deleted");
+            Assert::AreEqual(0, (int)this->GetCurrentItemCountInStorage(), L"Item wasn't deleted");
+        }
+
+        TEST_METHOD(NewItemsDontReuseTheIdsOfRestoredItems)
+        {
+            // A backlog queued faster than one item a millisecond has IDs
+            // ahead of the ones a new queue starts from.
+            auto restoredId = m_queue->m_baseId + 1;
+            auto restoredPayload = GenerateSamplePayload();
+            restoredPayload->Insert(L"title", JsonValue::CreateStringValue(L"Restored"));
+            m_queue->m_log->Append({ { restoredId, EncodePayload(restoredPayload) } });
+
+            auto restored = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            auto newId = m_queue->QueueEventToStorage(GenerateSamplePayload());
+            Assert::IsTrue(newId > restoredId, L"New item should have an ID after the restored item");
+
+            AsyncHelper::RunSynced(m_queue->PersistAllQueuedItemsToStorageAndShutdown());
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Both items should be in storage");
+
+            AsyncHelper::RunSynced(m_queue->LoadPayloadsFromStorage(restored));
+            Assert::AreEqual(L"Restored", static_cast<JsonObject^>(restored.front()->Payload)->GetNamedString(L"title")->Data(), L"Restored item's payload was replaced");
+        }
+
+        TEST_METHOD(QuarantinedItemsAreMovedOutOfStorage)
+        {
+            auto items = GenerateItems(3);
+            AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+
+            AsyncHelper::RunSynced(m_queue->QuarantineEvents({ items[1] }));
+            Assert::AreEqual(2, (int)this->GetCurrentItemCountInStorage(), L"Quarantined item should have been removed from storage");
+            Assert::AreEqual(1, (int)m_queue->GetQuarantinedEventCount(), L"Item should have been quarantined");
+
+            auto quarantined = m_queue->GetQuarantinedEvents();
+            Assert::AreEqual(1, (int)quarantined.size(), L"Wrong number of quarantined items");
+            Assert::AreEqual(items[1]->Id, quarantined.front()->Id, L"Wrong item quarantined");
+            Assert::AreEqual(L"SampleTitle", static_cast<JsonObject^>(quarantined.front()->Payload)->GetNamedString(L"title")->Data(), L"Quarantined payload is wrong");
+        }
+
+        TEST_METHOD(QuarantinedItemsWithReleasedPayloadsAreCopiedFromStorage)
+        {
+            m_queue->SetReleasePayloadsOnceWritten(true);
+            auto items = GenerateItems(1);
+            AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+            Assert::IsNull(items.front()->Payload, L"Payload should have been released");
+
+            AsyncHelper::RunSynced(m_queue->QuarantineEvents(items));
+
+            auto quarantined = m_queue->GetQuarantinedEvents();
+            Assert::AreEqual(1, (int)quarantined.size(), L"Item should have been quarantined");
+            Assert::AreEqual(L"SampleTitle", static_cast<JsonObject^>(quarantined.front()->Payload)->GetNamedString(L"title")->Data(), L"Quarantined payload is wrong");
+        }
+
+        TEST_METHOD(QuarantinedItemsThatCantBeReadAreLeftInStorage)
+        {
+            auto store = make_unique<UnreadableRecordStore>();
+            auto storePointer = store.get();
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, move(store), m_processWrittenItemsCallback);
+            m_queue->SetReleasePayloadsOnceWritten(true);
+
+            auto items = GenerateItems(1);
+            AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+            storePointer->Unreadable = true;
+
+            auto quarantined = AsyncHelper::RunSynced(m_queue->QuarantineEvents(items));
+            Assert::AreEqual(0, (int)quarantined.size(), L"Item that couldn't be read shouldn't have been quarantined");
+            Assert::AreEqual(0, (int)m_queue->GetQuarantinedEventCount(), L"Nothing should have been written to the dead-letter store");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Item should have been left in storage");
+        }
+
+        TEST_METHOD(ItemsBeyondTheMaximumAreLeftInStorage)
+        {
+            m_queue->SetMaximumQuarantinedEvents(2);
+            auto items = GenerateItems(3);
+            AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+
+            auto quarantined = AsyncHelper::RunSynced(m_queue->QuarantineEvents(items));
+            Assert::AreEqual(2, (int)quarantined.size(), L"Only the maximum number of items should have been quarantined");
+            Assert::AreEqual(2, (int)m_queue->GetQuarantinedEventCount(), L"Wrong number of items in the dead-letter store");
+            Assert::AreEqual(1, (int)this->GetCurrentItemCountInStorage(), L"Item that wasn't quarantined should have been left in storage");
+
+            m_queue->SetMaximumQuarantinedEvents(0);
+            quarantined = AsyncHelper::RunSynced(m_queue->QuarantineEvents(items));
+            Assert::AreEqual(0, (int)quarantined.size(), L"Nothing should be quarantined when the maximum is zero");
+        }
+
+        TEST_METHOD(QuarantinedItemsAreKeptWhenTheQueueIsRecreated)
+        {
+            auto items = GenerateItems(2);
+            AsyncHelper::RunSynced(m_queue->WriteItemsToStorage(items, []() { return true; }));
+            AsyncHelper::RunSynced(m_queue->QuarantineEvents({ items[0] }));
+
+            m_queue = nullptr;
+            m_queue = make_shared<EventStorageQueue>(m_queueFolder, m_processWrittenItemsCallback);
+
+            auto restored = AsyncHelper::RunSynced(m_queue->LoadItemsFromStorage());
+            Assert::AreEqual(1, (int)restored.size(), L"Quarantined item shouldn't be restored to be uploaded");
+            Assert::AreEqual(items[1]->Id, restored.front()->Id, L"Wrong item restored");
+            Assert::AreEqual(1, (int)m_queue->GetQuarantinedEventCount(), L"Quarantined item should still be kept");
+        }
+
+        TEST_METHOD(OldestQuarantinedItemsAreDroppedOnceTheMaximumIsReached)
+        {
+            m_queue->SetMaximumQuarantinedEvents(2);
+            auto items = GenerateItems(3);
+            for (auto&& item : items)
+            {
+                AsyncHelper::RunSynced(m_queue->QuarantineEvents({ item }));
+            }
+
+            auto quarantined = m_queue->GetQuarantinedEvents();
+            Assert::AreEqual(2, (int)quarantined.size(), L"Wrong number of quarantined items kept");
+            Assert::AreEqual(items[1]->Id, quarantined[0]->Id, L"Oldest item should have been dropped");
+            Assert::AreEqual(items[2]->Id, quarantined[1]->Id, L"Newest item should have been kept");
+        }
+
+        TEST_METHOD(QuarantinedItemsAreRemovedWhenQueueIsCleared)
+        {
+            AsyncHelper::RunSynced(m_queue->QuarantineEvents(GenerateItems(2)));
+            Assert::AreEqual(2, (int)m_queue->GetQuarantinedEventCount(), L"Items should have been quarantined");
+
+            AsyncHelper::RunSynced(m_queue->Clear());
+            Assert::AreEqual(0, (int)m_queue->GetQuarantinedEventCount(), L"Quarantined items should have been cleared");
         }
         
+        size_t GetCurrentItemCountInStorage()
+        {
+            return m_queue->m_log->GetPendingRecordCount();
+        }
+
         task<unsigned int> GetCurrentFileCountInQueueFolder()
         {
-            auto files = co_await m_queueFolder->GetFilesAsync();
-            return files->Size;
+            // Cleared items are removed in the background, so make sure
+            // that's finished before counting what's left.
+            auto log = dynamic_cast<SegmentedLog*>(m_queue->m_log.get());
+            if (log != nullptr)
+            {
+                log->WaitForOldGenerationsToBeRemoved();
+            }
+
+            unsigned int count = 0;
+            for (auto&& entry : filesystem::recursive_directory_iterator(m_queueFolder->Path->Data()))
+            {
+                if (entry.is_regular_file())
+                {
+                    count += 1;
+                }
+            }
+
+            return task_from_result(count);
         }
 
         task<void> WritePayload(long long id, JsonObject^ payload)
@@ -435,21 +1053,19 @@ namespace Codevoid::Tests::Mixpanel
             co_await FileIO::WriteTextAsync(file, L"");
         }
 
-        task<JsonObject^> RetrievePayloadForId(long long id)
+        JsonObject^ RetrievePayloadForId(long long id)
         {
-            auto fileName = ref new String(std::to_wstring(id).append(L".json").c_str());
-
-            StorageFile^ file = dynamic_cast<StorageFile^>(co_await m_queueFolder->TryGetItemAsync(fileName));
-
-            if (file == nullptr)
+            for (auto&& record : m_queue->m_log->ReadPendingRecords())
             {
-                return nullptr;
+                if (record.Id != id)
+                {
+                    continue;
+                }
+
+                return DecodePayload(record.Payload);
             }
-            
-            auto fileContent = co_await FileIO::ReadTextAsync(file);
-            auto result = JsonObject::Parse(fileContent);
 
-            return result;
+            return nullptr;
         }
     };
 }
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include "pch.h"
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+#include "CppUnitTest.h"
+#include "Crc32.h"
+#include "GzipCompressor.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Codevoid::Tests
+{
+    // <summary>
+    // Decompresses the block types GzipCompressor writes -- fixed Huffman
+    // blocks -- so what it writes can be checked without a full inflater.
+    // Throws if the stream isn't valid.
+    // </summary>
+    class FixedHuffmanInflater
+    {
+    public:
+        static string Inflate(const string& compressed)
+        {
+            FixedHuffmanInflater inflater(compressed);
+            return inflater.InflateStream();
+        }
+
+    private:
+        FixedHuffmanInflater(const string& compressed) : m_data(compressed), m_bitPosition(0)
+        { }
+
+        string InflateStream()
+        {
+            if ((m_data.size() < 18) || (static_cast<uint8_t>(m_data[0]) != 0x1F) || (static_cast<uint8_t>(m_data[1]) != 0x8B) || (m_data[2] != 0x08))
+            {
+                throw invalid_argument("Not a gzip stream");
+            }
+
+            m_bitPosition = 10 * 8;
+            string result;
+            bool finalBlock = false;
+            while (!finalBlock)
+            {
+                finalBlock = this->ReadBits(1) == 1;
+                if (this->ReadBits(2) != 1)
+                {
+                    throw invalid_argument("Expected a fixed Huffman block");
+                }
+
+                this->InflateBlock(result);
+            }
+
+            auto trailer = (m_bitPosition + 7) / 8;
+            if (trailer + 8 != m_data.size())
+            {
+                throw invalid_argument("Trailer is in the wrong place");
+            }
+
+            if ((ReadUInt32(trailer) != Crc32(result.data(), result.size())) || (ReadUInt32(trailer + 4) != static_cast<uint32_t>(result.size())))
+            {
+                throw invalid_argument("Trailer doesn't match the data");
+            }
+
+            return result;
+        }
+
+        void InflateBlock(string& result)
+        {
+            const vector<uint32_t> lengthBase = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            const vector<uint32_t> lengthExtra = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+            const vector<uint32_t> distanceBase = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+            const vector<uint32_t> distanceExtra = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+            while (true)
+            {
+                auto symbol = this->ReadSymbol();
+                if (symbol < 256)
+                {
+                    result.push_back(static_cast<char>(symbol));
+                    continue;
+                }
+
+                if (symbol == 256)
+                {
+                    return;
+                }
+
+                auto lengthCode = symbol - 257;
+                if (lengthCode >= lengthBase.size())
+                {
+                    throw invalid_argument("Invalid length code");
+                }
+
+                auto length = lengthBase[lengthCode] + this->ReadBits(lengthExtra[lengthCode]);
+                auto distanceCode = this->ReadCode(5);
+                if (distanceCode >= distanceBase.size())
+                {
+                    throw invalid_argument("Invalid distance code");
+                }
+
+                auto distance = distanceBase[distanceCode] + this->ReadBits(distanceExtra[distanceCode]);
+                if ((distance > result.size()) || (distance > 32768))
+                {
+                    throw invalid_argument("Distance is too far back");
+                }
+
+                for (uint32_t i = 0; i < length; i++)
+                {
+                    result.push_back(result[result.size() - distance]);
+                }
+            }
+        }
+
+        uint32_t ReadSymbol()
+        {
+            // The fixed codes are 7, 8, or 9 bits long; what's been read so
+            // far says which.
+            auto code = this->ReadCode(7);
+            if (code <= 0x17)
+            {
+                return code + 256;
+            }
+
+            code = (code << 1) | this->ReadBits(1);
+            if ((code >= 0x30) && (code <= 0xBF))
+            {
+                return code - 0x30;
+            }
+
+            if ((code >= 0xC0) && (code <= 0xC7))
+            {
+                return code - 0xC0 + 280;
+            }
+
+            code = (code << 1) | this->ReadBits(1);
+            return code - 0x190 + 144;
+        }
+
+        uint32_t ReadCode(const uint32_t length)
+        {
+            uint32_t code = 0;
+            for (uint32_t i = 0; i < length; i++)
+            {
+                code = (code << 1) | this->ReadBits(1);
+            }
+
+            return code;
+        }
+
+        uint32_t ReadBits(const uint32_t count)
+        {
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < count; i++, m_bitPosition++)
+            {
+                if (m_bitPosition / 8 >= m_data.size())
+                {
+                    throw invalid_argument("Stream ended early");
+                }
+
+                value |= ((static_cast<uint8_t>(m_data[m_bitPosition / 8]) >> (m_bitPosition % 8)) & 1) << i;
+            }
+
+            return value;
+        }
+
+        uint32_t ReadUInt32(const size_t offset)
+        {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                value |= static_cast<uint32_t>(static_cast<uint8_t>(m_data[offset + i])) << (i * 8);
+            }
+
+            return value;
+        }
+
+        const string& m_data;
+        size_t m_bitPosition;
+    };
+
+    static string GenerateEvents(const int count)
+    {
+        // Events repeat the same names & values, with a few that change
+        string events = "[";
+        for (int i = 0; i < count; i++)
+        {
+            events += "{\"event\":\"Page Viewed\",\"properties\":{\"token\":\"e3bc4100330c35722740fb8c6f5abddc\",\"distinct_id\":\"13793\",\"time\":"
+                + to_string(1535731746 + i * 7) + ",\"page\":\"Page " + to_string(i % 13) + "\",\"duration\":" + to_string((i * 37) % 1000) + "}}";
+        }
+
+        return events + "]";
+    }
+
+    static string GenerateRandomData(const size_t length)
+    {
+        mt19937 random(42);
+        string data(length, '\0');
+        for (auto&& c : data)
+        {
+            c = static_cast<char>(random() & 0xFF);
+        }
+
+        return data;
+    }
+
+    static string Compress(const string& data)
+    {
+        GzipCompressor compressor;
+        compressor.Write(data);
+        return compressor.Finish();
+    }
+
+    TEST_CLASS(GzipCompressorTests)
+    {
+    public:
+        TEST_METHOD(EmptyInputCanBeCompressed)
+        {
+            auto compressed = Compress(string());
+            Assert::IsTrue(FixedHuffmanInflater::Inflate(compressed).empty(), L"Expected nothing when decompressed");
+        }
+
+        TEST_METHOD(CompressedDataDecompressesToTheOriginal)
+        {
+            vector<string> inputs = {
+                "a",
+                "abc",
+                "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                string(1000, '\0'),
+                GenerateEvents(1),
+                GenerateEvents(50),
+                GenerateEvents(2000),
+                GenerateRandomData(100 * 1024)
+            };
+
+            for (auto&& input : inputs)
+            {
+                auto decompressed = FixedHuffmanInflater::Inflate(Compress(input));
+                Assert::IsTrue(input == decompressed, L"Decompressed data didn't match the original");
+            }
+        }
+
+        TEST_METHOD(DataWrittenInPiecesDecompressesToTheOriginal)
+        {
+            auto input = GenerateEvents(2000);
+            for (size_t pieceSize : { 1, 7, 300, 4096, 40000 })
+            {
+                GzipCompressor compressor;
+                for (size_t start = 0; start < input.size(); start += pieceSize)
+                {
+                    compressor.Write(input.data() + start, (min)(pieceSize, input.size() - start));
+                }
+
+                auto decompressed = FixedHuffmanInflater::Inflate(compressor.Finish());
+                Assert::IsTrue(input == decompressed, L"Decompressed data didn't match the original");
+            }
+        }
+
+        TEST_METHOD(RepetitiveEventsAreMuchSmallerWhenCompressed)
+        {
+            auto events = GenerateEvents(50);
+            auto compressed = Compress(events);
+            Assert::IsTrue(compressed.size() * 4 < events.size(), L"Expected events to compress to less than a quarter of their size");
+        }
+
+        TEST_METHOD(CannotWriteToAFinishedStream)
+        {
+            GzipCompressor compressor;
+            compressor.Write("data");
+            compressor.Finish();
+
+            Assert::ExpectException<logic_error>([&compressor]() {
+                compressor.Write("more");
+            });
+        }
+
+        TEST_METHOD(CompressionRatioAndThroughput)
+        {
+            // Not a pass/fail test; records how much a batch of events
+            // shrinks, and how quickly they're compressed.
+            constexpr int ITERATIONS = 200;
+            auto events = GenerateEvents(50);
+            size_t compressedSize = 0;
+
+            auto start = steady_clock::now();
+            for (int i = 0; i < ITERATIONS; i++)
+            {
+                compressedSize = Compress(events).size();
+            }
+
+            auto duration = duration_cast<microseconds>(steady_clock::now() - start);
+            wstring message = L"50 events: " + to_wstring(events.size()) + L" bytes compressed to " + to_wstring(compressedSize) + L" bytes, "
+                + to_wstring((ITERATIONS * static_cast<long long>(events.size())) / (max)(static_cast<long long>(duration.count()), 1LL)) + L" MB/sec";
+            Logger::WriteMessage(message.c_str());
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "pch.h"
+
+#include "CppUnitTest.h"
+#include "LockFreeIngestionQueue.h"
+
+using namespace std;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Codevoid::Tests
+{
+    TEST_CLASS(LockFreeIngestionQueueTests)
+    {
+    public:
+        TEST_METHOD(DrainingEmptyQueueConsumesNothing)
+        {
+            LockFreeIngestionQueue<int> queue;
+            auto consumed = queue.Drain([](int&&) {
+                Assert::Fail(L"Nothing should have been consumed");
+            });
+
+            Assert::AreEqual(0, (int)consumed, L"Wrong number of items consumed");
+            Assert::IsTrue(queue.IsEmpty(), L"Queue should be empty");
+        }
+
+        TEST_METHOD(ItemsAreDrainedInTheOrderTheyWerePushed)
+        {
+            LockFreeIngestionQueue<int> queue;
+            queue.Push(1);
+            queue.Push({ 2, 3, 4 });
+            queue.Push(5);
+
+            vector<int> drained;
+            auto consumed = queue.Drain([&drained](int&& value) {
+                drained.push_back(value);
+            });
+
+            Assert::AreEqual(5, (int)consumed, L"Wrong number of items consumed");
+            Assert::IsTrue(queue.IsEmpty(), L"Queue should be empty after draining");
+            for (int i = 0; i < 5; i++)
+            {
+                Assert::AreEqual(i + 1, drained[i], L"Items drained out of order");
+            }
+        }
+
+        TEST_METHOD(ItemsFromConcurrentProducersAreAllDrainedInPerProducerOrder)
+        {
+            constexpr int PRODUCER_COUNT = 8;
+            constexpr int ITEMS_PER_PRODUCER = 10000;
+
+            LockFreeIngestionQueue<pair<int, int>> queue;
+            vector<pair<int, int>> drained;
+            atomic<int> finishedProducers = 0;
+            vector<thread> producers;
+
+            for (int producer = 0; producer < PRODUCER_COUNT; producer++)
+            {
+                producers.emplace_back([&queue, &finishedProducers, producer]() {
+                    for (int item = 0; item < ITEMS_PER_PRODUCER; item++)
+                    {
+                        queue.Push({ producer, item });
+                    }
+
+                    finishedProducers += 1;
+                });
+            }
+
+            auto drain = [&queue, &drained]() {
+                queue.Drain([&drained](pair<int, int>&& value) {
+                    drained.push_back(value);
+                });
+            };
+
+            // Drain while the producers are still running, to make sure
+            // nothing is lost when the list is detached mid-push
+            while (finishedProducers.load() < PRODUCER_COUNT)
+            {
+                drain();
+                this_thread::yield();
+            }
+
+            for (auto&& producer : producers)
+            {
+                producer.join();
+            }
+
+            drain();
+
+            Assert::AreEqual(PRODUCER_COUNT * ITEMS_PER_PRODUCER, (int)drained.size(), L"Wrong number of items drained");
+
+            vector<int> nextExpectedItem(PRODUCER_COUNT, 0);
+            for (auto&& value : drained)
+            {
+                Assert::AreEqual(nextExpectedItem[value.first], value.second, L"Items from a producer were out of order");
+                nextExpectedItem[value.first] += 1;
+            }
+        }
+    };
+}
\ No newline at end of file
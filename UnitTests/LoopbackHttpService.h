@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "pch.h"
+
+namespace Codevoid::Tests::Utilities {
+    // Minimal HTTP/1.1 service listening on the loopback address, standing in
+    // for the real service in tests that need to send actual requests (e.g.
+    // to measure connection reuse) without depending on the internet. Every
+    // request is answered with "1" -- what Mixpanel returns on success --
+    // unless another response has been set, and connections are kept open
+    // for further requests.
+    class LoopbackHttpService
+    {
+    public:
+        LoopbackHttpService() : m_state(std::make_shared<ServiceState>())
+        {
+            auto state = m_state;
+            m_listener = ref new Windows::Networking::Sockets::StreamSocketListener();
+            m_listener->ConnectionReceived += ref new Windows::Foundation::TypedEventHandler<
+                Windows::Networking::Sockets::StreamSocketListener^,
+                Windows::Networking::Sockets::StreamSocketListenerConnectionReceivedEventArgs^>(
+                [state](Windows::Networking::Sockets::StreamSocketListener^, Windows::Networking::Sockets::StreamSocketListenerConnectionReceivedEventArgs^ args) {
+                    state->ConnectionCount++;
+                    LoopbackHttpService::ServeConnection(state, args->Socket);
+                });
+
+            // Binding to an empty service name picks any available port
+            concurrency::create_task(m_listener->BindServiceNameAsync(L"")).get();
+        }
+
+        ~LoopbackHttpService()
+        {
+            delete m_listener;
+        }
+
+        Windows::Foundation::Uri^ GetUri()
+        {
+            return ref new Windows::Foundation::Uri(L"http://127.0.0.1:" + m_listener->Information->LocalPort + L"/track");
+        }
+
+        int GetConnectionCount()
+        {
+            return m_state->ConnectionCount;
+        }
+
+        int GetRequestCount()
+        {
+            return m_state->RequestCount;
+        }
+
+        // The most recent request, exactly as it was received: request line,
+        // headers, and body.
+        std::string GetLastRequest()
+        {
+            std::lock_guard<std::mutex> lock(m_state->LastRequestLock);
+            return m_state->LastRequest;
+        }
+
+        // Answers every request from now on with the supplied status & body.
+        void SetResponse(const int statusCode, const std::string& body)
+        {
+            std::lock_guard<std::mutex> lock(m_state->LastRequestLock);
+            m_state->Response = "HTTP/1.1 " + std::to_string(statusCode) + " Response\r\nContent-Type: text/plain\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\n\r\n" + body;
+        }
+
+    private:
+        struct ServiceState
+        {
+            std::atomic<int> ConnectionCount{ 0 };
+            std::atomic<int> RequestCount{ 0 };
+            std::mutex LastRequestLock;
+            std::string LastRequest;
+            std::string Response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 1\r\n\r\n1";
+        };
+
+        static concurrency::task<void> ServeConnection(std::shared_ptr<ServiceState> state, Windows::Networking::Sockets::StreamSocket^ socket)
+        {
+            using namespace Windows::Storage::Streams;
+
+            auto reader = ref new DataReader(socket->InputStream);
+            reader->InputStreamOptions = InputStreamOptions::Partial;
+            auto writer = ref new DataWriter(socket->OutputStream);
+            std::string received;
+
+            try
+            {
+                while (true)
+                {
+                    // Read until there's a complete request -- the headers,
+                    // and as much body as they say there is.
+                    auto headersEnd = received.find("\r\n\r\n");
+                    size_t requestLength = 0;
+                    if (headersEnd != std::string::npos)
+                    {
+                        requestLength = headersEnd + 4 + GetContentLength(received.substr(0, headersEnd));
+                    }
+
+                    if ((headersEnd == std::string::npos) || (received.size() < requestLength))
+                    {
+                        auto loaded = co_await reader->LoadAsync(4096);
+                        if (loaded == 0)
+                        {
+                            break;
+                        }
+
+                        std::string chunk(loaded, '\0');
+                        reader->ReadBytes(Platform::ArrayReference<unsigned char>(reinterpret_cast<unsigned char*>(&chunk[0]), loaded));
+                        received.append(chunk);
+                        continue;
+                    }
+
+                    std::string response;
+                    {
+                        std::lock_guard<std::mutex> lock(state->LastRequestLock);
+                        state->LastRequest = received.substr(0, requestLength);
+                        response = state->Response;
+                    }
+
+                    received.erase(0, requestLength);
+                    state->RequestCount++;
+
+                    writer->WriteString(ref new Platform::String(std::wstring(response.begin(), response.end()).c_str()));
+                    co_await writer->StoreAsync();
+                }
+            }
+            catch (Platform::Exception^)
+            {
+                // The client closed the connection
+            }
+
+            delete socket;
+        }
+
+        static size_t GetContentLength(std::string headers)
+        {
+            for (auto&& c : headers)
+            {
+                c = static_cast<char>(tolower(c));
+            }
+
+            auto header = headers.find("content-length:");
+            if (header == std::string::npos)
+            {
+                return 0;
+            }
+
+            return std::stoul(headers.substr(header + 15));
+        }
+
+        std::shared_ptr<ServiceState> m_state;
+        Windows::Networking::Sockets::StreamSocketListener^ m_listener;
+    };
+}
\ No newline at end of file
@@ -1,10 +1,12 @@
 #include "pch.h"
+#include <filesystem>
 #include "CppUnitTest.h"
 #include "DurationTracker.h"
 #include "PayloadEncoder.h"
 #include "EngageConstants.h"
 #include "MixpanelClient.h"
 #include "AsyncHelper.h"
+#include "LoopbackHttpService.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -17,6 +19,8 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace Windows::Data::Json;
 using namespace Windows::Foundation::Collections;
 using namespace Windows::Storage;
+using namespace Windows::Web::Http;
+using namespace Windows::Web::Http::Filters;
 using namespace Windows::Web::Http::Headers;
 
 constexpr auto DEFAULT_TOKEN = L"DEFAULT_TOKEN";
@@ -79,9 +83,125 @@ namespace Codevoid::Tests::Mixpanel
                 }
             }
 
+            // Items are stored in folders within the storage folder
+            auto folders = co_await storageFolder->GetFoldersAsync();
+            for (auto&& folderToDelete : folders)
+            {
+                co_await folderToDelete->DeleteAsync(StorageDeleteOption::PermanentDelete);
+            }
+
             return storageFolder;
         }
 
+        static int GetStoredFileCount(String^ folderName)
+        {
+            auto folder = AsyncHelper::RunSynced(ApplicationData::Current->LocalFolder->GetFolderAsync(folderName));
+
+            // Items are stored in numbered folders within the storage folder,
+            // which other folders (e.g. the profile storage folder) may be in
+            // too, so only files in those are counted.
+            int count = 0;
+            for (auto&& entry : filesystem::directory_iterator(folder->Path->Data()))
+            {
+                auto name = entry.path().filename().wstring();
+                if (!entry.is_directory() || !all_of(begin(name), end(name), [](const wchar_t c) { return (c >= L'0') && (c <= L'9'); }))
+                {
+                    count += entry.is_regular_file() ? 1 : 0;
+                    continue;
+                }
+
+                for (auto&& stored : filesystem::recursive_directory_iterator(entry.path()))
+                {
+                    count += stored.is_regular_file() ? 1 : 0;
+                }
+            }
+
+            return count;
+        }
+
+        static HttpClient^ CreateTestHttpClient()
+        {
+            return MixpanelClient::CreateHttpClient(
+                ref new HttpBaseProtocolFilter(),
+                ref new HttpProductInfoHeaderValue(L"Codevoid.Mixpanel.MixpanelTests", L"1.0"));
+        }
+
+        static IMap<String^, IJsonValue^>^ GenerateRequestPayload()
+        {
+            auto payload = ref new Map<String^, IJsonValue^>();
+            payload->Insert(L"data", JsonArray::Parse(L"[ { \"event\": \"TestEvent\", \"properties\": { \"token\": \"DEFAULT_TOKEN\" } } ]"));
+
+            return payload;
+        }
+
+        static IMap<String^, IJsonValue^>^ GenerateRequestPayloadWithEvents(const int count)
+        {
+            auto events = ref new JsonArray();
+            for (int i = 0; i < count; i++)
+            {
+                auto properties = ref new JsonObject();
+                properties->Insert(L"token", JsonValue::CreateStringValue(StringReference(DEFAULT_TOKEN)));
+                properties->Insert(L"distinct_id", JsonValue::CreateStringValue(L"13793"));
+                properties->Insert(L"time", JsonValue::CreateNumberValue(1535731746 + i));
+
+                auto event = ref new JsonObject();
+                event->Insert(L"event", JsonValue::CreateStringValue(L"TestEvent"));
+                event->Insert(L"properties", properties);
+                events->Append(event);
+            }
+
+            auto payload = ref new Map<String^, IJsonValue^>();
+            payload->Insert(L"data", events);
+
+            return payload;
+        }
+
+        static vector<shared_ptr<PayloadContainer>> GenerateUploadItems(const int count)
+        {
+            vector<shared_ptr<PayloadContainer>> items;
+            for (int i = 0; i < count; i++)
+            {
+                auto payload = ref new JsonObject();
+                payload->Insert(L"event", JsonValue::CreateStringValue(L"TestEvent"));
+                payload->Insert(L"id", JsonValue::CreateNumberValue(i + 1));
+
+                items.push_back(make_shared<PayloadContainer>(i + 1, payload, EventPriority::Normal));
+            }
+
+            return items;
+        }
+
+        task<vector<shared_ptr<PayloadContainer>>> UploadItems(const vector<shared_ptr<PayloadContainer>>& items)
+        {
+            return m_client->HandleBatchUploadWithUri(m_client->m_trackEventUri, *m_client->m_trackStorageQueue, items, []() { return true; });
+        }
+
+        // Size of the body SendRequestToService sends for the payload: each
+        // value encoded with EncodeJson, and then form encoded, which
+        // escapes the characters base64 uses that a form can't contain.
+        static size_t GetFormEncodedRequestSize(IMap<String^, IJsonValue^>^ payload)
+        {
+            size_t size = 0;
+            for (auto&& pair : payload)
+            {
+                size += pair->Key->Length() + 1;
+                for (auto character : EncodeJson(pair->Value))
+                {
+                    size += ((character == L'+') || (character == L'/') || (character == L'=')) ? 3 : 1;
+                }
+            }
+
+            return size + (payload->Size - 1);
+        }
+
+        static bool RequestWasCompressed(const string& request)
+        {
+            auto headers = request.substr(0, request.find("\r\n\r\n"));
+            transform(begin(headers), end(headers), begin(headers), [](const char c) { return static_cast<char>(tolower(c)); });
+
+            return headers.find("content-encoding: gzip") != string::npos;
+        }
+
         static vector<IJsonValue^> CaptureRequestPayloads(IMap<String^, IJsonValue^>^ payload)
         {
             // Data is intended in the 'data' keyed item in the payload.
@@ -926,42 +1046,92 @@ namespace Codevoid::Tests::Mixpanel
 
             AsyncHelper::RunSynced(m_client->PauseAsync());
 
-            auto trackFileCount = AsyncHelper::RunSynced(create_task([]() -> task<int> {
-                auto folder = co_await ApplicationData::Current->LocalFolder->GetFolderAsync(StringReference(OVERRIDE_STORAGE_FOLDER));
-                auto files = co_await folder->GetFilesAsync();
-
-                return files->Size;
-            }));
-
-            auto profileFileCount = AsyncHelper::RunSynced(create_task([]() -> task<int> {
-                auto folder = co_await ApplicationData::Current->LocalFolder->GetFolderAsync(StringReference(OVERRIDE_PROFILE_STORAGE_FOLDER));
-                auto files = co_await folder->GetFilesAsync();
-
-                return files->Size;
-            }));
+            auto trackFileCount = GetStoredFileCount(StringReference(OVERRIDE_STORAGE_FOLDER));
+            auto profileFileCount = GetStoredFileCount(StringReference(OVERRIDE_PROFILE_STORAGE_FOLDER));
 
             Assert::AreEqual(1, trackFileCount, L"Wrong number of track persisted items found");
             Assert::AreEqual(1, profileFileCount, L"Wrong number of profile persisted items found");
 
             AsyncHelper::RunSynced(m_client->ClearStorageAsync());
 
-            trackFileCount = AsyncHelper::RunSynced(create_task([]() -> task<int> {
-                auto folder = co_await ApplicationData::Current->LocalFolder->GetFolderAsync(StringReference(OVERRIDE_STORAGE_FOLDER));
-                auto files = co_await folder->GetFilesAsync();
-
-                return files->Size;
-            }));
+            // Cleared items are removed in the background, so give that a
+            // chance to finish.
+            size_t loopCount = 0;
+            do
+            {
+                this_thread::sleep_for(2ms);
+                trackFileCount = GetStoredFileCount(StringReference(OVERRIDE_STORAGE_FOLDER));
+                profileFileCount = GetStoredFileCount(StringReference(OVERRIDE_PROFILE_STORAGE_FOLDER));
+                loopCount++;
+            } while (((trackFileCount + profileFileCount) > 0) && (loopCount < SPIN_LOOP_LIMIT));
 
             Assert::AreEqual(0, trackFileCount, L"Didn't expect to find any items");
+            Assert::AreEqual(0, profileFileCount, L"Didn't expect to find any items");
+        }
+
+        TEST_METHOD(NothingIsWrittenToStorageWhenDurabilityIsNone)
+        {
+            m_client->GenerateAndSetUserIdentity();
+            m_client->ForceWritingToStorage();
+            m_client->SetStorageDurability(StorageDurability::None);
+            m_client->Start();
+            m_client->Track(L"TestEvent", nullptr);
+            m_client->UpdateProfile(UserProfileOperation::Set, GetPropertySetWithStuffInIt());
 
-            profileFileCount = AsyncHelper::RunSynced(create_task([]() -> task<int> {
-                auto folder = co_await ApplicationData::Current->LocalFolder->GetFolderAsync(StringReference(OVERRIDE_PROFILE_STORAGE_FOLDER));
-                auto files = co_await folder->GetFilesAsync();
+            AsyncHelper::RunSynced(m_client->PauseAsync());
 
-                return files->Size;
-            }));
+            auto trackFileCount = GetStoredFileCount(StringReference(OVERRIDE_STORAGE_FOLDER));
+            auto profileFileCount = GetStoredFileCount(StringReference(OVERRIDE_PROFILE_STORAGE_FOLDER));
 
-            Assert::AreEqual(0, profileFileCount, L"Didn't expect to find any items");
+            Assert::AreEqual(0, trackFileCount, L"Didn't expect any track items to be written");
+            Assert::AreEqual(0, profileFileCount, L"Didn't expect any profile items to be written");
+        }
+
+        TEST_METHOD(EventsNotWrittenToStorageCountTowardsTheQueueSize)
+        {
+            // Events only held in memory are counted at the size they'll be
+            // sent at, so they're limited like any other event.
+            task_completion_event<SendToServiceResult> uploadCompleted;
+            m_client->SetUploadToServiceMock([uploadCompleted](auto, auto, auto)
+            {
+                return create_task(uploadCompleted);
+            });
+
+            m_client->SetStorageDurability(StorageDurability::None);
+            m_client->Start();
+            for (int i = 0; i < 3; i++)
+            {
+                m_client->Track(L"TestEvent", nullptr);
+            }
+
+            size_t loopCount = 0;
+            while ((m_client->m_trackUploadWorker.GetQueueLength() < 3) && (loopCount < SPIN_LOOP_LIMIT))
+            {
+                this_thread::sleep_for(2ms);
+                loopCount++;
+            }
+
+            Assert::AreEqual(3, (int)m_client->m_trackUploadWorker.GetQueueLength(), L"Events should be waiting to be uploaded");
+            Assert::IsTrue(m_client->m_trackUploadWorker.GetQueueSizeInBytes() > 0, L"Events not written to storage should still have a size");
+            Assert::AreEqual(0, (int)m_client->GetDroppedEventCount(), L"Nothing should have been dropped");
+
+            uploadCompleted.set(SendToServiceResult::SuccessfullySent);
+            AsyncHelper::RunSynced(m_client->PauseAsync());
+        }
+
+        TEST_METHOD(QueueOverflowPolicyMustBeKnown)
+        {
+            bool exceptionThrown = false;
+            try
+            {
+                m_client->SetQueueOverflowPolicy(static_cast<QueueOverflowPolicy>(-1));
+            }
+            catch (InvalidArgumentException^ ex)
+            {
+                exceptionThrown = true;
+            }
+
+            Assert::IsTrue(exceptionThrown, L"Expected an exception for an unknown overflow policy");
         }
 
         TEST_METHOD(RequestIndicatesFailureWhenCallingNonExistantEndPoint)
@@ -970,7 +1140,7 @@ namespace Codevoid::Tests::Mixpanel
             auto wasSuccessful = MixpanelClient::SendRequestToService(
                 ref new Uri(L"https://fake.codevoid.net"),
                 payload,
-                ref new HttpProductInfoHeaderValue(L"Codevoid.Mixpanel.MixpanelTests", L"1.0")).get();
+                CreateTestHttpClient()).get();
             Assert::IsFalse(SendToServiceResult::SuccessfullySent == wasSuccessful, L"Was not supposed to be successful");
         }
 
@@ -981,10 +1151,136 @@ namespace Codevoid::Tests::Mixpanel
             auto wasSuccessful = MixpanelClient::SendRequestToService(
                 ref new Uri(L"https://jsonplaceholder.typicode.com/posts"),
                 payload,
-                ref new HttpProductInfoHeaderValue(L"Codevoid.Mixpanel.MixpanelTests", L"1.0")).get();
+                CreateTestHttpClient()).get();
             Assert::IsTrue(SendToServiceResult::SuccessfullySent == wasSuccessful, L"Result was not a success");
         }
 
+        TEST_METHOD(RequestsFromTheSameClientReuseAConnection)
+        {
+            LoopbackHttpService service;
+            auto client = CreateTestHttpClient();
+
+            for (int i = 0; i < 5; i++)
+            {
+                auto result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayload(), client).get();
+                Assert::IsTrue(SendToServiceResult::SuccessfullySent == result, L"Request wasn't successful");
+            }
+
+            Assert::AreEqual(5, service.GetRequestCount(), L"Wrong number of requests received");
+            Assert::AreEqual(1, service.GetConnectionCount(), L"Requests should have been sent on the same connection");
+        }
+
+        TEST_METHOD(ServerErrorsThrottlingAndRefusedAccessAreReportedAsServiceUnavailable)
+        {
+            LoopbackHttpService service;
+            auto client = CreateTestHttpClient();
+
+            for (auto statusCode : { 500, 503, 408, 429, 401, 403 })
+            {
+                service.SetResponse(statusCode, "");
+                auto result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayload(), client).get();
+                Assert::IsTrue(SendToServiceResult::FailedServiceUnavailable == result, (L"Wrong result for status " + to_wstring(statusCode)).c_str());
+            }
+        }
+
+        TEST_METHOD(RejectedPayloadsAreReportedAsFailedAtService)
+        {
+            LoopbackHttpService service;
+            auto client = CreateTestHttpClient();
+
+            service.SetResponse(400, "");
+            auto result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayload(), client).get();
+            Assert::IsTrue(SendToServiceResult::FailedAtService == result, L"Client error should be a rejected payload");
+
+            service.SetResponse(200, "0");
+            result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayload(), client).get();
+            Assert::IsTrue(SendToServiceResult::FailedAtService == result, L"Body of 0 should be a rejected payload");
+        }
+
+        TEST_METHOD(MaximumUploadConnectionsMustAllowAConnection)
+        {
+            bool exceptionThrown = false;
+
+            try
+            {
+                m_client->SetMaximumUploadConnections(0);
+            }
+            catch (InvalidArgumentException^ ex)
+            {
+                exceptionThrown = true;
+            }
+
+            Assert::IsTrue(exceptionThrown, L"Didn't get expected exception");
+            m_client->SetMaximumUploadConnections(1);
+        }
+
+        TEST_METHOD(UploadLatencyWithANewOrSharedHttpClient)
+        {
+            // Not a pass/fail test; records the cost of each request when a
+            // client is created for it, compared to sharing one client (and
+            // it's connections) for every request.
+            constexpr int REQUESTS = 100;
+            LoopbackHttpService service;
+            auto sharedClient = CreateTestHttpClient();
+
+            for (auto shareClient : { false, true })
+            {
+                auto start = steady_clock::now();
+                for (int i = 0; i < REQUESTS; i++)
+                {
+                    auto client = shareClient ? sharedClient : CreateTestHttpClient();
+                    MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayload(), client).get();
+                }
+
+                auto duration = duration_cast<microseconds>(steady_clock::now() - start);
+                wstring message = (shareClient ? L"Shared client: " : L"New client per request: ")
+                    + to_wstring(duration.count() / REQUESTS) + L"us per request, "
+                    + to_wstring(service.GetConnectionCount()) + L" connections opened so far";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+
+        TEST_METHOD(RequestsLargerThanTheCompressionThresholdAreCompressed)
+        {
+            LoopbackHttpService service;
+            auto client = CreateTestHttpClient();
+
+            auto result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayloadWithEvents(50), client, 1024).get();
+            Assert::IsTrue(SendToServiceResult::SuccessfullySent == result, L"Request wasn't successful");
+            Assert::IsTrue(RequestWasCompressed(service.GetLastRequest()), L"Request should have been compressed");
+        }
+
+        TEST_METHOD(RequestsSmallerThanTheCompressionThresholdAreNotCompressed)
+        {
+            LoopbackHttpService service;
+            auto client = CreateTestHttpClient();
+
+            auto result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayloadWithEvents(1), client, 1024).get();
+            Assert::IsTrue(SendToServiceResult::SuccessfullySent == result, L"Request wasn't successful");
+            Assert::IsFalse(RequestWasCompressed(service.GetLastRequest()), L"Request shouldn't have been compressed");
+
+            result = MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayloadWithEvents(50), client).get();
+            Assert::IsTrue(SendToServiceResult::SuccessfullySent == result, L"Request wasn't successful");
+            Assert::IsFalse(RequestWasCompressed(service.GetLastRequest()), L"Requests shouldn't be compressed by default");
+        }
+
+        TEST_METHOD(UploadSizeWithAndWithoutCompression)
+        {
+            // Not a pass/fail test; records how much smaller a batch of
+            // events is when it's sent compressed.
+            LoopbackHttpService service;
+            auto client = CreateTestHttpClient();
+
+            for (auto compressionThreshold : { NO_UPLOAD_COMPRESSION, (size_t)0 })
+            {
+                MixpanelClient::SendRequestToService(service.GetUri(), GenerateRequestPayloadWithEvents(50), client, compressionThreshold).get();
+
+                wstring message = ((compressionThreshold == NO_UPLOAD_COMPRESSION) ? L"Uncompressed: " : L"Compressed: ")
+                    + to_wstring(service.GetLastRequest().size()) + L" bytes for 50 events";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+
         TEST_METHOD(QueueIsUploaded)
         {
             vector<vector<IJsonValue^>> trackPayloads;
@@ -1019,6 +1315,35 @@ namespace Codevoid::Tests::Mixpanel
             Assert::AreEqual(1, (int)(profilePayloads[0].size()), L"Wrong number of items in the first profile payload");
         }
 
+        TEST_METHOD(QueueIsUploadedWhenPagedFromStorage)
+        {
+            vector<vector<IJsonValue^>> trackPayloads;
+            m_client->SetUploadToServiceMock([&trackPayloads](Uri^ uri, auto payloads, auto)
+            {
+                if (uri->Path == StringReference(L"/track"))
+                {
+                    trackPayloads.push_back(MixpanelTests::CaptureRequestPayloads(payloads));
+                }
+
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            m_client->ConfigureForTesting(DEFAULT_IDLE_TIMEOUT, 1);
+            m_client->ForceWritingToStorage();
+            m_client->SetPageUploadsFromStorage(true);
+            m_client->GenerateAndSetUserIdentity();
+            m_client->Start();
+            m_client->Track(L"TestEvent", nullptr);
+
+            this_thread::sleep_for(DEFAULT_IDLE_TIMEOUT * 100);
+
+            Assert::AreEqual(1, (int)trackPayloads.size(), L"Wrong number of track payloads sent");
+            Assert::AreEqual(1, (int)(trackPayloads[0].size()), L"Wrong number of items in the first track payload");
+
+            auto payload = static_cast<JsonObject^>(trackPayloads[0][0]);
+            Assert::AreEqual(StringReference(L"TestEvent"), payload->GetNamedString(L"event"), L"Payload wasn't read back from storage");
+        }
+
         TEST_METHOD(BatchesIncludeMoreThanOneItem)
         {
             vector<vector<IJsonValue^>> capturedPayloads;
@@ -1066,7 +1391,7 @@ namespace Codevoid::Tests::Mixpanel
             Assert::AreEqual(50, (int)(capturedPayloads[2].size()), L"Wrong number of items in the third payload");
         }
 
-        TEST_METHOD(ItemsAreRetriedIndividuallyAfterAFailure)
+        TEST_METHOD(ItemsInAFailedBatchAreRetriedInHalves)
         {
             shared_ptr<vector<int>> capturedPayloadCounts = make_shared<vector<int>>();
             int itemsSeenCount = 0;
@@ -1102,11 +1427,9 @@ namespace Codevoid::Tests::Mixpanel
 
             SpinWaitForItemCount(itemsSuccessfullyUploaded, 100);
 
-            Assert::AreEqual(51, (int)capturedPayloadCounts->size(), L"Wrong number of payloads sent");
-            for (int i = 1; i < 50; i++)
-            {
-                Assert::AreEqual(1, (*capturedPayloadCounts)[i], L"Wrong number of items in single-item-payloads");
-            }
+            Assert::AreEqual(3, (int)capturedPayloadCounts->size(), L"Wrong number of payloads sent");
+            Assert::AreEqual(25, (*capturedPayloadCounts)[1], L"Wrong number of items in the first half of the failed payload");
+            Assert::AreEqual(25, (*capturedPayloadCounts)[2], L"Wrong number of items in the second half of the failed payload");
 
             for (int i = 0; i < 50; i++)
             {
@@ -1115,8 +1438,8 @@ namespace Codevoid::Tests::Mixpanel
 
             SpinWaitForItemCount(itemsSuccessfullyUploaded, 150);
 
-            Assert::AreEqual(52, (int)capturedPayloadCounts->size(), L"Wrong number of payloads sent");
-            Assert::AreEqual(50, (*capturedPayloadCounts)[51], L"Wrong number of items in the third payload");
+            Assert::AreEqual(4, (int)capturedPayloadCounts->size(), L"Wrong number of payloads sent");
+            Assert::AreEqual(50, (*capturedPayloadCounts)[3], L"Wrong number of items in the last payload");
 
             m_client->Shutdown().wait();
             m_client = nullptr;
@@ -1167,16 +1490,512 @@ namespace Codevoid::Tests::Mixpanel
 
             m_client->Start();
 
-            SpinWaitForItemCount(itemCount, 7);
+            // The first payload is split into [1] & [2, 3]; the second of
+            // those fails too, and is split into [2] & [3].
+            SpinWaitForItemCount(itemCount, 8);
 
-            Assert::AreEqual(2, event1Count, L"Should only see event 1 twice - once in first payload, second in individual payload");
-            Assert::AreEqual(2, event3Count, L"Should only see event 3 once - once in first payload, second in individual payload");
+            Assert::AreEqual(2, event1Count, L"Should only see event 1 twice - once in first payload, second in it's half of the payload");
+            Assert::AreEqual(3, event3Count, L"Should see event 3 three times - in the first payload, alongside event 2, and on it's own");
             Assert::AreEqual(3, event2Count, L"Event 2 should have been retried twice, and once successfully");
 
             m_client->Shutdown().wait();
             m_client = nullptr;
         }
 
+        TEST_METHOD(UploadsAreSentConcurrentlyUpToTheWindow)
+        {
+            mutex responsesLock;
+            vector<task_completion_event<SendToServiceResult>> responses;
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadsInFlight(3);
+            m_client->SetUploadToServiceMock([&responsesLock, &responses, &requestCount](auto, auto, auto)
+            {
+                task_completion_event<SendToServiceResult> response;
+                {
+                    lock_guard<mutex> lock(responsesLock);
+                    responses.push_back(response);
+                }
+
+                requestCount++;
+                return create_task(response);
+            });
+
+            // Responses are completed outside the lock, since completing one
+            // can send the next request on this thread.
+            auto respond = [&responsesLock, &responses](const size_t index) {
+                task_completion_event<SendToServiceResult> response;
+                {
+                    lock_guard<mutex> lock(responsesLock);
+                    response = responses[index];
+                }
+
+                response.set(SendToServiceResult::SuccessfullySent);
+            };
+
+            auto items = GenerateUploadItems(250);
+            auto upload = this->UploadItems(items);
+
+            SpinWaitForItemCount(requestCount, 3);
+            this_thread::sleep_for(DEFAULT_IDLE_TIMEOUT);
+            Assert::AreEqual(3, requestCount.load(), L"Only the window's worth of requests should be in flight");
+
+            // Responses are handled in order, so the second completing first
+            // doesn't make room for another request.
+            respond(1);
+            this_thread::sleep_for(DEFAULT_IDLE_TIMEOUT);
+            Assert::AreEqual(3, requestCount.load(), L"Request shouldn't have been sent before the first completed");
+
+            respond(0);
+            SpinWaitForItemCount(requestCount, 5);
+            respond(2);
+            respond(3);
+            respond(4);
+
+            auto successfulItems = upload.get();
+            Assert::AreEqual(250, (int)successfulItems.size(), L"All the items should have been uploaded");
+            for (size_t i = 0; i < successfulItems.size(); i++)
+            {
+                Assert::IsTrue(items[i] == successfulItems[i], L"Items should be acknowledged in the order they were sent");
+            }
+        }
+
+        TEST_METHOD(BatchThatFailsWhileAnEarlierBatchIsInFlightIsRetried)
+        {
+            task_completion_event<SendToServiceResult> firstResponse;
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadsInFlight(2);
+            m_client->SetUploadToServiceMock([&firstResponse, &requestCount](auto, auto, auto)
+            {
+                auto request = requestCount++;
+                if (request == 0)
+                {
+                    return create_task(firstResponse);
+                }
+
+                return task_from_result((request == 1) ? SendToServiceResult::FailedAtService : SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(100);
+            auto upload = this->UploadItems(items);
+            SpinWaitForItemCount(requestCount, 2);
+            firstResponse.set(SendToServiceResult::SuccessfullySent);
+
+            auto successfulItems = upload.get();
+            Assert::AreEqual(100, (int)successfulItems.size(), L"All the items should have been uploaded");
+            Assert::AreEqual(4, requestCount.load(), L"Failed batch should have been retried in halves");
+        }
+
+        TEST_METHOD(ConnectivityFailureStopsFurtherBatchesBeingSent)
+        {
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadsInFlight(2);
+            m_client->SetUploadToServiceMock([&requestCount](auto, auto, auto)
+            {
+                auto request = requestCount++;
+                return task_from_result((request == 0) ? SendToServiceResult::FailedConnectivity : SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(250);
+            auto successfulItems = this->UploadItems(items).get();
+            Assert::AreEqual(2, requestCount.load(), L"Only the batches already in flight should have been sent");
+            Assert::AreEqual(50, (int)successfulItems.size(), L"Batch in flight alongside the failure should have been uploaded");
+        }
+
+        TEST_METHOD(ServiceUnavailableStopsFurtherBatchesWithoutSplittingThem)
+        {
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadsInFlight(2);
+            m_client->SetUploadToServiceMock([&requestCount](auto, auto, auto)
+            {
+                auto request = requestCount++;
+                return task_from_result((request == 0) ? SendToServiceResult::FailedServiceUnavailable : SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(250);
+            auto successfulItems = this->UploadItems(items).get();
+            Assert::AreEqual(2, requestCount.load(), L"Failed batch shouldn't have been split, and nothing more sent");
+            Assert::AreEqual(50, (int)successfulItems.size(), L"Batch in flight alongside the failure should have been uploaded");
+        }
+
+        TEST_METHOD(MaximumUploadsInFlightMustAllowAnUpload)
+        {
+            bool exceptionThrown = false;
+
+            try
+            {
+                m_client->SetMaximumUploadsInFlight(0);
+            }
+            catch (InvalidArgumentException^ ex)
+            {
+                exceptionThrown = true;
+            }
+
+            Assert::IsTrue(exceptionThrown, L"Didn't get expected exception");
+        }
+
+        TEST_METHOD(UploadThroughputForEachUploadWindow)
+        {
+            // Not a pass/fail test; records how the number of batches in
+            // flight changes how quickly a backlog drains over a link with
+            // a long round trip.
+            constexpr int ITEM_COUNT = 1000;
+            m_client->SetUploadToServiceMock([](auto, auto, auto)
+            {
+                return create_task([]() {
+                    this_thread::sleep_for(50ms);
+                    return SendToServiceResult::SuccessfullySent;
+                });
+            });
+
+            for (unsigned int window : { 1, 2, 4, 8 })
+            {
+                m_client->SetMaximumUploadsInFlight(window);
+
+                auto items = GenerateUploadItems(ITEM_COUNT);
+                auto start = steady_clock::now();
+                auto successfulItems = this->UploadItems(items).get();
+                auto duration = duration_cast<milliseconds>(steady_clock::now() - start);
+
+                Assert::AreEqual(ITEM_COUNT, (int)successfulItems.size(), L"All the items should have been uploaded");
+
+                wstring message = L"Window " + to_wstring(window) + L": "
+                    + to_wstring((ITEM_COUNT * 1000LL) / (max)(duration.count(), 1LL)) + L" items/sec";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+
+        TEST_METHOD(BatchesArePackedUpToTheMaximumBatchSize)
+        {
+            vector<int> capturedPayloadCounts;
+            m_client->SetMaximumUploadBatchSize(1000);
+            m_client->SetUploadToServiceMock([&capturedPayloadCounts](auto, auto payloads, auto)
+            {
+                capturedPayloadCounts.push_back((int)MixpanelTests::CaptureRequestPayloads(payloads).size());
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            // Sizes are set, rather than estimated, so the batches are
+            // predictable.
+            auto items = GenerateUploadItems(35);
+            for (auto&& item : items)
+            {
+                item->UploadSizeInBytes = 100;
+            }
+
+            auto successfulItems = this->UploadItems(items).get();
+
+            Assert::AreEqual(35, (int)successfulItems.size(), L"All the items should have been uploaded");
+            vector<int> expectedPayloadCounts{ 10, 10, 10, 5 };
+            Assert::IsTrue(expectedPayloadCounts == capturedPayloadCounts, L"Batches weren't filled up to the maximum size");
+        }
+
+        TEST_METHOD(SmallItemsAreStillLimitedToTheMaximumBatchCount)
+        {
+            vector<int> capturedPayloadCounts;
+            m_client->SetUploadToServiceMock([&capturedPayloadCounts](auto, auto payloads, auto)
+            {
+                capturedPayloadCounts.push_back((int)MixpanelTests::CaptureRequestPayloads(payloads).size());
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(120);
+            for (auto&& item : items)
+            {
+                item->UploadSizeInBytes = 1;
+            }
+
+            this->UploadItems(items).get();
+
+            vector<int> expectedPayloadCounts{ 50, 50, 20 };
+            Assert::IsTrue(expectedPayloadCounts == capturedPayloadCounts, L"Batches should be limited to 50 items");
+        }
+
+        TEST_METHOD(ItemLargerThanTheMaximumBatchSizeIsSentOnItsOwn)
+        {
+            vector<int> capturedPayloadCounts;
+            m_client->SetMaximumUploadBatchSize(1000);
+            m_client->SetUploadToServiceMock([&capturedPayloadCounts](auto, auto payloads, auto)
+            {
+                capturedPayloadCounts.push_back((int)MixpanelTests::CaptureRequestPayloads(payloads).size());
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(5);
+            for (auto&& item : items)
+            {
+                item->UploadSizeInBytes = 10;
+            }
+
+            items[2]->UploadSizeInBytes = 5000;
+
+            auto successfulItems = this->UploadItems(items).get();
+
+            Assert::AreEqual(5, (int)successfulItems.size(), L"All the items should have been uploaded");
+            vector<int> expectedPayloadCounts{ 2, 1, 2 };
+            Assert::IsTrue(expectedPayloadCounts == capturedPayloadCounts, L"Large item should have been sent on it's own");
+        }
+
+        TEST_METHOD(RequestsAreNoLargerThanTheMaximumBatchSizeOnceEncoded)
+        {
+            constexpr size_t MAXIMUM_BATCH_BYTES = 16 * 1024;
+            mutex requestSizesLock;
+            vector<size_t> requestSizes;
+
+            m_client->SetMaximumUploadBatchSize(MAXIMUM_BATCH_BYTES);
+            m_client->SetUploadToServiceMock([&requestSizesLock, &requestSizes](auto, auto payloads, auto)
+            {
+                lock_guard<mutex> lock(requestSizesLock);
+                requestSizes.push_back(MixpanelTests::GetFormEncodedRequestSize(payloads));
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            // Each event is ~1.4KB of JSON, some of which is more than one
+            // byte once it's UTF-8.
+            auto items = GenerateUploadItems(40);
+            auto padding = ref new String((wstring(1000, L'x') + wstring(200, L'\u00e9')).c_str());
+            for (auto&& item : items)
+            {
+                static_cast<JsonObject^>(item->Payload)->Insert(L"padding", JsonValue::CreateStringValue(padding));
+            }
+
+            auto successfulItems = this->UploadItems(items).get();
+            Assert::AreEqual(40, (int)successfulItems.size(), L"All the items should have been uploaded");
+            Assert::IsTrue(requestSizes.size() > 1, L"Items should have been split across requests");
+
+            size_t largestRequest = 0;
+            for (auto size : requestSizes)
+            {
+                Assert::IsTrue(size <= MAXIMUM_BATCH_BYTES, (L"Request of " + to_wstring(size) + L" bytes is larger than the maximum").c_str());
+                largestRequest = (max)(largestRequest, size);
+            }
+
+            Assert::IsTrue(largestRequest > (MAXIMUM_BATCH_BYTES * 3 / 4), L"Batches should have been filled close to the maximum");
+        }
+
+        TEST_METHOD(MaximumUploadBatchSizeMustAllowAByte)
+        {
+            bool exceptionThrown = false;
+
+            try
+            {
+                m_client->SetMaximumUploadBatchSize(0);
+            }
+            catch (InvalidArgumentException^ ex)
+            {
+                exceptionThrown = true;
+            }
+
+            Assert::IsTrue(exceptionThrown, L"Didn't get expected exception");
+        }
+
+        TEST_METHOD(RequestsAndLargestRequestForEachMaximumBatchSize)
+        {
+            // Not a pass/fail test; records how the size limit on a batch
+            // changes the number of requests, and the size of the largest,
+            // when uploading a mix of small & large events.
+            constexpr int ITEM_COUNT = 1000;
+            size_t requestCount = 0;
+            size_t largestRequest = 0;
+            m_client->SetUploadToServiceMock([&requestCount, &largestRequest](auto, auto payloads, auto)
+            {
+                requestCount++;
+                largestRequest = (max)(largestRequest, MixpanelTests::GetFormEncodedRequestSize(payloads));
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            // Every tenth event is ~8KB; the rest are tiny.
+            auto items = GenerateUploadItems(ITEM_COUNT);
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                auto payload = static_cast<JsonObject^>(items[i]->Payload);
+                if ((i % 10) == 0)
+                {
+                    payload->Insert(L"padding", JsonValue::CreateStringValue(ref new String(wstring(8 * 1024, L'x').c_str())));
+                }
+            }
+
+            for (unsigned int maximumBytes : { 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 })
+            {
+                m_client->SetMaximumUploadBatchSize(maximumBytes);
+                requestCount = 0;
+                largestRequest = 0;
+
+                this->UploadItems(items).get();
+
+                wstring message = L"Maximum batch size " + to_wstring(maximumBytes / 1024) + L"KB: "
+                    + to_wstring(requestCount) + L" requests, largest "
+                    + to_wstring(largestRequest / 1024) + L"KB";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+
+        TEST_METHOD(BadItemIsIsolatedWithoutSendingEveryItemIndividually)
+        {
+            constexpr double BAD_ITEM_ID = 137;
+            atomic<int> requestCount = 0;
+            mutex failedBatchSizesLock;
+            vector<int> failedBatchSizes;
+
+            // More than one request is in flight at once, so the mock can be
+            // called from more than one thread.
+            m_client->SetUploadToServiceMock([&requestCount, &failedBatchSizesLock, &failedBatchSizes, BAD_ITEM_ID](auto, auto payloads, auto)
+            {
+                requestCount++;
+                auto items = MixpanelTests::CaptureRequestPayloads(payloads);
+                for (auto item : items)
+                {
+                    if (static_cast<JsonObject^>(item)->GetNamedNumber(L"id") == BAD_ITEM_ID)
+                    {
+                        lock_guard<mutex> lock(failedBatchSizesLock);
+                        failedBatchSizes.push_back((int)items.size());
+                        return task_from_result(SendToServiceResult::FailedAtService);
+                    }
+                }
+
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(500);
+            auto successfulItems = this->UploadItems(items).get();
+
+            Assert::AreEqual(499, (int)successfulItems.size(), L"Every item except the bad one should have been uploaded");
+            for (auto&& item : successfulItems)
+            {
+                Assert::AreNotEqual(BAD_ITEM_ID, static_cast<JsonObject^>(item->Payload)->GetNamedNumber(L"id"), L"Bad item shouldn't have been uploaded");
+            }
+
+            // 10 batches of 50, and then two requests for each time the half
+            // containing the bad item is split again.
+            vector<int> expectedFailedBatchSizes{ 50, 25, 12, 6, 3, 2, 1 };
+            Assert::IsTrue(expectedFailedBatchSizes == failedBatchSizes, L"Failed batch wasn't halved each time");
+            Assert::AreEqual(10 + 12, requestCount.load(), L"Wrong number of requests to isolate the bad item");
+        }
+
+        TEST_METHOD(ItemsRejectedTooManyTimesAreQuarantined)
+        {
+            constexpr double BAD_ITEM_ID = 2;
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadFailures(2);
+            m_client->SetUploadToServiceMock([&requestCount, BAD_ITEM_ID](auto, auto payloads, auto)
+            {
+                requestCount++;
+                for (auto item : MixpanelTests::CaptureRequestPayloads(payloads))
+                {
+                    if (static_cast<JsonObject^>(item)->GetNamedNumber(L"id") == BAD_ITEM_ID)
+                    {
+                        return task_from_result(SendToServiceResult::FailedAtService);
+                    }
+                }
+
+                return task_from_result(SendToServiceResult::SuccessfullySent);
+            });
+
+            auto items = GenerateUploadItems(3);
+            auto completedItems = this->UploadItems(items).get();
+            Assert::AreEqual(2, (int)completedItems.size(), L"Only the good items should have been uploaded");
+            Assert::AreEqual(0, (int)m_client->GetQuarantinedEventCount(), L"Item shouldn't be quarantined after one failure");
+
+            // The worker would leave the bad item in the queue to be retried,
+            // along with anything queued since.
+            vector<shared_ptr<PayloadContainer>> retriedItems{ items[1], GenerateUploadItems(4)[3] };
+            completedItems = this->UploadItems(retriedItems).get();
+            Assert::AreEqual(2, (int)completedItems.size(), L"Good item & quarantined item should be done with");
+            Assert::AreEqual(1, (int)m_client->GetQuarantinedEventCount(), L"Item should have been quarantined");
+
+            auto exported = m_client->ExportQuarantinedEvents();
+            Assert::AreEqual(1, (int)exported->Size, L"Wrong number of quarantined events exported");
+
+            auto quarantined = exported->GetObjectAt(0);
+            Assert::AreEqual(L"track", quarantined->GetNamedString(L"type")->Data(), L"Wrong type of event");
+            Assert::AreEqual(BAD_ITEM_ID, quarantined->GetNamedObject(L"payload")->GetNamedNumber(L"id"), L"Wrong event quarantined");
+
+            m_client->ClearQuarantinedEvents();
+            Assert::AreEqual(0, (int)m_client->GetQuarantinedEventCount(), L"Quarantined events should have been cleared");
+        }
+
+        TEST_METHOD(ItemsAreNotQuarantinedWhenTheServiceKeepsFailing)
+        {
+            // Server errors say nothing about the events, so however many
+            // times they're sent, they're kept to be sent again.
+            LoopbackHttpService service;
+            service.SetResponse(500, "");
+            auto client = CreateTestHttpClient();
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadFailures(1);
+            m_client->SetUploadToServiceMock([&service, client, &requestCount](auto, auto payloads, auto)
+            {
+                requestCount++;
+                return MixpanelClient::SendRequestToService(service.GetUri(), payloads, client);
+            });
+
+            auto items = GenerateUploadItems(3);
+            for (int i = 0; i < 5; i++)
+            {
+                auto completedItems = this->UploadItems(items).get();
+                Assert::AreEqual(0, (int)completedItems.size(), L"Nothing should have been uploaded, or quarantined");
+            }
+
+            Assert::AreEqual(5, requestCount.load(), L"Failed batch shouldn't have been split");
+            Assert::AreEqual(0, (int)m_client->GetQuarantinedEventCount(), L"Nothing should have been quarantined");
+            for (auto&& item : items)
+            {
+                Assert::AreEqual(0, (int)item->FailureCount, L"Server errors shouldn't count as the item failing");
+            }
+        }
+
+        TEST_METHOD(ItemsAreNotQuarantinedWhenTheServiceRejectsEverything)
+        {
+            // If the service rejects every request (e.g. a revoked token),
+            // it says nothing about the events, and they're kept.
+            atomic<int> requestCount = 0;
+
+            m_client->SetMaximumUploadFailures(1);
+            m_client->SetUploadToServiceMock([&requestCount](auto, auto, auto)
+            {
+                requestCount++;
+                return task_from_result(SendToServiceResult::FailedAtService);
+            });
+
+            auto items = GenerateUploadItems(100);
+            for (int i = 0; i < 5; i++)
+            {
+                auto completedItems = this->UploadItems(items).get();
+                Assert::AreEqual(0, (int)completedItems.size(), L"Nothing should have been uploaded, or quarantined");
+            }
+
+            Assert::AreEqual(0, (int)m_client->GetQuarantinedEventCount(), L"Nothing should have been quarantined");
+            for (auto&& item : items)
+            {
+                Assert::AreEqual(0, (int)item->FailureCount, L"Rejections shouldn't count when nothing was accepted");
+            }
+
+            // Splitting every batch down to single events would take 199
+            // requests a pass.
+            Assert::IsTrue(requestCount.load() <= (5 * 10), L"Rejected batches shouldn't have been split all the way down");
+        }
+
+        TEST_METHOD(MaximumUploadFailuresMustAllowAFailure)
+        {
+            bool exceptionThrown = false;
+
+            try
+            {
+                m_client->SetMaximumUploadFailures(0);
+            }
+            catch (InvalidArgumentException^ ex)
+            {
+                exceptionThrown = true;
+            }
+
+            Assert::IsTrue(exceptionThrown, L"Didn't get expected exception");
+        }
+
         TEST_METHOD(DurationIsAutomaticallyAttached)
         {
             vector<vector<IJsonValue^>> capturedPayloads;
@@ -0,0 +1,202 @@
+#include "pch.h"
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+
+#include "CppUnitTest.h"
+#include "MemoryRecordStore.h"
+#include "SegmentedLog.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace fs = std::filesystem;
+
+namespace Codevoid::Tests
+{
+    static vector<LogRecord> GenerateStoreRecords(const int count, const long long startingAt = 1)
+    {
+        vector<LogRecord> records;
+        for (int i = 0; i < count; i++)
+        {
+            auto id = startingAt + i;
+            records.push_back({ id, "{\"title\":\"Record " + to_string(id) + "\"}" });
+        }
+
+        return records;
+    }
+
+    // <summary>
+    // Every RecordStore is expected to behave the same way, so each test is
+    // run against each of them.
+    // </summary>
+    TEST_CLASS(RecordStoreTests)
+    {
+    private:
+        fs::path m_folder;
+
+        void ForEachStore(const function<void(RecordStore&, const wstring&)>& test)
+        {
+            {
+                MemoryRecordStore store;
+                test(store, L"MemoryRecordStore");
+            }
+
+            {
+                fs::remove_all(m_folder);
+                SegmentedLog store(m_folder);
+                test(store, L"SegmentedLog");
+            }
+        }
+
+    public:
+        TEST_METHOD_INITIALIZE(InitializeClass)
+        {
+            m_folder = fs::temp_directory_path() / "RecordStoreTests";
+            fs::remove_all(m_folder);
+        }
+
+        TEST_METHOD(WrittenRecordsAreListedInTheOrderTheyWereWritten)
+        {
+            this->ForEachStore([](RecordStore& store, const wstring& name) {
+                Assert::IsTrue(store.Append(GenerateStoreRecords(3)), (name + L": Records weren't written").c_str());
+                store.Append(GenerateStoreRecords(2, 4));
+
+                auto pending = store.GetPendingRecords();
+                Assert::AreEqual(5, (int)pending.size(), (name + L": Wrong number of records").c_str());
+                for (int i = 0; i < 5; i++)
+                {
+                    Assert::AreEqual(i + 1, (int)pending[i].Id, (name + L": Records were out of order").c_str());
+                    Assert::AreEqual(GenerateStoreRecords(1, i + 1)[0].Payload.size(), pending[i].PayloadSize, (name + L": Wrong payload size").c_str());
+                }
+
+                Assert::AreEqual(5, (int)store.GetPendingRecordCount(), (name + L": Wrong record count").c_str());
+            });
+        }
+
+        TEST_METHOD(RecordsCanBeReadById)
+        {
+            this->ForEachStore([](RecordStore& store, const wstring& name) {
+                store.Append(GenerateStoreRecords(5));
+
+                auto records = store.ReadRecords({ 4, 2, 10 });
+                Assert::AreEqual(2, (int)records.size(), (name + L": Wrong number of records").c_str());
+                Assert::AreEqual(2, (int)records[0].Id, (name + L": Records should be in written order").c_str());
+                Assert::AreEqual(GenerateStoreRecords(1, 4)[0].Payload, records[1].Payload, (name + L": Payload didn't match").c_str());
+            });
+        }
+
+        TEST_METHOD(AcknowledgedRecordsAreRemoved)
+        {
+            this->ForEachStore([](RecordStore& store, const wstring& name) {
+                store.Append(GenerateStoreRecords(4));
+                store.Acknowledge({ 1, 3, 10 });
+
+                auto records = store.ReadPendingRecords();
+                Assert::AreEqual(2, (int)records.size(), (name + L": Wrong number of records").c_str());
+                Assert::AreEqual(2, (int)records[0].Id, (name + L": Wrong first record").c_str());
+                Assert::AreEqual(4, (int)records[1].Id, (name + L": Wrong second record").c_str());
+                Assert::AreEqual(0, (int)store.ReadRecords({ 1 }).size(), (name + L": Acknowledged record was read").c_str());
+            });
+        }
+
+        TEST_METHOD(WritingAPendingIdReplacesIt)
+        {
+            this->ForEachStore([](RecordStore& store, const wstring& name) {
+                store.Append(GenerateStoreRecords(2));
+                store.Append({ { 1, "replaced" } });
+
+                auto records = store.ReadPendingRecords();
+                Assert::AreEqual(2, (int)records.size(), (name + L": Wrong number of records").c_str());
+                Assert::AreEqual(1, (int)records.back().Id, (name + L": Replaced record should be last").c_str());
+                Assert::AreEqual(string("replaced"), records.back().Payload, (name + L": Record wasn't replaced").c_str());
+            });
+        }
+
+        TEST_METHOD(ClearRemovesEveryRecord)
+        {
+            this->ForEachStore([](RecordStore& store, const wstring& name) {
+                store.Append(GenerateStoreRecords(3));
+                store.Clear();
+
+                Assert::AreEqual(0, (int)store.GetPendingRecordCount(), (name + L": Expected no records").c_str());
+
+                store.Append(GenerateStoreRecords(1, 4));
+                Assert::AreEqual(1, (int)store.ReadPendingRecords().size(), (name + L": Store should be usable after clearing").c_str());
+            });
+        }
+
+        TEST_METHOD(ThroughputForEachStore)
+        {
+            // Not a pass/fail test; records how quickly records can be written,
+            // listed, read & acknowledged in each store, so the cost of the
+            // storage can be separated from the cost of everything else.
+            constexpr int BATCH_SIZE = 50;
+            constexpr int BATCHES = 200;
+
+            this->ForEachStore([](RecordStore& store, const wstring& name) {
+                auto start = steady_clock::now();
+                for (int i = 0; i < BATCHES; i++)
+                {
+                    store.Append(GenerateStoreRecords(BATCH_SIZE, (i * BATCH_SIZE) + 1));
+                }
+
+                auto written = steady_clock::now();
+                auto pending = store.GetPendingRecords();
+                for (size_t i = 0; i < pending.size(); i += BATCH_SIZE)
+                {
+                    vector<long long> ids;
+                    for (size_t j = i; j < (min)(i + BATCH_SIZE, pending.size()); j++)
+                    {
+                        ids.push_back(pending[j].Id);
+                    }
+
+                    store.ReadRecords(ids);
+                    store.Acknowledge(ids);
+                }
+
+                auto finished = steady_clock::now();
+                Assert::AreEqual(0, (int)store.GetPendingRecordCount(), (name + L": Every record should have been acknowledged").c_str());
+
+                auto itemsPerSecond = [](const steady_clock::duration duration) {
+                    return to_wstring((BATCH_SIZE * BATCHES * 1000000LL) / (max)(static_cast<long long>(duration_cast<microseconds>(duration).count()), 1LL));
+                };
+
+                wstring message = name + L": written " + itemsPerSecond(written - start) + L" items/sec, read & acknowledged "
+                    + itemsPerSecond(finished - written) + L" items/sec";
+                Logger::WriteMessage(message.c_str());
+            });
+        }
+
+        TEST_METHOD(SegmentedLogRestoreThroughput)
+        {
+            // Not a pass/fail test; records how long it takes to find out what's
+            // pending when a log is reopened (e.g. after the app exited, or
+            // crashed) with a large backlog.
+            constexpr int BATCH_SIZE = 50;
+            constexpr int BATCHES = 400;
+
+            {
+                SegmentedLog log(m_folder, 64 * 1024);
+                for (int i = 0; i < BATCHES; i++)
+                {
+                    log.Append(GenerateStoreRecords(BATCH_SIZE, (i * BATCH_SIZE) + 1));
+                }
+            }
+
+            auto start = steady_clock::now();
+            SegmentedLog log(m_folder, 64 * 1024);
+            auto pendingCount = log.GetPendingRecords().size();
+            auto duration = duration_cast<microseconds>(steady_clock::now() - start);
+
+            Assert::AreEqual(BATCH_SIZE * BATCHES, (int)pendingCount, L"Wrong number of records restored");
+
+            wstring message = L"Restored " + to_wstring(pendingCount) + L" records at "
+                + to_wstring((pendingCount * 1000000LL) / (max)(static_cast<long long>(duration.count()), 1LL)) + L" items/sec";
+            Logger::WriteMessage(message.c_str());
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "pch.h"
+
+#include "CppUnitTest.h"
+#include "RetryBackoff.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Codevoid::Tests
+{
+    // <summary>
+    // Clock that only moves when the test moves it.
+    // </summary>
+    class ManualClock
+    {
+    public:
+        ManualClock() : m_now(make_shared<steady_clock::time_point>(steady_clock::now()))
+        { }
+
+        void Advance(const milliseconds amount)
+        {
+            *m_now += amount;
+        }
+
+        RetryClock AsRetryClock()
+        {
+            auto now = m_now;
+            return [now]() { return *now; };
+        }
+
+    private:
+        shared_ptr<steady_clock::time_point> m_now;
+    };
+
+    TEST_CLASS(RetryBackoffTests)
+    {
+    public:
+        TEST_METHOD(DelaysAreBetweenTheBaseAndTheMaximum)
+        {
+            DecorrelatedJitterBackoff backoff(10ms, 1000ms);
+
+            for (int i = 0; i < 1000; i++)
+            {
+                auto delay = backoff.NextDelay();
+                Assert::IsTrue(delay >= 10ms, L"Delay was less than the base delay");
+                Assert::IsTrue(delay <= 1000ms, L"Delay was more than the maximum delay");
+            }
+        }
+
+        TEST_METHOD(DelaysGrowFromTheBase)
+        {
+            DecorrelatedJitterBackoff backoff(10ms, 1000ms);
+
+            // Each delay is at most three times the previous one, so after
+            // a few attempts we'd expect to have seen the delay grow well past
+            // the base, even though each is random.
+            milliseconds longestDelay = 0ms;
+            for (int i = 0; i < 50; i++)
+            {
+                auto delay = backoff.NextDelay();
+                longestDelay = (max)(longestDelay, delay);
+            }
+
+            Assert::IsTrue(longestDelay > 100ms, L"Delays didn't grow");
+        }
+
+        TEST_METHOD(EachDelayIsAtMostThreeTimesThePrevious)
+        {
+            DecorrelatedJitterBackoff backoff(10ms, 1000000ms);
+
+            auto previous = 10ms;
+            for (int i = 0; i < 100; i++)
+            {
+                auto delay = backoff.NextDelay();
+                Assert::IsTrue(delay <= (max)(previous * 3, 10ms), L"Delay grew too quickly");
+                previous = delay;
+            }
+        }
+
+        TEST_METHOD(ResetStartsDelaysFromTheBase)
+        {
+            DecorrelatedJitterBackoff backoff(10ms, 1000000ms);
+
+            for (int i = 0; i < 20; i++)
+            {
+                backoff.NextDelay();
+            }
+
+            backoff.Reset();
+            Assert::IsTrue(backoff.NextDelay() <= 30ms, L"Delay wasn't reset");
+        }
+
+        TEST_METHOD(MaximumIsNeverLessThanTheBase)
+        {
+            DecorrelatedJitterBackoff backoff(100ms, 10ms);
+
+            Assert::AreEqual(100, (int)backoff.GetMaximumDelay().count(), L"Maximum should have been raised to the base");
+            Assert::AreEqual(100, (int)backoff.NextDelay().count(), L"Delay should be the base");
+        }
+
+        TEST_METHOD(SeparateBackoffsDoNotRetryInLockstep)
+        {
+            DecorrelatedJitterBackoff first(10ms, 60000ms);
+            DecorrelatedJitterBackoff second(10ms, 60000ms);
+
+            bool differed = false;
+            for (int i = 0; (i < 20) && !differed; i++)
+            {
+                differed = (first.NextDelay() != second.NextDelay());
+            }
+
+            Assert::IsTrue(differed, L"Two backoffs produced the same delays");
+        }
+
+        TEST_METHOD(CircuitOpensOnceThresholdIsReached)
+        {
+            ManualClock clock;
+            CircuitBreaker breaker(3, 1000ms, clock.AsRetryClock());
+
+            breaker.RecordFailure();
+            breaker.RecordFailure();
+            Assert::IsTrue(CircuitState::Closed == breaker.GetState(), L"Circuit opened too early");
+            Assert::IsTrue(breaker.TryAttempt(), L"Should be able to attempt while closed");
+
+            breaker.RecordFailure();
+            Assert::IsTrue(CircuitState::Open == breaker.GetState(), L"Circuit should be open");
+            Assert::IsFalse(breaker.TryAttempt(), L"Shouldn't be able to attempt while open");
+        }
+
+        TEST_METHOD(SuccessResetsConsecutiveFailures)
+        {
+            ManualClock clock;
+            CircuitBreaker breaker(2, 1000ms, clock.AsRetryClock());
+
+            breaker.RecordFailure();
+            breaker.RecordSuccess();
+            breaker.RecordFailure();
+
+            Assert::IsTrue(CircuitState::Closed == breaker.GetState(), L"Failures either side of a success shouldn't open the circuit");
+            Assert::AreEqual(1, (int)breaker.GetConsecutiveFailures(), L"Wrong number of consecutive failures");
+        }
+
+        TEST_METHOD(CircuitIsHalfOpenAfterProbeInterval)
+        {
+            ManualClock clock;
+            CircuitBreaker breaker(1, 1000ms, clock.AsRetryClock());
+
+            breaker.RecordFailure();
+            clock.Advance(999ms);
+            Assert::IsFalse(breaker.TryAttempt(), L"Probe interval hasn't passed");
+
+            clock.Advance(1ms);
+            Assert::IsTrue(breaker.TryAttempt(), L"Should be able to probe");
+            Assert::IsTrue(CircuitState::HalfOpen == breaker.GetState(), L"Circuit should be half open");
+        }
+
+        TEST_METHOD(SuccessfulProbeClosesTheCircuit)
+        {
+            ManualClock clock;
+            CircuitBreaker breaker(1, 1000ms, clock.AsRetryClock());
+
+            breaker.RecordFailure();
+            clock.Advance(1000ms);
+            breaker.TryAttempt();
+            breaker.RecordSuccess();
+
+            Assert::IsTrue(CircuitState::Closed == breaker.GetState(), L"Circuit should be closed");
+            Assert::AreEqual(0, (int)breaker.GetConsecutiveFailures(), L"Failures should have been reset");
+        }
+
+        TEST_METHOD(FailedProbeReopensTheCircuitForAnotherInterval)
+        {
+            ManualClock clock;
+            CircuitBreaker breaker(3, 1000ms, clock.AsRetryClock());
+
+            breaker.RecordFailure();
+            breaker.RecordFailure();
+            breaker.RecordFailure();
+            clock.Advance(1000ms);
+            breaker.TryAttempt();
+
+            auto probedAt = clock.AsRetryClock()();
+            breaker.RecordFailure();
+
+            Assert::IsTrue(CircuitState::Open == breaker.GetState(), L"Circuit should be open again");
+            Assert::IsTrue((probedAt + 1000ms) == breaker.GetProbeAt(), L"Next probe should be a full interval later");
+            Assert::IsFalse(breaker.TryAttempt(), L"Shouldn't be able to attempt straight after a failed probe");
+        }
+    };
+}
\ No newline at end of file
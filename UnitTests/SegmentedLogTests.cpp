@@ -0,0 +1,599 @@
+#include "pch.h"
+#include <filesystem>
+#include <fstream>
+
+#include "CppUnitTest.h"
+#include "SegmentedLog.h"
+
+using namespace std;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace fs = std::filesystem;
+
+namespace Codevoid::Tests
+{
+    static vector<LogRecord> GenerateRecords(const int count, const long long startingAt = 1)
+    {
+        vector<LogRecord> records;
+        for (int i = 0; i < count; i++)
+        {
+            auto id = startingAt + i;
+            records.push_back({ id, "{\"title\":\"Record " + to_string(id) + "\"}" });
+        }
+
+        return records;
+    }
+
+    static vector<long long> GetIds(const vector<LogRecord>& records)
+    {
+        vector<long long> ids;
+        for (auto&& record : records)
+        {
+            ids.push_back(record.Id);
+        }
+
+        return ids;
+    }
+
+    TEST_CLASS(SegmentedLogTests)
+    {
+    private:
+        fs::path m_folder;
+
+        size_t GetFileCount(const string& extension = "")
+        {
+            size_t count = 0;
+            for (auto&& entry : fs::recursive_directory_iterator(m_folder))
+            {
+                if (!entry.is_regular_file())
+                {
+                    continue;
+                }
+
+                if (extension.empty() || (entry.path().extension() == extension))
+                {
+                    count += 1;
+                }
+            }
+
+            return count;
+        }
+
+    public:
+        TEST_METHOD_INITIALIZE(InitializeClass)
+        {
+            m_folder = fs::temp_directory_path() / "SegmentedLogTests";
+            fs::remove_all(m_folder);
+            fs::create_directories(m_folder);
+        }
+
+        TEST_METHOD(ConstructionThrowsIfSegmentsCantHoldAnything)
+        {
+            bool exceptionSeen = false;
+            try
+            {
+                SegmentedLog log(m_folder, 0);
+            }
+            catch (const invalid_argument&)
+            {
+                exceptionSeen = true;
+            }
+
+            Assert::IsTrue(exceptionSeen, L"Expected to get exception on construction");
+        }
+
+        TEST_METHOD(AppendedRecordsCanBeReadBack)
+        {
+            SegmentedLog log(m_folder);
+            Assert::IsTrue(log.Append(GenerateRecords(3)), L"Records weren't appended");
+
+            auto records = log.ReadPendingRecords();
+            Assert::AreEqual(3, (int)records.size(), L"Wrong number of records");
+            Assert::AreEqual(3, (int)log.GetPendingRecordCount(), L"Wrong number of pending records");
+
+            for (int i = 0; i < 3; i++)
+            {
+                Assert::AreEqual(i + 1, (int)records[i].Id, L"Records were out of order");
+                Assert::AreEqual(GenerateRecords(1, i + 1)[0].Payload, records[i].Payload, L"Payload didn't match");
+            }
+        }
+
+        TEST_METHOD(RecordsFlushedToDiskCanBeReadBack)
+        {
+            SegmentedLog log(m_folder);
+            Assert::IsTrue(log.Append(GenerateRecords(3), true), L"Records weren't appended");
+            Assert::AreEqual(3, (int)log.ReadPendingRecords().size(), L"Wrong number of records");
+        }
+
+        TEST_METHOD(RecordsAreReadBackByANewInstance)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+                log.Append(GenerateRecords(2, 4));
+            }
+
+            SegmentedLog log(m_folder);
+            auto records = log.ReadPendingRecords();
+            Assert::AreEqual(5, (int)records.size(), L"Wrong number of records");
+            Assert::AreEqual(5, (int)records.back().Id, L"Records were out of order");
+        }
+
+        TEST_METHOD(RecordsAreWrittenToOneSegmentFile)
+        {
+            SegmentedLog log(m_folder);
+            for (int i = 0; i < 10; i++)
+            {
+                log.Append(GenerateRecords(10, i * 10));
+            }
+
+            Assert::AreEqual(1, (int)this->GetFileCount(), L"Expected a single file for all the records");
+        }
+
+        TEST_METHOD(AcknowledgedRecordsAreNotReadBack)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(5));
+                log.Acknowledge({ 1, 2 });
+
+                Assert::AreEqual(3, (int)log.ReadPendingRecords().size(), L"Acknowledged records were read");
+            }
+
+            SegmentedLog log(m_folder);
+            auto records = log.ReadPendingRecords();
+            Assert::AreEqual(3, (int)records.size(), L"Acknowledged records were restored");
+            Assert::AreEqual(3, (int)records.front().Id, L"Wrong first record");
+        }
+
+        TEST_METHOD(RecordsAcknowledgedOutOfOrderAreNotReadBack)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(5));
+                log.Acknowledge({ 2, 4 });
+            }
+
+            SegmentedLog log(m_folder);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 1, 3, 5 } == ids, L"Wrong records restored");
+        }
+
+        TEST_METHOD(AcknowledgingUnknownIdsIsIgnored)
+        {
+            SegmentedLog log(m_folder);
+            log.Append(GenerateRecords(2));
+            log.Acknowledge({ 10, 11 });
+
+            Assert::AreEqual(2, (int)log.GetPendingRecordCount(), L"Wrong number of pending records");
+            Assert::AreEqual(1, (int)this->GetFileCount(), L"Nothing should have been committed");
+        }
+
+        TEST_METHOD(SegmentsAreRotatedOnceFull)
+        {
+            SegmentedLog log(m_folder, 64);
+            log.Append(GenerateRecords(2, 1));
+            log.Append(GenerateRecords(2, 3));
+            log.Append(GenerateRecords(2, 5));
+
+            Assert::AreEqual(3, (int)log.GetSegmentCount(), L"Wrong number of segments");
+            Assert::AreEqual(3, (int)this->GetFileCount(".log"), L"Wrong number of segment files");
+            Assert::AreEqual(6, (int)log.ReadPendingRecords().size(), L"Wrong number of records");
+        }
+
+        TEST_METHOD(BatchLargerThanASegmentIsWrittenToASingleSegment)
+        {
+            SegmentedLog log(m_folder, 64);
+            log.Append(GenerateRecords(10));
+
+            Assert::AreEqual(1, (int)this->GetFileCount(".log"), L"Batch shouldn't have been split across segments");
+            Assert::AreEqual(10, (int)log.ReadPendingRecords().size(), L"Wrong number of records");
+        }
+
+        TEST_METHOD(FullyAcknowledgedSegmentsAreDeleted)
+        {
+            SegmentedLog log(m_folder, 64);
+            log.Append(GenerateRecords(2, 1));
+            log.Append(GenerateRecords(2, 3));
+            log.Append(GenerateRecords(2, 5));
+
+            log.Acknowledge({ 1, 2, 4 });
+            Assert::AreEqual(2, (int)this->GetFileCount(".log"), L"Only the first segment should have been deleted");
+
+            log.Acknowledge({ 3 });
+            Assert::AreEqual(1, (int)this->GetFileCount(".log"), L"Second segment should have been deleted");
+            Assert::AreEqual(2, (int)log.GetPendingRecordCount(), L"Wrong number of pending records");
+        }
+
+        TEST_METHOD(SegmentBeingAppendedToIsKeptWhenFullyAcknowledged)
+        {
+            SegmentedLog log(m_folder);
+            log.Append(GenerateRecords(2));
+            log.Acknowledge({ 1, 2 });
+
+            Assert::AreEqual(1, (int)this->GetFileCount(".log"), L"Active segment shouldn't have been deleted");
+
+            log.Append(GenerateRecords(1, 3));
+            Assert::AreEqual(1, (int)this->GetFileCount(".log"), L"Active segment should have been appended to");
+            Assert::AreEqual(1, (int)log.ReadPendingRecords().size(), L"Wrong number of records");
+        }
+
+        TEST_METHOD(FullyAcknowledgedSegmentsAreDeletedWhenOpened)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(2));
+                log.Acknowledge({ 1, 2 });
+            }
+
+            SegmentedLog log(m_folder);
+            Assert::AreEqual(0, (int)log.GetSegmentCount(), L"Expected no segments");
+            Assert::AreEqual(0, (int)this->GetFileCount(".log"), L"Segment file should have been deleted");
+        }
+
+        TEST_METHOD(AppendingAfterReopeningStartsANewSegment)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(2));
+            }
+
+            SegmentedLog log(m_folder);
+            log.Append(GenerateRecords(2, 3));
+
+            Assert::AreEqual(2, (int)this->GetFileCount(".log"), L"Wrong number of segment files");
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 1, 2, 3, 4 } == ids, L"Wrong records read");
+        }
+
+        TEST_METHOD(RecordsAppendedAfterDeletedSegmentsAreRestored)
+        {
+            // Each record fills a segment, so every segment is acknowledged &
+            // deleted, and then the next instance appends without
+            // acknowledging anything, so it never writes a commit of it's own.
+            {
+                SegmentedLog log(m_folder, 16);
+                log.Append(GenerateRecords(1, 1));
+                log.Append(GenerateRecords(1, 2));
+                log.Append(GenerateRecords(1, 3));
+                log.Acknowledge({ 1, 2, 3 });
+            }
+
+            {
+                SegmentedLog log(m_folder, 16);
+                log.Append(GenerateRecords(1, 4));
+                log.Append(GenerateRecords(1, 5));
+                log.Append(GenerateRecords(1, 6));
+            }
+
+            SegmentedLog log(m_folder, 16);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 4, 5, 6 } == ids, L"Records appended after the segments were deleted should be pending");
+        }
+
+        TEST_METHOD(SegmentNumbersAreNotReusedAfterReopening)
+        {
+            {
+                SegmentedLog log(m_folder, 16);
+                log.Append(GenerateRecords(1, 1));
+                log.Append(GenerateRecords(1, 2));
+                log.Acknowledge({ 1, 2 });
+            }
+
+            SegmentedLog log(m_folder, 16);
+            log.Append(GenerateRecords(1, 3));
+
+            for (auto&& entry : fs::recursive_directory_iterator(m_folder))
+            {
+                if (entry.path().extension() == ".log")
+                {
+                    Assert::AreNotEqual(string("0"), entry.path().stem().string(), L"Deleted segment's number was reused");
+                }
+            }
+        }
+
+        TEST_METHOD(PartiallyWrittenRecordIsIgnored)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+            }
+
+            auto segment = m_folder / "0" / "0.log";
+            fs::resize_file(segment, fs::file_size(segment) - 3);
+
+            SegmentedLog log(m_folder);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 1, 2 } == ids, L"Only the complete records should be read");
+        }
+
+        TEST_METHOD(ClosedSegmentsAreIndexed)
+        {
+            {
+                SegmentedLog log(m_folder, 64);
+                log.Append(GenerateRecords(2, 1));
+                log.Append(GenerateRecords(2, 3));
+
+                Assert::AreEqual(1, (int)this->GetFileCount(".idx"), L"Only the closed segment should be indexed");
+            }
+
+            Assert::AreEqual(2, (int)this->GetFileCount(".idx"), L"Both segments should be indexed once closed");
+        }
+
+        TEST_METHOD(PendingRecordsAreListedWithoutReadingPayloads)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+                log.Acknowledge({ 2 });
+            }
+
+            // Damage the payload of the last record; the index still lists it,
+            // since listing records doesn't read the segment.
+            auto segment = m_folder / "0" / "0.log";
+            {
+                fstream file(segment, ios::in | ios::out | ios::binary);
+                file.seekp(-2, ios::end);
+                file.put('X');
+            }
+
+            SegmentedLog log(m_folder);
+            auto pending = log.GetPendingRecords();
+            Assert::AreEqual(2, (int)pending.size(), L"Wrong number of pending records");
+            Assert::AreEqual(1, (int)pending[0].Id, L"Wrong first record");
+            Assert::AreEqual(3, (int)pending[1].Id, L"Wrong second record");
+            Assert::AreEqual(GenerateRecords(1, 3)[0].Payload.size(), pending[1].PayloadSize, L"Wrong payload size");
+
+            auto ids = GetIds(log.ReadRecords({ 1, 3 }));
+            Assert::IsTrue(vector<long long>{ 1 } == ids, L"Damaged record shouldn't have been read");
+        }
+
+        TEST_METHOD(MissingIndexFallsBackToReadingTheSegment)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+                log.Acknowledge({ 1 });
+            }
+
+            fs::remove(m_folder / "0" / "0.idx");
+
+            {
+                SegmentedLog log(m_folder);
+                auto ids = GetIds(log.ReadPendingRecords());
+                Assert::IsTrue(vector<long long>{ 2, 3 } == ids, L"Wrong records restored");
+            }
+
+            Assert::AreEqual(1, (int)this->GetFileCount(".idx"), L"Segment should have been indexed once read");
+        }
+
+        TEST_METHOD(DamagedIndexFallsBackToReadingTheSegment)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+            }
+
+            fs::resize_file(m_folder / "0" / "0.idx", 12);
+
+            SegmentedLog log(m_folder);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 1, 2, 3 } == ids, L"Wrong records restored");
+        }
+
+        TEST_METHOD(IndexForADifferentSizedSegmentIsNotUsed)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+            }
+
+            auto segment = m_folder / "0" / "0.log";
+            fs::resize_file(segment, fs::file_size(segment) - 3);
+
+            SegmentedLog log(m_folder);
+            auto pending = log.GetPendingRecords();
+            Assert::AreEqual(2, (int)pending.size(), L"Partial record shouldn't have been listed");
+        }
+
+        TEST_METHOD(RecordsCanBeReadById)
+        {
+            SegmentedLog log(m_folder, 64);
+            log.Append(GenerateRecords(2, 1));
+            log.Append(GenerateRecords(2, 3));
+            log.Append(GenerateRecords(2, 5));
+
+            auto records = log.ReadRecords({ 5, 2, 10, 3 });
+            Assert::IsTrue(vector<long long>{ 2, 3, 5 } == GetIds(records), L"Wrong records read");
+            Assert::AreEqual(GenerateRecords(1, 3)[0].Payload, records[1].Payload, L"Payload didn't match");
+        }
+
+        TEST_METHOD(RecordsInASegmentThatCantBeOpenedAreReportedUnreadable)
+        {
+            SegmentedLog log(m_folder, 64);
+            log.Append(GenerateRecords(2, 1));
+            log.Append(GenerateRecords(2, 3));
+
+            // As if the segment was briefly unavailable
+            auto segment = m_folder / "0" / "0.log";
+            auto movedSegment = m_folder / "0" / "moved";
+            fs::rename(segment, movedSegment);
+
+            vector<long long> unreadableIds;
+            auto records = log.ReadRecords({ 1, 3 }, &unreadableIds);
+            Assert::IsTrue(vector<long long>{ 3 } == GetIds(records), L"Only the record in the readable segment should have been read");
+            Assert::IsTrue(vector<long long>{ 1 } == unreadableIds, L"Record in the missing segment should be unreadable");
+            Assert::AreEqual(4, (int)log.GetPendingRecordCount(), L"Unreadable records should still be pending");
+
+            fs::rename(movedSegment, segment);
+            unreadableIds.clear();
+            records = log.ReadRecords({ 1 }, &unreadableIds);
+            Assert::IsTrue(vector<long long>{ 1 } == GetIds(records), L"Record should be readable once the segment is back");
+            Assert::IsTrue(unreadableIds.empty(), L"Nothing should be unreadable");
+        }
+
+        TEST_METHOD(DamagedRecordsAreNotReportedUnreadable)
+        {
+            SegmentedLog log(m_folder);
+            log.Append(GenerateRecords(2));
+
+            // Damage the payload of the last record, so it's checksum fails
+            {
+                fstream segment(m_folder / "0" / "0.log", ios::in | ios::out | ios::binary);
+                segment.seekp(-2, ios::end);
+                segment.put('X');
+            }
+
+            vector<long long> unreadableIds;
+            auto records = log.ReadRecords({ 1, 2 }, &unreadableIds);
+            Assert::IsTrue(vector<long long>{ 1 } == GetIds(records), L"Damaged record shouldn't have been read");
+            Assert::IsTrue(unreadableIds.empty(), L"Damaged record isn't an I/O failure");
+        }
+
+        TEST_METHOD(DamagedCommitFallsBackToThePreviousCommit)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+                log.Acknowledge({ 1 });
+                log.Acknowledge({ 2 });
+            }
+
+            // The most recent commit (acknowledging 2) is the second one
+            // written, so damage that as if the write was torn.
+            fs::resize_file(m_folder / "0" / "commit.0", 6);
+
+            SegmentedLog log(m_folder);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 2, 3 } == ids, L"Expected the earlier commit to be used");
+        }
+
+        TEST_METHOD(AppendingAnExistingIdReplacesIt)
+        {
+            SegmentedLog log(m_folder);
+            log.Append(GenerateRecords(2));
+            log.Append({ { 1, "replaced" } });
+
+            auto records = log.ReadPendingRecords();
+            Assert::AreEqual(2, (int)records.size(), L"Wrong number of records");
+            Assert::AreEqual(1, (int)records.back().Id, L"Replaced record should be last");
+            Assert::AreEqual(string("replaced"), records.back().Payload, L"Record wasn't replaced");
+        }
+
+        TEST_METHOD(ClearRemovesAllRecordsAndFiles)
+        {
+            SegmentedLog log(m_folder, 64);
+            log.Append(GenerateRecords(2, 1));
+            log.Append(GenerateRecords(2, 3));
+            log.Acknowledge({ 1 });
+
+            log.Clear();
+
+            Assert::AreEqual(0, (int)log.GetPendingRecordCount(), L"Expected no pending records");
+
+            log.WaitForOldGenerationsToBeRemoved();
+            Assert::AreEqual(0, (int)this->GetFileCount(), L"Expected no files");
+
+            log.Append(GenerateRecords(1, 5));
+            Assert::AreEqual(1, (int)log.ReadPendingRecords().size(), L"Log should be usable after clearing");
+        }
+
+        TEST_METHOD(ClearingStartsANewGeneration)
+        {
+            SegmentedLog log(m_folder);
+            log.Append(GenerateRecords(2));
+            log.Clear();
+
+            Assert::IsTrue(fs::is_directory(m_folder / "1"), L"New generation wasn't created");
+
+            log.Append(GenerateRecords(1, 3));
+            log.WaitForOldGenerationsToBeRemoved();
+
+            Assert::IsFalse(fs::exists(m_folder / "0"), L"Old generation wasn't removed");
+            Assert::IsTrue(fs::exists(m_folder / "1" / "0.log"), L"Records should be written to the new generation");
+        }
+
+        TEST_METHOD(ClearedRecordsAreNotRestored)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(2));
+                log.Clear();
+                log.Append(GenerateRecords(1, 3));
+            }
+
+            SegmentedLog log(m_folder);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 3 } == ids, L"Only records added after clearing should be restored");
+        }
+
+        TEST_METHOD(ClearingWithoutOpeningClearsRecords)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(2));
+            }
+
+            {
+                SegmentedLog log(m_folder);
+                log.Clear();
+            }
+
+            SegmentedLog log(m_folder);
+            Assert::AreEqual(0, (int)log.GetPendingRecordCount(), L"Expected no pending records");
+        }
+
+        TEST_METHOD(PartiallyRemovedGenerationIsRemovedWhenOpened)
+        {
+            {
+                SegmentedLog log(m_folder, 64);
+                log.Append(GenerateRecords(2, 1));
+                log.Append(GenerateRecords(2, 3));
+            }
+
+            // As if the process exited after clearing, but part way through
+            // removing the old generation.
+            fs::create_directories(m_folder / "1");
+            fs::remove(m_folder / "0" / "0.log");
+
+            SegmentedLog log(m_folder);
+            Assert::AreEqual(0, (int)log.GetPendingRecordCount(), L"Expected no pending records");
+
+            log.WaitForOldGenerationsToBeRemoved();
+            Assert::IsFalse(fs::exists(m_folder / "0"), L"Old generation wasn't removed");
+        }
+
+        TEST_METHOD(FilesFromBeforeGenerationsAreMovedIntoAGeneration)
+        {
+            {
+                SegmentedLog log(m_folder);
+                log.Append(GenerateRecords(3));
+                log.Acknowledge({ 1 });
+            }
+
+            for (auto&& entry : fs::directory_iterator(m_folder / "0"))
+            {
+                fs::rename(entry.path(), m_folder / entry.path().filename());
+            }
+
+            fs::remove(m_folder / "0");
+
+            SegmentedLog log(m_folder);
+            auto ids = GetIds(log.ReadPendingRecords());
+            Assert::IsTrue(vector<long long>{ 2, 3 } == ids, L"Wrong records restored");
+            Assert::IsTrue(fs::exists(m_folder / "0" / "0.log"), L"Segment should have been moved into a generation");
+        }
+
+        TEST_METHOD(AppendFailsIfTheFolderCantBeCreated)
+        {
+            auto blocker = m_folder / "blocker";
+            FILE* file = fopen(blocker.string().c_str(), "wb");
+            fclose(file);
+
+            SegmentedLog log(blocker / "log");
+            Assert::IsFalse(log.Append(GenerateRecords(1)), L"Append should have failed");
+            Assert::AreEqual(0, (int)log.GetPendingRecordCount(), L"Expected no pending records");
+        }
+    };
+}
\ No newline at end of file
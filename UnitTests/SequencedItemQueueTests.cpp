@@ -0,0 +1,277 @@
+#include "pch.h"
+
+#include "CppUnitTest.h"
+#include "SequencedItemQueue.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using IntQueue = SequencedItemQueue<int>;
+
+namespace Codevoid::Tests
+{
+    static void AddItems(IntQueue& queue, int count, int startingAt = 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            queue.Push(make_shared<int>(startingAt + i));
+        }
+    }
+
+    static vector<int> CopyValues(const IntQueue& queue)
+    {
+        vector<shared_ptr<int>> items;
+        IntQueue::SequenceNumberVector sequenceNumbers;
+        queue.PeekFront(items, sequenceNumbers, queue.Size());
+
+        vector<int> values;
+        for (auto&& item : items)
+        {
+            values.push_back(*item);
+        }
+
+        return values;
+    }
+
+    TEST_CLASS(SequencedItemQueueTests)
+    {
+    public:
+        TEST_METHOD(ItemsArePeekedInTheOrderTheyWereAdded)
+        {
+            IntQueue queue;
+            AddItems(queue, 5);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            auto count = queue.PeekFront(items, sequenceNumbers, 3);
+
+            Assert::AreEqual(3, (int)count, L"Wrong number of items peeked");
+            Assert::AreEqual(3, (int)sequenceNumbers.size(), L"Sequence numbers should match items");
+            Assert::AreEqual(5, (int)queue.Size(), L"Peeking shouldn't remove items");
+
+            for (int i = 0; i < 3; i++)
+            {
+                Assert::AreEqual(i, *items[i], L"Items out of order");
+            }
+        }
+
+        TEST_METHOD(ProcessedItemsAreRemoved)
+        {
+            IntQueue queue;
+            AddItems(queue, 10);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, 4);
+
+            auto removed = queue.Remove(items, sequenceNumbers, items);
+
+            Assert::AreEqual(4, (int)removed, L"Wrong number of items removed");
+            Assert::AreEqual(6, (int)queue.Size(), L"Wrong number of items remaining");
+            Assert::AreEqual(4, CopyValues(queue)[0], L"Wrong item at the front of the queue");
+        }
+
+        TEST_METHOD(OnlyTheProcessedSubsetOfABatchIsRemoved)
+        {
+            IntQueue queue;
+            AddItems(queue, 6);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, queue.Size());
+
+            vector<shared_ptr<int>> processed{ items[1], items[3], items[4] };
+            queue.Remove(items, sequenceNumbers, processed);
+
+            auto remaining = CopyValues(queue);
+            Assert::AreEqual(3, (int)remaining.size(), L"Wrong number of items remaining");
+            Assert::AreEqual(0, remaining[0], L"Wrong first item");
+            Assert::AreEqual(2, remaining[1], L"Wrong second item");
+            Assert::AreEqual(5, remaining[2], L"Wrong third item");
+        }
+
+        TEST_METHOD(ItemsProcessedOutOfOrderAreRemoved)
+        {
+            IntQueue queue;
+            AddItems(queue, 5);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, queue.Size());
+
+            vector<shared_ptr<int>> processed{ items[4], items[0], items[2] };
+            auto removed = queue.Remove(items, sequenceNumbers, processed);
+
+            auto remaining = CopyValues(queue);
+            Assert::AreEqual(3, (int)removed, L"Wrong number of items removed");
+            Assert::AreEqual(2, (int)remaining.size(), L"Wrong number of items remaining");
+            Assert::AreEqual(1, remaining[0], L"Wrong first item");
+            Assert::AreEqual(3, remaining[1], L"Wrong second item");
+        }
+
+        TEST_METHOD(ItemsNotInTheBatchAreIgnoredWhenRemoving)
+        {
+            IntQueue queue;
+            AddItems(queue, 3);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, queue.Size());
+
+            auto removed = queue.Remove(items, sequenceNumbers, { make_shared<int>(1) });
+
+            Assert::AreEqual(0, (int)removed, L"Nothing should have been removed");
+            Assert::AreEqual(3, (int)queue.Size(), L"Wrong number of items remaining");
+        }
+
+        TEST_METHOD(RemovingABatchAfterClearingIsANoOp)
+        {
+            IntQueue queue;
+            AddItems(queue, 3);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, queue.Size());
+
+            queue.Clear();
+            AddItems(queue, 2, 10);
+
+            auto removed = queue.Remove(items, sequenceNumbers, items);
+
+            Assert::AreEqual(0, (int)removed, L"Nothing should have been removed");
+            Assert::AreEqual(2, (int)queue.Size(), L"Items added after clearing shouldn't be removed");
+        }
+
+        TEST_METHOD(RemovingTheSameBatchTwiceOnlyRemovesOnce)
+        {
+            IntQueue queue;
+            AddItems(queue, 4);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, 2);
+
+            queue.Remove(items, sequenceNumbers, items);
+            auto removed = queue.Remove(items, sequenceNumbers, items);
+
+            Assert::AreEqual(0, (int)removed, L"Nothing should have been removed the second time");
+            Assert::AreEqual(2, (int)queue.Size(), L"Wrong number of items remaining");
+        }
+
+        TEST_METHOD(OrderIsMaintainedWhenFrontItemIsNeverRemoved)
+        {
+            // Simulates an item at the front of the queue that always fails,
+            // while everything behind it succeeds. This forces the storage to
+            // be compacted, and then items removed after compaction.
+            IntQueue queue;
+            AddItems(queue, 1000);
+
+            for (int pass = 0; pass < 10; pass++)
+            {
+                vector<shared_ptr<int>> items;
+                IntQueue::SequenceNumberVector sequenceNumbers;
+                queue.PeekFront(items, sequenceNumbers, 50);
+
+                vector<shared_ptr<int>> processed(next(begin(items)), end(items));
+                auto removed = queue.Remove(items, sequenceNumbers, processed);
+                Assert::AreEqual(49, (int)removed, L"Wrong number of items removed");
+            }
+
+            auto remaining = CopyValues(queue);
+            Assert::AreEqual(1000 - 490, (int)remaining.size(), L"Wrong number of items remaining");
+            Assert::AreEqual(0, remaining[0], L"Failing item should still be at the front");
+            for (size_t i = 1; i < remaining.size(); i++)
+            {
+                Assert::AreEqual((int)(i + 490), remaining[i], L"Items out of order");
+            }
+        }
+
+        TEST_METHOD(PoppingRemovesTheFrontItem)
+        {
+            IntQueue queue;
+            AddItems(queue, 3);
+
+            auto popped = queue.PopFront();
+
+            Assert::AreEqual(0, *popped, L"Wrong item popped");
+            Assert::AreEqual(2, (int)queue.Size(), L"Wrong number of items remaining");
+            Assert::AreEqual(1, CopyValues(queue)[0], L"Wrong item at the front of the queue");
+        }
+
+        TEST_METHOD(RemovingAPoppedItemIsANoOp)
+        {
+            IntQueue queue;
+            AddItems(queue, 3);
+
+            vector<shared_ptr<int>> items;
+            IntQueue::SequenceNumberVector sequenceNumbers;
+            queue.PeekFront(items, sequenceNumbers, 2);
+            queue.PopFront();
+
+            vector<shared_ptr<int>> removedItems;
+            auto removed = queue.Remove(items, sequenceNumbers, items, &removedItems);
+
+            Assert::AreEqual(1, (int)removed, L"Only the item that wasn't popped should be removed");
+            Assert::AreEqual(1, (int)removedItems.size(), L"Wrong number of removed items returned");
+            Assert::AreEqual(1, *removedItems[0], L"Wrong item returned as removed");
+            Assert::AreEqual(1, (int)queue.Size(), L"Wrong number of items remaining");
+        }
+
+        TEST_METHOD(FrontArrivalReflectsWhenTheItemWasAdded)
+        {
+            IntQueue queue;
+            Assert::IsFalse(queue.GetFrontArrival().has_value(), L"Empty queue shouldn't have an arrival");
+
+            queue.Push(make_shared<int>(1), 10);
+            queue.Push(make_shared<int>(2), 20);
+
+            Assert::AreEqual(10, (int)*queue.GetFrontArrival(), L"Wrong arrival for the front item");
+
+            queue.PopFront();
+            Assert::AreEqual(20, (int)*queue.GetFrontArrival(), L"Wrong arrival after popping");
+        }
+
+        TEST_METHOD(BatchRemovalCostDoesNotGrowWithQueueLength)
+        {
+            // Not a pass/fail test -- this logs the average time to peek &
+            // remove a 50 item batch as the queue grows, to demonstrate that
+            // removal cost is flat rather than proportional to the queue.
+            constexpr int BATCH_SIZE = 50;
+            constexpr int ITERATIONS = 200;
+
+            for (int queueLength : { 1000, 10000, 100000, 1000000 })
+            {
+                IntQueue queue;
+                AddItems(queue, queueLength);
+
+                vector<shared_ptr<int>> items;
+                IntQueue::SequenceNumberVector sequenceNumbers;
+                items.reserve(BATCH_SIZE);
+                sequenceNumbers.reserve(BATCH_SIZE);
+
+                nanoseconds totalDuration{ 0 };
+                for (int i = 0; i < ITERATIONS; i++)
+                {
+                    items.clear();
+                    sequenceNumbers.clear();
+
+                    auto start = steady_clock::now();
+                    queue.PeekFront(items, sequenceNumbers, BATCH_SIZE);
+                    queue.Remove(items, sequenceNumbers, items);
+                    totalDuration += (steady_clock::now() - start);
+
+                    // Keep the queue at a steady length
+                    queue.Push(items);
+                }
+
+                Assert::AreEqual(queueLength, (int)queue.Size(), L"Queue length changed");
+
+                wstring message = L"Queue length: " + to_wstring(queueLength)
+                    + L", average batch removal: " + to_wstring(duration_cast<nanoseconds>(totalDuration).count() / ITERATIONS) + L"ns";
+                Logger::WriteMessage(message.c_str());
+            }
+        }
+    };
+}
\ No newline at end of file
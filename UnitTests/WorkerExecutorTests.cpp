@@ -0,0 +1,353 @@
+#include "pch.h"
+
+#include <set>
+
+#include "CppUnitTest.h"
+#include "BackgroundWorker.h"
+#include "WorkerExecutor.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace concurrency;
+using namespace Codevoid::Utilities;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Codevoid::Tests
+{
+    TEST_CLASS(WorkerExecutorTests)
+    {
+    public:
+        TEST_METHOD(ExecutorMustHaveAtLeastOneThread)
+        {
+            Assert::ExpectException<invalid_argument>([]() {
+                WorkerExecutor executor(0);
+            }, L"Expected an exception creating an executor with no threads");
+        }
+
+        TEST_METHOD(PostedWorkIsRun)
+        {
+            WorkerExecutor executor(2);
+            atomic<int> workRun = 0;
+            int owner = 0;
+
+            for (int i = 0; i < 10; i++)
+            {
+                executor.Post(&owner, [&workRun]() {
+                    workRun += 1;
+                });
+            }
+
+            auto start = steady_clock::now();
+            while ((workRun.load() < 10) && ((steady_clock::now() - start) < 1s))
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            Assert::AreEqual(10, workRun.load(), L"Not all work was run");
+        }
+
+        TEST_METHOD(ScheduledWorkIsNotRunBeforeItsTime)
+        {
+            WorkerExecutor executor(1);
+            atomic<bool> workRun = false;
+            int owner = 0;
+
+            auto postedAt = steady_clock::now();
+            steady_clock::time_point runAt;
+            executor.PostAt(&owner, postedAt + 100ms, [&workRun, &runAt]() {
+                runAt = steady_clock::now();
+                workRun = true;
+            });
+
+            this_thread::sleep_for(50ms);
+            Assert::IsFalse(workRun.load(), L"Work was run before it was due");
+
+            auto start = steady_clock::now();
+            while (!workRun.load() && ((steady_clock::now() - start) < 1s))
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            Assert::IsTrue(workRun.load(), L"Scheduled work wasn't run");
+            Assert::IsTrue((runAt - postedAt) >= 100ms, L"Work ran too early");
+        }
+
+        TEST_METHOD(CancelledWorkIsNotRun)
+        {
+            WorkerExecutor executor(1);
+            atomic<bool> workRun = false;
+            int owner = 0;
+            int otherOwner = 0;
+            atomic<bool> otherWorkRun = false;
+
+            executor.PostAt(&owner, steady_clock::now() + 50ms, [&workRun]() {
+                workRun = true;
+            });
+
+            executor.PostAt(&otherOwner, steady_clock::now() + 50ms, [&otherWorkRun]() {
+                otherWorkRun = true;
+            });
+
+            executor.CancelAndWait(&owner);
+            this_thread::sleep_for(150ms);
+
+            Assert::IsFalse(workRun.load(), L"Cancelled work was run");
+            Assert::IsTrue(otherWorkRun.load(), L"Work for another owner should have been run");
+        }
+
+        TEST_METHOD(CancelAndWaitBlocksUntilRunningWorkHasCompleted)
+        {
+            WorkerExecutor executor(1);
+            atomic<bool> workStarted = false;
+            atomic<bool> workCompleted = false;
+            int owner = 0;
+
+            executor.Post(&owner, [&workStarted, &workCompleted]() {
+                workStarted = true;
+                this_thread::sleep_for(100ms);
+                workCompleted = true;
+            });
+
+            while (!workStarted.load())
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            executor.CancelAndWait(&owner);
+
+            Assert::IsTrue(workCompleted.load(), L"CancelAndWait returned while work was still running");
+        }
+
+        TEST_METHOD(StartingAWorkerOnAnExecutorDoesNotCreateAThread)
+        {
+            auto executor = make_shared<WorkerExecutor>(1);
+            atomic<thread::id> processedOn;
+
+            BackgroundWorker<int> worker(
+                [&processedOn](auto current, auto)
+                {
+                    processedOn = this_thread::get_id();
+                    return current;
+                },
+                [](auto) {},
+                L"StartingAWorkerOnAnExecutorDoesNotCreateAThread", 10ms, 1);
+
+            worker.SetExecutor(executor);
+            worker.Start();
+            worker.AddWork(make_shared<int>(1));
+
+            // Find the one thread the executor has, so we can compare
+            atomic<thread::id> executorThread;
+            int owner = 0;
+            executor->Post(&owner, [&executorThread]() {
+                executorThread = this_thread::get_id();
+            });
+
+            worker.Shutdown();
+            executor->CancelAndWait(&owner);
+
+            Assert::IsTrue(executorThread.load() != thread::id(), L"Executor didn't run posted work");
+            Assert::IsTrue(processedOn.load() == executorThread.load(), L"Items weren't processed on the executor thread");
+        }
+
+        TEST_METHOD(SettingExecutorWhileRunningThrows)
+        {
+            BackgroundWorker<int> worker(
+                [](auto current, auto) { return current; },
+                [](auto) {},
+                L"SettingExecutorWhileRunningThrows");
+
+            worker.Start();
+
+            Assert::ExpectException<logic_error>([&worker]() {
+                worker.SetExecutor(make_shared<WorkerExecutor>(1));
+            }, L"Expected exception changing executor while running");
+
+            worker.Shutdown();
+        }
+
+        TEST_METHOD(WorkersSharingAnExecutorProcessTheirItemsInOrder)
+        {
+            constexpr int WORKER_COUNT = 16;
+            constexpr int ITEMS_PER_WORKER = 200;
+
+            auto executor = make_shared<WorkerExecutor>(2);
+            vector<unique_ptr<BackgroundWorker<int>>> workers;
+            vector<vector<int>> processedPerWorker(WORKER_COUNT);
+            mutex threadsLock;
+            set<thread::id> threadsUsed;
+
+            for (int i = 0; i < WORKER_COUNT; i++)
+            {
+                auto& processed = processedPerWorker[i];
+                auto worker = make_unique<BackgroundWorker<int>>(
+                    [&threadsLock, &threadsUsed](auto current, auto)
+                    {
+                        lock_guard<mutex> lock(threadsLock);
+                        threadsUsed.insert(this_thread::get_id());
+                        return current;
+                    },
+                    [&processed](auto items)
+                    {
+                        for (auto&& item : items)
+                        {
+                            processed.push_back(*item);
+                        }
+                    },
+                    L"WorkersSharingAnExecutorProcessTheirItemsInOrder", 5ms, 10);
+
+                worker->SetExecutor(executor);
+                worker->SetMaximumBatchSize(7);
+                worker->Start();
+                workers.emplace_back(move(worker));
+            }
+
+            for (int item = 0; item < ITEMS_PER_WORKER; item++)
+            {
+                for (auto&& worker : workers)
+                {
+                    worker->AddWork(make_shared<int>(item));
+                }
+            }
+
+            for (auto&& worker : workers)
+            {
+                worker->Shutdown();
+            }
+
+            Assert::IsTrue(threadsUsed.size() <= executor->GetThreadCount(), L"Items were processed on threads other than the executors");
+
+            for (auto&& processed : processedPerWorker)
+            {
+                Assert::AreEqual(ITEMS_PER_WORKER, (int)processed.size(), L"Not all items were processed");
+                for (int item = 0; item < ITEMS_PER_WORKER; item++)
+                {
+                    Assert::AreEqual(item, processed[item], L"Items processed out of order");
+                }
+            }
+        }
+
+        TEST_METHOD(WorkerOnExecutorLeavesItemsWhenDropped)
+        {
+            auto executor = make_shared<WorkerExecutor>(1);
+            atomic<bool> postProcessCalled = false;
+
+            BackgroundWorker<int> worker(
+                [](auto current, auto) { return current; },
+                [&postProcessCalled](auto)
+                {
+                    postProcessCalled = true;
+                },
+                L"WorkerOnExecutorLeavesItemsWhenDropped", 1000ms, 10);
+
+            worker.SetExecutor(executor);
+            worker.Start();
+
+            worker.AddWork(make_shared<int>(7));
+            worker.AddWork(make_shared<int>(9));
+
+            worker.ShutdownAndDrop();
+
+            Assert::AreEqual(2, (int)worker.GetQueueLength(), L"Items should have been left in the queue");
+            Assert::IsFalse(postProcessCalled.load(), L"Nothing should have been post processed");
+        }
+
+        TEST_METHOD(WorkerOnExecutorDoesNotHoldAThreadWhileWaitingForACallback)
+        {
+            auto executor = make_shared<WorkerExecutor>(1);
+            task_completion_event<void> allowUpload;
+            atomic<int> uploadedCount = 0;
+            atomic<int> otherProcessedCount = 0;
+
+            BackgroundWorker<int> waitingWorker(
+                [allowUpload](auto& current, auto&)
+                {
+                    return create_task(allowUpload).then([&current]() {
+                        return current;
+                    });
+                },
+                [&uploadedCount](auto& items)
+                {
+                    uploadedCount += (int)items.size();
+                    return task_from_result();
+                },
+                L"WorkerOnExecutorDoesNotHoldAThreadWhileWaitingForACallback", 10ms, 1);
+
+            BackgroundWorker<int> otherWorker(
+                [](auto current, auto) { return current; },
+                [&otherProcessedCount](auto items)
+                {
+                    otherProcessedCount += (int)items.size();
+                },
+                L"WorkerOnExecutorDoesNotHoldAThreadWhileWaitingForACallback_Other", 10ms, 1);
+
+            waitingWorker.SetExecutor(executor);
+            otherWorker.SetExecutor(executor);
+            waitingWorker.Start();
+            otherWorker.Start();
+
+            waitingWorker.AddWork(make_shared<int>(1));
+            this_thread::sleep_for(50ms);
+
+            // The only executor thread would be stuck if the waiting worker
+            // was holding on to it, and this would never be processed.
+            otherWorker.AddWork(make_shared<int>(2));
+            auto start = steady_clock::now();
+            while ((otherProcessedCount.load() < 1) && ((steady_clock::now() - start) < 1s))
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            Assert::AreEqual(1, otherProcessedCount.load(), L"Other worker couldn't process while a callback was pending");
+            Assert::AreEqual(0, uploadedCount.load(), L"Items were post processed before processing had completed");
+            Assert::AreEqual(1, (int)waitingWorker.GetQueueLength(), L"Item should still be in the queue");
+
+            allowUpload.set();
+            waitingWorker.Shutdown();
+            otherWorker.Shutdown();
+
+            Assert::AreEqual(1, uploadedCount.load(), L"Item wasn't post processed after processing completed");
+            Assert::AreEqual(0, (int)waitingWorker.GetQueueLength(), L"Item should have been removed from the queue");
+        }
+
+        TEST_METHOD(ShuttingDownWorkerOnExecutorWaitsForPendingCallback)
+        {
+            auto executor = make_shared<WorkerExecutor>(1);
+            task_completion_event<void> allowProcessing;
+            atomic<bool> processingStarted = false;
+            atomic<bool> processingCompleted = false;
+
+            BackgroundWorker<int> worker(
+                [allowProcessing, &processingStarted, &processingCompleted](auto& current, auto&)
+                {
+                    processingStarted = true;
+                    return create_task(allowProcessing).then([&current, &processingCompleted]() {
+                        processingCompleted = true;
+                        return current;
+                    });
+                },
+                [](auto&) { return task_from_result(); },
+                L"ShuttingDownWorkerOnExecutorWaitsForPendingCallback", 10ms, 1);
+
+            worker.SetExecutor(executor);
+            worker.Start();
+            worker.AddWork(make_shared<int>(1));
+
+            while (!processingStarted.load())
+            {
+                this_thread::sleep_for(1ms);
+            }
+
+            thread completer([allowProcessing]() {
+                this_thread::sleep_for(100ms);
+                allowProcessing.set();
+            });
+
+            worker.ShutdownAndDrop();
+            completer.join();
+
+            Assert::IsTrue(processingCompleted.load(), L"Shutdown returned while processing was still pending");
+            Assert::AreEqual(0, (int)worker.GetQueueLength(), L"Processed item should have been removed");
+        }
+    };
+}
\ No newline at end of file